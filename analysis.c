@@ -0,0 +1,192 @@
+//
+// Analysis of each block split into independent jobs run in parallel on a worker pool.
+//
+
+#include "analysis.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Number of shards to split the spectra into for a pool of the given size.
+ *
+ * @param numThreads Number of threads of the pool.
+ * @return Number of shards for spectroOptions.numShards.
+ */
+int analysis_shards(int numThreads) {
+  return numThreads > 1 ? numThreads * ANALYSIS_SHARDS_PER_THREAD : 1;
+}
+
+/**
+ * Number of channels among the rows of the given shard.
+ */
+static int shard_channels(const blockAnalyser *analyser, int shard) {
+  int first = analyser->spectroData->shardRows[shard];
+  int end = analyser->spectroData->shardRows[shard + 1];
+  end = end < analyser->numChannels ? end : analyser->numChannels;
+  return end > first ? end - first : 0;
+}
+
+/**
+ * Allocates the meters, the pitch detectors and the loudness meter and starts the pool of an analyser.
+ *
+ * @param analyser Analyser to initialize.
+ * @param numChannels Number of interleaved channels in each block.
+ * @param spectroData Spectro data of the stream; its shards become the jobs.
+ * @param numThreads Threads of the pool; values below 1 select one per core.
+ * @return 0 on success, -1 if memory could not be allocated or the threads could not be started.
+ */
+int analyser_init(blockAnalyser *analyser, int numChannels, streamCallbackData *spectroData, int numThreads) {
+  memset(analyser, 0, sizeof(*analyser));
+  analyser->numChannels = numChannels;
+  analyser->spectroData = spectroData;
+  if (pool_init(&analyser->pool, numThreads) != 0) {
+    return -1;
+  }
+  analyser->meters = (meterState *) session_calloc((size_t) spectroData->numShards, sizeof(meterState));
+  analyser->levels = (channelLevels *) session_calloc((size_t) numChannels, sizeof(channelLevels));
+  const spectroOptions *options = &spectroData->options;
+  analyser->loudnessSquares =
+      (double *) session_alloc(sizeof(double) * spectroData->numShards * options->framesPerBuffer);
+  if (options->pitch) {
+    analyser->pitch = (pitchDetector *) session_calloc((size_t) spectroData->numShards, sizeof(pitchDetector));
+    analyser->pitches = (pitchEstimate *) session_calloc((size_t) numChannels, sizeof(pitchEstimate));
+  }
+  if (analyser->meters == NULL || analyser->levels == NULL || analyser->loudnessSquares == NULL ||
+      loudness_init(&analyser->loudness, numChannels, options->sampleRate, options->framesPerBuffer) != 0 ||
+      (options->pitch && (analyser->pitch == NULL || analyser->pitches == NULL))) {
+    analyser_free(analyser);
+    return -1;
+  }
+  for (int c = 0; analyser->pitches != NULL && c < numChannels; c++) {
+    analyser->pitches[c].note = -1;
+  }
+
+  for (int shard = 0; shard < spectroData->numShards; shard++) {
+    int channels = shard_channels(analyser, shard);
+    if (channels > 0 && meter_init(&analyser->meters[shard], channels, options->framesPerBuffer) != 0) {
+      analyser_free(analyser);
+      return -1;
+    }
+    if (channels > 0 && analyser->pitch != NULL &&
+        pitch_init(&analyser->pitch[shard], channels, options->sampleRate) != 0) {
+      analyser_free(analyser);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Stops the pool and frees the meters, the pitch detectors and the loudness meter of an analyser.
+ *
+ * @param analyser Analyser to free.
+ */
+void analyser_free(blockAnalyser *analyser) {
+  pool_free(&analyser->pool);
+  for (int shard = 0; analyser->meters != NULL && shard < analyser->spectroData->numShards; shard++) {
+    meter_free(&analyser->meters[shard]);
+  }
+  for (int shard = 0; analyser->pitch != NULL && shard < analyser->spectroData->numShards; shard++) {
+    pitch_free(&analyser->pitch[shard]);
+  }
+  session_free(analyser->meters);
+  session_free(analyser->levels);
+  session_free(analyser->pitch);
+  session_free(analyser->pitches);
+  session_free(analyser->loudnessSquares);
+  loudness_free(&analyser->loudness);
+  analyser->meters = NULL;
+  analyser->levels = NULL;
+  analyser->pitch = NULL;
+  analyser->pitches = NULL;
+  analyser->loudnessSquares = NULL;
+}
+
+/**
+ * Clears the meters, the pitch detectors and the loudness meter of an analyser and its levels, as
+ * if the stream had just started. Nothing is allocated or freed and the pool keeps running.
+ *
+ * @param analyser Analyser to reset.
+ */
+void analyser_reset(blockAnalyser *analyser) {
+  for (int shard = 0; shard < analyser->spectroData->numShards; shard++) {
+    if (shard_channels(analyser, shard) == 0) {
+      continue;
+    }
+    meter_reset(&analyser->meters[shard]);
+    if (analyser->pitch != NULL) {
+      pitch_reset(&analyser->pitch[shard]);
+    }
+  }
+  loudness_reset(&analyser->loudness);
+  memset(analyser->levels, 0, sizeof(channelLevels) * analyser->numChannels);
+  for (int c = 0; analyser->pitches != NULL && c < analyser->numChannels; c++) {
+    analyser->pitches[c] = (pitchEstimate) {0.0f, 0.0f, 0.0f, -1};
+  }
+}
+
+/**
+ * Job of one shard: the levels, pitch and K-weighted squares of its channels and the columns of its spectra.
+ */
+static void analyse_shard(void *context, int shard) {
+  audio_path_enter();
+  blockAnalyser *analyser = (blockAnalyser *) context;
+  int first = analyser->spectroData->shardRows[shard];
+  int channels = shard_channels(analyser, shard);
+
+  if (channels > 0) {
+    meter_process_strided(&analyser->meters[shard], analyser->block + first, analyser->numChannels,
+                          analyser->framesPerBuffer, analyser->levels + first);
+  }
+  if (channels > 0 && analyser->pitch != NULL &&
+      pitch_push(&analyser->pitch[shard], analyser->block + first, analyser->numChannels,
+                 analyser->framesPerBuffer) > 0) {
+    memcpy(analyser->pitches + first, analyser->pitch[shard].estimates, sizeof(pitchEstimate) * channels);
+  }
+
+  unsigned long maxFrames = (unsigned long) analyser->spectroData->options.framesPerBuffer;
+  unsigned long frames = analyser->framesPerBuffer < maxFrames ? analyser->framesPerBuffer : maxFrames;
+  double *squares = analyser->loudnessSquares + (size_t) shard * maxFrames;
+  memset(squares, 0, sizeof(double) * frames);
+  if (channels > 0) {
+    loudness_filter(&analyser->loudness, analyser->block + first, analyser->numChannels, first, channels, frames,
+                    squares);
+  }
+
+  compute_frequency_shard(analyser->block, frames, analyser->spectroData, shard,
+                          analyser->spectroData->proportions);
+  audio_path_leave();
+}
+
+/**
+ * Analyses one block: analyser->levels receives the levels of every channel and
+ * spectroData->proportions the columns of every spectrum, exactly as meter_process and
+ * compute_frequencies would compute them. analyser->pitches is updated whenever a pitch frame
+ * completes and analyser->loudness.levels whenever a loudness block does.
+ *
+ * @param analyser Analyser of the stream.
+ * @param in Interleaved input samples.
+ * @param framesPerBuffer Number of frames in the block; the spectra and the loudness take the
+ *        first options.framesPerBuffer of the spectro data.
+ */
+void analyse_block(blockAnalyser *analyser, const float *in, unsigned long framesPerBuffer) {
+  audio_path_enter();
+  band_map_resize(&analyser->spectroData->bands, WIN_WIDTH, analyser->spectroData->shards[0].fftSize);
+
+  analyser->block = in;
+  analyser->framesPerBuffer = framesPerBuffer;
+  pool_run(&analyser->pool, analyse_shard, analyser, analyser->spectroData->numShards);
+
+  unsigned long maxFrames = (unsigned long) analyser->spectroData->options.framesPerBuffer;
+  unsigned long frames = framesPerBuffer < maxFrames ? framesPerBuffer : maxFrames;
+  double *squares = analyser->loudnessSquares;
+  for (int shard = 1; shard < analyser->spectroData->numShards; shard++) {
+    const double *shardSquares = analyser->loudnessSquares + (size_t) shard * maxFrames;
+    for (unsigned long i = 0; i < frames; i++) {
+      squares[i] += shardSquares[i];
+    }
+  }
+  loudness_accumulate(&analyser->loudness, squares, frames);
+  audio_path_leave();
+}
@@ -0,0 +1,102 @@
+//
+// Analysis of each block split into independent jobs run in parallel on a worker pool.
+//
+
+#ifndef ANALYSIS_H
+#define ANALYSIS_H
+
+#include "frequencies.h"
+#include "meter.h"
+#include "pitch.h"
+#include "loudness.h"
+#include "pool.h"
+
+/// Shards per pool thread, so that threads finishing early can steal the remaining ones
+#define ANALYSIS_SHARDS_PER_THREAD 2
+
+/**
+ * Per-block analysis of a stream: levels (and optionally the pitch) of every channel, the loudness
+ * of the stream and the columns of every spectrum. Every shard of the spectro data is one job,
+ * covering the STFT of its rows and the level meter, pitch detector and K-weighting filters of the
+ * channels among them; the jobs of a block run in parallel on the pool and are joined before
+ * analyse_block returns, so blocks are analysed strictly in order. The K-weighted squares of the
+ * shards are then summed into the loudness blocks.
+ */
+typedef struct {
+  int numChannels;
+
+  /// Spectro data whose shards are the jobs of every block.
+  streamCallbackData *spectroData;
+
+  /// Meter of the channels of each shard; unused for shards holding only mixed-down views.
+  meterState *meters;
+
+  /// Levels of every channel of the last analysed block.
+  channelLevels *levels;
+
+  /// Pitch detector of the channels of each shard, and the latest pitch of every channel; NULL
+  /// unless the spectro options enable pitch detection.
+  pitchDetector *pitch;
+  pitchEstimate *pitches;
+
+  /// Loudness of the stream, and the K-weighted squares of every frame of the block filtered by
+  /// each shard, options.framesPerBuffer of the spectro data per shard.
+  loudnessMeter loudness;
+  double *loudnessSquares;
+
+  /// Threads running the jobs.
+  workPool pool;
+
+  /// Block being analysed, read by every job.
+  const float *block;
+  unsigned long framesPerBuffer;
+} blockAnalyser;
+
+/**
+ * Number of shards to split the spectra into for a pool of the given size.
+ *
+ * @param numThreads Number of threads of the pool.
+ * @return Number of shards for spectroOptions.numShards.
+ */
+int analysis_shards(int numThreads);
+
+/**
+ * Allocates the meters, the pitch detectors and the loudness meter and starts the pool of an analyser.
+ *
+ * @param analyser Analyser to initialize.
+ * @param numChannels Number of interleaved channels in each block.
+ * @param spectroData Spectro data of the stream; its shards become the jobs.
+ * @param numThreads Threads of the pool; values below 1 select one per core.
+ * @return 0 on success, -1 if memory could not be allocated or the threads could not be started.
+ */
+int analyser_init(blockAnalyser *analyser, int numChannels, streamCallbackData *spectroData, int numThreads);
+
+/**
+ * Stops the pool and frees the meters, the pitch detectors and the loudness meter of an analyser.
+ *
+ * @param analyser Analyser to free.
+ */
+void analyser_free(blockAnalyser *analyser);
+
+/**
+ * Clears the meters, the pitch detectors and the loudness meter of an analyser and its levels, as
+ * if the stream had just started. Nothing is allocated or freed and the pool keeps running.
+ *
+ * @param analyser Analyser to reset.
+ */
+void analyser_reset(blockAnalyser *analyser);
+
+/**
+ * Analyses one block: analyser->levels receives the levels of every channel and
+ * spectroData->proportions the columns of every spectrum, exactly as meter_process and
+ * compute_frequencies would compute them. analyser->pitches is updated whenever a pitch frame
+ * completes and analyser->loudness.levels whenever a loudness block does.
+ *
+ * @param analyser Analyser of the stream.
+ * @param in Interleaved input samples.
+ * @param framesPerBuffer Number of frames in the block; the spectra and the loudness take the
+ *        first options.framesPerBuffer of the spectro data.
+ */
+void analyse_block(blockAnalyser *analyser, const float *in, unsigned long framesPerBuffer);
+
+#endif //ANALYSIS_H
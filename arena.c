@@ -0,0 +1,247 @@
+//
+// Session arena: every buffer of a capture session carved out of one mapping sized at stream open.
+//
+
+#include "arena.h"
+#include <errno.h>
+#include <fftw3.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+static sessionArena *session_arena = NULL;
+static _Atomic unsigned long audio_path_count = 0;
+static _Thread_local int audio_path_depth = 0;
+
+/**
+ * Counts an allocation if the calling thread is on the audio path.
+ */
+static void count_allocation() {
+  if (audio_path_depth > 0) {
+    atomic_fetch_add_explicit(&audio_path_count, 1, memory_order_relaxed);
+  }
+}
+
+/**
+ * Rounds a size up to a multiple of the given power of two.
+ */
+static size_t round_up(size_t size, size_t multiple) {
+  return (size + multiple - 1) & ~(multiple - 1);
+}
+
+/**
+ * Reserves the address space of an arena and makes it the one session_alloc carves from. Only one
+ * arena can be open or sealed at a time.
+ *
+ * @param arena Arena to open.
+ * @param lockMemory Non-zero to lock the arena into RAM (mlock) when it is sealed.
+ * @return 0 on success, -1 if the address space could not be reserved or another arena exists.
+ */
+int arena_open(sessionArena *arena, int lockMemory) {
+  memset(arena, 0, sizeof(*arena));
+  if (session_arena != NULL) {
+    return -1;
+  }
+
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+  flags |= MAP_NORESERVE;
+#endif
+  void *base = mmap(NULL, ARENA_RESERVE_BYTES, PROT_READ | PROT_WRITE, flags, -1, 0);
+  if (base == MAP_FAILED) {
+    return -1;
+  }
+
+  arena->base = (unsigned char *) base;
+  arena->size = ARENA_RESERVE_BYTES;
+  arena->lockMemory = lockMemory;
+  session_arena = arena;
+  return 0;
+}
+
+/**
+ * Fixes the size of the arena to the blocks carved so far, unmaps the rest of the reservation,
+ * touches every page and locks them if requested. Later session_alloc calls use the heap. Must be
+ * called before any other thread uses the blocks.
+ *
+ * @param arena Open arena.
+ */
+void arena_seal(sessionArena *arena) {
+  size_t page = (size_t) sysconf(_SC_PAGESIZE);
+  size_t size = round_up(arena->used > 0 ? arena->used : 1, page);
+  if (size < arena->size) {
+    munmap(arena->base + size, arena->size - size);
+  }
+  arena->size = size;
+  arena->sealed = 1;
+
+  // Writing (not just reading) every page makes the kernel back it now rather than on first use.
+  for (size_t offset = 0; offset < size; offset += page) {
+    volatile unsigned char *byte = arena->base + offset;
+    *byte = *byte;
+  }
+  if (arena->lockMemory && mlock(arena->base, size) != 0) {
+    arena->lockError = errno;
+  }
+}
+
+/**
+ * Unmaps the arena. Every block carved from it must no longer be in use.
+ *
+ * @param arena Arena to close; nothing happens if it was never opened.
+ */
+void arena_close(sessionArena *arena) {
+  if (arena->base == NULL) {
+    return;
+  }
+  if (arena->lockMemory && arena->lockError == 0) {
+    munlock(arena->base, arena->size);
+  }
+  munmap(arena->base, arena->size);
+  arena->base = NULL;
+  if (session_arena == arena) {
+    session_arena = NULL;
+  }
+}
+
+/**
+ * Prints the size and lock state of the arena and the allocations counted on the audio path.
+ *
+ * @param arena Sealed arena.
+ * @param file File to print to.
+ */
+void print_arena_stats(const sessionArena *arena, FILE *file) {
+  fprintf(file, "Session memory: %.1f KiB in %lu blocks", (double) arena->used / 1024.0, arena->blocks);
+  if (arena->overflows > 0) {
+    fprintf(file, " (%lu more on the heap)", arena->overflows);
+  }
+  if (arena->lockMemory && arena->lockError == 0) {
+    fprintf(file, ", locked");
+  } else if (arena->lockMemory) {
+    fprintf(file, ", not locked (%s)", strerror(arena->lockError));
+  }
+  fprintf(file, "\n  allocations on the audio path: %lu\n", audio_path_allocations());
+}
+
+/**
+ * Allocates a buffer of a session: from the open arena if there is one, otherwise from the heap
+ * with fftw_malloc. Either way the buffer is aligned for SIMD loads and FFTW plans.
+ *
+ * @param size Size of the buffer in bytes.
+ * @return The buffer, or NULL if it could not be allocated.
+ */
+void *session_alloc(size_t size) {
+  count_allocation();
+
+  sessionArena *arena = session_arena;
+  if (arena != NULL && !arena->sealed) {
+    size_t start = round_up(arena->used, ARENA_ALIGNMENT);
+    if (start <= arena->size && size <= arena->size - start) {
+      arena->used = start + size;
+      arena->blocks++;
+      return arena->base + start;
+    }
+    arena->overflows++;
+  }
+  return fftw_malloc(size);
+}
+
+/**
+ * Allocates a zeroed array of a session, see session_alloc.
+ *
+ * @param count Number of elements.
+ * @param size Size of each element in bytes.
+ * @return The array, or NULL if it could not be allocated.
+ */
+void *session_calloc(size_t count, size_t size) {
+  if (size != 0 && count > SIZE_MAX / size) {
+    return NULL;
+  }
+  void *block = session_alloc(count * size);
+  if (block != NULL) {
+    memset(block, 0, count * size);
+  }
+  return block;
+}
+
+/**
+ * Frees a buffer returned by session_alloc or session_calloc. Buffers carved from the arena are
+ * left in place until the arena is closed.
+ *
+ * @param block Buffer to free, or NULL.
+ */
+void session_free(void *block) {
+  const sessionArena *arena = session_arena;
+  const unsigned char *byte = (const unsigned char *) block;
+  if (arena != NULL && byte >= arena->base && byte < arena->base + arena->size) {
+    return;
+  }
+  fftw_free(block);
+}
+
+/**
+ * Marks the calling thread as running the audio path (the audio callback or the analysis of a
+ * block) until the matching audio_path_leave. Calls nest.
+ */
+void audio_path_enter() {
+  audio_path_depth++;
+}
+
+/**
+ * Ends the audio path section started by the last audio_path_enter of the calling thread.
+ */
+void audio_path_leave() {
+  audio_path_depth--;
+}
+
+/**
+ * Returns the number of allocations made by threads while on the audio path: session_alloc calls,
+ * and every malloc, calloc, realloc and aligned allocation when built with ARENA_COUNT_MALLOC
+ * (glibc only). A session that never allocates on the audio path keeps it at 0.
+ *
+ * @return Number of allocations counted since the program started.
+ */
+unsigned long audio_path_allocations() {
+  return atomic_load_explicit(&audio_path_count, memory_order_relaxed);
+}
+
+#if defined(ARENA_COUNT_MALLOC) && defined(__GLIBC__)
+// Debug builds count the allocations of every library (FFTW, ncurses, libc) as well, by wrapping
+// the allocator entry points around glibc's own.
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *block, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+void *malloc(size_t size) {
+  count_allocation();
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  count_allocation();
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *block, size_t size) {
+  count_allocation();
+  return __libc_realloc(block, size);
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  count_allocation();
+  return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **block, size_t alignment, size_t size) {
+  count_allocation();
+  *block = __libc_memalign(alignment, size);
+  return *block == NULL && size > 0 ? ENOMEM : 0;
+}
+#endif
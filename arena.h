@@ -0,0 +1,128 @@
+//
+// Session arena: every buffer of a capture session carved out of one mapping sized at stream open.
+//
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/// Alignment of every block carved from the arena: one cache line, which also covers the SIMD
+/// alignment fftw_malloc guarantees
+#define ARENA_ALIGNMENT 64
+
+/// Address space reserved while a session is being set up; only the part carved out of it is ever
+/// touched, and the rest is unmapped when the arena is sealed
+#define ARENA_RESERVE_BYTES ((size_t) 1 << 30)
+
+/**
+ * Memory of one capture session. While the arena is open, session_alloc carves blocks out of it
+ * with a bump pointer; sealing it fixes its size to what was carved, touches every page so the
+ * audio path never takes a page fault, and optionally locks it into RAM. Blocks are never freed
+ * one by one: the whole arena is unmapped when the session closes.
+ */
+typedef struct {
+
+  /// Start of the mapping, ARENA_ALIGNMENT aligned.
+  unsigned char *base;
+
+  /// Bytes mapped: ARENA_RESERVE_BYTES while open, the carved bytes rounded up to whole pages once sealed.
+  size_t size;
+
+  /// Bytes carved out so far, alignment padding included.
+  size_t used;
+
+  /// Number of blocks carved out, and of session_alloc calls the open arena could not serve.
+  unsigned long blocks;
+  unsigned long overflows;
+
+  /// Non-zero once sealed; later session_alloc calls fall back to the heap.
+  int sealed;
+
+  /// Non-zero to lock the sealed arena into RAM, and the errno of mlock if that failed (0 otherwise).
+  int lockMemory;
+  int lockError;
+} sessionArena;
+
+/**
+ * Reserves the address space of an arena and makes it the one session_alloc carves from. Only one
+ * arena can be open or sealed at a time.
+ *
+ * @param arena Arena to open.
+ * @param lockMemory Non-zero to lock the arena into RAM (mlock) when it is sealed.
+ * @return 0 on success, -1 if the address space could not be reserved or another arena exists.
+ */
+int arena_open(sessionArena *arena, int lockMemory);
+
+/**
+ * Fixes the size of the arena to the blocks carved so far, unmaps the rest of the reservation,
+ * touches every page and locks them if requested. Later session_alloc calls use the heap. Must be
+ * called before any other thread uses the blocks.
+ *
+ * @param arena Open arena.
+ */
+void arena_seal(sessionArena *arena);
+
+/**
+ * Unmaps the arena. Every block carved from it must no longer be in use.
+ *
+ * @param arena Arena to close; nothing happens if it was never opened.
+ */
+void arena_close(sessionArena *arena);
+
+/**
+ * Prints the size and lock state of the arena and the allocations counted on the audio path.
+ *
+ * @param arena Sealed arena.
+ * @param file File to print to.
+ */
+void print_arena_stats(const sessionArena *arena, FILE *file);
+
+/**
+ * Allocates a buffer of a session: from the open arena if there is one, otherwise from the heap
+ * with fftw_malloc. Either way the buffer is aligned for SIMD loads and FFTW plans.
+ *
+ * @param size Size of the buffer in bytes.
+ * @return The buffer, or NULL if it could not be allocated.
+ */
+void *session_alloc(size_t size);
+
+/**
+ * Allocates a zeroed array of a session, see session_alloc.
+ *
+ * @param count Number of elements.
+ * @param size Size of each element in bytes.
+ * @return The array, or NULL if it could not be allocated.
+ */
+void *session_calloc(size_t count, size_t size);
+
+/**
+ * Frees a buffer returned by session_alloc or session_calloc. Buffers carved from the arena are
+ * left in place until the arena is closed.
+ *
+ * @param block Buffer to free, or NULL.
+ */
+void session_free(void *block);
+
+/**
+ * Marks the calling thread as running the audio path (the audio callback or the analysis of a
+ * block) until the matching audio_path_leave. Calls nest.
+ */
+void audio_path_enter();
+
+/**
+ * Ends the audio path section started by the last audio_path_enter of the calling thread.
+ */
+void audio_path_leave();
+
+/**
+ * Returns the number of allocations made by threads while on the audio path: session_alloc calls,
+ * and every malloc, calloc, realloc and aligned allocation when built with ARENA_COUNT_MALLOC
+ * (glibc only). A session that never allocates on the audio path keeps it at 0.
+ *
+ * @return Number of allocations counted since the program started.
+ */
+unsigned long audio_path_allocations();
+
+#endif //ARENA_H
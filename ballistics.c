@@ -0,0 +1,283 @@
+//
+// Time-based attack, release and peak-hold ballistics of the volume bars and spectrum columns.
+//
+
+#include "ballistics.h"
+#include "arena.h"
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#define BALLISTICS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+/// Times of the presets, in milliseconds: attack and release time constants, hold and full-height fall
+static const ballisticsOptions PRESETS[] = {
+    {BallisticsPeak, 0.0, 0.0, 0.0, BALLISTICS_DEFAULT_FALL_MS},
+    {BallisticsVu, 65.0, 65.0, 0.0, BALLISTICS_DEFAULT_FALL_MS},
+    {BallisticsPpm, 3.0, 650.0, 1500.0, 3000.0},
+};
+
+/**
+ * Coefficients of one update, shared by every value.
+ */
+typedef struct {
+
+  /// Share of the distance to the analysed value a rising and a falling bar cover.
+  float attack;
+  float release;
+
+  /// Elapsed time, hold time of a new peak, both in milliseconds, and the fall of a mark per millisecond.
+  float elapsed;
+  float hold;
+  float fall;
+} ballisticsStep;
+
+/**
+ * Returns the name of the given mode ("peak", "vu", "ppm" or "custom").
+ *
+ * @param mode Mode to name.
+ * @return Name of the mode.
+ */
+const char *ballistics_mode_name(enum BallisticsMode mode) {
+  static const char *NAMES[NUM_BALLISTICS_MODES] = {"peak", "vu", "ppm", "custom"};
+  return NAMES[mode];
+}
+
+/**
+ * Sets the default ballistics: the BallisticsPeak preset.
+ *
+ * @param options Options to initialize.
+ */
+void default_ballistics_options(ballisticsOptions *options) {
+  *options = PRESETS[BallisticsPeak];
+}
+
+/**
+ * Selects a preset by name and sets its times.
+ *
+ * @param name "peak", "vu" or "ppm".
+ * @param options Options to update; left unchanged if the name is unknown.
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int parse_ballistics_mode(const char *name, ballisticsOptions *options) {
+  for (int mode = 0; mode < BallisticsCustom; mode++) {
+    if (strcmp(name, ballistics_mode_name((enum BallisticsMode) mode)) == 0) {
+      *options = PRESETS[mode];
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Allocates the ballistics of a stream, with every bar and mark at 0.
+ *
+ * @param ballistics Ballistics to initialize.
+ * @param numChannels Number of channels of the volume view.
+ * @param numSpectra Number of spectra of the frequency view.
+ * @param options Times of the bars and marks; negative times count as 0.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int ballistics_init(meterBallistics *ballistics, int numChannels, int numSpectra, const ballisticsOptions *options) {
+  memset(ballistics, 0, sizeof(*ballistics));
+  ballistics->options = *options;
+  ballistics->numChannels = numChannels;
+  ballistics->numSpectra = numSpectra;
+  ballistics->count = numChannels * BALLISTICS_LEVEL_VALUES + numSpectra * WIN_WIDTH;
+
+  size_t count = (size_t) ballistics->count;
+  ballistics->target = (float *) session_calloc(count, sizeof(float));
+  ballistics->value = (float *) session_calloc(count, sizeof(float));
+  ballistics->peak = (float *) session_calloc(count, sizeof(float));
+  ballistics->hold = (float *) session_calloc(count, sizeof(float));
+  ballistics->levels = (channelLevels *) session_calloc((size_t) numChannels, sizeof(channelLevels));
+  if (ballistics->target == NULL || ballistics->value == NULL || ballistics->peak == NULL ||
+      ballistics->hold == NULL || ballistics->levels == NULL) {
+    ballistics_free(ballistics);
+    return -1;
+  }
+
+  ballistics->columns = ballistics->value + numChannels * BALLISTICS_LEVEL_VALUES;
+  ballistics->columnPeaks = ballistics->peak + numChannels * BALLISTICS_LEVEL_VALUES;
+  return 0;
+}
+
+/**
+ * Frees the ballistics of a stream.
+ *
+ * @param ballistics Ballistics to free.
+ */
+void ballistics_free(meterBallistics *ballistics) {
+  session_free(ballistics->target);
+  session_free(ballistics->value);
+  session_free(ballistics->peak);
+  session_free(ballistics->hold);
+  session_free(ballistics->levels);
+  memset(ballistics, 0, sizeof(*ballistics));
+}
+
+/**
+ * Drops every bar and mark to 0, e.g. after a restart.
+ *
+ * @param ballistics Ballistics to reset.
+ */
+void ballistics_reset(meterBallistics *ballistics) {
+  size_t count = (size_t) ballistics->count;
+  memset(ballistics->target, 0, sizeof(float) * count);
+  memset(ballistics->value, 0, sizeof(float) * count);
+  memset(ballistics->peak, 0, sizeof(float) * count);
+  memset(ballistics->hold, 0, sizeof(float) * count);
+  memset(ballistics->levels, 0, sizeof(channelLevels) * (size_t) ballistics->numChannels);
+}
+
+/**
+ * Share of the distance to a constant target an exponential follower of the given time constant
+ * covers in the given time: 1 - exp(-elapsed / timeConstant).
+ */
+static float follow_coefficient(double timeConstantMs, double elapsedMs) {
+  return timeConstantMs > 0.0 ? (float) -expm1(-elapsedMs / timeConstantMs) : 1.0f;
+}
+
+/**
+ * Larger of a value and 0, as _mm_max_ps computes it; fmaxf is a library call on most targets.
+ */
+static inline float positive(float value) {
+  return value > 0.0f ? value : 0.0f;
+}
+
+/**
+ * Scalar kernel for values [first, count). It is also the reference the vector kernel is checked
+ * against, so both compute every value with the same operations.
+ *
+ * A mark whose hold runs out during the step only falls for the rest of it, so a step of 2t ms
+ * moves it as far as two steps of t ms.
+ */
+static void ballistics_scalar(meterBallistics *ballistics, const ballisticsStep *step, int first) {
+  for (int i = first; i < ballistics->count; i++) {
+    float target = ballistics->target[i];
+    float value = ballistics->value[i];
+    float coefficient = target > value ? step->attack : step->release;
+    ballistics->value[i] = value + coefficient * (target - value);
+
+    float hold = ballistics->hold[i] - step->elapsed;
+    float peak = positive(ballistics->peak[i] - positive(0.0f - hold) * step->fall);
+    int fresh = target >= peak;
+    ballistics->peak[i] = fresh ? target : peak;
+    ballistics->hold[i] = fresh ? step->hold : positive(hold);
+  }
+}
+
+#ifdef BALLISTICS_SSE2
+/**
+ * SSE2 kernel: four values per vector, branch-free.
+ *
+ * @return First value left for the scalar kernel.
+ */
+static int ballistics_sse2(meterBallistics *ballistics, const ballisticsStep *step) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 attack = _mm_set1_ps(step->attack);
+  const __m128 release = _mm_set1_ps(step->release);
+  const __m128 elapsed = _mm_set1_ps(step->elapsed);
+  const __m128 holdTime = _mm_set1_ps(step->hold);
+  const __m128 fall = _mm_set1_ps(step->fall);
+
+  int i = 0;
+  for (; i + 4 <= ballistics->count; i += 4) {
+    __m128 target = _mm_loadu_ps(ballistics->target + i);
+    __m128 value = _mm_loadu_ps(ballistics->value + i);
+    __m128 rising = _mm_cmpgt_ps(target, value);
+    __m128 coefficient = _mm_or_ps(_mm_and_ps(rising, attack), _mm_andnot_ps(rising, release));
+    _mm_storeu_ps(ballistics->value + i, _mm_add_ps(value, _mm_mul_ps(coefficient, _mm_sub_ps(target, value))));
+
+    __m128 hold = _mm_sub_ps(_mm_loadu_ps(ballistics->hold + i), elapsed);
+    __m128 fallen = _mm_mul_ps(_mm_max_ps(_mm_sub_ps(zero, hold), zero), fall);
+    __m128 peak = _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(ballistics->peak + i), fallen), zero);
+    __m128 fresh = _mm_cmpge_ps(target, peak);
+    _mm_storeu_ps(ballistics->peak + i, _mm_or_ps(_mm_and_ps(fresh, target), _mm_andnot_ps(fresh, peak)));
+    _mm_storeu_ps(ballistics->hold + i,
+                  _mm_or_ps(_mm_and_ps(fresh, holdTime), _mm_andnot_ps(fresh, _mm_max_ps(hold, zero))));
+  }
+  return i;
+}
+
+/**
+ * SSE2 conversion of the analysed column amplitudes into targets between 0 and 1, four at a time.
+ *
+ * @return First column left for the scalar loop.
+ */
+static int gather_columns_sse2(float *target, const double *proportions, int count) {
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 low = _mm_cvtpd_ps(_mm_loadu_pd(proportions + i));
+    __m128 high = _mm_cvtpd_ps(_mm_loadu_pd(proportions + i + 2));
+    _mm_storeu_ps(target + i, _mm_min_ps(_mm_max_ps(_mm_movelh_ps(low, high), zero), one));
+  }
+  return i;
+}
+#endif
+
+/**
+ * Advances every bar and mark towards the values of an analysed block and updates the shown levels
+ * and columns. Advancing by 2t ms once gives the same bars as advancing by t ms twice with the same
+ * analysed values.
+ *
+ * @param ballistics Ballistics of the stream.
+ * @param levels Analysed levels of every channel.
+ * @param proportions Analysed amplitudes of numSpectra * WIN_WIDTH columns, between 0 and 1.
+ * @param elapsedMs Duration of the block, in milliseconds.
+ */
+void ballistics_update(meterBallistics *ballistics, const channelLevels *levels, const double *proportions,
+                       double elapsedMs) {
+  const ballisticsOptions *options = &ballistics->options;
+  elapsedMs = fmax(elapsedMs, 0.0);
+
+  ballisticsStep step;
+  step.attack = follow_coefficient(options->attackMs, elapsedMs);
+  step.release = follow_coefficient(options->releaseMs, elapsedMs);
+  step.elapsed = (float) elapsedMs;
+  step.hold = (float) fmax(options->holdMs, 0.0);
+  step.fall = options->fallMs > 0.0 ? (float) (1.0 / options->fallMs) : FLT_MAX;
+
+  float *target = ballistics->target;
+  for (int c = 0; c < ballistics->numChannels; c++, target += BALLISTICS_LEVEL_VALUES) {
+    target[0] = levels[c].rms;
+    target[1] = levels[c].peak;
+    target[2] = levels[c].truePeak;
+  }
+
+  int numColumns = ballistics->numSpectra * WIN_WIDTH;
+  int firstColumn = 0;
+#ifdef BALLISTICS_SSE2
+  if (!ballistics->scalar) {
+    firstColumn = gather_columns_sse2(target, proportions, numColumns);
+  }
+#endif
+  for (int i = firstColumn; i < numColumns; i++) {
+    float proportion = positive((float) proportions[i]);
+    target[i] = proportion < 1.0f ? proportion : 1.0f;
+  }
+
+  int first = 0;
+#ifdef BALLISTICS_SSE2
+  if (!ballistics->scalar) {
+    first = ballistics_sse2(ballistics, &step);
+  }
+#endif
+  ballistics_scalar(ballistics, &step, first);
+
+  const float *value = ballistics->value;
+  const float *peak = ballistics->peak;
+  for (int c = 0; c < ballistics->numChannels; c++) {
+    int i = c * BALLISTICS_LEVEL_VALUES;
+    ballistics->levels[c].rms = value[i];
+    ballistics->levels[c].peak = value[i + 1];
+    ballistics->levels[c].truePeak = peak[i + 2];
+    ballistics->levels[c].dc = levels[c].dc;
+  }
+}
@@ -0,0 +1,151 @@
+//
+// Time-based attack, release and peak-hold ballistics of the volume bars and spectrum columns.
+//
+
+#ifndef BALLISTICS_H
+#define BALLISTICS_H
+
+#include "meter.h"
+#include "utils.h"
+
+/// Values of a channel of the volume view that go through the ballistics: RMS, peak and true-peak
+#define BALLISTICS_LEVEL_VALUES 3
+
+/// Time a released peak mark of the default ballistics takes to fall the full height of its view, in
+/// milliseconds; close to the fall of the fixed per-draw decrement it replaces at 256 frames and 44.1 kHz
+#define BALLISTICS_DEFAULT_FALL_MS 1000.0
+
+/**
+ * Preset ballistics. Times are exponential time constants on the scale of each view: linear
+ * amplitude for the volume bars and SPECTRO_DB_FLOOR..0 dBFS for the spectrum columns.
+ */
+enum BallisticsMode {
+
+  /// Bars follow every block at once, peak marks fall after it (the look of earlier versions).
+  BallisticsPeak,
+
+  /// Volume-unit meter: rises and falls with a 65 ms time constant, i.e. 99% of a step in 300 ms.
+  BallisticsVu,
+
+  /// Peak programme meter: rises within a few milliseconds and falls 20 dB in 1.5 s, with held peaks.
+  BallisticsPpm,
+
+  /// Times given by the options.
+  BallisticsCustom,
+
+  NUM_BALLISTICS_MODES
+};
+
+/**
+ * How the shown values follow the analysed ones.
+ */
+typedef struct {
+  enum BallisticsMode mode;
+
+  /// Time constant of a rising bar, in milliseconds; 0 follows it at once.
+  double attackMs;
+
+  /// Time constant of a falling bar, in milliseconds; 0 follows it at once.
+  double releaseMs;
+
+  /// Time a peak mark stays where it is before it falls, in milliseconds.
+  double holdMs;
+
+  /// Time a released peak mark takes to fall the full height of its view, in milliseconds; 0 drops it at once.
+  double fallMs;
+} ballisticsOptions;
+
+/**
+ * Ballistics of every volume bar and spectrum column of a stream. The analysed values of a block are
+ * gathered into one array (numChannels * BALLISTICS_LEVEL_VALUES levels, then numSpectra * WIN_WIDTH
+ * columns) and all of them are advanced by the duration of the block in one vectorized pass, so the
+ * bars move alike whatever the buffer size, sample rate or refresh rate.
+ */
+typedef struct {
+  ballisticsOptions options;
+  int numChannels;
+  int numSpectra;
+
+  /// Number of values: numChannels * BALLISTICS_LEVEL_VALUES + numSpectra * WIN_WIDTH.
+  int count;
+
+  /// Analysed value, shown value, held peak and milliseconds of hold left of every value.
+  float *target;
+  float *value;
+  float *peak;
+  float *hold;
+
+  /// Shown levels of every channel: RMS and peak bars, held true-peak, and the analysed DC offset.
+  channelLevels *levels;
+
+  /// Shown and held amplitude of every spectrum column, numSpectra rows of WIN_WIDTH; point into value and peak.
+  const float *columns;
+  const float *columnPeaks;
+
+  /// Set to run the scalar reference kernel instead of the vector one.
+  int scalar;
+} meterBallistics;
+
+/**
+ * Returns the name of the given mode ("peak", "vu", "ppm" or "custom").
+ *
+ * @param mode Mode to name.
+ * @return Name of the mode.
+ */
+const char *ballistics_mode_name(enum BallisticsMode mode);
+
+/**
+ * Sets the default ballistics: the BallisticsPeak preset.
+ *
+ * @param options Options to initialize.
+ */
+void default_ballistics_options(ballisticsOptions *options);
+
+/**
+ * Selects a preset by name and sets its times.
+ *
+ * @param name "peak", "vu" or "ppm".
+ * @param options Options to update; left unchanged if the name is unknown.
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int parse_ballistics_mode(const char *name, ballisticsOptions *options);
+
+/**
+ * Allocates the ballistics of a stream, with every bar and mark at 0.
+ *
+ * @param ballistics Ballistics to initialize.
+ * @param numChannels Number of channels of the volume view.
+ * @param numSpectra Number of spectra of the frequency view.
+ * @param options Times of the bars and marks; negative times count as 0.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int ballistics_init(meterBallistics *ballistics, int numChannels, int numSpectra, const ballisticsOptions *options);
+
+/**
+ * Frees the ballistics of a stream.
+ *
+ * @param ballistics Ballistics to free.
+ */
+void ballistics_free(meterBallistics *ballistics);
+
+/**
+ * Drops every bar and mark to 0, e.g. after a restart.
+ *
+ * @param ballistics Ballistics to reset.
+ */
+void ballistics_reset(meterBallistics *ballistics);
+
+/**
+ * Advances every bar and mark towards the values of an analysed block and updates the shown levels
+ * and columns. Advancing by 2t ms once gives the same bars as advancing by t ms twice with the same
+ * analysed values.
+ *
+ * @param ballistics Ballistics of the stream.
+ * @param levels Analysed levels of every channel.
+ * @param proportions Analysed amplitudes of numSpectra * WIN_WIDTH columns, between 0 and 1.
+ * @param elapsedMs Duration of the block, in milliseconds.
+ */
+void ballistics_update(meterBallistics *ballistics, const channelLevels *levels, const double *proportions,
+                       double elapsedMs);
+
+#endif //BALLISTICS_H
@@ -0,0 +1,204 @@
+//
+// Mapping of FFT bins to the columns of the frequency view.
+//
+
+#include "bands.h"
+#include "arena.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Parses a scale name ("quadratic", "log" or "mel").
+ *
+ * @param name Name of the scale.
+ * @param scale Set to the parsed scale.
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int parse_band_scale(const char *name, enum BandScale *scale) {
+  if (strcmp(name, "quadratic") == 0) {
+    *scale = BandScaleQuadratic;
+  } else if (strcmp(name, "log") == 0) {
+    *scale = BandScaleLog;
+  } else if (strcmp(name, "mel") == 0) {
+    *scale = BandScaleMel;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Parses a reduction name ("peak" or "rms").
+ *
+ * @param name Name of the reduction.
+ * @param reduce Set to the parsed reduction.
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int parse_band_reduce(const char *name, enum BandReduce *reduce) {
+  if (strcmp(name, "peak") == 0) {
+    *reduce = BandPeak;
+  } else if (strcmp(name, "rms") == 0) {
+    *reduce = BandRms;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+static double hz_to_mel(double frequency) {
+  return 2595.0 * log10(1.0 + frequency / 700.0);
+}
+
+static double mel_to_hz(double mel) {
+  return 700.0 * (pow(10.0, mel / 2595.0) - 1.0);
+}
+
+/**
+ * Frequency at the given position (0 = left edge of the first column, 1 = right edge of the last).
+ */
+static double edge_frequency(const bandMap *map, double position) {
+  double low = map->lowFrequency;
+  double high = map->highFrequency;
+
+  switch (map->scale) {
+    case BandScaleLog:
+      return low * pow(high / low, position);
+    case BandScaleMel:
+      return mel_to_hz(hz_to_mel(low) + position * (hz_to_mel(high) - hz_to_mel(low)));
+    case BandScaleQuadratic:
+    default:
+      return low + position * position * (high - low);
+  }
+}
+
+/**
+ * Fills the bin ranges and weights for the current column count and FFT size.
+ */
+static void build_bands(bandMap *map) {
+  int numBins = map->fftSize / 2 + 1;
+  double binsPerHz = map->fftSize / map->sampleRate;
+
+  for (int c = 0; c < map->numColumns; c++) {
+    double lowEdge = edge_frequency(map, (double) c / map->numColumns) * binsPerHz;
+    double highEdge = edge_frequency(map, (double) (c + 1) / map->numColumns) * binsPerHz;
+
+    int first = (int) lround(lowEdge);
+    int end = (int) lround(highEdge);
+    if (first > numBins - 1) {
+      first = numBins - 1;
+    }
+    if (end > numBins) {
+      end = numBins;
+    }
+    if (end <= first) {
+      end = first + 1;
+    }
+
+    map->firstBin[c] = first;
+    map->endBin[c] = end;
+    map->weights[c] = map->reduce == BandRms ? 1.0 / (end - first) : 1.0;
+  }
+}
+
+/**
+ * Builds the map of the given frequency range onto numColumns columns.
+ *
+ * @param map Map to initialize.
+ * @param numColumns Number of columns.
+ * @param fftSize FFT size of the power spectra (fftSize / 2 + 1 bins).
+ * @param sampleRate Sample rate of the analysed signal.
+ * @param lowFrequency Frequency at the left edge of the first column.
+ * @param highFrequency Frequency at the right edge of the last column.
+ * @param scale Frequency scale of the columns.
+ * @param reduce Reduction of the bins of each column.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int band_map_init(bandMap *map, int numColumns, int fftSize, double sampleRate, double lowFrequency,
+                  double highFrequency, enum BandScale scale, enum BandReduce reduce) {
+  memset(map, 0, sizeof(*map));
+  map->sampleRate = sampleRate;
+  map->lowFrequency = lowFrequency;
+  map->highFrequency = highFrequency;
+  map->scale = scale;
+  map->reduce = reduce;
+  return band_map_resize(map, numColumns, fftSize);
+}
+
+/**
+ * Rebuilds the map if the column count or the FFT size changed; does nothing otherwise.
+ *
+ * @param map Map to update.
+ * @param numColumns Number of columns.
+ * @param fftSize FFT size of the power spectra.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int band_map_resize(bandMap *map, int numColumns, int fftSize) {
+  if (map->numColumns == numColumns && map->fftSize == fftSize) {
+    return 0;
+  }
+
+  if (map->numColumns != numColumns) {
+    session_free(map->firstBin);
+    session_free(map->endBin);
+    session_free(map->weights);
+    map->firstBin = (int *) session_alloc(sizeof(int) * numColumns);
+    map->endBin = (int *) session_alloc(sizeof(int) * numColumns);
+    map->weights = (double *) session_alloc(sizeof(double) * numColumns);
+    if (map->firstBin == NULL || map->endBin == NULL || map->weights == NULL) {
+      band_map_free(map);
+      return -1;
+    }
+  }
+
+  map->numColumns = numColumns;
+  map->fftSize = fftSize;
+  build_bands(map);
+  return 0;
+}
+
+/**
+ * Frees the tables of the map.
+ *
+ * @param map Map to free.
+ */
+void band_map_free(bandMap *map) {
+  session_free(map->firstBin);
+  session_free(map->endBin);
+  session_free(map->weights);
+  map->firstBin = NULL;
+  map->endBin = NULL;
+  map->weights = NULL;
+  map->numColumns = 0;
+}
+
+/**
+ * Reduces one power spectrum into a power per column.
+ *
+ * @param map Map of the spectrum.
+ * @param power Power of every bin, fftSize / 2 + 1 values.
+ * @param columns Set to the reduced power of every column, numColumns values.
+ */
+void band_map_apply(const bandMap *map, const double *restrict power, double *restrict columns) {
+  const int *firstBin = map->firstBin;
+  const int *endBin = map->endBin;
+
+  if (map->reduce == BandPeak) {
+    for (int c = 0; c < map->numColumns; c++) {
+      double peak = 0.0;
+      for (int k = firstBin[c]; k < endBin[c]; k++) {
+        peak = power[k] > peak ? power[k] : peak;
+      }
+      columns[c] = peak;
+    }
+    return;
+  }
+
+  for (int c = 0; c < map->numColumns; c++) {
+    double sum = 0.0;
+    for (int k = firstBin[c]; k < endBin[c]; k++) {
+      sum += power[k];
+    }
+    columns[c] = sum * map->weights[c];
+  }
+}
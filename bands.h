@@ -0,0 +1,112 @@
+//
+// Mapping of FFT bins to the columns of the frequency view.
+//
+
+#ifndef BANDS_H
+#define BANDS_H
+
+/**
+ * Frequency scale of the columns.
+ */
+enum BandScale {
+  BandScaleQuadratic,
+  BandScaleLog,
+  BandScaleMel
+};
+
+/**
+ * How the bins of a column are reduced to a single level.
+ */
+enum BandReduce {
+  BandPeak,
+  BandRms
+};
+
+/**
+ * Precomputed bin range of every column. Column c covers bins [firstBin[c], endBin[c]), at
+ * least one bin wide, so narrow low-frequency columns repeat a bin instead of skipping ahead.
+ * Built once per (column count, FFT size, sample rate, scale) and rebuilt by band_map_resize.
+ */
+typedef struct {
+
+  /// Number of columns and the FFT size the map was built for.
+  int numColumns;
+  int fftSize;
+
+  /// Sample rate and frequency range mapped onto the columns.
+  double sampleRate;
+  double lowFrequency;
+  double highFrequency;
+
+  enum BandScale scale;
+  enum BandReduce reduce;
+
+  /// First bin and one past the last bin of every column.
+  int *firstBin;
+  int *endBin;
+
+  /// Factor applied to the reduced power of every column: 1 / bin count for RMS, 1 for peak.
+  double *weights;
+} bandMap;
+
+/**
+ * Parses a scale name ("quadratic", "log" or "mel").
+ *
+ * @param name Name of the scale.
+ * @param scale Set to the parsed scale.
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int parse_band_scale(const char *name, enum BandScale *scale);
+
+/**
+ * Parses a reduction name ("peak" or "rms").
+ *
+ * @param name Name of the reduction.
+ * @param reduce Set to the parsed reduction.
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int parse_band_reduce(const char *name, enum BandReduce *reduce);
+
+/**
+ * Builds the map of the given frequency range onto numColumns columns.
+ *
+ * @param map Map to initialize.
+ * @param numColumns Number of columns.
+ * @param fftSize FFT size of the power spectra (fftSize / 2 + 1 bins).
+ * @param sampleRate Sample rate of the analysed signal.
+ * @param lowFrequency Frequency at the left edge of the first column.
+ * @param highFrequency Frequency at the right edge of the last column.
+ * @param scale Frequency scale of the columns.
+ * @param reduce Reduction of the bins of each column.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int band_map_init(bandMap *map, int numColumns, int fftSize, double sampleRate, double lowFrequency,
+                  double highFrequency, enum BandScale scale, enum BandReduce reduce);
+
+/**
+ * Rebuilds the map if the column count or the FFT size changed; does nothing otherwise.
+ *
+ * @param map Map to update.
+ * @param numColumns Number of columns.
+ * @param fftSize FFT size of the power spectra.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int band_map_resize(bandMap *map, int numColumns, int fftSize);
+
+/**
+ * Frees the tables of the map.
+ *
+ * @param map Map to free.
+ */
+void band_map_free(bandMap *map);
+
+/**
+ * Reduces one power spectrum into a power per column.
+ *
+ * @param map Map of the spectrum.
+ * @param power Power of every bin, fftSize / 2 + 1 values.
+ * @param columns Set to the reduced power of every column, numColumns values.
+ */
+void band_map_apply(const bandMap *map, const double *power, double *columns);
+
+#endif //BANDS_H
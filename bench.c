@@ -0,0 +1,2122 @@
+//
+// Benchmark harness for the per-buffer processing stages.
+//
+// Feeds deterministic synthetic signals through each stage without an audio device or a
+// terminal (ncurses draws into a temporary file) and reports ns/block, blocks/s, latency
+// percentiles and the terminal bytes written per block. Results can also be written as JSON lines
+// for regression tracking.
+// With --verify, checks every SIMD metering kernel against the scalar reference, the spectral
+// frame codec against the analysis it encodes, the meter ballistics against blocks of another
+// size, the pitch detector on tones of known pitch, the loudness meter on the EBU compliance signals
+// and that the audio path never allocates instead; with
+// --loopback, streams blocks through the network server to local clients and checks what they receive;
+// with --udp-loopback, does the same over UDP with induced loss through the jitter buffer;
+// with --record, records in real time through the asynchronous recorder and reads the files back.
+// The analysis stage runs on worker pools of every --threads count to show how it scales with cores.
+//
+
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "utils.h"
+#include "display.h"
+#include "volume.h"
+#include "meter.h"
+#include "frequencies.h"
+#include "signals.h"
+#include "wisdom.h"
+#include "server.h"
+#include "client.h"
+#include "spectral.h"
+#include "jitter.h"
+#include "analysis.h"
+#include "waterfall.h"
+#include "recorder.h"
+#include "pitch.h"
+#include "loudness.h"
+#include "arena.h"
+#include "ring.h"
+#include "ballistics.h"
+#include "offline.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/// Number of consecutive blocks of synthetic input cycled through by every stage
+#define BENCH_INPUT_BLOCKS 16
+
+/// Iterations run before timing starts
+#define BENCH_WARMUP_ITERATIONS 100
+
+/// Maximum number of values in a comma-separated option list
+#define BENCH_MAX_LIST 16
+
+/// Largest difference allowed between a SIMD metering kernel and the scalar reference
+#define BENCH_VERIFY_TOLERANCE 1e-6f
+
+/// Seconds of each signal streamed as spectral frames by the spectral check
+#define BENCH_SPECTRAL_SECONDS 2
+
+/// Smallest bandwidth reduction of spectral frames over raw samples the spectral check accepts
+#define BENCH_SPECTRAL_MIN_RATIO 10.0
+
+/// Block durations of the ballistics check, in milliseconds: the short blocks fit the long ones exactly
+#define BENCH_BALLISTICS_SHORT_MS 1.0
+#define BENCH_BALLISTICS_LONG_MS 25.0
+
+/// Length of the full-scale burst and of the silence after it in the ballistics check, in long blocks
+#define BENCH_BALLISTICS_BURST_BLOCKS 2
+#define BENCH_BALLISTICS_BLOCKS 120
+
+/// Largest difference allowed between bars advanced by short and by long blocks
+#define BENCH_BALLISTICS_TOLERANCE 1e-4f
+
+/// Longest a restart to a new FFT size may stall the render thread, in milliseconds: one render period at 30 fps
+#define BENCH_RESTART_MAX_MS 33.0
+
+/// Channels, threads and length in chunks of the file the offline check analyses
+#define BENCH_OFFLINE_CHANNELS 2
+#define BENCH_OFFLINE_THREADS 3
+#define BENCH_OFFLINE_CHUNKS 3
+
+/// Consecutive blocks the parallel analysis is compared with the serial one over
+#define BENCH_ANALYSIS_BLOCKS 64
+
+/// Largest difference allowed between a column amplitude of the parallel and of the serial analysis
+#define BENCH_ANALYSIS_TOLERANCE 1e-9
+
+/// Seconds of each signal the pitch check analyses; the last estimate is checked
+#define BENCH_PITCH_SECONDS 1
+
+/// Largest error of a detected pitch the pitch check accepts, in cents
+#define BENCH_PITCH_TOLERANCE_CENTS 5.0
+
+/// Mains frequency and number of harmonics of the hum signal of the pitch check
+#define BENCH_HUM_FREQ 50.0
+#define BENCH_HUM_HARMONICS 6
+
+/// Sample rate, tone frequency and most segments of the EBU loudness compliance signals
+#define LOUDNESS_CHECK_RATE 48000.0
+#define LOUDNESS_CHECK_TONE 1000.0
+#define LOUDNESS_CHECK_SEGMENTS 5
+
+/// Tolerances of EBU Tech 3341 (loudness, in LU) and Tech 3342 (loudness range, in LU)
+#define LOUDNESS_CHECK_TOLERANCE 0.1
+#define LOUDNESS_RANGE_CHECK_TOLERANCE 1.0
+
+/// Length of each file of the recorder check, in seconds, so that every run rotates
+#define RECORD_CHECK_ROTATE_SECONDS 1.0
+
+/// Clients of the loopback check that read every frame, next to one that never reads
+#define LOOPBACK_READERS 2
+
+/// Receive buffer of the loopback client that never reads, so that the server drops it quickly
+#define LOOPBACK_SLOW_RCVBUF 4096
+
+/// Playout delay of the jitter buffer in the UDP loopback check, in milliseconds
+#define UDP_LOOPBACK_DELAY_MS 20
+
+/// Quiet time after which the UDP loopback check considers the stream over, in milliseconds
+#define UDP_LOOPBACK_SETTLE_MS 200
+
+/// Pause of the publisher halfway through the second UDP loopback run, in milliseconds; shorter than the
+/// JITTER_SLOTS blocks that would resynchronize the jitter buffer
+#define UDP_LOOPBACK_PAUSE_MS 150
+
+/// Blocks the loopback check publishes at most while waiting for the stalled client to be dropped
+#define LOOPBACK_MAX_BLOCKS (1 << 20)
+
+/// Time after which the loopback check stops waiting for its readers
+#define LOOPBACK_TIMEOUT_NS 30000000000ULL
+
+/**
+ * Inputs and scratch memory handed to every stage.
+ */
+typedef struct {
+  const float *block;
+  unsigned long framesPerBuffer;
+  int numChannels;
+  streamCallbackData *spectroData;
+  meterState *meter;
+  channelLevels *levels;
+  blockAnalyser *analyser;
+  waterfallHistory *waterfall;
+  pitchDetector *pitch;
+  loudnessMeter *loudness;
+  meterBallistics *ballistics;
+} benchContext;
+
+typedef void (*benchStageFn)(benchContext *context);
+
+/**
+ * A single stage of the per-buffer processing.
+ */
+typedef struct {
+  const char *name;
+  benchStageFn run;
+
+  /// Set if the stage draws into the ncurses windows.
+  int needsScreen;
+
+  /// Metering kernel the stage forces, or -1 to use the fastest one the CPU supports.
+  int meterKernel;
+
+  /// Set if the stage runs once for every --threads count, on a worker pool of that size.
+  int parallel;
+} benchStage;
+
+/**
+ * Latency statistics of one (stage, signal, channels, frames) case.
+ */
+typedef struct {
+  double meanNs;
+  double blocksPerSecond;
+  double p50Ns;
+  double p99Ns;
+  double p999Ns;
+  double maxNs;
+  double terminalBytes;
+} benchResult;
+
+static void stage_volume(benchContext *context) {
+  meter_process(context->meter, context->block, context->framesPerBuffer, context->levels);
+}
+
+static void stage_frequencies(benchContext *context) {
+  compute_frequencies(context->block, context->framesPerBuffer, context->numChannels,
+                      context->spectroData, context->spectroData->proportions);
+}
+
+static void stage_analysis(benchContext *context) {
+  analyse_block(context->analyser, context->block, context->framesPerBuffer);
+}
+
+static void stage_pitch(benchContext *context) {
+  pitch_push(context->pitch, context->block, context->numChannels, context->framesPerBuffer);
+}
+
+static void stage_loudness(benchContext *context) {
+  loudness_process(context->loudness, context->block, context->framesPerBuffer);
+}
+
+static void stage_fftw_execute(benchContext *context) {
+  for (int shard = 0; shard < context->spectroData->numShards; shard++) {
+    fftw_execute(context->spectroData->shards[shard].plan);
+  }
+}
+
+static void stage_ballistics(benchContext *context) {
+  ballistics_update(context->ballistics, context->levels, context->spectroData->proportions,
+                    (double) context->framesPerBuffer * 1000.0 / DEFAULT_SAMPLE_RATE);
+}
+
+static void stage_draw_volume(benchContext *context) {
+  meter_process(context->meter, context->block, context->framesPerBuffer, context->levels);
+  stage_ballistics(context);
+  draw_volume(context->ballistics->levels, context->numChannels);
+}
+
+static void stage_draw_frequencies(benchContext *context) {
+  compute_frequencies(context->block, context->framesPerBuffer, context->numChannels,
+                      context->spectroData, context->spectroData->proportions);
+  stage_ballistics(context);
+  draw_frequencies(context->spectroData, context->ballistics->columns, context->ballistics->columnPeaks, NULL);
+}
+
+static void stage_draw_waterfall(benchContext *context) {
+  compute_frequencies(context->block, context->framesPerBuffer, context->numChannels,
+                      context->spectroData, context->spectroData->proportions);
+  waterfall_push(context->waterfall, context->spectroData->proportions, context->framesPerBuffer);
+  draw_waterfall(context->waterfall, 0, "channel 1");
+  wnoutrefresh(WATERFALL_WIN);
+  doupdate();
+}
+
+static void stage_render_frame(benchContext *context) {
+  stage_draw_volume(context);
+  stage_draw_frequencies(context);
+  refresh_screen();
+}
+
+static const benchStage STAGES[] = {
+    {"volume", stage_volume, 0, -1, 0},
+    {"meter_scalar", stage_volume, 0, MeterScalar, 0},
+    {"meter_sse2", stage_volume, 0, MeterSse2, 0},
+    {"meter_avx2", stage_volume, 0, MeterAvx2, 0},
+    {"frequencies", stage_frequencies, 0, -1, 0},
+    {"analysis", stage_analysis, 0, -1, 1},
+    {"pitch", stage_pitch, 0, -1, 0},
+    {"loudness", stage_loudness, 0, -1, 0},
+    {"fftw_execute", stage_fftw_execute, 0, -1, 0},
+    {"ballistics", stage_ballistics, 0, -1, 0},
+    {"draw_volume", stage_draw_volume, 1, -1, 0},
+    {"draw_frequencies", stage_draw_frequencies, 1, -1, 0},
+    {"draw_waterfall", stage_draw_waterfall, 1, -1, 0},
+    {"render_frame", stage_render_frame, 1, -1, 0},
+};
+
+#define NUM_STAGES ((int) (sizeof(STAGES) / sizeof(STAGES[0])))
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a;
+  uint64_t y = *(const uint64_t *) b;
+  return (x > y) - (x < y);
+}
+
+static double percentile(const uint64_t *sorted, int count, double fraction) {
+  int index = (int) (fraction * (double) (count - 1) + 0.5);
+  return (double) sorted[index];
+}
+
+/**
+ * Number of bytes ncurses has written to the benchmark terminal so far.
+ */
+static off_t terminal_size(FILE *terminal) {
+  struct stat st;
+  if (terminal == NULL || fstat(fileno(terminal), &st) != 0) {
+    return 0;
+  }
+  return st.st_size;
+}
+
+/**
+ * Runs one stage over the given input and computes its latency statistics.
+ */
+static benchResult run_case(const benchStage *stage, benchContext *context, const float *input,
+                            int iterations, uint64_t *samples, FILE *terminal) {
+  size_t blockSamples = context->framesPerBuffer * (size_t) context->numChannels;
+
+  for (int i = 0; i < BENCH_WARMUP_ITERATIONS; i++) {
+    context->block = input + (size_t) (i % BENCH_INPUT_BLOCKS) * blockSamples;
+    stage->run(context);
+  }
+
+  off_t terminalStart = terminal_size(terminal);
+  uint64_t total = 0;
+  for (int i = 0; i < iterations; i++) {
+    context->block = input + (size_t) (i % BENCH_INPUT_BLOCKS) * blockSamples;
+    uint64_t start = now_ns();
+    stage->run(context);
+    samples[i] = now_ns() - start;
+    total += samples[i];
+  }
+
+  qsort(samples, iterations, sizeof(uint64_t), compare_u64);
+
+  benchResult result;
+  result.meanNs = (double) total / iterations;
+  result.blocksPerSecond = result.meanNs > 0 ? 1e9 / result.meanNs : 0;
+  result.p50Ns = percentile(samples, iterations, 0.50);
+  result.p99Ns = percentile(samples, iterations, 0.99);
+  result.p999Ns = percentile(samples, iterations, 0.999);
+  result.maxNs = (double) samples[iterations - 1];
+  result.terminalBytes = (double) (terminal_size(terminal) - terminalStart) / iterations;
+  return result;
+}
+
+/**
+ * Opens an ncurses screen that writes to a temporary file so the drawing stages can run without
+ * a terminal and their output can be measured.
+ *
+ * @return 0 on success, -1 if no usable terminal description was found.
+ */
+static int open_null_screen(FILE **nullOut, FILE **nullIn) {
+  *nullOut = tmpfile();
+  *nullIn = fopen("/dev/null", "r");
+  if (*nullOut == NULL || *nullIn == NULL) {
+    return -1;
+  }
+
+  // Large enough for the volume window of the highest channel count plus the frequency window.
+  setenv("LINES", "256", 1);
+  setenv("COLUMNS", "256", 1);
+  SCREEN *screen = newterm("xterm", *nullOut, *nullIn);
+  if (screen == NULL) {
+    return -1;
+  }
+  set_term(screen);
+  return 0;
+}
+
+/**
+ * Parses a comma-separated list of positive integers.
+ *
+ * @return Number of values parsed.
+ */
+static int parse_int_list(const char *text, int *values) {
+  int count = 0;
+  char *copy = strdup(text);
+  for (char *token = strtok(copy, ","); token != NULL && count < BENCH_MAX_LIST; token = strtok(NULL, ",")) {
+    int value = atoi(token);
+    if (value > 0) {
+      values[count++] = value;
+    }
+  }
+  free(copy);
+  return count;
+}
+
+/**
+ * Returns whether name appears in the comma-separated filter, or the filter is empty.
+ */
+static int matches_filter(const char *filter, const char *name) {
+  if (filter == NULL) {
+    return 1;
+  }
+  size_t length = strlen(name);
+  for (const char *p = filter; (p = strstr(p, name)) != NULL; p += length) {
+    int startsToken = p == filter || p[-1] == ',';
+    int endsToken = p[length] == '\0' || p[length] == ',';
+    if (startsToken && endsToken) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Largest difference between the levels of two meters over all channels.
+ */
+static float levels_difference(const channelLevels *a, const channelLevels *b, int numChannels) {
+  float difference = 0.0f;
+  for (int c = 0; c < numChannels; c++) {
+    difference = fmaxf(difference, fabsf(a[c].peak - b[c].peak));
+    difference = fmaxf(difference, fabsf(a[c].rms - b[c].rms));
+    difference = fmaxf(difference, fabsf(a[c].dc - b[c].dc));
+    difference = fmaxf(difference, fabsf(a[c].truePeak - b[c].truePeak));
+  }
+  return difference;
+}
+
+/**
+ * Runs every supported SIMD metering kernel next to the scalar reference over consecutive blocks
+ * of every benchmark signal and checks that all levels agree.
+ *
+ * @return Number of failing cases.
+ */
+static int verify_meters(const int *channelCounts, int numChannelCounts, const int *frameCounts,
+                         int numFrameCounts, const char *signalFilter) {
+  int failures = 0;
+
+  for (int kernel = MeterSse2; kernel < NUM_METER_KERNELS; kernel++) {
+    if (!meter_kernel_supported((enum MeterKernel) kernel)) {
+      printf("%-8s not supported on this CPU, skipped\n", meter_kernel_name((enum MeterKernel) kernel));
+      continue;
+    }
+
+    for (int c = 0; c < numChannelCounts; c++) {
+      int numChannels = channelCounts[c];
+      channelLevels *expected = (channelLevels *) malloc(sizeof(channelLevels) * numChannels);
+      channelLevels *actual = (channelLevels *) malloc(sizeof(channelLevels) * numChannels);
+
+      for (int f = 0; f < numFrameCounts; f++) {
+        unsigned long framesPerBuffer = (unsigned long) frameCounts[f];
+        size_t blockSamples = framesPerBuffer * (size_t) numChannels;
+        float *input = (float *) malloc(sizeof(float) * blockSamples * BENCH_INPUT_BLOCKS);
+
+        for (int kind = 0; kind < NUM_SIGNAL_KINDS; kind++) {
+          if (!matches_filter(signalFilter, signal_name(kind))) {
+            continue;
+          }
+          generate_signal(kind, input, framesPerBuffer * BENCH_INPUT_BLOCKS, numChannels, DEFAULT_SAMPLE_RATE, 1);
+
+          meterState reference;
+          meterState simd;
+          if (meter_init(&reference, numChannels, framesPerBuffer) != 0 ||
+              meter_init(&simd, numChannels, framesPerBuffer) != 0) {
+            printf("Could not allocate the meters.\n");
+            exit(EXIT_FAILURE);
+          }
+          reference.kernel = MeterScalar;
+          simd.kernel = (enum MeterKernel) kernel;
+
+          float difference = 0.0f;
+          for (int block = 0; block < BENCH_INPUT_BLOCKS; block++) {
+            const float *in = input + (size_t) block * blockSamples;
+            meter_process(&reference, in, framesPerBuffer, expected);
+            meter_process(&simd, in, framesPerBuffer, actual);
+            difference = fmaxf(difference, levels_difference(expected, actual, numChannels));
+          }
+          meter_free(&reference);
+          meter_free(&simd);
+
+          int passed = difference <= BENCH_VERIFY_TOLERANCE;
+          failures += !passed;
+          printf("%-8s %-12s %4d %6lu  max difference %.3g  %s\n",
+                 meter_kernel_name((enum MeterKernel) kernel), signal_name(kind), numChannels, framesPerBuffer,
+                 difference, passed ? "ok" : "FAILED");
+        }
+
+        free(input);
+      }
+
+      free(expected);
+      free(actual);
+    }
+  }
+
+  return failures;
+}
+
+/**
+ * Largest difference in dB between two amplitudes that are both within the quantization range.
+ */
+static double amplitude_error_db(float expected, float actual) {
+  double expectedDb = 20.0 * log10(fabsf(expected));
+  if (!(expectedDb > SPECTRAL_DB_MIN)) {
+    return 0.0;
+  }
+  return fabs(expectedDb - 20.0 * log10(fabsf(actual)));
+}
+
+/**
+ * Streams the analysis of every benchmark signal as spectral frames at SPECTRAL_DEFAULT_RATE with
+ * 8- and 16-bit codes, decodes them again and checks that the decoder tracks the encoder exactly,
+ * that no value is off by more than half a quantization step and that the frames take at least
+ * BENCH_SPECTRAL_MIN_RATIO times less bandwidth than the samples.
+ *
+ * @return Number of failing cases.
+ */
+static int verify_spectral(const int *channelCounts, int numChannelCounts, const char *signalFilter,
+                           const spectroOptions *spectro) {
+  int failures = 0;
+  unsigned long blocks = (unsigned long) BENCH_SPECTRAL_SECONDS * DEFAULT_SAMPLE_RATE / DEFAULT_FRAMES_PER_BUFFER;
+
+  for (int c = 0; c < numChannelCounts; c++) {
+    int numChannels = channelCounts[c];
+    size_t blockSamples = (size_t) DEFAULT_FRAMES_PER_BUFFER * numChannels;
+    float *input = (float *) malloc(sizeof(float) * blockSamples * blocks);
+    channelLevels *levels = (channelLevels *) malloc(sizeof(channelLevels) * numChannels);
+    channelLevels *decodedLevels = (channelLevels *) malloc(sizeof(channelLevels) * numChannels);
+    if (input == NULL || levels == NULL || decodedLevels == NULL) {
+      printf("Could not allocate the spectral check buffers.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    for (int kind = 0; kind < NUM_SIGNAL_KINDS; kind++) {
+      if (!matches_filter(signalFilter, signal_name(kind))) {
+        continue;
+      }
+      generate_signal(kind, input, DEFAULT_FRAMES_PER_BUFFER * blocks, numChannels, DEFAULT_SAMPLE_RATE, 1);
+
+      for (int bits = 8; bits <= 16; bits += 8) {
+        streamCallbackData *spectroData = init_spectro_data(numChannels, spectro);
+        int numColumnValues = spectroData->numSpectra * WIN_WIDTH;
+        float *columns = (float *) malloc(sizeof(float) * numColumnValues);
+        double *decodedColumns = (double *) malloc(sizeof(double) * numColumnValues);
+        meterState meter;
+        spectralCodec encoder;
+        spectralCodec decoder;
+        memset(&decoder, 0, sizeof(decoder));
+        if (columns == NULL || decodedColumns == NULL ||
+            meter_init(&meter, numChannels, DEFAULT_FRAMES_PER_BUFFER) != 0 ||
+            spectral_codec_init(&encoder, numChannels, spectroData->numSpectra, WIN_WIDTH, bits) != 0) {
+          printf("Could not allocate the spectral codec.\n");
+          exit(EXIT_FAILURE);
+        }
+        unsigned char *payload = (unsigned char *) malloc(spectral_max_payload(&encoder));
+
+        unsigned long long accumulator = 0;
+        unsigned long long bytes = 0;
+        int frames = 0;
+        int mismatches = 0;
+        double error = 0.0;
+        double dcError = 0.0;
+        for (unsigned long block = 0; block < blocks; block++) {
+          const float *in = input + block * blockSamples;
+          meter_process(&meter, in, DEFAULT_FRAMES_PER_BUFFER, levels);
+          compute_frequencies(in, DEFAULT_FRAMES_PER_BUFFER, numChannels, spectroData, spectroData->proportions);
+
+          accumulator += (unsigned long long) DEFAULT_FRAMES_PER_BUFFER * SPECTRAL_DEFAULT_RATE;
+          if (accumulator < DEFAULT_SAMPLE_RATE) {
+            continue;
+          }
+          accumulator %= (unsigned long long) DEFAULT_SAMPLE_RATE;
+
+          for (int i = 0; i < numColumnValues; i++) {
+            columns[i] = (float) spectroData->proportions[i];
+          }
+          spectral_quantize(&encoder, levels, columns);
+          int keyframe = !encoder.havePrevious;
+          size_t length = spectral_encode(&encoder, keyframe, payload);
+          spectral_commit(&encoder);
+          bytes += STREAM_HEADER_SIZE + length;
+          frames++;
+
+          if (spectral_decode(&decoder, numChannels, keyframe, payload, length) != 0 ||
+              memcmp(decoder.previous, encoder.previous, sizeof(uint16_t) * encoder.numValues) != 0) {
+            mismatches++;
+            continue;
+          }
+          spectral_dequantize(&decoder, decodedLevels, decodedColumns);
+          for (int ch = 0; ch < numChannels; ch++) {
+            error = fmax(error, amplitude_error_db(levels[ch].peak, decodedLevels[ch].peak));
+            error = fmax(error, amplitude_error_db(levels[ch].rms, decodedLevels[ch].rms));
+            dcError = fmax(dcError, amplitude_error_db(levels[ch].dc, decodedLevels[ch].dc));
+            mismatches += decodedLevels[ch].dc != 0.0f && (decodedLevels[ch].dc < 0.0f) != (levels[ch].dc < 0.0f);
+            error = fmax(error, amplitude_error_db(levels[ch].truePeak, decodedLevels[ch].truePeak));
+          }
+          for (int i = 0; i < numColumnValues; i++) {
+            error = fmax(error, fabs(columns[i] - decodedColumns[i]) * -SPECTRO_DB_FLOOR);
+          }
+        }
+
+        double seconds = (double) blocks * DEFAULT_FRAMES_PER_BUFFER / DEFAULT_SAMPLE_RATE;
+        double ratio = (double) blockSamples * sizeof(float) * blocks / (double) bytes;
+        double halfStep = (spectral_code_db(bits, 1) - spectral_code_db(bits, 0)) / 2.0;
+        // The signed DC offset is quantized at twice the step.
+        int passed = mismatches == 0 && error <= halfStep + 1e-3 && dcError <= 2.0 * halfStep + 1e-3 &&
+                     ratio >= BENCH_SPECTRAL_MIN_RATIO;
+        failures += !passed;
+        printf("spectral %2d bit %-12s %4d  %5d frames  %8.0f B/s  %6.1fx smaller  max error %.3f dB (DC %.3f)  %s\n",
+               bits, signal_name(kind), numChannels, frames, bytes / seconds, ratio, error, dcError,
+               passed ? "ok" : "FAILED");
+
+        free(payload);
+        free(columns);
+        free(decodedColumns);
+        meter_free(&meter);
+        spectral_codec_free(&encoder);
+        spectral_codec_free(&decoder);
+        free_spectro_data(spectroData);
+      }
+    }
+
+    free(input);
+    free(levels);
+    free(decodedLevels);
+  }
+
+  return failures;
+}
+
+/**
+ * Computes the spectra of consecutive blocks of every benchmark signal, with the mixed-down views,
+ * once through the de-interleaving kernel specialized for each power of two from
+ * SPECTRO_KERNEL_MIN_FRAMES to SPECTRO_KERNEL_MAX_FRAMES and once through the generic loop (spectro
+ * data sized one frame larger), and checks that both produce exactly the same columns.
+ *
+ * @return Number of failing cases.
+ */
+static int verify_block_kernels(const int *channelCounts, int numChannelCounts, const char *signalFilter,
+                                const spectroOptions *spectro) {
+  int failures = 0;
+
+  for (int c = 0; c < numChannelCounts; c++) {
+    int numChannels = channelCounts[c];
+    for (int frames = SPECTRO_KERNEL_MIN_FRAMES; frames <= SPECTRO_KERNEL_MAX_FRAMES; frames *= 2) {
+      size_t blockSamples = (size_t) frames * numChannels;
+      float *input = (float *) malloc(sizeof(float) * blockSamples * BENCH_INPUT_BLOCKS);
+      if (input == NULL) {
+        printf("Could not allocate the kernel check buffers.\n");
+        exit(EXIT_FAILURE);
+      }
+
+      for (int kind = 0; kind < NUM_SIGNAL_KINDS; kind++) {
+        if (!matches_filter(signalFilter, signal_name(kind))) {
+          continue;
+        }
+        generate_signal(kind, input, (unsigned long) frames * BENCH_INPUT_BLOCKS, numChannels, DEFAULT_SAMPLE_RATE, 1);
+
+        spectroOptions specialized = *spectro;
+        specialized.mixViews = 1;
+        specialized.numShards = 1;
+        specialized.framesPerBuffer = frames;
+        spectroOptions generic = specialized;
+        generic.framesPerBuffer = frames + 1;
+        streamCallbackData *expected = init_spectro_data(numChannels, &generic);
+        streamCallbackData *actual = init_spectro_data(numChannels, &specialized);
+        size_t columnBytes = sizeof(double) * actual->numSpectra * WIN_WIDTH;
+
+        int mismatches = 0;
+        for (int block = 0; block < BENCH_INPUT_BLOCKS; block++) {
+          const float *in = input + (size_t) block * blockSamples;
+          compute_frequencies(in, (unsigned long) frames, numChannels, expected, expected->proportions);
+          compute_frequencies(in, (unsigned long) frames, numChannels, actual, actual->proportions);
+          mismatches += memcmp(expected->proportions, actual->proportions, columnBytes) != 0;
+        }
+        free_spectro_data(expected);
+        free_spectro_data(actual);
+
+        failures += mismatches != 0;
+        printf("deinterleave %-12s %4d %6d  %d mismatching blocks  %s\n", signal_name(kind), numChannels, frames,
+               mismatches, mismatches == 0 ? "ok" : "FAILED");
+      }
+
+      free(input);
+    }
+  }
+
+  return failures;
+}
+
+/**
+ * Largest difference between the bars, marks and hold times of two ballistics of the same size.
+ */
+static float ballistics_difference(const meterBallistics *a, const meterBallistics *b) {
+  float difference = 0.0f;
+  for (int i = 0; i < a->count; i++) {
+    difference = fmaxf(difference, fabsf(a->value[i] - b->value[i]));
+    difference = fmaxf(difference, fabsf(a->peak[i] - b->peak[i]));
+    difference = fmaxf(difference, fabsf(a->hold[i] - b->hold[i]) / BENCH_BALLISTICS_LONG_MS);
+  }
+  return difference;
+}
+
+/**
+ * Sets every level of every channel and every column to the given amplitude.
+ */
+static void fill_ballistics_input(channelLevels *levels, double *proportions, int numChannels, float amplitude) {
+  for (int c = 0; c < numChannels; c++) {
+    levels[c].peak = amplitude;
+    levels[c].rms = amplitude;
+    levels[c].dc = 0.0f;
+    levels[c].truePeak = amplitude;
+  }
+  for (int i = 0; i < numChannels * WIN_WIDTH; i++) {
+    proportions[i] = amplitude;
+  }
+}
+
+/**
+ * Runs a full-scale burst followed by silence through the ballistics of every preset, once in
+ * BENCH_BALLISTICS_SHORT_MS blocks with the scalar kernel and once in BENCH_BALLISTICS_LONG_MS blocks
+ * with the vector kernel, and checks that the bars and marks agree after every long block: the
+ * movement must not depend on the buffer size or the kernel.
+ *
+ * @return Number of failing cases.
+ */
+static int verify_ballistics(const int *channelCounts, int numChannelCounts) {
+  int failures = 0;
+  int shortBlocks = (int) (BENCH_BALLISTICS_LONG_MS / BENCH_BALLISTICS_SHORT_MS);
+
+  for (int c = 0; c < numChannelCounts; c++) {
+    int numChannels = channelCounts[c];
+    channelLevels *levels = (channelLevels *) malloc(sizeof(channelLevels) * numChannels);
+    double *proportions = (double *) malloc(sizeof(double) * numChannels * WIN_WIDTH);
+    if (levels == NULL || proportions == NULL) {
+      printf("Could not allocate the ballistics check buffers.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    for (int mode = 0; mode < BallisticsCustom; mode++) {
+      ballisticsOptions options;
+      parse_ballistics_mode(ballistics_mode_name((enum BallisticsMode) mode), &options);
+      meterBallistics reference;
+      meterBallistics simd;
+      if (ballistics_init(&reference, numChannels, numChannels, &options) != 0 ||
+          ballistics_init(&simd, numChannels, numChannels, &options) != 0) {
+        printf("Could not allocate the ballistics.\n");
+        exit(EXIT_FAILURE);
+      }
+      reference.scalar = 1;
+
+      float difference = 0.0f;
+      for (int block = 0; block < BENCH_BALLISTICS_BLOCKS; block++) {
+        fill_ballistics_input(levels, proportions, numChannels, block < BENCH_BALLISTICS_BURST_BLOCKS ? 1.0f : 0.0f);
+        for (int i = 0; i < shortBlocks; i++) {
+          ballistics_update(&reference, levels, proportions, BENCH_BALLISTICS_SHORT_MS);
+        }
+        ballistics_update(&simd, levels, proportions, BENCH_BALLISTICS_LONG_MS);
+        difference = fmaxf(difference, ballistics_difference(&reference, &simd));
+      }
+      ballistics_free(&reference);
+      ballistics_free(&simd);
+
+      int passed = difference <= BENCH_BALLISTICS_TOLERANCE;
+      failures += !passed;
+      printf("ballistics %-6s %4d  %.0f vs %.0f ms blocks  max difference %.3g  %s\n",
+             ballistics_mode_name((enum BallisticsMode) mode), numChannels, BENCH_BALLISTICS_SHORT_MS,
+             BENCH_BALLISTICS_LONG_MS, difference, passed ? "ok" : "FAILED");
+    }
+
+    free(levels);
+    free(proportions);
+  }
+
+  return failures;
+}
+
+/**
+ * Reconfigures spectro data to every FFT size from STFT_MIN_SIZE to STFT_MAX_SIZE, with the hop scaled
+ * along as '+' does, on a thread planning as the render thread does (see set_planner_realtime), and
+ * checks that no restart takes longer than BENCH_RESTART_MAX_MS.
+ *
+ * @return Number of failing cases.
+ */
+static int verify_restart(const int *channelCounts, int numChannelCounts, const spectroOptions *spectro) {
+  int failures = 0;
+  set_planner_realtime(1);
+
+  for (int c = 0; c < numChannelCounts; c++) {
+    int numChannels = channelCounts[c];
+    streamCallbackData *spectroData = init_spectro_data(numChannels, spectro);
+    double slowestMs = 0.0;
+    int slowestSize = 0;
+    int refused = 0;
+
+    for (int size = STFT_MIN_SIZE; size <= STFT_MAX_SIZE; size *= 2) {
+      spectroOptions options = spectroData->options;
+      options.fftSize = size;
+      options.hopSize = (int) ((long) size * spectro->hopSize / spectro->fftSize);
+      options.hopSize = options.hopSize > 0 ? options.hopSize : 1;
+      uint64_t start = now_ns();
+      refused += reconfigure_spectro_data(spectroData, &options) != 0;
+      double elapsedMs = (double) (now_ns() - start) / 1e6;
+      if (elapsedMs > slowestMs) {
+        slowestMs = elapsedMs;
+        slowestSize = size;
+      }
+    }
+    free_spectro_data(spectroData);
+
+    int passed = refused == 0 && slowestMs <= BENCH_RESTART_MAX_MS;
+    failures += !passed;
+    printf("restart %4d  FFT %d..%d  slowest %.2f ms at %d, %d refused  %s\n", numChannels, STFT_MIN_SIZE,
+           STFT_MAX_SIZE, slowestMs, slowestSize, refused, passed ? "ok" : "FAILED");
+  }
+
+  set_planner_realtime(0);
+  return failures;
+}
+
+/**
+ * Writes the given bytes to a new temporary file created from the mkstemp template in path.
+ *
+ * @return 0 on success, -1 if the file could not be written.
+ */
+static int write_temporary(char *path, const void *data, size_t bytes) {
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    perror(path);
+    return -1;
+  }
+  FILE *file = fdopen(fd, "wb");
+  int failed = file == NULL || fwrite(data, 1, bytes, file) != bytes;
+  if (file == NULL) {
+    close(fd);
+  } else if (fclose(file) != 0) {
+    failed = 1;
+  }
+  return failed ? -1 : 0;
+}
+
+/**
+ * Checks that --format accepts only the offline output formats by name: "bin" and "csv" are parsed, while
+ * misspelled, differently cased or unknown names are refused and leave the format as it was.
+ *
+ * @return Number of failing cases.
+ */
+static int verify_offline_formats() {
+  static const char *REFUSED[] = {"json", "cvs", "CSV", "binary", ""};
+  int failures = 0;
+
+  enum OfflineFormat format = OfflineCsv;
+  int passed = parse_offline_format("bin", &format) == 0 && format == OfflineBinary &&
+               parse_offline_format("csv", &format) == 0 && format == OfflineCsv;
+  failures += !passed;
+  printf("offline format bin, csv  parsed  %s\n", passed ? "ok" : "FAILED");
+
+  for (size_t k = 0; k < sizeof(REFUSED) / sizeof(REFUSED[0]); k++) {
+    format = OfflineCsv;
+    passed = parse_offline_format(REFUSED[k], &format) == -1 && format == OfflineCsv;
+    failures += !passed;
+    printf("offline format \"%s\"  refused  %s\n", REFUSED[k], passed ? "ok" : "FAILED");
+  }
+
+  return failures;
+}
+
+/**
+ * Analyses a raw pink-noise file with run_offline on several threads at block sizes that are not powers of two
+ * and do not divide the hop (or the other way round), and checks that every record holds exactly the spectra of
+ * one uninterrupted compute_frequencies pass: the chunks must not depend on where the worker starts.
+ *
+ * @return Number of failing cases.
+ */
+static int verify_offline(const spectroOptions *spectro) {
+  static const int CASES[][2] = {{1000, 2048}, {48, 4096}, {3000, 1024}};
+  int failures = 0;
+
+  for (size_t k = 0; k < sizeof(CASES) / sizeof(CASES[0]); k++) {
+    offlineOptions options;
+    memset(&options, 0, sizeof(options));
+    options.format = OfflineBinary;
+    options.rawChannels = BENCH_OFFLINE_CHANNELS;
+    options.rawSampleRate = (int) DEFAULT_SAMPLE_RATE;
+    options.numThreads = BENCH_OFFLINE_THREADS;
+    options.spectro = *spectro;
+    options.spectro.mixViews = 1;
+    options.spectro.numShards = 1;
+    options.spectro.framesPerBuffer = CASES[k][0];
+    options.spectro.hopSize = CASES[k][1];
+    options.spectro.fftSize = STFT_DEFAULT_SIZE;
+    options.spectro.sampleRate = DEFAULT_SAMPLE_RATE;
+
+    // End mid-block, so the zero-padded last block is checked as well.
+    size_t framesPerBuffer = (size_t) CASES[k][0];
+    size_t numBlocks = (size_t) BENCH_OFFLINE_CHUNKS * OFFLINE_CHUNK_BLOCKS;
+    size_t numFrames = numBlocks * framesPerBuffer - framesPerBuffer / 2;
+    size_t blockSamples = framesPerBuffer * BENCH_OFFLINE_CHANNELS;
+    float *input = (float *) calloc(numBlocks * blockSamples, sizeof(float));
+    if (input == NULL) {
+      printf("Could not allocate the offline check buffers.\n");
+      exit(EXIT_FAILURE);
+    }
+    generate_signal(SignalPinkNoise, input, (unsigned long) numFrames, BENCH_OFFLINE_CHANNELS, DEFAULT_SAMPLE_RATE, 1);
+
+    char inputPath[] = "/tmp/audio_analyzer_offline_in_XXXXXX";
+    char outputPath[] = "/tmp/audio_analyzer_offline_out_XXXXXX";
+    int outputFd = mkstemp(outputPath);
+    if (outputFd >= 0) {
+      close(outputFd);
+    }
+    options.inputPath = inputPath;
+    options.outputPath = outputPath;
+    size_t inputBytes = sizeof(float) * numFrames * BENCH_OFFLINE_CHANNELS;
+    int ran = outputFd >= 0 && write_temporary(inputPath, input, inputBytes) == 0 && run_offline(&options) == 0;
+
+    streamCallbackData *serial = init_spectro_data(BENCH_OFFLINE_CHANNELS, &options.spectro);
+    int numColumns = serial->numSpectra * WIN_WIDTH;
+    int numLevels = BENCH_OFFLINE_CHANNELS * OFFLINE_LEVELS;
+    float *record = (float *) malloc(sizeof(float) * (numLevels + numColumns));
+    FILE *output = ran ? fopen(outputPath, "rb") : NULL;
+    offlineHeader header;
+    ran = output != NULL && record != NULL && fread(&header, sizeof(header), 1, output) == 1 &&
+          header.blockCount == numBlocks && header.numSpectra == serial->numSpectra;
+
+    size_t mismatches = 0;
+    for (size_t block = 0; ran && block < numBlocks; block++) {
+      compute_frequencies(input + block * blockSamples, (unsigned long) framesPerBuffer, BENCH_OFFLINE_CHANNELS, serial,
+                          serial->proportions);
+      size_t recordValues = (size_t) (numLevels + numColumns);
+      if (fread(record, sizeof(float), recordValues, output) != recordValues) {
+        ran = 0;
+        break;
+      }
+      for (int i = 0; i < numColumns; i++) {
+        if (record[numLevels + i] != (float) serial->proportions[i]) {
+          mismatches++;
+          break;
+        }
+      }
+    }
+
+    if (output != NULL) {
+      fclose(output);
+    }
+    remove(inputPath);
+    remove(outputPath);
+    free_spectro_data(serial);
+    free(record);
+    free(input);
+
+    int passed = ran && mismatches == 0;
+    failures += !passed;
+    printf("offline chunks %4d frames hop %4d  %zu blocks on %d threads  %zu mismatching blocks  %s\n",
+           CASES[k][0], CASES[k][1], numBlocks, BENCH_OFFLINE_THREADS, mismatches, passed ? "ok" : "FAILED");
+  }
+
+  return failures;
+}
+
+/**
+ * Analyses consecutive blocks of every benchmark signal on worker pools of every given size and
+ * checks that the levels, spectra, pitches and loudness blocks match the serial analysis with a single shard.
+ *
+ * @return Number of failing cases.
+ */
+static int verify_analysis(const int *channelCounts, int numChannelCounts, const int *threadCounts,
+                           int numThreadCounts, const char *signalFilter, const spectroOptions *spectro) {
+  int failures = 0;
+  spectroOptions serialOptions = *spectro;
+  serialOptions.numShards = 1;
+
+  for (int c = 0; c < numChannelCounts; c++) {
+    int numChannels = channelCounts[c];
+    size_t blockSamples = (size_t) DEFAULT_FRAMES_PER_BUFFER * numChannels;
+    float *input = (float *) malloc(sizeof(float) * blockSamples * BENCH_ANALYSIS_BLOCKS);
+    channelLevels *levels = (channelLevels *) malloc(sizeof(channelLevels) * numChannels);
+    if (input == NULL || levels == NULL) {
+      printf("Could not allocate the analysis check buffers.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    for (int kind = 0; kind < NUM_SIGNAL_KINDS; kind++) {
+      if (!matches_filter(signalFilter, signal_name(kind))) {
+        continue;
+      }
+      generate_signal(kind, input, DEFAULT_FRAMES_PER_BUFFER * BENCH_ANALYSIS_BLOCKS, numChannels,
+                      DEFAULT_SAMPLE_RATE, 1);
+
+      for (int t = 0; t < numThreadCounts; t++) {
+        spectroOptions shardedOptions = *spectro;
+        shardedOptions.numShards = analysis_shards(threadCounts[t]);
+        shardedOptions.pitch = 1;
+        streamCallbackData *serial = init_spectro_data(numChannels, &serialOptions);
+        streamCallbackData *sharded = init_spectro_data(numChannels, &shardedOptions);
+        meterState meter;
+        pitchDetector pitch;
+        loudnessMeter loudness;
+        blockAnalyser analyser;
+        if (meter_init(&meter, numChannels, DEFAULT_FRAMES_PER_BUFFER) != 0 ||
+            pitch_init(&pitch, numChannels, DEFAULT_SAMPLE_RATE) != 0 ||
+            loudness_init(&loudness, numChannels, DEFAULT_SAMPLE_RATE, DEFAULT_FRAMES_PER_BUFFER) != 0 ||
+            analyser_init(&analyser, numChannels, sharded, threadCounts[t]) != 0) {
+          printf("Could not start the analysis pool.\n");
+          exit(EXIT_FAILURE);
+        }
+
+        float levelError = 0.0f;
+        float pitchError = 0.0f;
+        double columnError = 0.0;
+        for (int block = 0; block < BENCH_ANALYSIS_BLOCKS; block++) {
+          const float *in = input + (size_t) block * blockSamples;
+          meter_process(&meter, in, DEFAULT_FRAMES_PER_BUFFER, levels);
+          compute_frequencies(in, DEFAULT_FRAMES_PER_BUFFER, numChannels, serial, serial->proportions);
+          pitch_push(&pitch, in, numChannels, DEFAULT_FRAMES_PER_BUFFER);
+          loudness_process(&loudness, in, DEFAULT_FRAMES_PER_BUFFER);
+          analyse_block(&analyser, in, DEFAULT_FRAMES_PER_BUFFER);
+
+          levelError = fmaxf(levelError, levels_difference(levels, analyser.levels, numChannels));
+          for (int ch = 0; ch < numChannels; ch++) {
+            pitchError = fmaxf(pitchError, fabsf(pitch.estimates[ch].frequency - analyser.pitches[ch].frequency));
+          }
+          for (int i = 0; i < serial->numSpectra * WIN_WIDTH; i++) {
+            columnError = fmax(columnError, fabs(serial->proportions[i] - sharded->proportions[i]));
+          }
+        }
+
+        // Shards sum the squares of their channels first, so only rounding may differ.
+        double loudnessError = analyser.loudness.blocksCompleted == loudness.blocksCompleted ? 0.0 : INFINITY;
+        for (int block = 0; block < LOUDNESS_SHORT_TERM_BLOCKS; block++) {
+          double expected = loudness.blockPowers[block];
+          double difference = fabs(analyser.loudness.blockPowers[block] - expected);
+          loudnessError = fmax(loudnessError, expected > 0.0 ? difference / expected : difference);
+        }
+
+        int ok = levelError <= BENCH_VERIFY_TOLERANCE && columnError <= BENCH_ANALYSIS_TOLERANCE &&
+                 pitchError <= BENCH_VERIFY_TOLERANCE && loudnessError <= BENCH_ANALYSIS_TOLERANCE;
+        printf("analysis %2d threads %3d shards %-12s %2d ch: level error %.2g, column error %.2g, pitch error %.2g, "
+               "loudness error %.2g, %lu steals  %s\n",
+               analyser.pool.numThreads, sharded->numShards, signal_name(kind), numChannels, levelError, columnError,
+               pitchError, loudnessError, atomic_load(&analyser.pool.steals), ok ? "ok" : "FAIL");
+        failures += !ok;
+
+        analyser_free(&analyser);
+        pitch_free(&pitch);
+        loudness_free(&loudness);
+        meter_free(&meter);
+        free_spectro_data(serial);
+        free_spectro_data(sharded);
+      }
+    }
+
+    free(input);
+    free(levels);
+  }
+
+  return failures;
+}
+
+/**
+ * Sets up the buffers of a capture session in a sealed arena, as the analyzer does, and streams
+ * every benchmark signal through them block by block: queued into a ring as the audio callback
+ * would, then analysed and recorded into the waterfall history as the render thread would, with a
+ * short block and a restart in between. Checks that nothing on the audio path allocated and that
+ * every buffer came from the arena.
+ *
+ * @return Number of failing cases.
+ */
+static int verify_audio_path(const int *channelCounts, int numChannelCounts, const int *threadCounts,
+                             int numThreadCounts, const char *signalFilter, const spectroOptions *spectro) {
+  int failures = 0;
+
+  for (int c = 0; c < numChannelCounts; c++) {
+    for (int t = 0; t < numThreadCounts; t++) {
+      int numChannels = channelCounts[c];
+      sessionArena arena;
+      if (arena_open(&arena, 0) != 0) {
+        printf("Could not reserve the session arena.\n");
+        exit(EXIT_FAILURE);
+      }
+
+      spectroOptions options = *spectro;
+      options.numShards = analysis_shards(threadCounts[t]);
+      options.pitch = 1;
+      streamCallbackData *spectroData = init_spectro_data(numChannels, &options);
+      size_t blockSamples = (size_t) options.framesPerBuffer * numChannels;
+      float *input = (float *) session_alloc(sizeof(float) * blockSamples * BENCH_ANALYSIS_BLOCKS);
+      blockRing ring;
+      blockAnalyser analyser;
+      waterfallHistory waterfall;
+      if (input == NULL || ring_init(&ring, BENCH_ANALYSIS_BLOCKS, blockSamples) != 0 ||
+          analyser_init(&analyser, numChannels, spectroData, threadCounts[t]) != 0 ||
+          waterfall_init(&waterfall, spectroData->numSpectra,
+                         waterfall_frames_per_row(options.sampleRate, (unsigned long) options.framesPerBuffer),
+                         options.sampleRate) != 0) {
+        printf("Could not allocate the audio path check.\n");
+        exit(EXIT_FAILURE);
+      }
+      arena_seal(&arena);
+
+      unsigned long before = audio_path_allocations();
+      for (int kind = 0; kind < NUM_SIGNAL_KINDS; kind++) {
+        if (!matches_filter(signalFilter, signal_name(kind))) {
+          continue;
+        }
+        generate_signal(kind, input, (unsigned long) options.framesPerBuffer * BENCH_ANALYSIS_BLOCKS, numChannels,
+                        options.sampleRate, 1);
+        for (int block = 0; block < BENCH_ANALYSIS_BLOCKS; block++) {
+          unsigned long frames = block == BENCH_ANALYSIS_BLOCKS / 2 ? (unsigned long) options.framesPerBuffer / 2
+                                                                    : (unsigned long) options.framesPerBuffer;
+          audio_path_enter();
+          ring_push(&ring, input + (size_t) block * blockSamples, frames, numChannels);
+          audio_path_leave();
+
+          const float *queued = ring_peek(&ring, &frames);
+          analyse_block(&analyser, queued, frames);
+          waterfall_push(&waterfall, spectroData->proportions, frames);
+          ring_release(&ring);
+        }
+        analyser_reset(&analyser);
+        reset_spectro_data(spectroData);
+        waterfall_reset(&waterfall);
+      }
+      unsigned long allocations = audio_path_allocations() - before;
+
+      int ok = allocations == 0 && arena.overflows == 0;
+      printf("audio path %2d threads %2d ch: %lu allocations, %.1f KiB in %lu arena blocks, %lu on the heap  %s\n",
+             analyser.pool.numThreads, numChannels, allocations, (double) arena.used / 1024.0, arena.blocks,
+             arena.overflows, ok ? "ok" : "FAIL");
+      failures += !ok;
+
+      waterfall_free(&waterfall);
+      analyser_free(&analyser);
+      ring_free(&ring);
+      session_free(input);
+      free_spectro_data(spectroData);
+      arena_close(&arena);
+    }
+  }
+
+  return failures;
+}
+
+/**
+ * Error of a detected pitch in cents, or infinity if none was detected.
+ */
+static double pitch_error_cents(const pitchEstimate *estimate, double expected) {
+  if (estimate->note < 0 || estimate->confidence < PITCH_MIN_CONFIDENCE) {
+    return INFINITY;
+  }
+  return fabs(1200.0 * log2(estimate->frequency / expected));
+}
+
+/**
+ * Runs the pitch detector over BENCH_PITCH_SECONDS of the given signal and leaves the last
+ * estimate of every channel in the detector.
+ */
+static void detect_pitch(pitchDetector *detector, const float *input, int numChannels) {
+  unsigned long frames = (unsigned long) (BENCH_PITCH_SECONDS * DEFAULT_SAMPLE_RATE);
+  pitch_reset(detector);
+  for (unsigned long frame = 0; frame + DEFAULT_FRAMES_PER_BUFFER <= frames; frame += DEFAULT_FRAMES_PER_BUFFER) {
+    pitch_push(detector, input + frame * numChannels, numChannels, DEFAULT_FRAMES_PER_BUFFER);
+  }
+}
+
+/**
+ * Checks the pitch detector on the benchmark sines (440 Hz * (channel + 1), where within
+ * PITCH_MAX_FREQ), on mains hum of BENCH_HUM_FREQ with its harmonics, and that white noise and
+ * silence are reported as unpitched.
+ *
+ * @return Number of failing cases.
+ */
+static int verify_pitch(const int *channelCounts, int numChannelCounts) {
+  int failures = 0;
+  unsigned long frames = (unsigned long) (BENCH_PITCH_SECONDS * DEFAULT_SAMPLE_RATE);
+
+  for (int c = 0; c < numChannelCounts; c++) {
+    int numChannels = channelCounts[c];
+    float *input = (float *) malloc(sizeof(float) * frames * numChannels);
+    pitchDetector detector;
+    if (input == NULL || pitch_init(&detector, numChannels, DEFAULT_SAMPLE_RATE) != 0) {
+      printf("Could not allocate the pitch check.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    double sineError = 0.0;
+    generate_signal(SignalSine, input, frames, numChannels, DEFAULT_SAMPLE_RATE, 1);
+    detect_pitch(&detector, input, numChannels);
+    for (int ch = 0; ch < numChannels && 440.0 * (ch + 1) <= PITCH_MAX_FREQ; ch++) {
+      sineError = fmax(sineError, pitch_error_cents(&detector.estimates[ch], 440.0 * (ch + 1)));
+    }
+
+    // Hum whose harmonics are louder than the fundamental, as picked up from a transformer.
+    for (unsigned long frame = 0; frame < frames; frame++) {
+      double t = frame / DEFAULT_SAMPLE_RATE;
+      double sample = 0.0;
+      for (int harmonic = 1; harmonic <= BENCH_HUM_HARMONICS; harmonic++) {
+        double amplitude = harmonic == 1 ? 0.05 : 0.3 / harmonic;
+        sample += amplitude * sin(2.0 * M_PI * BENCH_HUM_FREQ * harmonic * t + harmonic);
+      }
+      for (int ch = 0; ch < numChannels; ch++) {
+        input[frame * numChannels + ch] = (float) sample;
+      }
+    }
+    detect_pitch(&detector, input, numChannels);
+    double humError = 0.0;
+    for (int ch = 0; ch < numChannels; ch++) {
+      humError = fmax(humError, pitch_error_cents(&detector.estimates[ch], BENCH_HUM_FREQ));
+    }
+
+    float noiseConfidence = 0.0f;
+    generate_signal(SignalWhiteNoise, input, frames, numChannels, DEFAULT_SAMPLE_RATE, 1);
+    detect_pitch(&detector, input, numChannels);
+    for (int ch = 0; ch < numChannels; ch++) {
+      noiseConfidence = fmaxf(noiseConfidence, detector.estimates[ch].note < 0 ? 0.0f
+                                                                                : detector.estimates[ch].confidence);
+    }
+
+    int silentNotes = 0;
+    generate_signal(SignalSilence, input, frames, numChannels, DEFAULT_SAMPLE_RATE, 1);
+    detect_pitch(&detector, input, numChannels);
+    for (int ch = 0; ch < numChannels; ch++) {
+      silentNotes += detector.estimates[ch].note >= 0;
+    }
+
+    int ok = sineError <= BENCH_PITCH_TOLERANCE_CENTS && humError <= BENCH_PITCH_TOLERANCE_CENTS &&
+             noiseConfidence < PITCH_MIN_CONFIDENCE && silentNotes == 0;
+    printf("pitch %2d ch: sine error %.2f cents, hum error %.2f cents, noise confidence %.2f, "
+           "%d pitched silent channels  %s\n",
+           numChannels, sineError, humError, noiseConfidence, silentNotes, ok ? "ok" : "FAIL");
+    failures += !ok;
+
+    pitch_free(&detector);
+    free(input);
+  }
+
+  return failures;
+}
+
+/**
+ * A loudness compliance signal: 1 kHz sine segments of the given length and level, with the same
+ * level on every channel plus a per-channel offset, and the loudness expected at its end (NAN
+ * where the case does not specify it).
+ */
+typedef struct {
+  const char *name;
+  int numChannels;
+  int numSegments;
+  double seconds[LOUDNESS_CHECK_SEGMENTS];
+  double dbfs[LOUDNESS_CHECK_SEGMENTS];
+  double channelOffsets[5];
+  double momentary;
+  double shortTerm;
+  double integrated;
+  double range;
+} loudnessCase;
+
+/**
+ * The synthetic test signals of EBU Tech 3341 (cases 1 to 6) and Tech 3342 (cases 1 to 4).
+ */
+static const loudnessCase LOUDNESS_CASES[] = {
+    {"3341-1", 2, 1, {20}, {-23}, {0}, -23, -23, -23, NAN},
+    {"3341-2", 2, 1, {20}, {-33}, {0}, -33, -33, -33, NAN},
+    {"3341-3", 2, 3, {10, 60, 10}, {-36, -23, -36}, {0}, NAN, NAN, -23, NAN},
+    {"3341-4", 2, 5, {10, 10, 60, 10, 10}, {-72, -36, -23, -36, -72}, {0}, NAN, NAN, -23, NAN},
+    {"3341-5", 2, 3, {20, 20.1, 20}, {-26, -20, -26}, {0}, NAN, NAN, -23, NAN},
+    {"3341-6", 5, 1, {20}, {-28}, {0, 0, 4, -2, -2}, NAN, NAN, -23, NAN},
+    {"3342-1", 2, 2, {20, 20}, {-20, -30}, {0}, NAN, NAN, NAN, 10},
+    {"3342-2", 2, 2, {20, 20}, {-20, -15}, {0}, NAN, NAN, NAN, 5},
+    {"3342-3", 2, 2, {20, 20}, {-40, -20}, {0}, NAN, NAN, NAN, 20},
+    {"3342-4", 2, 5, {20, 20, 20, 20, 20}, {-50, -35, -20, -35, -50}, {0}, NAN, NAN, NAN, 15},
+};
+
+#define NUM_LOUDNESS_CASES ((int) (sizeof(LOUDNESS_CASES) / sizeof(LOUDNESS_CASES[0])))
+
+/**
+ * Whether a measured loudness is within the tolerance of the expected one, or none is expected.
+ */
+static int loudness_matches(double expected, double measured, double tolerance) {
+  return isnan(expected) || fabs(measured - expected) <= tolerance;
+}
+
+/**
+ * Generates the EBU loudness compliance signals block by block, measures them and checks the
+ * momentary, short-term and integrated loudness and the loudness range at the end of each.
+ * Also reports how long a block takes once the histograms hold a day of gating blocks.
+ *
+ * @return Number of failing cases.
+ */
+static int verify_loudness() {
+  int failures = 0;
+  float block[DEFAULT_FRAMES_PER_BUFFER * 5];
+
+  for (int i = 0; i < NUM_LOUDNESS_CASES; i++) {
+    const loudnessCase *test = &LOUDNESS_CASES[i];
+    loudnessMeter meter;
+    if (loudness_init(&meter, test->numChannels, LOUDNESS_CHECK_RATE, DEFAULT_FRAMES_PER_BUFFER) != 0) {
+      printf("Could not allocate the loudness meter.\n");
+      exit(EXIT_FAILURE);
+    }
+
+    unsigned long frame = 0;
+    for (int segment = 0; segment < test->numSegments; segment++) {
+      unsigned long end = frame + (unsigned long) lround(test->seconds[segment] * LOUDNESS_CHECK_RATE);
+      while (frame < end) {
+        unsigned long frames = end - frame < DEFAULT_FRAMES_PER_BUFFER ? end - frame : DEFAULT_FRAMES_PER_BUFFER;
+        for (unsigned long f = 0; f < frames; f++) {
+          double phase = sin(2.0 * M_PI * LOUDNESS_CHECK_TONE * (double) (frame + f) / LOUDNESS_CHECK_RATE);
+          for (int ch = 0; ch < test->numChannels; ch++) {
+            double amplitude = pow(10.0, (test->dbfs[segment] + test->channelOffsets[ch]) / 20.0);
+            block[f * test->numChannels + ch] = (float) (amplitude * phase);
+          }
+        }
+        loudness_process(&meter, block, frames);
+        frame += frames;
+      }
+    }
+
+    const loudnessLevels *levels = &meter.levels;
+    int ok = loudness_matches(test->momentary, levels->momentary, LOUDNESS_CHECK_TOLERANCE) &&
+             loudness_matches(test->shortTerm, levels->shortTerm, LOUDNESS_CHECK_TOLERANCE) &&
+             loudness_matches(test->integrated, levels->integrated, LOUDNESS_CHECK_TOLERANCE) &&
+             loudness_matches(test->range, levels->range, LOUDNESS_RANGE_CHECK_TOLERANCE);
+    printf("loudness %s %d ch: M %.2f S %.2f I %.2f LUFS, LRA %.2f LU  %s\n", test->name, test->numChannels,
+           levels->momentary, levels->shortTerm, levels->integrated, levels->range, ok ? "ok" : "FAIL");
+    failures += !ok;
+    loudness_free(&meter);
+  }
+
+  // A day of gating blocks at every loudness, then the cost of the blocks that follow.
+  loudnessMeter meter;
+  if (loudness_init(&meter, 2, LOUDNESS_CHECK_RATE, DEFAULT_FRAMES_PER_BUFFER) != 0) {
+    printf("Could not allocate the loudness meter.\n");
+    exit(EXIT_FAILURE);
+  }
+  double squares[DEFAULT_FRAMES_PER_BUFFER];
+  unsigned long day = (unsigned long) (24 * 3600 * 1000 / LOUDNESS_BLOCK_MS);
+  for (unsigned long i = 0; i < day; i++) {
+    double power = pow(10.0, (-60.0 + 50.0 * (double) i / day) / 10.0);
+    for (unsigned long f = 0; f < meter.blockFrames; f += DEFAULT_FRAMES_PER_BUFFER) {
+      unsigned long frames = meter.blockFrames - f < DEFAULT_FRAMES_PER_BUFFER ? meter.blockFrames - f
+                                                                               : DEFAULT_FRAMES_PER_BUFFER;
+      for (unsigned long s = 0; s < frames; s++) {
+        squares[s] = power;
+      }
+      loudness_accumulate(&meter, squares, frames);
+    }
+  }
+  generate_signal(SignalPinkNoise, block, DEFAULT_FRAMES_PER_BUFFER, 2, LOUDNESS_CHECK_RATE, 1);
+  int blocks = (int) (LOUDNESS_CHECK_RATE / DEFAULT_FRAMES_PER_BUFFER);
+  uint64_t start = now_ns();
+  for (int i = 0; i < blocks; i++) {
+    loudness_process(&meter, block, DEFAULT_FRAMES_PER_BUFFER);
+  }
+  printf("loudness after 24 h of blocks: I %.2f LUFS, LRA %.2f LU, %.0f ns per block of %d frames\n",
+         meter.levels.integrated, meter.levels.range, (double) (now_ns() - start) / blocks, DEFAULT_FRAMES_PER_BUFFER);
+  loudness_free(&meter);
+
+  return failures;
+}
+
+/**
+ * A loopback client that reads every frame until the server closes the stream and checks each
+ * frame against the published blocks.
+ */
+typedef struct {
+  pthread_t thread;
+  const char *port;
+  const float *input;
+  int numChannels;
+  _Atomic int received;
+  int mismatches;
+} loopbackReader;
+
+static void *loopback_read(void *arg) {
+  loopbackReader *reader = (loopbackReader *) arg;
+  size_t blockSamples = (size_t) DEFAULT_FRAMES_PER_BUFFER * reader->numChannels;
+  float *samples = (float *) malloc(sizeof(float) * blockSamples);
+
+  streamClient client;
+  if (samples == NULL || stream_client_connect(&client, "127.0.0.1", reader->port) != 0) {
+    free(samples);
+    reader->mismatches = 1;
+    return NULL;
+  }
+
+  streamHeader header;
+  const unsigned char *payload;
+  while (stream_client_receive(&client, &header, &payload) == 0) {
+    int received = atomic_load(&reader->received);
+    const float *expected = reader->input + (size_t) (header.sequence % BENCH_INPUT_BLOCKS) * blockSamples;
+    int valid = header.sequence == (uint32_t) received &&
+                header.timestamp == (uint64_t) header.sequence * DEFAULT_FRAMES_PER_BUFFER &&
+                header.numChannels == reader->numChannels &&
+                header.payloadLength == blockSamples * sizeof(float);
+    if (valid) {
+      decode_stream_samples(payload, blockSamples, samples);
+      valid = memcmp(samples, expected, sizeof(float) * blockSamples) == 0;
+    }
+    reader->mismatches += !valid;
+    atomic_store(&reader->received, received + 1);
+  }
+
+  stream_client_close(&client);
+  free(samples);
+  return NULL;
+}
+
+/**
+ * Smallest number of frames received by any loopback reader.
+ */
+static int loopback_min_received(loopbackReader *readers) {
+  int received = atomic_load(&readers[0].received);
+  for (int i = 1; i < LOOPBACK_READERS; i++) {
+    int other = atomic_load(&readers[i].received);
+    received = other < received ? other : received;
+  }
+  return received;
+}
+
+/**
+ * Streams blocks through the network server to LOOPBACK_READERS clients reading every frame and
+ * one client that never reads. Publishing is paced by the slowest reader, as a live stream is
+ * by the sound card, and goes on past the requested number of blocks until the stalled client
+ * fills its queue. Passes if every reader receives every block intact and in order and the
+ * stalled client is dropped instead of holding the others back.
+ *
+ * @return 0 if the check passed, 1 otherwise.
+ */
+static int verify_loopback(int numChannels, int blocks) {
+  size_t blockSamples = (size_t) DEFAULT_FRAMES_PER_BUFFER * numChannels;
+  float *input = (float *) malloc(sizeof(float) * blockSamples * BENCH_INPUT_BLOCKS);
+  if (input == NULL) {
+    printf("Could not allocate the loopback input.\n");
+    exit(EXIT_FAILURE);
+  }
+  generate_signal(SignalWhiteNoise, input, (unsigned long) DEFAULT_FRAMES_PER_BUFFER * BENCH_INPUT_BLOCKS, numChannels,
+                  DEFAULT_SAMPLE_RATE, 1);
+
+  serverOptions options;
+  default_server_options(&options);
+  streamServer server;
+  if (start_server(&server, "0", numChannels, DEFAULT_SAMPLE_RATE, &options) != 0) {
+    free(input);
+    return 1;
+  }
+  char port[16];
+  snprintf(port, sizeof(port), "%d", server.port);
+
+  streamClient slow;
+  if (stream_client_connect(&slow, "127.0.0.1", port) != 0) {
+    stop_server(&server);
+    free(input);
+    return 1;
+  }
+  int rcvbuf = LOOPBACK_SLOW_RCVBUF;
+  setsockopt(slow.fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+  loopbackReader readers[LOOPBACK_READERS];
+  for (int i = 0; i < LOOPBACK_READERS; i++) {
+    readers[i].port = port;
+    readers[i].input = input;
+    readers[i].numChannels = numChannels;
+    readers[i].mismatches = 0;
+    atomic_init(&readers[i].received, 0);
+    pthread_create(&readers[i].thread, NULL, loopback_read, &readers[i]);
+  }
+
+  struct timespec pause = {0, 50000};
+  while (atomic_load(&server.clientsConnected) < LOOPBACK_READERS + 1) {
+    nanosleep(&pause, NULL);
+  }
+
+  uint64_t start = now_ns();
+  uint64_t deadline = start + LOOPBACK_TIMEOUT_NS;
+  int published = 0;
+  while (published < blocks || (atomic_load(&server.clientsDropped) == 0 && published < LOOPBACK_MAX_BLOCKS)) {
+    // Neither the ring nor a reader's queue may overflow; either would show up as a failure.
+    while (published - loopback_min_received(readers) >= SERVER_RING_BLOCKS / 2 && now_ns() < deadline) {
+      nanosleep(&pause, NULL);
+    }
+    server_publish(&server, input + (size_t) (published % BENCH_INPUT_BLOCKS) * blockSamples,
+                   DEFAULT_FRAMES_PER_BUFFER);
+    published++;
+  }
+  while (loopback_min_received(readers) < published && now_ns() < deadline) {
+    nanosleep(&pause, NULL);
+  }
+  double seconds = (double) (now_ns() - start) / 1e9;
+
+  unsigned long dropped = atomic_load(&server.clientsDropped);
+  stop_server(&server);
+  stream_client_close(&slow);
+
+  int failures = dropped != 1;
+  for (int i = 0; i < LOOPBACK_READERS; i++) {
+    pthread_join(readers[i].thread, NULL);
+    failures += atomic_load(&readers[i].received) != published || readers[i].mismatches != 0;
+  }
+
+  printf("loopback %3d channels: %6d blocks, %7.1f MB/s per reader, readers received",
+         numChannels, published, (double) published * blockSamples * sizeof(float) / seconds / 1e6);
+  for (int i = 0; i < LOOPBACK_READERS; i++) {
+    printf(" %d (%d bad)", atomic_load(&readers[i].received), readers[i].mismatches);
+  }
+  printf(", %lu client%s dropped  %s\n", dropped, dropped == 1 ? "" : "s", failures == 0 ? "ok" : "FAILED");
+
+  free(input);
+  return failures != 0;
+}
+
+/**
+ * Publisher of the UDP loopback check: publishes the blocks at the pace of a sound card.
+ */
+typedef struct {
+  streamServer *server;
+  const float *input;
+  size_t blockSamples;
+  int blocks;
+
+  /// Block before which publishing stops for pauseMs, like a sender that stalls, and resumes at pace.
+  int pauseBlock;
+  int pauseMs;
+  _Atomic int done;
+} udpPublisher;
+
+static void *udp_publish(void *arg) {
+  udpPublisher *publisher = (udpPublisher *) arg;
+  uint64_t blockNs = (uint64_t) DEFAULT_FRAMES_PER_BUFFER * 1000000000ULL / (uint64_t) DEFAULT_SAMPLE_RATE;
+  uint64_t deadline = now_ns();
+
+  for (int block = 0; block < publisher->blocks; block++) {
+    const float *in = publisher->input + (size_t) (block % BENCH_INPUT_BLOCKS) * publisher->blockSamples;
+    if (block == publisher->pauseBlock && publisher->pauseMs > 0) {
+      struct timespec pause = {publisher->pauseMs / 1000, (long) (publisher->pauseMs % 1000) * 1000000L};
+      nanosleep(&pause, NULL);
+      deadline = now_ns();
+    }
+    server_publish(publisher->server, in, DEFAULT_FRAMES_PER_BUFFER);
+    deadline += blockNs;
+    uint64_t now = now_ns();
+    if (deadline > now) {
+      struct timespec pause = {(time_t) ((deadline - now) / 1000000000ULL), (long) ((deadline - now) % 1000000000ULL)};
+      nanosleep(&pause, NULL);
+    }
+  }
+  atomic_store(&publisher->done, 1);
+  return NULL;
+}
+
+/**
+ * Streams blocks in real time over UDP to a local jitter buffer while the server discards the
+ * given percentage of datagrams. Passes if every block is played out in order, every received block
+ * intact, and exactly the discarded ones are reported lost and concealed. With a pause, the publisher
+ * also stops for that long halfway through; the received blocks of the second half must then again
+ * be held for at least half the playout delay on average, rather than played the moment they arrive.
+ *
+ * @return 0 if the check passed, 1 otherwise.
+ */
+static int verify_udp_loopback(int numChannels, int blocks, double inducedLoss, int pauseMs) {
+  size_t blockSamples = (size_t) DEFAULT_FRAMES_PER_BUFFER * numChannels;
+  float *input = (float *) malloc(sizeof(float) * blockSamples * BENCH_INPUT_BLOCKS);
+  unsigned char *datagram = (unsigned char *) malloc(UDP_RECEIVE_BUFFER);
+  uint64_t *arrivals = (uint64_t *) calloc((size_t) blocks, sizeof(uint64_t));
+  jitterBuffer jitter;
+  if (input == NULL || datagram == NULL || arrivals == NULL ||
+      jitter_init(&jitter, numChannels, DEFAULT_FRAMES_PER_BUFFER, DEFAULT_SAMPLE_RATE, UDP_LOOPBACK_DELAY_MS) != 0) {
+    printf("Could not allocate the UDP loopback buffers.\n");
+    exit(EXIT_FAILURE);
+  }
+  generate_signal(SignalWhiteNoise, input, (unsigned long) DEFAULT_FRAMES_PER_BUFFER * BENCH_INPUT_BLOCKS, numChannels,
+                  DEFAULT_SAMPLE_RATE, 1);
+
+  int fd = udp_receiver_open("0", NULL);
+  struct sockaddr_in address;
+  socklen_t addressLength = sizeof(address);
+  if (fd < 0 || getsockname(fd, (struct sockaddr *) &address, &addressLength) != 0) {
+    perror("Could not open the UDP receiver");
+    exit(EXIT_FAILURE);
+  }
+  char port[16];
+  snprintf(port, sizeof(port), "%d", ntohs(address.sin_port));
+
+  serverOptions options;
+  default_server_options(&options);
+  options.udpHost = "127.0.0.1";
+  options.inducedLoss = inducedLoss;
+  streamServer server;
+  if (start_server(&server, port, numChannels, DEFAULT_SAMPLE_RATE, &options) != 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  udpPublisher publisher = {&server, input, blockSamples, blocks, blocks / 2, pauseMs, 0};
+  pthread_t publisherThread;
+  pthread_create(&publisherThread, NULL, udp_publish, &publisher);
+
+  int played = 0;
+  int concealedBlocks = 0;
+  int mismatches = 0;
+  int outOfOrder = 0;
+  uint64_t heldNs = 0;
+  int held = 0;
+  uint64_t lastActivity = now_ns();
+  while (!atomic_load(&publisher.done) || now_ns() - lastActivity < UDP_LOOPBACK_SETTLE_MS * 1000000ULL) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    poll(&pfd, 1, 1);
+
+    streamHeader header;
+    int status;
+    while ((status = udp_receiver_read(fd, datagram, &header)) != 0) {
+      mismatches += status < 0;
+      if (status > 0) {
+        uint64_t arrival = now_ns();
+        if (header.sequence < (uint32_t) blocks) {
+          arrivals[header.sequence] = arrival;
+        }
+        jitter_push(&jitter, &header, datagram + STREAM_HEADER_SIZE, arrival);
+        lastActivity = now_ns();
+      }
+    }
+
+    uint32_t sequence;
+    unsigned long frames;
+    int concealed;
+    const float *block;
+    while ((block = jitter_pop(&jitter, now_ns(), &sequence, &frames, &concealed)) != NULL) {
+      outOfOrder += sequence != (uint32_t) played;
+      concealedBlocks += concealed;
+      if (!concealed) {
+        const float *expected = input + (size_t) (sequence % BENCH_INPUT_BLOCKS) * blockSamples;
+        mismatches += frames != DEFAULT_FRAMES_PER_BUFFER || memcmp(block, expected, sizeof(float) * blockSamples) != 0;
+        if (sequence >= (uint32_t) blocks / 2 && sequence < (uint32_t) blocks) {
+          heldNs += now_ns() - arrivals[sequence];
+          held++;
+        }
+      }
+      played++;
+      lastActivity = now_ns();
+    }
+  }
+  pthread_join(publisherThread, NULL);
+  stop_server(&server);
+  close(fd);
+
+  // Trailing blocks that were discarded can never be detected as lost: nothing follows them.
+  unsigned long discarded = atomic_load(&server.datagramsDiscarded) + atomic_load(&server.datagramsFailed);
+  unsigned long trailing = (unsigned long) (blocks - played);
+  double heldMs = held > 0 ? (double) heldNs / held / 1e6 : 0.0;
+  int passed = mismatches == 0 && outOfOrder == 0 && jitter.stats.late == 0 && jitter.stats.duplicates == 0 &&
+               jitter.stats.lost + trailing == discarded && (unsigned long) concealedBlocks == jitter.stats.lost &&
+               (pauseMs == 0 || (jitter.stats.reanchors > 0 && heldMs >= UDP_LOOPBACK_DELAY_MS / 2.0));
+  printf("udp %3d channels, %3d ms pause: %d blocks, %lu discarded, %d played, %lu lost + %lu trailing, "
+         "%lu reordered, %lu late, %lu reanchored, jitter %.3f ms, delay %.1f ms, second half held %.1f ms  %s\n",
+         numChannels, pauseMs, blocks, discarded, played, jitter.stats.lost, trailing, jitter.stats.reordered,
+         jitter.stats.late, jitter.stats.reanchors, jitter.jitterNs / 1e6, jitter_delay(&jitter) / 1e6, heldMs,
+         passed ? "ok" : "FAILED");
+
+  jitter_free(&jitter);
+  free(arrivals);
+  free(datagram);
+  free(input);
+  return !passed;
+}
+
+/**
+ * Records the given number of seconds of white noise through the recorder, pushing blocks at the
+ * pace of an audio callback at the given sample rate, then reads the rotated files back and checks
+ * that they hold every block in order.
+ *
+ * @return 0 if the recording is complete and nothing was dropped, 1 otherwise.
+ */
+static int verify_recording(int numChannels, double seconds, int sampleRate, const char *directory,
+                            const recorderOptions *base) {
+  size_t blockSamples = (size_t) DEFAULT_FRAMES_PER_BUFFER * numChannels;
+  size_t blockBytes = sizeof(float) * blockSamples;
+  float *input = (float *) malloc(blockBytes * BENCH_INPUT_BLOCKS);
+  float *readBack = (float *) malloc(blockBytes);
+  if (input == NULL || readBack == NULL) {
+    printf("Could not allocate the recorder check buffers.\n");
+    exit(EXIT_FAILURE);
+  }
+  generate_signal(SignalWhiteNoise, input, (unsigned long) DEFAULT_FRAMES_PER_BUFFER * BENCH_INPUT_BLOCKS, numChannels,
+                  sampleRate, 1);
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/bench_record_%dch.%s", directory, numChannels,
+           base->format == RecordWav ? "wav" : "f32");
+  recorderOptions options = *base;
+  options.path = path;
+  options.rotateSeconds = RECORD_CHECK_ROTATE_SECONDS;
+  audioRecorder recorder;
+  if (start_recorder(&recorder, &options, numChannels, sampleRate, DEFAULT_FRAMES_PER_BUFFER) != 0) {
+    exit(EXIT_FAILURE);
+  }
+
+  long blocks = (long) (seconds * sampleRate / DEFAULT_FRAMES_PER_BUFFER);
+  long periodNs = (long) (1e9 * DEFAULT_FRAMES_PER_BUFFER / sampleRate);
+  uint64_t slowestPushNs = 0;
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  for (long b = 0; b < blocks; b++) {
+    uint64_t start = now_ns();
+    recorder_push(&recorder, input + (size_t) (b % BENCH_INPUT_BLOCKS) * blockSamples, DEFAULT_FRAMES_PER_BUFFER);
+    uint64_t elapsed = now_ns() - start;
+    slowestPushNs = elapsed > slowestPushNs ? elapsed : slowestPushNs;
+
+    deadline.tv_nsec += periodNs;
+    while (deadline.tv_nsec >= 1000000000L) {
+      deadline.tv_nsec -= 1000000000L;
+      deadline.tv_sec++;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0) {
+    }
+  }
+  int stopped = stop_recorder(&recorder);
+
+  // Files hold whole blocks in order; rotation happens between blocks.
+  long checked = 0;
+  int mismatches = 0;
+  int files = atomic_load(&recorder.filesWritten);
+  size_t stem = strlen(path) - 4;
+  for (int index = 0; index < files; index++) {
+    char filePath[4096];
+    snprintf(filePath, sizeof(filePath), "%.*s-%04d%s", (int) stem, path, index, path + stem);
+    FILE *file = fopen(filePath, "rb");
+    if (file == NULL) {
+      perror(filePath);
+      mismatches++;
+      continue;
+    }
+    if (base->format == RecordWav) {
+      unsigned char header[RECORDER_WAV_HEADER_BYTES];
+      struct stat st;
+      mismatches += fread(header, 1, sizeof(header), file) != sizeof(header) || memcmp(header, "RIFF", 4) != 0 ||
+                    fstat(fileno(file), &st) != 0 ||
+                    (off_t) (header[4] | header[5] << 8 | header[6] << 16 | (uint32_t) header[7] << 24) + 8 !=
+                    st.st_size;
+    }
+    while (fread(readBack, 1, blockBytes, file) == blockBytes) {
+      mismatches += memcmp(readBack, input + (size_t) (checked % BENCH_INPUT_BLOCKS) * blockSamples, blockBytes) != 0;
+      checked++;
+    }
+    fclose(file);
+    remove(filePath);
+  }
+
+  unsigned long dropped = atomic_load(&recorder.ring.dropped);
+  int passed = stopped == 0 && mismatches == 0 && dropped == 0 && checked == blocks;
+  printf("record %3d channels at %d Hz: %ld blocks (%.1f MB/s) in %d files, %ld read back, queue high-water %zu/%zu, "
+         "dropped %lu, slowest write %.1f ms, slowest push %.1f us, %s  %s\n",
+         numChannels, sampleRate, blocks, blockBytes * (double) sampleRate / DEFAULT_FRAMES_PER_BUFFER / 1e6, files,
+         checked, atomic_load(&recorder.highWater), recorder.ring.capacity, dropped,
+         atomic_load(&recorder.maxWriteNs) / 1e6, slowestPushNs / 1e3,
+         recorder.directIo ? "O_DIRECT" : "page cache", passed ? "ok" : "FAILED");
+
+  free(readBack);
+  free(input);
+  return !passed;
+}
+
+static void print_usage(const char *program) {
+  printf("Usage: %s [options]\n", program);
+  printf("  -n, --iterations N    Timed iterations per case (default 2000)\n");
+  printf("  -c, --channels LIST   Channel counts, e.g. 1,2,8,32 (default)\n");
+  printf("  -b, --frames LIST     Frames per buffer, e.g. 64,256,1024,4096 (default)\n");
+  printf("  -s, --signals LIST    Signals among sine,white,pink,silence,square_clip (default all)\n");
+  printf("  -t, --stages LIST     Stages among volume,meter_scalar,meter_sse2,meter_avx2,frequencies,\n");
+  printf("                        analysis,pitch,loudness,fftw_execute,ballistics,draw_volume,\n");
+  printf("                        draw_frequencies,draw_waterfall,render_frame (default all)\n");
+  printf("  -j, --json FILE       Also write one JSON object per case to FILE\n");
+  printf("      --threads LIST    Worker pool sizes of the analysis stage and check, e.g. 1,2,4 (default)\n");
+  printf("      --verify          Check the SIMD metering kernels, the spectral frame codec, the parallel\n");
+  printf("                        analysis, the buffer-size kernels, the meter ballistics, the pitch detector,\n");
+  printf("                        the loudness meter (EBU compliance signals) and that the audio path never\n");
+  printf("                        allocates, and exit\n");
+  printf("      --loopback N      Stream N blocks to local clients through the network server, check them and exit\n");
+  printf("      --udp-loopback N  Stream N blocks in real time over UDP through a jitter buffer, once more with\n"
+         "                        a sender pause halfway, check and exit\n");
+  printf("      --induce-loss PCT Percentage of datagrams discarded by --udp-loopback (default 5)\n");
+  printf("      --record SECONDS  Record SECONDS in real time through the recorder, read the files back and exit\n");
+  printf("      --record-rate HZ  Sample rate simulated by --record (default 192000)\n");
+  printf("      --record-dir DIR  Directory --record writes to (default .)\n");
+  printf("      --record-direct   Bypass the page cache while recording\n");
+  printf("      --fft-size N      STFT frame size (default %d)\n", STFT_DEFAULT_SIZE);
+  printf("      --hop N           Samples between STFT frames (default %d)\n", STFT_DEFAULT_HOP);
+  printf("      --window NAME     hann, blackman-harris or flat-top (default hann)\n");
+  printf("      --scale NAME      Column frequency scale: quadratic, log or mel (default quadratic)\n");
+  printf("      --bands MODE      Reduction of the bins of a column: peak or rms (default peak)\n");
+  printf("      --planner EFFORT  FFTW planning effort: estimate, measure or patient (default measure)\n");
+  printf("  -h, --help            Show this message\n");
+}
+
+int main(int argc, char **argv) {
+  static const struct option longOptions[] = {
+      {"iterations", required_argument, NULL, 'n'},
+      {"channels", required_argument, NULL, 'c'},
+      {"frames", required_argument, NULL, 'b'},
+      {"signals", required_argument, NULL, 's'},
+      {"stages", required_argument, NULL, 't'},
+      {"json", required_argument, NULL, 'j'},
+      {"verify", no_argument, NULL, 'V'},
+      {"loopback", required_argument, NULL, 'L'},
+      {"udp-loopback", required_argument, NULL, 'U'},
+      {"induce-loss", required_argument, NULL, 'I'},
+      {"threads", required_argument, NULL, 'T'},
+      {"record", required_argument, NULL, 'R'},
+      {"record-rate", required_argument, NULL, 'r'},
+      {"record-dir", required_argument, NULL, 'D'},
+      {"record-direct", no_argument, NULL, 'O'},
+      {"fft-size", required_argument, NULL, 'N'},
+      {"hop", required_argument, NULL, 'H'},
+      {"window", required_argument, NULL, 'W'},
+      {"scale", required_argument, NULL, 'S'},
+      {"bands", required_argument, NULL, 'B'},
+      {"planner", required_argument, NULL, 'P'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}
+  };
+
+  int iterations = 2000;
+  int channelCounts[BENCH_MAX_LIST] = {1, 2, 8, 32};
+  int numChannelCounts = 4;
+  int frameCounts[BENCH_MAX_LIST] = {64, 256, 1024, 4096};
+  int numFrameCounts = 4;
+  int threadCounts[BENCH_MAX_LIST] = {1, 2, 4};
+  int numThreadCounts = 3;
+  const char *signalFilter = NULL;
+  const char *stageFilter = NULL;
+  const char *jsonPath = NULL;
+  int verify = 0;
+  int loopbackBlocks = 0;
+  int udpLoopbackBlocks = 0;
+  double inducedLoss = 5.0;
+  double recordSeconds = 0.0;
+  int recordRate = 192000;
+  const char *recordDirectory = ".";
+  recorderOptions record;
+  default_recorder_options(&record);
+  spectroOptions spectro;
+  default_spectro_options(&spectro);
+  ballisticsOptions defaultBallistics;
+  default_ballistics_options(&defaultBallistics);
+
+  int option;
+  while ((option = getopt_long(argc, argv, "n:c:b:s:t:j:h", longOptions, NULL)) != -1) {
+    switch (option) {
+      case 'n':
+        iterations = atoi(optarg);
+        break;
+      case 'c':
+        numChannelCounts = parse_int_list(optarg, channelCounts);
+        break;
+      case 'b':
+        numFrameCounts = parse_int_list(optarg, frameCounts);
+        break;
+      case 's':
+        signalFilter = optarg;
+        break;
+      case 't':
+        stageFilter = optarg;
+        break;
+      case 'j':
+        jsonPath = optarg;
+        break;
+      case 'V':
+        verify = 1;
+        break;
+      case 'L':
+        loopbackBlocks = atoi(optarg);
+        break;
+      case 'U':
+        udpLoopbackBlocks = atoi(optarg);
+        break;
+      case 'I':
+        inducedLoss = atof(optarg);
+        break;
+      case 'T':
+        numThreadCounts = parse_int_list(optarg, threadCounts);
+        break;
+      case 'R':
+        recordSeconds = atof(optarg);
+        break;
+      case 'r':
+        recordRate = atoi(optarg);
+        break;
+      case 'D':
+        recordDirectory = optarg;
+        break;
+      case 'O':
+        record.direct = 1;
+        break;
+      case 'N':
+        spectro.fftSize = atoi(optarg);
+        break;
+      case 'H':
+        spectro.hopSize = atoi(optarg);
+        break;
+      case 'W':
+        if (parse_window_type(optarg, &spectro.window) != 0) {
+          printf("Unknown window: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'S':
+        if (parse_band_scale(optarg, &spectro.scale) != 0) {
+          printf("Unknown scale: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'B':
+        if (parse_band_reduce(optarg, &spectro.reduce) != 0) {
+          printf("Unknown band reduction: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'P':
+        if (set_planner_effort(optarg) != 0) {
+          printf("Unknown planner effort: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'h':
+        print_usage(argv[0]);
+        return EXIT_SUCCESS;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (iterations < 1) {
+    iterations = 1;
+  }
+
+  if (verify) {
+    int failures = verify_meters(channelCounts, numChannelCounts, frameCounts, numFrameCounts, signalFilter);
+    failures += verify_spectral(channelCounts, numChannelCounts, signalFilter, &spectro);
+    failures += verify_block_kernels(channelCounts, numChannelCounts, signalFilter, &spectro);
+    failures += verify_analysis(channelCounts, numChannelCounts, threadCounts, numThreadCounts, signalFilter, &spectro);
+    failures += verify_audio_path(channelCounts, numChannelCounts, threadCounts, numThreadCounts, signalFilter,
+                                  &spectro);
+    failures += verify_ballistics(channelCounts, numChannelCounts);
+    failures += verify_restart(channelCounts, numChannelCounts, &spectro);
+    failures += verify_offline_formats();
+    failures += verify_offline(&spectro);
+    failures += verify_pitch(channelCounts, numChannelCounts);
+    failures += verify_loudness();
+    printf("%d failing case%s\n", failures, failures == 1 ? "" : "s");
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (recordSeconds > 0.0) {
+    int failures = 0;
+    for (int c = 0; c < numChannelCounts; c++) {
+      failures += verify_recording(channelCounts[c], recordSeconds, recordRate, recordDirectory, &record);
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (udpLoopbackBlocks > 0) {
+    int failures = 0;
+    for (int c = 0; c < numChannelCounts; c++) {
+      failures += verify_udp_loopback(channelCounts[c], udpLoopbackBlocks, inducedLoss, 0);
+      failures += verify_udp_loopback(channelCounts[c], udpLoopbackBlocks, inducedLoss, UDP_LOOPBACK_PAUSE_MS);
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if (loopbackBlocks > 0) {
+    int failures = 0;
+    for (int c = 0; c < numChannelCounts; c++) {
+      failures += verify_loopback(channelCounts[c], loopbackBlocks);
+    }
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // Plans are timed as the analyzer would run them: measured once, then reused from the cache.
+  load_wisdom();
+
+  FILE *json = NULL;
+  if (jsonPath != NULL) {
+    json = fopen(jsonPath, "w");
+    if (json == NULL) {
+      perror(jsonPath);
+      return EXIT_FAILURE;
+    }
+  }
+
+  // One waterfall row per block of any size, so that every timed block scrolls the view.
+  set_waterfall_seconds((WATERFALL_WIN_HEIGHT - 1) * MIN_FRAMES_PER_BUFFER / DEFAULT_SAMPLE_RATE);
+
+  FILE *nullOut;
+  FILE *nullIn;
+  int haveScreen = open_null_screen(&nullOut, &nullIn) == 0;
+  if (!haveScreen) {
+    fprintf(stderr, "No terminal description for xterm; skipping drawing stages.\n");
+  }
+
+  uint64_t *samples = (uint64_t *) malloc(sizeof(uint64_t) * iterations);
+
+  printf("%-18s %-12s %4s %3s %6s %12s %14s %10s %10s %10s %10s\n",
+         "stage", "signal", "ch", "thr", "frames", "ns/block", "blocks/s", "p50", "p99", "p999", "term B");
+
+  for (int c = 0; c < numChannelCounts; c++) {
+    int numChannels = channelCounts[c];
+    channelLevels *levels = (channelLevels *) malloc(sizeof(channelLevels) * numChannels);
+    meterState meter;
+    if (meter_init(&meter, numChannels, DEFAULT_FRAMES_PER_BUFFER) != 0) {
+      printf("Could not allocate the meter.\n");
+      return EXIT_FAILURE;
+    }
+    enum MeterKernel bestKernel = meter.kernel;
+    if (haveScreen) {
+      init_vol_win(numChannels);
+      init_freq_win(numChannels);
+      init_waterfall_win(numChannels);
+    }
+
+    for (int f = 0; f < numFrameCounts; f++) {
+      unsigned long framesPerBuffer = (unsigned long) frameCounts[f];
+      size_t inputSamples = framesPerBuffer * BENCH_INPUT_BLOCKS * (size_t) numChannels;
+      float *input = (float *) malloc(sizeof(float) * inputSamples);
+
+      // Everything is set up for this buffer size, as the analyzer would be with --buffer-size.
+      spectroOptions sized = spectro;
+      sized.framesPerBuffer = (int) framesPerBuffer;
+      streamCallbackData *spectroData = init_spectro_data(numChannels, &sized);
+      pitchDetector pitch;
+      loudnessMeter loudness;
+      if (pitch_init(&pitch, numChannels, DEFAULT_SAMPLE_RATE) != 0 ||
+          loudness_init(&loudness, numChannels, DEFAULT_SAMPLE_RATE, framesPerBuffer) != 0) {
+        printf("Could not allocate the pitch detector and the loudness meter.\n");
+        return EXIT_FAILURE;
+      }
+      meterBallistics ballistics;
+      if (ballistics_init(&ballistics, numChannels, spectroData->numSpectra, &defaultBallistics) != 0) {
+        printf("Could not allocate the meter ballistics.\n");
+        return EXIT_FAILURE;
+      }
+      waterfallHistory waterfall;
+      if (haveScreen && waterfall_init(&waterfall, spectroData->numSpectra,
+                                       waterfall_frames_per_row(DEFAULT_SAMPLE_RATE, framesPerBuffer),
+                                       DEFAULT_SAMPLE_RATE) != 0) {
+        printf("Could not allocate the waterfall history.\n");
+        return EXIT_FAILURE;
+      }
+
+      for (int kind = 0; kind < NUM_SIGNAL_KINDS; kind++) {
+        if (!matches_filter(signalFilter, signal_name(kind))) {
+          continue;
+        }
+        generate_signal(kind, input, framesPerBuffer * BENCH_INPUT_BLOCKS, numChannels, DEFAULT_SAMPLE_RATE, 1);
+
+        for (int s = 0; s < NUM_STAGES; s++) {
+          const benchStage *stage = &STAGES[s];
+          if (!matches_filter(stageFilter, stage->name) ||
+              (stage->needsScreen && !haveScreen) ||
+              (stage->meterKernel >= 0 && !meter_kernel_supported((enum MeterKernel) stage->meterKernel))) {
+            continue;
+          }
+          meter.kernel = stage->meterKernel >= 0 ? (enum MeterKernel) stage->meterKernel : bestKernel;
+
+          for (int t = 0; t < (stage->parallel ? numThreadCounts : 1); t++) {
+            int numThreads = stage->parallel ? threadCounts[t] : 1;
+
+            benchContext context;
+            memset(&context, 0, sizeof(context));
+            context.framesPerBuffer = framesPerBuffer;
+            context.numChannels = numChannels;
+            context.spectroData = spectroData;
+            context.meter = &meter;
+            context.levels = levels;
+            context.waterfall = &waterfall;
+            context.pitch = &pitch;
+            context.loudness = &loudness;
+            context.ballistics = &ballistics;
+
+            blockAnalyser analyser;
+            if (stage->parallel) {
+              spectroOptions sharded = sized;
+              sharded.numShards = analysis_shards(numThreads);
+              context.spectroData = init_spectro_data(numChannels, &sharded);
+              if (analyser_init(&analyser, numChannels, context.spectroData, numThreads) != 0) {
+                printf("Could not start the analysis pool.\n");
+                return EXIT_FAILURE;
+              }
+              context.analyser = &analyser;
+            }
+
+            benchResult result = run_case(stage, &context, input, iterations, samples,
+                                          haveScreen ? nullOut : NULL);
+
+            printf("%-18s %-12s %4d %3d %6lu %12.0f %14.0f %10.0f %10.0f %10.0f %10.0f\n",
+                   stage->name, signal_name(kind), numChannels, numThreads, framesPerBuffer,
+                   result.meanNs, result.blocksPerSecond, result.p50Ns, result.p99Ns, result.p999Ns,
+                   result.terminalBytes);
+
+            if (json != NULL) {
+              fprintf(json,
+                      "{\"stage\":\"%s\",\"signal\":\"%s\",\"channels\":%d,\"threads\":%d,\"frames\":%lu,"
+                      "\"iterations\":%d,\"ns_per_block\":%.1f,\"blocks_per_s\":%.1f,"
+                      "\"p50_ns\":%.0f,\"p99_ns\":%.0f,\"p999_ns\":%.0f,\"max_ns\":%.0f,"
+                      "\"terminal_bytes_per_block\":%.1f}\n",
+                      stage->name, signal_name(kind), numChannels, numThreads, framesPerBuffer, iterations,
+                      result.meanNs, result.blocksPerSecond,
+                      result.p50Ns, result.p99Ns, result.p999Ns, result.maxNs, result.terminalBytes);
+            }
+
+            if (stage->parallel) {
+              analyser_free(&analyser);
+              free_spectro_data(context.spectroData);
+            }
+          }
+        }
+      }
+
+      if (haveScreen) {
+        waterfall_free(&waterfall);
+      }
+      ballistics_free(&ballistics);
+      free_spectro_data(spectroData);
+      pitch_free(&pitch);
+      loudness_free(&loudness);
+      free(input);
+    }
+
+    if (haveScreen) {
+      del_screen();
+    }
+    meter_free(&meter);
+    free(levels);
+  }
+
+  if (haveScreen) {
+    endwin();
+  }
+  if (json != NULL) {
+    fclose(json);
+  }
+
+  free(samples);
+  save_wisdom();
+
+  return EXIT_SUCCESS;
+}
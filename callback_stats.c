@@ -0,0 +1,301 @@
+//
+// Callback deadline, xrun and latency instrumentation.
+//
+
+#include "callback_stats.h"
+#include "utils.h"
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+WINDOW *STATS_WIN;
+
+static int stats_extra_rows = 0;
+
+/// Characters used to draw the load histogram, from empty to full
+static const char HISTOGRAM_LEVELS[] = " .:-=+*#%@";
+
+static uint64_t load_u64(const _Atomic uint64_t *value) {
+  return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+static int64_t load_i64(const _Atomic int64_t *value) {
+  return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+/**
+ * Increments a counter that only the audio callback writes.
+ */
+static void bump(_Atomic uint64_t *counter) {
+  atomic_store_explicit(counter, load_u64(counter) + 1, memory_order_relaxed);
+}
+
+/**
+ * Resets all statistics.
+ *
+ * @param stats Statistics to reset.
+ * @param framesPerBuffer Number of frames per callback.
+ * @param sampleRate Sample rate of the stream in Hz.
+ */
+void init_callback_stats(callbackStats *stats, unsigned long framesPerBuffer, double sampleRate) {
+  memset(stats, 0, sizeof(*stats));
+  stats->bufferPeriodNs = (uint64_t) ((double) framesPerBuffer * 1e9 / sampleRate);
+  for (int bucket = 0; bucket < CALLBACK_LOAD_BUCKETS - 1; bucket++) {
+    stats->bucketEdgesNs[bucket] = (uint64_t) ceil(callback_load_bucket_edge(bucket) * (double) stats->bufferPeriodNs);
+  }
+  atomic_store(&stats->minLatencyUs, INT64_MAX);
+}
+
+/**
+ * Returns the current CLOCK_MONOTONIC time in nanoseconds; cheap enough for the audio callback.
+ */
+uint64_t callback_clock_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+/**
+ * Records one callback. Called at the end of the audio callback.
+ *
+ * @param stats Statistics to update.
+ * @param startNs Value of callback_clock_ns() at the start of the callback.
+ * @param timeInfo Timestamps passed to the callback.
+ * @param statusFlags Status flags passed to the callback.
+ */
+void record_callback(callbackStats *stats, uint64_t startNs,
+                     const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags) {
+  uint64_t elapsed = callback_clock_ns() - startNs;
+
+  // Binary search for the first bucket whose upper edge lies above the callback: six comparisons.
+  int low = 0;
+  int high = CALLBACK_LOAD_BUCKETS - 1;
+  while (low < high) {
+    int middle = (low + high) / 2;
+    if (elapsed < stats->bucketEdgesNs[middle]) {
+      high = middle;
+    } else {
+      low = middle + 1;
+    }
+  }
+  bump(&stats->loadHistogram[low]);
+  bump(&stats->callbacks);
+  if (elapsed > load_u64(&stats->maxCallbackNs)) {
+    atomic_store_explicit(&stats->maxCallbackNs, elapsed, memory_order_relaxed);
+  }
+
+  if (statusFlags & paInputUnderflow) {
+    bump(&stats->inputUnderflows);
+  }
+  if (statusFlags & paInputOverflow) {
+    bump(&stats->inputOverflows);
+  }
+  if (statusFlags & paOutputUnderflow) {
+    bump(&stats->outputUnderflows);
+  }
+  if (statusFlags & paOutputOverflow) {
+    bump(&stats->outputOverflows);
+  }
+
+  if (timeInfo != NULL && timeInfo->inputBufferAdcTime > 0) {
+    // Without an output stream the DAC time is 0; fall back to the time the callback was invoked.
+    PaTime end = timeInfo->outputBufferDacTime > 0 ? timeInfo->outputBufferDacTime : timeInfo->currentTime;
+    int64_t latency = (int64_t) ((end - timeInfo->inputBufferAdcTime) * 1e6);
+
+    atomic_store_explicit(&stats->lastLatencyUs, latency, memory_order_relaxed);
+    if (latency < load_i64(&stats->minLatencyUs)) {
+      atomic_store_explicit(&stats->minLatencyUs, latency, memory_order_relaxed);
+    }
+    if (latency > load_i64(&stats->maxLatencyUs)) {
+      atomic_store_explicit(&stats->maxLatencyUs, latency, memory_order_relaxed);
+    }
+    atomic_store_explicit(&stats->sumLatencyUs, load_i64(&stats->sumLatencyUs) + latency, memory_order_relaxed);
+    bump(&stats->latencySamples);
+  }
+}
+
+/**
+ * Returns the upper edge of a histogram bucket as a fraction of the buffer period:
+ * 2^(bucket / CALLBACK_LOAD_BUCKETS_PER_OCTAVE - CALLBACK_LOAD_MIN_OCTAVE).
+ *
+ * @param bucket Index of the bucket, below CALLBACK_LOAD_BUCKETS - 1 (the last bucket has no upper edge).
+ * @return Upper edge of the bucket; 1.0 means the whole buffer period.
+ */
+double callback_load_bucket_edge(int bucket) {
+  return exp2((double) bucket / CALLBACK_LOAD_BUCKETS_PER_OCTAVE - CALLBACK_LOAD_MIN_OCTAVE);
+}
+
+/**
+ * Returns the callback wall time below which the given fraction of callbacks completed,
+ * as a fraction of the buffer period. The value is interpolated inside its histogram bucket and
+ * never exceeds the longest callback.
+ *
+ * @param stats Statistics to read.
+ * @param fraction Fraction between 0 and 1, e.g. 0.99.
+ * @return Callback load at the given percentile; 1.0 means the whole buffer period.
+ */
+double callback_load_percentile(const callbackStats *stats, double fraction) {
+  uint64_t counts[CALLBACK_LOAD_BUCKETS];
+  uint64_t total = 0;
+  for (int bucket = 0; bucket < CALLBACK_LOAD_BUCKETS; bucket++) {
+    counts[bucket] = load_u64(&stats->loadHistogram[bucket]);
+    total += counts[bucket];
+  }
+  if (total == 0 || stats->bufferPeriodNs == 0) {
+    return 0.0;
+  }
+
+  double maxLoad = (double) load_u64(&stats->maxCallbackNs) / (double) stats->bufferPeriodNs;
+  double target = fmax(1.0, ceil(fraction * (double) total));
+  uint64_t seen = 0;
+  for (int bucket = 0; bucket < CALLBACK_LOAD_BUCKETS; bucket++) {
+    if (counts[bucket] == 0 || (double) (seen + counts[bucket]) < target) {
+      seen += counts[bucket];
+      continue;
+    }
+    // Spread the callbacks of the bucket evenly between its edges; the longest callback bounds both.
+    double lower = bucket > 0 ? callback_load_bucket_edge(bucket - 1) : 0.0;
+    double upper = bucket < CALLBACK_LOAD_BUCKETS - 1 ? callback_load_bucket_edge(bucket) : maxLoad;
+    upper = fmin(upper, maxLoad);
+    lower = fmin(lower, upper);
+    return lower + (upper - lower) * (target - (double) seen) / (double) counts[bucket];
+  }
+  return maxLoad;
+}
+
+/**
+ * Initializes the statistics view window below the frequency window.
+ *
+ * @param num_chan number of channels in the input; affects the initial y position of the window.
+ */
+void init_stats_win(int num_chan) {
+  STATS_WIN = newwin(stats_win_height(), WIN_WIDTH, num_chan + 1 + MARGIN + FREQ_WIN_HEIGHT + MARGIN, 0);
+  waddstr(STATS_WIN, "Callback statistics:\n");
+}
+
+/**
+ * Adds rows below the statistics of screens initialized afterwards, e.g. one per captured stream.
+ *
+ * @param rows Number of rows starting at row STATS_WIN_HEIGHT of the window.
+ */
+void set_stats_extra_rows(int rows) {
+  stats_extra_rows = rows < 0 ? 0 : rows;
+}
+
+/**
+ * Returns the height of the statistics view window, the extra rows included.
+ *
+ * @return Height in number of lines.
+ */
+int stats_win_height() {
+  return STATS_WIN_HEIGHT + stats_extra_rows;
+}
+
+/**
+ * Draws the statistics into the statistics view window.
+ *
+ * @param stats Statistics to draw.
+ * @param droppedBlocks Number of captured blocks dropped before analysis.
+ */
+void display_callback_stats(const callbackStats *stats, unsigned long droppedBlocks) {
+  if (STATS_WIN == NULL) {
+    return;
+  }
+
+  double periodMs = (double) stats->bufferPeriodNs / 1e6;
+  double maxLoad = stats->bufferPeriodNs > 0
+                   ? (double) load_u64(&stats->maxCallbackNs) / (double) stats->bufferPeriodNs
+                   : 0.0;
+
+  mvwprintw(STATS_WIN, 1, 0, "Calls: %llu  period: %.2f ms  load p50 %.2f%%  p99 %.2f%%  p99.9 %.2f%%  max %.2f%%",
+            (unsigned long long) load_u64(&stats->callbacks), periodMs,
+            100.0 * callback_load_percentile(stats, 0.5),
+            100.0 * callback_load_percentile(stats, 0.99),
+            100.0 * callback_load_percentile(stats, 0.999),
+            100.0 * maxLoad);
+  wclrtoeol(STATS_WIN);
+
+  uint64_t peak = 0;
+  for (int bucket = 0; bucket < CALLBACK_LOAD_BUCKETS; bucket++) {
+    uint64_t count = load_u64(&stats->loadHistogram[bucket]);
+    peak = count > peak ? count : peak;
+  }
+  mvwprintw(STATS_WIN, 2, 0, "Load %.1f%%..200%% (%d per octave): |", 100.0 * callback_load_bucket_edge(0),
+            CALLBACK_LOAD_BUCKETS_PER_OCTAVE);
+  for (int bucket = 0; bucket < CALLBACK_LOAD_BUCKETS; bucket++) {
+    uint64_t count = load_u64(&stats->loadHistogram[bucket]);
+    int level = 0;
+    if (count > 0) {
+      level = 1 + (int) ((sizeof(HISTOGRAM_LEVELS) - 2) * log((double) count) / log((double) peak + 1.0));
+    }
+    if (bucket == CALLBACK_LOAD_DEADLINE_BUCKET) {
+      // Marks the deadline: everything to the right missed it.
+      waddch(STATS_WIN, '|');
+    }
+    waddch(STATS_WIN, HISTOGRAM_LEVELS[level]);
+  }
+  waddch(STATS_WIN, '|');
+  wclrtoeol(STATS_WIN);
+
+  mvwprintw(STATS_WIN, 3, 0, "Xruns: in overflow %llu  in underflow %llu  out underflow %llu  out overflow %llu  dropped %lu",
+            (unsigned long long) load_u64(&stats->inputOverflows),
+            (unsigned long long) load_u64(&stats->inputUnderflows),
+            (unsigned long long) load_u64(&stats->outputUnderflows),
+            (unsigned long long) load_u64(&stats->outputOverflows),
+            droppedBlocks);
+  wclrtoeol(STATS_WIN);
+
+  uint64_t samples = load_u64(&stats->latencySamples);
+  if (samples > 0) {
+    mvwprintw(STATS_WIN, 4, 0, "Latency capture->output: last %.2f ms  min %.2f ms  mean %.2f ms  max %.2f ms",
+              load_i64(&stats->lastLatencyUs) / 1000.0,
+              load_i64(&stats->minLatencyUs) / 1000.0,
+              (double) load_i64(&stats->sumLatencyUs) / (double) samples / 1000.0,
+              load_i64(&stats->maxLatencyUs) / 1000.0);
+  } else {
+    mvwprintw(STATS_WIN, 4, 0, "Latency capture->output: not reported by the host API");
+  }
+  wclrtoeol(STATS_WIN);
+}
+
+/**
+ * Prints a summary of the statistics, e.g. after the screen has been closed.
+ *
+ * @param stats Statistics to print.
+ * @param droppedBlocks Number of captured blocks dropped before analysis.
+ * @param file File to print to.
+ */
+void print_callback_stats(const callbackStats *stats, unsigned long droppedBlocks, FILE *file) {
+  uint64_t callbacks = load_u64(&stats->callbacks);
+  fprintf(file, "Callback statistics\n");
+  fprintf(file, "  callbacks:         %llu\n", (unsigned long long) callbacks);
+  fprintf(file, "  buffer period:     %.3f ms\n", (double) stats->bufferPeriodNs / 1e6);
+  fprintf(file, "  load p50/p99/p999: %.2f%% / %.2f%% / %.2f%% of the period\n",
+          100.0 * callback_load_percentile(stats, 0.5),
+          100.0 * callback_load_percentile(stats, 0.99),
+          100.0 * callback_load_percentile(stats, 0.999));
+  fprintf(file, "  max callback time: %.3f ms\n", (double) load_u64(&stats->maxCallbackNs) / 1e6);
+  fprintf(file, "  input overflows:   %llu\n", (unsigned long long) load_u64(&stats->inputOverflows));
+  fprintf(file, "  input underflows:  %llu\n", (unsigned long long) load_u64(&stats->inputUnderflows));
+  fprintf(file, "  output underflows: %llu\n", (unsigned long long) load_u64(&stats->outputUnderflows));
+  fprintf(file, "  output overflows:  %llu\n", (unsigned long long) load_u64(&stats->outputOverflows));
+  fprintf(file, "  dropped blocks:    %lu\n", droppedBlocks);
+
+  uint64_t samples = load_u64(&stats->latencySamples);
+  if (samples > 0) {
+    fprintf(file, "  latency min/mean/max: %.3f / %.3f / %.3f ms\n",
+            load_i64(&stats->minLatencyUs) / 1000.0,
+            (double) load_i64(&stats->sumLatencyUs) / (double) samples / 1000.0,
+            load_i64(&stats->maxLatencyUs) / 1000.0);
+  }
+
+  fprintf(file, "  load histogram (upper edge, callbacks):\n");
+  for (int bucket = 0; bucket < CALLBACK_LOAD_BUCKETS; bucket++) {
+    uint64_t count = load_u64(&stats->loadHistogram[bucket]);
+    if (count > 0) {
+      int last = bucket == CALLBACK_LOAD_BUCKETS - 1;
+      fprintf(file, "    %s%7.2f%%  %llu\n", last ? ">=" : "< ",
+              100.0 * callback_load_bucket_edge(last ? bucket - 1 : bucket), (unsigned long long) count);
+    }
+  }
+}
@@ -0,0 +1,153 @@
+//
+// Callback deadline, xrun and latency instrumentation.
+//
+
+#ifndef CALLBACK_STATS_H
+#define CALLBACK_STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <curses.h>
+#include <portaudio.h>
+
+/// Number of histogram buckets per octave of callback load; bucket edges are log-spaced
+#define CALLBACK_LOAD_BUCKETS_PER_OCTAVE 4
+
+/// The histogram resolves loads from 2^-CALLBACK_LOAD_MIN_OCTAVE of the buffer period (about 0.1%) up to 2 periods
+#define CALLBACK_LOAD_MIN_OCTAVE 10
+
+/// Total number of histogram buckets: the first one collects every callback below the smallest resolved load,
+/// the last one every callback that took 2 periods or longer
+#define CALLBACK_LOAD_BUCKETS ((CALLBACK_LOAD_MIN_OCTAVE + 1) * CALLBACK_LOAD_BUCKETS_PER_OCTAVE + 2)
+
+/// First bucket of the callbacks that missed their deadline (took a whole period or longer)
+#define CALLBACK_LOAD_DEADLINE_BUCKET (CALLBACK_LOAD_MIN_OCTAVE * CALLBACK_LOAD_BUCKETS_PER_OCTAVE + 1)
+
+/// Height of the statistics view window in number of lines, without the rows of set_stats_extra_rows
+#define STATS_WIN_HEIGHT 6
+
+/// Data structure representing the callback statistics view window
+extern WINDOW *STATS_WIN;
+
+/**
+ * Statistics recorded by the audio callback. Every field has a single writer (the callback),
+ * so updates are plain relaxed loads and stores: nothing locks, allocates or issues atomic
+ * read-modify-write instructions on the audio thread. Readers may see a snapshot that is one
+ * callback out of date.
+ */
+typedef struct {
+
+  /// Duration of one buffer, i.e. the deadline of each callback, in nanoseconds.
+  uint64_t bufferPeriodNs;
+
+  /// Upper edge of every histogram bucket but the last, in nanoseconds; see callback_load_bucket_edge.
+  uint64_t bucketEdgesNs[CALLBACK_LOAD_BUCKETS - 1];
+
+  /// Histogram of callback wall time as a fraction of bufferPeriodNs.
+  _Atomic uint64_t loadHistogram[CALLBACK_LOAD_BUCKETS];
+
+  /// Number of callbacks recorded.
+  _Atomic uint64_t callbacks;
+
+  /// Longest callback wall time, in nanoseconds.
+  _Atomic uint64_t maxCallbackNs;
+
+  /// Number of callbacks flagged with each PortAudio status flag.
+  _Atomic uint64_t inputUnderflows;
+  _Atomic uint64_t inputOverflows;
+  _Atomic uint64_t outputUnderflows;
+  _Atomic uint64_t outputOverflows;
+
+  /// Capture-to-output latency reported by PortAudio, in microseconds.
+  _Atomic int64_t lastLatencyUs;
+  _Atomic int64_t minLatencyUs;
+  _Atomic int64_t maxLatencyUs;
+  _Atomic int64_t sumLatencyUs;
+  _Atomic uint64_t latencySamples;
+} callbackStats;
+
+/**
+ * Resets all statistics.
+ *
+ * @param stats Statistics to reset.
+ * @param framesPerBuffer Number of frames per callback.
+ * @param sampleRate Sample rate of the stream in Hz.
+ */
+void init_callback_stats(callbackStats *stats, unsigned long framesPerBuffer, double sampleRate);
+
+/**
+ * Returns the current CLOCK_MONOTONIC time in nanoseconds; cheap enough for the audio callback.
+ */
+uint64_t callback_clock_ns();
+
+/**
+ * Records one callback. Called at the end of the audio callback.
+ *
+ * @param stats Statistics to update.
+ * @param startNs Value of callback_clock_ns() at the start of the callback.
+ * @param timeInfo Timestamps passed to the callback.
+ * @param statusFlags Status flags passed to the callback.
+ */
+void record_callback(callbackStats *stats, uint64_t startNs,
+                     const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags);
+
+/**
+ * Returns the upper edge of a histogram bucket as a fraction of the buffer period:
+ * 2^(bucket / CALLBACK_LOAD_BUCKETS_PER_OCTAVE - CALLBACK_LOAD_MIN_OCTAVE).
+ *
+ * @param bucket Index of the bucket, below CALLBACK_LOAD_BUCKETS - 1 (the last bucket has no upper edge).
+ * @return Upper edge of the bucket; 1.0 means the whole buffer period.
+ */
+double callback_load_bucket_edge(int bucket);
+
+/**
+ * Returns the callback wall time below which the given fraction of callbacks completed,
+ * as a fraction of the buffer period. The value is interpolated inside its histogram bucket and
+ * never exceeds the longest callback.
+ *
+ * @param stats Statistics to read.
+ * @param fraction Fraction between 0 and 1, e.g. 0.99.
+ * @return Callback load at the given percentile; 1.0 means the whole buffer period.
+ */
+double callback_load_percentile(const callbackStats *stats, double fraction);
+
+/**
+ * Initializes the statistics view window below the frequency window.
+ *
+ * @param num_chan number of channels in the input; affects the initial y position of the window.
+ */
+void init_stats_win(int num_chan);
+
+/**
+ * Adds rows below the statistics of screens initialized afterwards, e.g. one per captured stream.
+ *
+ * @param rows Number of rows starting at row STATS_WIN_HEIGHT of the window.
+ */
+void set_stats_extra_rows(int rows);
+
+/**
+ * Returns the height of the statistics view window, the extra rows included.
+ *
+ * @return Height in number of lines.
+ */
+int stats_win_height();
+
+/**
+ * Draws the statistics into the statistics view window.
+ *
+ * @param stats Statistics to draw.
+ * @param droppedBlocks Number of captured blocks dropped before analysis.
+ */
+void display_callback_stats(const callbackStats *stats, unsigned long droppedBlocks);
+
+/**
+ * Prints a summary of the statistics, e.g. after the screen has been closed.
+ *
+ * @param stats Statistics to print.
+ * @param droppedBlocks Number of captured blocks dropped before analysis.
+ * @param file File to print to.
+ */
+void print_callback_stats(const callbackStats *stats, unsigned long droppedBlocks, FILE *file);
+
+#endif //CALLBACK_STATS_H
@@ -0,0 +1,115 @@
+//
+// Off-screen cell buffer that sends only changed cells to an ncurses window.
+//
+
+#include "cellgrid.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Creates a grid covering the given window, filled with blanks. The first flush draws every cell.
+ *
+ * @param grid Grid to initialize.
+ * @param win Window the grid draws into.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int cell_grid_init(cellGrid *grid, WINDOW *win) {
+  memset(grid, 0, sizeof(*grid));
+  grid->win = win;
+  getmaxyx(win, grid->rows, grid->cols);
+
+  size_t cells = (size_t) grid->rows * grid->cols;
+  grid->next = (chtype *) malloc(sizeof(chtype) * cells);
+  grid->shown = (chtype *) malloc(sizeof(chtype) * cells);
+  if (grid->next == NULL || grid->shown == NULL) {
+    cell_grid_free(grid);
+    return -1;
+  }
+
+  for (size_t i = 0; i < cells; i++) {
+    grid->next[i] = ' ';
+  }
+  cell_grid_invalidate(grid);
+  return 0;
+}
+
+/**
+ * Frees the cell buffers of the grid.
+ *
+ * @param grid Grid to free.
+ */
+void cell_grid_free(cellGrid *grid) {
+  free(grid->next);
+  free(grid->shown);
+  grid->next = NULL;
+  grid->shown = NULL;
+  grid->rows = 0;
+  grid->cols = 0;
+}
+
+/**
+ * Forgets what the window holds, so the next flush redraws every cell.
+ *
+ * @param grid Grid to invalidate.
+ */
+void cell_grid_invalidate(cellGrid *grid) {
+  memset(grid->shown, 0, sizeof(chtype) * (size_t) grid->rows * grid->cols);
+}
+
+/**
+ * Writes text into a row of the next frame and blanks the rest of the row.
+ *
+ * @param grid Grid to draw into.
+ * @param row Row of the text.
+ * @param col Column of the first character.
+ * @param text Text to write; clipped at the right edge.
+ */
+void cell_grid_print_line(cellGrid *grid, int row, int col, const char *text) {
+  if (row < 0 || row >= grid->rows) {
+    return;
+  }
+
+  chtype *cells = grid->next + row * grid->cols;
+  for (; col < grid->cols && *text != '\0'; col++, text++) {
+    cells[col] = (unsigned char) *text;
+  }
+  for (; col < grid->cols; col++) {
+    cells[col] = ' ';
+  }
+}
+
+/**
+ * Sends the cells that differ from the window's content to ncurses, one call per run of
+ * changed cells. The window still has to be refreshed.
+ *
+ * @param grid Grid to flush.
+ * @return Number of cells sent.
+ */
+int cell_grid_flush(cellGrid *grid) {
+  int sent = 0;
+
+  for (int row = 0; row < grid->rows; row++) {
+    const chtype *next = grid->next + row * grid->cols;
+    chtype *shown = grid->shown + row * grid->cols;
+
+    int col = 0;
+    while (col < grid->cols) {
+      if (next[col] == shown[col]) {
+        col++;
+        continue;
+      }
+
+      int start = col;
+      while (col < grid->cols && next[col] != shown[col]) {
+        col++;
+      }
+      // waddchnstr neither wraps nor moves the cursor, so the bottom-right cell is safe to write.
+      mvwaddchnstr(grid->win, row, start, next + start, col - start);
+      memcpy(shown + start, next + start, sizeof(chtype) * (col - start));
+      sent += col - start;
+    }
+  }
+
+  grid->lastFlushCells = sent;
+  return sent;
+}
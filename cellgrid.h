@@ -0,0 +1,86 @@
+//
+// Off-screen cell buffer that sends only changed cells to an ncurses window.
+//
+
+#ifndef CELLGRID_H
+#define CELLGRID_H
+
+#include <curses.h>
+
+/**
+ * Cell buffer covering a whole ncurses window. Views compose every frame into next with plain
+ * memory writes; cell_grid_flush then compares it with shown (what the window already holds)
+ * and passes only the runs of changed cells to ncurses.
+ */
+typedef struct {
+  WINDOW *win;
+  int rows;
+  int cols;
+
+  /// Cells composed for the next frame, rows * cols; persists between frames.
+  chtype *next;
+
+  /// Cells last sent to the window; 0 marks a cell whose content is unknown.
+  chtype *shown;
+
+  /// Number of cells sent to ncurses by the last flush.
+  int lastFlushCells;
+} cellGrid;
+
+/**
+ * Creates a grid covering the given window, filled with blanks. The first flush draws every cell.
+ *
+ * @param grid Grid to initialize.
+ * @param win Window the grid draws into.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int cell_grid_init(cellGrid *grid, WINDOW *win);
+
+/**
+ * Frees the cell buffers of the grid.
+ *
+ * @param grid Grid to free.
+ */
+void cell_grid_free(cellGrid *grid);
+
+/**
+ * Forgets what the window holds, so the next flush redraws every cell.
+ *
+ * @param grid Grid to invalidate.
+ */
+void cell_grid_invalidate(cellGrid *grid);
+
+/**
+ * Sets one cell of the next frame; cells outside the grid are ignored.
+ *
+ * @param grid Grid to draw into.
+ * @param row Row of the cell.
+ * @param col Column of the cell.
+ * @param ch Character (with attributes) of the cell.
+ */
+static inline void cell_grid_put(cellGrid *grid, int row, int col, chtype ch) {
+  if (row >= 0 && row < grid->rows && col >= 0 && col < grid->cols) {
+    grid->next[row * grid->cols + col] = ch;
+  }
+}
+
+/**
+ * Writes text into a row of the next frame and blanks the rest of the row.
+ *
+ * @param grid Grid to draw into.
+ * @param row Row of the text.
+ * @param col Column of the first character.
+ * @param text Text to write; clipped at the right edge.
+ */
+void cell_grid_print_line(cellGrid *grid, int row, int col, const char *text);
+
+/**
+ * Sends the cells that differ from the window's content to ncurses, one call per run of
+ * changed cells. The window still has to be refreshed.
+ *
+ * @param grid Grid to flush.
+ * @return Number of cells sent.
+ */
+int cell_grid_flush(cellGrid *grid);
+
+#endif //CELLGRID_H
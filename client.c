@@ -3,64 +3,344 @@
 //
 
 #include "client.h"
+#include "spectral.h"
+#include "jitter.h"
 #include "utils.h"
-#include "dispatch.h"
+#include <math.h>
+#include <poll.h>
+#include <time.h>
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <unistd.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <netdb.h>
 
-int start_client(char *host, char *port)
-{
-  int sockfd, port_num, n;
-  struct sockaddr_in serv_addr;
-  struct hostent *server;
+/**
+ * Reads exactly length bytes from the socket.
+ *
+ * @return 0 on success, -1 at the end of the stream or on an error.
+ */
+static int read_exact(int fd, unsigned char *buffer, size_t length) {
+  while (length > 0) {
+    ssize_t n = recv(fd, buffer, length, 0);
+    if (n > 0) {
+      buffer += n;
+      length -= (size_t) n;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Connects to a streaming server.
+ *
+ * @param client Client to connect.
+ * @param host Host name or address of the server.
+ * @param port Port of the server.
+ * @return 0 on success, -1 if the connection failed.
+ */
+int stream_client_connect(streamClient *client, const char *host, const char *port) {
+  memset(client, 0, sizeof(*client));
+  client->fd = -1;
+
+  struct addrinfo hints;
+  struct addrinfo *addresses;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  int status = getaddrinfo(host, port, &hints, &addresses);
+  if (status != 0) {
+    fprintf(stderr, "Could not resolve %s:%s: %s\n", host, port, gai_strerror(status));
+    return -1;
+  }
+
+  for (struct addrinfo *address = addresses; address != NULL; address = address->ai_next) {
+    int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (fd < 0) {
+      continue;
+    }
+    if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+      client->fd = fd;
+      break;
+    }
+    close(fd);
+  }
+  freeaddrinfo(addresses);
+
+  if (client->fd < 0) {
+    fprintf(stderr, "Could not connect to %s:%s\n", host, port);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Blocks until the next frame has been received and counts any sequence gap before it.
+ *
+ * @param client Connected client.
+ * @param header Set to the header of the frame.
+ * @param payload Set to the payload of the frame; valid until the next call.
+ * @return 0 on success, -1 at the end of the stream or on a malformed frame.
+ */
+int stream_client_receive(streamClient *client, streamHeader *header, const unsigned char **payload) {
+  unsigned char encoded[STREAM_HEADER_SIZE];
+  if (read_exact(client->fd, encoded, STREAM_HEADER_SIZE) != 0 || decode_stream_header(encoded, header) != 0) {
+    return -1;
+  }
+
+  if (header->payloadLength > client->payloadCapacity) {
+    unsigned char *grown = (unsigned char *) realloc(client->payload, header->payloadLength);
+    if (grown == NULL) {
+      return -1;
+    }
+    client->payload = grown;
+    client->payloadCapacity = header->payloadLength;
+  }
+  if (read_exact(client->fd, client->payload, header->payloadLength) != 0) {
+    return -1;
+  }
+
+  if (client->framesReceived > 0) {
+    client->gaps += header->sequence - client->expectedSequence;
+  }
+  client->expectedSequence = header->sequence + 1;
+  client->framesReceived++;
+
+  *payload = client->payload;
+  return 0;
+}
+
+/**
+ * Closes the connection and frees the payload buffer.
+ *
+ * @param client Client to close.
+ */
+void stream_client_close(streamClient *client) {
+  if (client->fd >= 0) {
+    close(client->fd);
+  }
+  free(client->payload);
+  client->fd = -1;
+  client->payload = NULL;
+  client->payloadCapacity = 0;
+}
 
-  port_num = atoi(port);
-  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+/**
+ * Prints the peak level of each channel of the last decoded spectral frame.
+ */
+static void print_spectral_peaks(const spectralCodec *codec) {
+  channelLevels levels[codec->numChannels];
+  spectral_dequantize(codec, levels, NULL);
 
-  if(sockfd < 0) {
-    error("Error occurred when opening the socket");
+  printf("  peak dBFS:");
+  for (int c = 0; c < codec->numChannels; c++) {
+    printf(" %.1f", levels[c].peak > 0.0f ? 20.0 * log10(levels[c].peak) : SPECTRAL_DB_MIN);
   }
+  printf("\n");
+}
 
-  server = gethostbyname(host);
-  if(server == NULL) {
-    fprintf(stderr, "Error, no host found for %s", host);
+/**
+ * Connects to a streaming server and prints reception statistics about once per second until
+ * the server closes the stream. Spectral frames are decoded and their peak levels printed.
+ *
+ * @param host Host name or address of the server.
+ * @param port Port of the server.
+ * @return 0 when the stream ended, -1 if the connection failed.
+ */
+int start_client(const char *host, const char *port) {
+  streamClient client;
+  if (stream_client_connect(&client, host, port) != 0) {
+    return -1;
   }
 
-  bzero((char *) &serv_addr, sizeof(serv_addr));
+  streamHeader header;
+  const unsigned char *payload;
+  unsigned long long bytes = 0;
+  uint64_t nextReport = 0;
+  spectralCodec codec;
+  memset(&codec, 0, sizeof(codec));
 
-  serv_addr.sin_family = AF_INET;
-  bcopy((char *) server->h_addr,
-    (char *) &serv_addr.sin_addr.s_addr,
-    server -> h_length);
+  while (stream_client_receive(&client, &header, &payload) == 0) {
+    bytes += STREAM_HEADER_SIZE + header.payloadLength;
+    int spectral = header.type == StreamSpectrum;
+    if (spectral && spectral_decode(&codec, header.numChannels, (header.flags & STREAM_FLAG_KEYFRAME) != 0,
+                                    payload, header.payloadLength) != 0) {
+      printf("Malformed spectral frame %u\n", header.sequence);
+      break;
+    }
 
-  serv_addr.sin_port = htons(port_num);
+    if (header.timestamp >= nextReport) {
+      printf("%u Hz, %u channels: %lu frames received, %lu missing, %llu bytes\n",
+             header.sampleRate, header.numChannels, client.framesReceived, client.gaps, bytes);
+      if (spectral) {
+        print_spectral_peaks(&codec);
+      }
+      nextReport = header.timestamp + header.sampleRate;
+    }
+  }
 
-  if(connect(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
-    error("Error during connection to the server");
+  printf("Stream ended: %lu frames received, %lu missing, %llu bytes\n", client.framesReceived, client.gaps, bytes);
+  spectral_codec_free(&codec);
+  stream_client_close(&client);
+  return 0;
+}
+
+static uint64_t monotonic_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+/**
+ * Opens a UDP socket receiving streamed frames on the given port of every local address.
+ *
+ * @param port Port the server sends to; "0" picks a free port (see getsockname).
+ * @param group Multicast group to join, or NULL for unicast.
+ * @return The socket, or -1 on failure.
+ */
+int udp_receiver_open(const char *port, const char *group) {
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0) {
+    return -1;
   }
 
-  printf("Client: ");
+  // Lets several receivers on one host share a multicast stream.
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
 
-  for(;;) {
-    n = read(sockfd, global_output_buffer, FRAMES_PER_BUFFER);
-    if (n < 0) {
-      error("Error reading from the socket");
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons((uint16_t) atoi(port));
+  if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  if (group != NULL) {
+    struct ip_mreq membership;
+    memset(&membership, 0, sizeof(membership));
+    membership.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (inet_pton(AF_INET, group, &membership.imr_multiaddr) != 1 ||
+        setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0) {
+      close(fd);
+      return -1;
     }
-    printf("Server sent buffer with %lu bytes\n", sizeof(global_input_buffer));
+  }
+  return fd;
+}
 
-    int i = strncmp("Bye", global_output_buffer, 3);
-    if (i == 0) {
+/**
+ * Reads one datagram if one is pending and decodes its frame header.
+ *
+ * @param fd Socket from udp_receiver_open.
+ * @param buffer Buffer of UDP_RECEIVE_BUFFER bytes; holds the frame afterwards, its payload at
+ *        STREAM_HEADER_SIZE.
+ * @param header Set to the header of the frame.
+ * @return 1 if a valid frame was read, 0 if none was pending, -1 if the datagram was malformed.
+ */
+int udp_receiver_read(int fd, unsigned char *buffer, streamHeader *header) {
+  ssize_t n = recv(fd, buffer, UDP_RECEIVE_BUFFER, MSG_DONTWAIT);
+  if (n < 0) {
+    return 0;
+  }
+  if (n < STREAM_HEADER_SIZE || decode_stream_header(buffer, header) != 0 ||
+      header->payloadLength != (uint32_t) n - STREAM_HEADER_SIZE) {
+    return -1;
+  }
+  return 1;
+}
+
+/**
+ * Receives a UDP stream through a jitter buffer and prints reception, loss, reordering and
+ * latency statistics about once per second until no datagram arrives for UDP_CLIENT_TIMEOUT_MS.
+ *
+ * @param port Port the server sends to.
+ * @param group Multicast group to join, or NULL for unicast.
+ * @param delayMs Target playout delay in milliseconds.
+ * @return 0 when the stream ended, -1 if the socket could not be opened.
+ */
+int start_udp_client(const char *port, const char *group, int delayMs) {
+  int fd = udp_receiver_open(port, group);
+  unsigned char *datagram = (unsigned char *) malloc(UDP_RECEIVE_BUFFER);
+  if (fd < 0 || datagram == NULL) {
+    perror("Could not open the UDP stream socket");
+    free(datagram);
+    return -1;
+  }
+
+  jitterBuffer jitter;
+  memset(&jitter, 0, sizeof(jitter));
+  unsigned long played = 0;
+  unsigned long malformed = 0;
+  uint64_t lastArrival = monotonic_ns();
+  uint64_t nextReport = lastArrival + 1000000000ULL;
+
+  for (;;) {
+    uint64_t now = monotonic_ns();
+    uint64_t due = jitter_next_due(&jitter);
+    int timeoutMs = due == 0 ? 100 : due <= now ? 0 : (int) ((due - now) / 1000000ULL) + 1;
+    struct pollfd pfd = {fd, POLLIN, 0};
+    poll(&pfd, 1, timeoutMs > 100 ? 100 : timeoutMs);
+
+    streamHeader header;
+    int status;
+    while ((status = udp_receiver_read(fd, datagram, &header)) != 0) {
+      lastArrival = monotonic_ns();
+      if (status < 0 || header.type != StreamAudio) {
+        malformed += status < 0;
+        continue;
+      }
+      if (jitter.samples == NULL) {
+        // Datagrams carry one captured block each, so the first one sets the block size.
+        unsigned long frames = header.numChannels > 0 ? header.payloadLength / (sizeof(float) * header.numChannels) : 0;
+        if (frames < MIN_FRAMES_PER_BUFFER || frames > MAX_FRAMES_PER_BUFFER) {
+          malformed++;
+          continue;
+        }
+        if (jitter_init(&jitter, header.numChannels, frames, (int) header.sampleRate, delayMs) != 0) {
+          printf("Could not allocate the jitter buffer.\n");
+          exit(EXIT_FAILURE);
+        }
+      }
+      jitter_push(&jitter, &header, datagram + STREAM_HEADER_SIZE, lastArrival);
+    }
+
+    now = monotonic_ns();
+    uint32_t sequence;
+    unsigned long frames;
+    int concealed;
+    while (jitter.samples != NULL && jitter_pop(&jitter, now, &sequence, &frames, &concealed) != NULL) {
+      played++;
+    }
+
+    if (now >= nextReport && jitter.samples != NULL) {
+      printf("%lu played, %lu received, %lu lost, %lu reordered, %lu late, %lu duplicated, %lu malformed; "
+             "delay %.1f ms, jitter %.2f ms, %lu reanchored\n",
+             played, jitter.stats.received, jitter.stats.lost, jitter.stats.reordered, jitter.stats.late,
+             jitter.stats.duplicates, malformed, jitter_delay(&jitter) / 1e6, jitter.jitterNs / 1e6,
+             jitter.stats.reanchors);
+      nextReport = now + 1000000000ULL;
+    }
+    if (now - lastArrival > (uint64_t) UDP_CLIENT_TIMEOUT_MS * 1000000ULL) {
       break;
     }
   }
 
-  close(sockfd);
+  printf("Stream ended: %lu blocks played, %lu lost\n", played, jitter.stats.lost);
+  jitter_free(&jitter);
+  free(datagram);
+  close(fd);
   return 0;
-}
\ No newline at end of file
+}
@@ -5,6 +5,100 @@
 #ifndef CLIENT_H
 #define CLIENT_H
 
-int start_client(char *host, char *port);
+#include <stddef.h>
+#include <stdint.h>
+#include "protocol.h"
+
+/// Time without datagrams after which the UDP client considers the stream ended
+#define UDP_CLIENT_TIMEOUT_MS 2000
+
+/// Size of the buffer udp_receiver_read reads a datagram into: the largest UDP payload
+#define UDP_RECEIVE_BUFFER 65536
+
+/**
+ * Connection to a streaming server (see server.h) and the receive state of its frames.
+ */
+typedef struct {
+  int fd;
+
+  /// Sequence number the next frame should carry.
+  uint32_t expectedSequence;
+
+  /// Frames received and frames the sequence numbers show as missing.
+  unsigned long framesReceived;
+  unsigned long gaps;
+
+  /// Payload of the last received frame.
+  unsigned char *payload;
+  size_t payloadCapacity;
+} streamClient;
+
+/**
+ * Connects to a streaming server.
+ *
+ * @param client Client to connect.
+ * @param host Host name or address of the server.
+ * @param port Port of the server.
+ * @return 0 on success, -1 if the connection failed.
+ */
+int stream_client_connect(streamClient *client, const char *host, const char *port);
+
+/**
+ * Blocks until the next frame has been received and counts any sequence gap before it.
+ *
+ * @param client Connected client.
+ * @param header Set to the header of the frame.
+ * @param payload Set to the payload of the frame; valid until the next call.
+ * @return 0 on success, -1 at the end of the stream or on a malformed frame.
+ */
+int stream_client_receive(streamClient *client, streamHeader *header, const unsigned char **payload);
+
+/**
+ * Closes the connection and frees the payload buffer.
+ *
+ * @param client Client to close.
+ */
+void stream_client_close(streamClient *client);
+
+/**
+ * Connects to a streaming server and prints reception statistics about once per second until
+ * the server closes the stream.
+ *
+ * @param host Host name or address of the server.
+ * @param port Port of the server.
+ * @return 0 when the stream ended, -1 if the connection failed.
+ */
+int start_client(const char *host, const char *port);
+
+/**
+ * Opens a UDP socket receiving streamed frames on the given port of every local address.
+ *
+ * @param port Port the server sends to; "0" picks a free port (see getsockname).
+ * @param group Multicast group to join, or NULL for unicast.
+ * @return The socket, or -1 on failure.
+ */
+int udp_receiver_open(const char *port, const char *group);
+
+/**
+ * Reads one datagram if one is pending and decodes its frame header.
+ *
+ * @param fd Socket from udp_receiver_open.
+ * @param buffer Buffer of UDP_RECEIVE_BUFFER bytes; holds the frame afterwards, its payload at
+ *        STREAM_HEADER_SIZE.
+ * @param header Set to the header of the frame.
+ * @return 1 if a valid frame was read, 0 if none was pending, -1 if the datagram was malformed.
+ */
+int udp_receiver_read(int fd, unsigned char *buffer, streamHeader *header);
+
+/**
+ * Receives a UDP stream through a jitter buffer and prints reception, loss, reordering and
+ * latency statistics about once per second until no datagram arrives for UDP_CLIENT_TIMEOUT_MS.
+ *
+ * @param port Port the server sends to.
+ * @param group Multicast group to join, or NULL for unicast.
+ * @param delayMs Target playout delay in milliseconds.
+ * @return 0 when the stream ended, -1 if the socket could not be opened.
+ */
+int start_udp_client(const char *port, const char *group, int delayMs);
 
 #endif //CLIENT_H
@@ -3,12 +3,682 @@
 //
 
 #include "dispatch.h"
+#include "display.h"
+#include "volume.h"
+#include "frequencies.h"
+#include "arena.h"
+#include "wisdom.h"
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-void update_global_buffer(float *in, float *out)
-{
-  memcpy(global_input_buffer, in, sizeof(global_input_buffer));
-  memcpy(global_output_buffer, out, sizeof(global_output_buffer));
+static int render_fps = DEFAULT_RENDER_FPS;
+static int analysis_threads = 0;
+static streamServer *stream_server = NULL;
+static audioRecorder *stream_recorder = NULL;
+static int collect_metrics = 0;
+static const ballisticsOptions *ballistics_options = NULL;
 
-}
\ No newline at end of file
+/**
+ * Sets the maximum number of screen refreshes per second for pipelines started afterwards.
+ *
+ * @param fps Refresh rate limit; values below 1 are clamped to 1.
+ */
+void set_render_fps(int fps) {
+  render_fps = fps < 1 ? 1 : fps;
+}
+
+/**
+ * Sets the number of threads analysing each block for streams initialized afterwards. The spectro
+ * data of the streams should be split into analysis_shards(numThreads) shards.
+ *
+ * @param numThreads Number of threads including the render thread; values below 1 select one per core.
+ */
+void set_dispatch_threads(int numThreads) {
+  analysis_threads = numThreads;
+}
+
+/**
+ * Sets the server that the first stream of pipelines started afterwards publishes every analysed
+ * block to.
+ *
+ * @param server Running server, or NULL to stop publishing.
+ */
+void set_dispatch_server(streamServer *server) {
+  stream_server = server;
+}
+
+/**
+ * Sets the recorder that the first stream of pipelines started afterwards queues every captured
+ * block to.
+ *
+ * @param recorder Running recorder, or NULL to stop recording.
+ */
+void set_dispatch_recorder(audioRecorder *recorder) {
+  stream_recorder = recorder;
+}
+
+/**
+ * Sets whether streams initialized afterwards collect the statistics of their analysed blocks for
+ * the metrics exporter (see metrics.h).
+ *
+ * @param enabled Non-zero to collect them.
+ */
+void set_dispatch_metrics(int enabled) {
+  collect_metrics = enabled;
+}
+
+/**
+ * Sets the attack, release and peak-hold times of the bars of streams initialized afterwards.
+ *
+ * @param options Ballistics options; they must outlive the streams. NULL selects the defaults.
+ */
+void set_dispatch_ballistics(const ballisticsOptions *options) {
+  ballistics_options = options;
+}
+
+/**
+ * Advances the given absolute time by the given number of nanoseconds.
+ */
+static void timespec_add_ns(struct timespec *time, long ns) {
+  time->tv_nsec += ns;
+  while (time->tv_nsec >= 1000000000L) {
+    time->tv_nsec -= 1000000000L;
+    time->tv_sec++;
+  }
+}
+
+/**
+ * Sleeps until the given absolute CLOCK_MONOTONIC time.
+ */
+static void sleep_until(const struct timespec *deadline) {
+#ifdef __APPLE__
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long long ns = (long long) (deadline->tv_sec - now.tv_sec) * 1000000000LL + (deadline->tv_nsec - now.tv_nsec);
+  if (ns > 0) {
+    struct timespec rel = {(time_t) (ns / 1000000000LL), (long) (ns % 1000000000LL)};
+    nanosleep(&rel, NULL);
+  }
+#else
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL) != 0) {
+  }
+#endif
+}
+
+/**
+ * Duration of a block of the given number of frames of a stream, in milliseconds.
+ */
+static double block_ms(const dispatchStream *stream, unsigned long frames) {
+  return (double) frames * 1000.0 / ((const streamCallbackData *) stream->spectroData)->options.sampleRate;
+}
+
+/**
+ * Status shown in the title of the frequency view: whether the last restart of the stream failed.
+ */
+static const char *restart_status(const dispatchStream *stream) {
+  return atomic_load_explicit(&stream->restartFailed, memory_order_relaxed) ? "restart failed, options kept" : NULL;
+}
+
+/**
+ * Unpacks a slot queued by dispatch_analysis into the levels and columns of the stream and draws
+ * them if the stream is displayed.
+ */
+static void draw_analysis(dispatchStream *stream, const float *slot, int displayed) {
+  streamCallbackData *spectroData = (streamCallbackData *) stream->spectroData;
+  channelLevels *levels = stream->analyser.levels;
+  unsigned long frames = (unsigned long) *slot++;
+  for (int c = 0; c < stream->numChannels; c++, slot += DISPATCH_LEVEL_VALUES) {
+    levels[c].peak = slot[0];
+    levels[c].rms = slot[1];
+    levels[c].dc = slot[2];
+    levels[c].truePeak = slot[3];
+  }
+  for (int i = 0; i < spectroData->numSpectra * WIN_WIDTH; i++) {
+    spectroData->proportions[i] = slot[i];
+  }
+  meterBallistics *ballistics = &stream->ballistics;
+  ballistics_update(ballistics, levels, spectroData->proportions, block_ms(stream, frames));
+
+  if (displayed) {
+    draw_volume(ballistics->levels, stream->numChannels);
+    draw_frequencies(spectroData, ballistics->columns, ballistics->columnPeaks, restart_status(stream));
+  }
+  waterfall_push(&stream->waterfall, spectroData->proportions, frames);
+}
+
+/**
+ * Draws the rows the analysed blocks added to the waterfall history, for the displayed spectrum.
+ */
+static void draw_history(dispatchStream *stream) {
+  streamCallbackData *spectroData = (streamCallbackData *) stream->spectroData;
+  int displayed = atomic_load_explicit(&spectroData->displayedSpectrum, memory_order_relaxed);
+
+  char label[32];
+  spectrum_label(spectroData, displayed, label, sizeof(label));
+  draw_waterfall(&stream->waterfall, displayed, label);
+}
+
+/**
+ * Applies a restart requested by restart_dispatch_stream, if any: drops the blocks captured before
+ * the request, reconfigures the spectro data and clears the analysis state and waterfall history.
+ * Only allocates when the options changed the FFT or the band map, and only plans a new FFT size
+ * from the wisdom or by estimating it. If the spectro data cannot be reconfigured, the stream keeps
+ * its options and restartFailed is set.
+ */
+static void apply_restart(dispatchStream *stream) {
+  if (!atomic_load_explicit(&stream->restartPending, memory_order_acquire)) {
+    return;
+  }
+
+  unsigned long frames;
+  while ((ptrdiff_t) (stream->restartHead - atomic_load_explicit(&stream->ring.tail, memory_order_relaxed)) > 0 &&
+         ring_peek(&stream->ring, &frames) != NULL) {
+    ring_release(&stream->ring);
+  }
+
+  streamCallbackData *spectroData = (streamCallbackData *) stream->spectroData;
+  int failed = 0;
+  if (stream->preAnalysed) {
+    reset_spectro_data(spectroData);
+  } else if (reconfigure_spectro_data(spectroData, &stream->options) != 0) {
+    // The spectro data is left as it was, so the next restart starts from the options in use.
+    failed = 1;
+    stream->options = spectroData->options;
+    reset_spectro_data(spectroData);
+  }
+  atomic_store_explicit(&stream->restartFailed, failed, memory_order_relaxed);
+  analyser_reset(&stream->analyser);
+  ballistics_reset(&stream->ballistics);
+  waterfall_reset(&stream->waterfall);
+
+  atomic_store_explicit(&stream->restartPending, 0, memory_order_release);
+}
+
+/**
+ * Analyses every block queued by a stream and, if the stream is displayed, draws the result into
+ * the ncurses windows. Streams that are not displayed are still analysed, published and recorded
+ * into their waterfall history.
+ *
+ * @return Number of blocks analysed.
+ */
+static int drain_blocks(dispatchStream *stream, int displayed) {
+  int analysed = 0;
+  unsigned long frames;
+  const float *block;
+  streamCallbackData *spectroData = (streamCallbackData *) stream->spectroData;
+
+  for (apply_restart(stream); (block = ring_peek(&stream->ring, &frames)) != NULL; apply_restart(stream)) {
+    if (stream->preAnalysed) {
+      draw_analysis(stream, block, displayed);
+      ring_release(&stream->ring);
+      analysed++;
+      continue;
+    }
+
+    uint64_t startNs = callback_clock_ns();
+    analyse_block(&stream->analyser, block, frames);
+    uint64_t elapsed = callback_clock_ns() - startNs;
+    stream->analysisNs += elapsed;
+    stream->maxAnalysisNs = elapsed > stream->maxAnalysisNs ? elapsed : stream->maxAnalysisNs;
+    stream->analysedFrames += frames;
+    if (stream->metrics.numChannels > 0) {
+      metrics_add_block(&stream->metrics, &stream->analyser, frames, elapsed);
+    }
+
+    meterBallistics *ballistics = &stream->ballistics;
+    ballistics_update(ballistics, stream->analyser.levels, spectroData->proportions, block_ms(stream, frames));
+
+    if (displayed) {
+      draw_volume(ballistics->levels, stream->numChannels);
+      draw_loudness(&stream->analyser.loudness.levels);
+      if (stream->analyser.pitches != NULL) {
+        draw_pitch(stream->analyser.pitches, stream->numChannels);
+      }
+      draw_frequencies(spectroData, ballistics->columns, ballistics->columnPeaks, restart_status(stream));
+    }
+    waterfall_push(&stream->waterfall, spectroData->proportions, frames);
+    if (stream->server != NULL && stream->server->options.type == StreamSpectrum) {
+      server_publish_analysis(stream->server, stream->analyser.levels, spectroData->proportions, frames);
+    } else if (stream->server != NULL) {
+      server_publish(stream->server, block, frames);
+    }
+    ring_release(&stream->ring);
+    analysed++;
+  }
+
+  return analysed;
+}
+
+/**
+ * Share of real time the render thread spent analysing the blocks of a stream, and the longest
+ * block as a share of its duration.
+ */
+static void analysis_load(const dispatchStream *stream, double *mean, double *max) {
+  double sampleRate = ((const streamCallbackData *) stream->spectroData)->options.sampleRate;
+  double audioNs = (double) stream->analysedFrames * 1e9 / sampleRate;
+  *mean = audioNs > 0.0 ? (double) stream->analysisNs / audioNs : 0.0;
+  *max = stream->stats.bufferPeriodNs > 0 ? (double) stream->maxAnalysisNs / (double) stream->stats.bufferPeriodNs
+                                          : 0.0;
+}
+
+/**
+ * Draws one line per stream below the callback statistics: its channels, analysis load, callback
+ * load, latency and dropped blocks, with the displayed stream marked.
+ */
+static void display_stream_stats(dispatchPipeline *pipeline, int displayed) {
+  if (STATS_WIN == NULL) {
+    return;
+  }
+
+  mvwprintw(STATS_WIN, STATS_WIN_HEIGHT, 0, "Streams ('d' to switch; analysis and callback load per block period):");
+  wclrtoeol(STATS_WIN);
+  for (int s = 0; s < pipeline->numStreams; s++) {
+    dispatchStream *stream = pipeline->streams[s];
+    double mean;
+    double max;
+    analysis_load(stream, &mean, &max);
+    uint64_t samples = atomic_load_explicit(&stream->stats.latencySamples, memory_order_relaxed);
+    double latencyMs = samples > 0 ? (double) atomic_load_explicit(&stream->stats.sumLatencyUs, memory_order_relaxed) /
+                                     (double) samples / 1000.0
+                                   : 0.0;
+    mvwprintw(STATS_WIN, STATS_WIN_HEIGHT + 1 + s, 0,
+              "%c%d %-16.16s %2dch  analysis %5.1f%% max %5.1f%%  callback p99 %.0f%%  latency %.2f ms  drop %lu",
+              s == displayed ? '>' : ' ', s, stream->label, stream->numChannels, 100.0 * mean, 100.0 * max,
+              100.0 * callback_load_percentile(&stream->stats, 0.99), latencyMs, dispatch_dropped_blocks(stream));
+    wclrtoeol(STATS_WIN);
+  }
+}
+
+/**
+ * Render thread: analyses the blocks queued by every stream, refreshes the screen with the
+ * displayed one at most renderFps times per second and forwards key presses to wait_for_key.
+ * Headless pipelines only analyse.
+ */
+static void *render_loop(void *arg) {
+  dispatchPipeline *pipeline = (dispatchPipeline *) arg;
+  long framePeriod = 1000000000L / pipeline->renderFps;
+  // Restarts plan new FFT sizes here; measuring them would stall every stream.
+  set_planner_realtime(1);
+  int shownStream = 0;
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+
+  while (!atomic_load(&pipeline->stop)) {
+    int displayed = pipeline->headless ? -1 : atomic_load(&pipeline->displayedStream);
+    int changed = !pipeline->headless && displayed != shownStream;
+    if (changed) {
+      // The new stream may have fewer channels, and its waterfall was never drawn.
+      clear_volume();
+      pipeline->streams[displayed]->waterfall.shownSpectrum = -1;
+      shownStream = displayed;
+    }
+
+    int analysed = 0;
+    for (int s = 0; s < pipeline->numStreams; s++) {
+      analysed += drain_blocks(pipeline->streams[s], s == displayed);
+    }
+
+    if (!pipeline->headless && (analysed > 0 || changed)) {
+      dispatchStream *stream = pipeline->streams[displayed];
+      draw_history(stream);
+      display_callback_stats(&stream->stats, dispatch_dropped_blocks(stream));
+      for (int s = 0; s < pipeline->numStreams; s++) {
+        if (pipeline->streams[s]->recorder != NULL) {
+          display_recorder_stats(pipeline->streams[s]->recorder);
+        }
+      }
+      if (pipeline->numStreams > 1) {
+        display_stream_stats(pipeline, displayed);
+      }
+      refresh_screen();
+    }
+
+    int key = pipeline->headless ? ERR : getch();
+    if (key != ERR) {
+      post_key(pipeline, key);
+    }
+
+    timespec_add_ns(&deadline, framePeriod);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec > deadline.tv_sec + 1) {
+      // Fell far behind (e.g. the process was suspended); do not try to catch up.
+      deadline = now;
+    }
+    sleep_until(&deadline);
+  }
+
+  return NULL;
+}
+
+/**
+ * Allocates a ring of the given slot size, an analyser with a pool of the given number of threads, the
+ * ballistics of the bars and the waterfall history if the view is enabled.
+ */
+static void init_stream(dispatchStream *stream, int numChannels, void *spectroData, const char *label,
+                        size_t slotSamples, int numThreads) {
+  const spectroOptions *options = &((streamCallbackData *) spectroData)->options;
+  if (ring_init(&stream->ring, DISPATCH_RING_BLOCKS, slotSamples) != 0) {
+    endwin();
+    printf("Could not allocate the dispatch ring.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (analyser_init(&stream->analyser, numChannels, (streamCallbackData *) spectroData, numThreads) != 0) {
+    endwin();
+    printf("Could not start the analysis threads.\n");
+    exit(EXIT_FAILURE);
+  }
+  ballisticsOptions defaults;
+  default_ballistics_options(&defaults);
+  if (ballistics_init(&stream->ballistics, numChannels, ((streamCallbackData *) spectroData)->numSpectra,
+                      ballistics_options != NULL ? ballistics_options : &defaults) != 0) {
+    endwin();
+    printf("Could not allocate the meter ballistics.\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(&stream->waterfall, 0, sizeof(stream->waterfall));
+  if (WATERFALL_WIN != NULL &&
+      waterfall_init(&stream->waterfall, ((streamCallbackData *) spectroData)->numSpectra,
+                     waterfall_frames_per_row(options->sampleRate, (unsigned long) options->framesPerBuffer),
+                     options->sampleRate) != 0) {
+    endwin();
+    printf("Could not allocate the waterfall history.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  snprintf(stream->label, sizeof(stream->label), "%s", label);
+  stream->spectroData = spectroData;
+  stream->numChannels = numChannels;
+  stream->analysisNs = 0;
+  stream->maxAnalysisNs = 0;
+  stream->analysedFrames = 0;
+  stream->server = NULL;
+  stream->recorder = NULL;
+  stream->options = *options;
+  atomic_init(&stream->restartPending, 0);
+  atomic_init(&stream->restartFailed, 0);
+  stream->restartHead = 0;
+  init_callback_stats(&stream->stats, (unsigned long) options->framesPerBuffer, options->sampleRate);
+  memset(&stream->metrics, 0, sizeof(stream->metrics));
+}
+
+/**
+ * Allocates the ring, the analyser, the waterfall history and, if set_dispatch_metrics is enabled,
+ * the metrics of a stream of captured blocks.
+ *
+ * @param stream Stream to initialize.
+ * @param numChannels Number of interleaved channels in each captured block.
+ * @param spectroData Spectro data used for FFT computations.
+ * @param label Name of the stream in the statistics view; truncated to DISPATCH_LABEL_SIZE - 1 characters.
+ */
+void init_dispatch_stream(dispatchStream *stream, int numChannels, void *spectroData, const char *label) {
+  stream->preAnalysed = 0;
+  stream->analysis = NULL;
+  size_t slotSamples = (size_t) ((streamCallbackData *) spectroData)->options.framesPerBuffer * numChannels;
+  init_stream(stream, numChannels, spectroData, label, slotSamples, analysis_threads);
+  if (collect_metrics &&
+      metrics_init(&stream->metrics, numChannels, ((streamCallbackData *) spectroData)->numSpectra) != 0) {
+    endwin();
+    printf("Could not allocate the stream metrics.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * Allocates the ring and the waterfall history of a stream of levels and spectra analysed elsewhere
+ * (see dispatch_analysis) instead of samples.
+ *
+ * @param stream Stream to initialize.
+ * @param numChannels Number of channels whose levels are queued.
+ * @param spectroData Spectro data whose numSpectra rows of column amplitudes are queued.
+ * @param label Name of the stream in the statistics view.
+ */
+void init_analysis_stream(dispatchStream *stream, int numChannels, void *spectroData, const char *label) {
+  size_t slotSamples = 1 + (size_t) numChannels * DISPATCH_LEVEL_VALUES +
+                       (size_t) ((streamCallbackData *) spectroData)->numSpectra * WIN_WIDTH;
+  stream->preAnalysed = 1;
+  stream->analysis = (float *) session_alloc(sizeof(float) * slotSamples);
+  if (stream->analysis == NULL) {
+    endwin();
+    printf("Could not allocate the dispatch ring.\n");
+    exit(EXIT_FAILURE);
+  }
+  // Nothing is analysed, so the pool needs no threads besides the render thread.
+  init_stream(stream, numChannels, spectroData, label, slotSamples, 1);
+}
+
+/**
+ * Stops the analysis pool of a stream and frees its ring, ballistics, waterfall history and metrics. Neither its
+ * callback nor a render thread may be using it anymore.
+ *
+ * @param stream Stream to free.
+ */
+void free_dispatch_stream(dispatchStream *stream) {
+  ring_free(&stream->ring);
+  analyser_free(&stream->analyser);
+  ballistics_free(&stream->ballistics);
+  waterfall_free(&stream->waterfall);
+  session_free(stream->analysis);
+  stream->analysis = NULL;
+  metrics_free(&stream->metrics);
+}
+
+/**
+ * Starts the render thread of the given streams, the first of which is displayed.
+ *
+ * @param pipeline Pipeline to start.
+ * @param streams Initialized streams; they must outlive the pipeline.
+ * @param numStreams Number of streams, at most DISPATCH_MAX_STREAMS.
+ */
+void start_dispatch(dispatchPipeline *pipeline, dispatchStream *const *streams, int numStreams) {
+  if (!streams[0]->preAnalysed) {
+    streams[0]->server = stream_server;
+    streams[0]->recorder = stream_recorder;
+  }
+
+  for (int s = 0; s < numStreams; s++) {
+    pipeline->streams[s] = streams[s];
+  }
+  pipeline->numStreams = numStreams;
+  pipeline->renderFps = render_fps;
+  pipeline->headless = VOL_WIN == NULL;
+  pipeline->pendingKey = ERR;
+  atomic_init(&pipeline->displayedStream, 0);
+  atomic_init(&pipeline->stop, 0);
+  pthread_mutex_init(&pipeline->keyLock, NULL);
+  pthread_cond_init(&pipeline->keyReady, NULL);
+
+  if (!pipeline->headless) {
+    nodelay(stdscr, TRUE);
+  }
+
+  if (pthread_create(&pipeline->renderThread, NULL, render_loop, pipeline) != 0) {
+    endwin();
+    printf("Could not start the render thread.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/**
+ * Stops the render thread. The streams stay allocated until free_dispatch_stream.
+ *
+ * @param pipeline Pipeline to stop.
+ */
+void stop_dispatch(dispatchPipeline *pipeline) {
+  atomic_store(&pipeline->stop, 1);
+  pthread_join(pipeline->renderThread, NULL);
+
+  pthread_mutex_destroy(&pipeline->keyLock);
+  pthread_cond_destroy(&pipeline->keyReady);
+}
+
+/**
+ * Returns the stream shown in the volume, frequency and waterfall views.
+ *
+ * @param pipeline Running pipeline.
+ * @return Displayed stream.
+ */
+dispatchStream *displayed_stream(dispatchPipeline *pipeline) {
+  return pipeline->streams[atomic_load(&pipeline->displayedStream)];
+}
+
+/**
+ * Shows the next stream of the pipeline, wrapping around after the last one.
+ *
+ * @param pipeline Running pipeline.
+ */
+void show_next_stream(dispatchPipeline *pipeline) {
+  atomic_store(&pipeline->displayedStream, (atomic_load(&pipeline->displayedStream) + 1) % pipeline->numStreams);
+}
+
+/**
+ * Waits until the render thread has applied the pending restart of the stream, if any.
+ */
+static void wait_for_restart(dispatchStream *stream) {
+  while (atomic_load_explicit(&stream->restartPending, memory_order_acquire)) {
+    struct timespec wait = {0, 1000000L};
+    nanosleep(&wait, NULL);
+  }
+}
+
+/**
+ * Waits for a pending restart of the stream to be applied, at most one render period, and copies
+ * the spectro options the stream is analysed with.
+ *
+ * @param stream Stream of a running pipeline.
+ * @param options Set to the options of the stream.
+ */
+void dispatch_stream_options(dispatchStream *stream, spectroOptions *options) {
+  wait_for_restart(stream);
+  *options = stream->options;
+}
+
+/**
+ * Restarts the analysis of a running stream without stopping its audio stream or freeing its FFT
+ * plans and buffers. Before analysing the first block captured after the call, the render thread
+ * drops the blocks queued before it, applies the options with reconfigure_spectro_data and clears
+ * the meters, pitch, loudness, ballistics and waterfall history. Waits for a previous restart of
+ * the stream to be applied, at most one render period, but not for this one.
+ *
+ * @param stream Stream of a running pipeline.
+ * @param options New spectro options, or NULL to keep stream->options; pre-analysed streams only
+ *        accept NULL.
+ * @return 0 if the restart was queued, -1 if the options need new spectro data (see
+ *         spectro_options_compatible); the stream's restartFailed is set then.
+ */
+int restart_dispatch_stream(dispatchStream *stream, const spectroOptions *options) {
+  wait_for_restart(stream);
+
+  if (options != NULL) {
+    if (stream->preAnalysed || !spectro_options_compatible(&stream->options, options)) {
+      atomic_store_explicit(&stream->restartFailed, 1, memory_order_relaxed);
+      return -1;
+    }
+    stream->options = *options;
+  }
+  stream->restartHead = atomic_load_explicit(&stream->ring.head, memory_order_acquire);
+  atomic_store_explicit(&stream->restartPending, 1, memory_order_release);
+  return 0;
+}
+
+/**
+ * Queues a captured block for analysis, and for recording if a recorder is set. Lock-free; safe
+ * to call from the audio callback.
+ *
+ * @param stream Stream to queue the block into.
+ * @param in Interleaved input samples.
+ * @param framesPerBuffer Number of frames in the block.
+ */
+void dispatch_block(dispatchStream *stream, const float *in, unsigned long framesPerBuffer) {
+  ring_push(&stream->ring, in, framesPerBuffer, stream->numChannels);
+  if (stream->recorder != NULL) {
+    recorder_push(stream->recorder, in, framesPerBuffer);
+  }
+}
+
+/**
+ * Queues levels and column amplitudes analysed elsewhere for drawing. Not safe to call from the
+ * audio callback or from several threads.
+ *
+ * @param stream Stream initialized with init_analysis_stream.
+ * @param levels numChannels levels.
+ * @param columns numSpectra * WIN_WIDTH column amplitudes on the frequency view's 0..1 scale.
+ * @param frames Frames of audio the analysis covers, as recorded by the waterfall view.
+ */
+void dispatch_analysis(dispatchStream *stream, const channelLevels *levels, const double *columns,
+                       unsigned long frames) {
+  float *slot = stream->analysis;
+  *slot++ = (float) frames;
+  for (int c = 0; c < stream->numChannels; c++) {
+    *slot++ = levels[c].peak;
+    *slot++ = levels[c].rms;
+    *slot++ = levels[c].dc;
+    *slot++ = levels[c].truePeak;
+  }
+  int numColumns = ((streamCallbackData *) stream->spectroData)->numSpectra * WIN_WIDTH;
+  for (int i = 0; i < numColumns; i++) {
+    *slot++ = (float) columns[i];
+  }
+  ring_push(&stream->ring, stream->analysis, 1, (int) stream->ring.slotSamples);
+}
+
+/**
+ * Returns the number of captured blocks dropped because the render thread fell behind.
+ *
+ * @param stream Stream to query; may already be freed.
+ * @return Number of dropped blocks.
+ */
+unsigned long dispatch_dropped_blocks(dispatchStream *stream) {
+  return atomic_load_explicit(&stream->ring.dropped, memory_order_relaxed);
+}
+
+/**
+ * Prints the callback statistics and the analysis load of a stream, e.g. after the screen has been closed.
+ *
+ * @param stream Stream to print.
+ * @param file File to print to.
+ */
+void print_stream_stats(dispatchStream *stream, FILE *file) {
+  double mean;
+  double max;
+  analysis_load(stream, &mean, &max);
+  fprintf(file, "Stream %s (%d channels)\n", stream->label, stream->numChannels);
+  print_callback_stats(&stream->stats, dispatch_dropped_blocks(stream), file);
+  fprintf(file, "  analysis load:     %.1f%% of real time, longest block %.1f%% of its period\n",
+          100.0 * mean, 100.0 * max);
+}
+
+/**
+ * Blocks until the user presses a key. Keys are read on the render thread since
+ * ncurses may only be used from one thread.
+ *
+ * @param pipeline Pipeline whose render thread reads the keyboard.
+ * @return Key pressed by the user.
+ */
+int wait_for_key(dispatchPipeline *pipeline) {
+  pthread_mutex_lock(&pipeline->keyLock);
+  while (pipeline->pendingKey == ERR) {
+    pthread_cond_wait(&pipeline->keyReady, &pipeline->keyLock);
+  }
+  int key = pipeline->pendingKey;
+  pipeline->pendingKey = ERR;
+  pthread_mutex_unlock(&pipeline->keyLock);
+
+  return key;
+}
+
+/**
+ * Hands a key to wait_for_key as if the user had pressed it, e.g. to end the session when a
+ * remote stream closes.
+ *
+ * @param pipeline Pipeline whose wait_for_key receives the key.
+ * @param key Key to deliver.
+ */
+void post_key(dispatchPipeline *pipeline, int key) {
+  pthread_mutex_lock(&pipeline->keyLock);
+  pipeline->pendingKey = key;
+  pthread_cond_signal(&pipeline->keyReady);
+  pthread_mutex_unlock(&pipeline->keyLock);
+}
@@ -8,14 +8,324 @@
 
 #include <pthread.h>
 #include "utils.h"
+#include "ring.h"
+#include "callback_stats.h"
+#include "meter.h"
+#include "analysis.h"
+#include "server.h"
+#include "waterfall.h"
+#include "recorder.h"
+#include "metrics.h"
+#include "ballistics.h"
 
-#define NUMTHRDS 4
-pthread_t callThd[NUMTHRDS];
-pthread_mutex_t mutexsum;
+/// Number of blocks the callback can queue before the render thread falls behind and blocks are dropped
+#define DISPATCH_RING_BLOCKS 64
 
-float global_input_buffer[FRAMES_PER_BUFFER];
-float global_output_buffer[FRAMES_PER_BUFFER];
+/// Floats the levels of one channel take in a pre-analysed slot: peak, RMS, DC offset and true-peak
+#define DISPATCH_LEVEL_VALUES 4
 
-void update_global_buffer(float *in, float *out);
+/// Default maximum number of screen refreshes per second
+#define DEFAULT_RENDER_FPS 30
+
+/// Largest number of streams one render thread analyses and draws
+#define DISPATCH_MAX_STREAMS 8
+
+/// Size of the name of a stream shown in its statistics, terminator included
+#define DISPATCH_LABEL_SIZE 24
+
+/**
+ * State of one stream shared between its audio callback (producer) and the render thread
+ * (consumer). The callback only pushes captured blocks into the ring; analysis runs on the
+ * render thread, which draws the stream while it is the displayed one.
+ */
+typedef struct {
+
+  /// Name of the stream in the statistics view, e.g. the name of the input device.
+  char label[DISPATCH_LABEL_SIZE];
+
+  /// Blocks captured by the callback and not yet analysed.
+  blockRing ring;
+
+  /// Deadline, xrun and latency statistics recorded by the callback.
+  callbackStats stats;
+
+  /// Analysis of the captured blocks on the render thread and its worker pool; holds the levels
+  /// of the last analysed block.
+  blockAnalyser analyser;
+
+  /// Column amplitudes of past blocks shown by the waterfall view; empty when the view is disabled.
+  waterfallHistory waterfall;
+
+  /// Bars and peak marks of the volume and frequency views, advanced by the duration of every
+  /// analysed block whether the stream is displayed or not.
+  meterBallistics ballistics;
+
+  /// Spectro data used for FFT computations on the render thread.
+  void *spectroData;
+
+  /// Number of interleaved channels in each queued block.
+  int numChannels;
+
+  /// Wall time the render thread spent analysing blocks of the stream, the longest block and the
+  /// number of frames analysed, i.e. the share of one core the stream's analysis costs.
+  uint64_t analysisNs;
+  uint64_t maxAnalysisNs;
+  uint64_t analysedFrames;
+
+  /// Server every analysed block is published to, or NULL when not streaming.
+  streamServer *server;
+
+  /// Recorder every captured block is queued to, or NULL when not recording.
+  audioRecorder *recorder;
+
+  /// Set when the ring carries levels and column amplitudes analysed by a remote server instead of
+  /// samples: the number of frames they cover, numChannels levels and the numSpectra * WIN_WIDTH
+  /// columns, as floats.
+  int preAnalysed;
+
+  /// Staging buffer of one pre-analysed slot, written by dispatch_analysis only.
+  float *analysis;
+
+  /// Statistics of the analysed blocks taken by the metrics exporter every interval; zeroed unless
+  /// set_dispatch_metrics was enabled when the stream was initialized.
+  metricsAccumulator metrics;
+
+  /// Spectro options of the last restart requested by restart_dispatch_stream, or of the spectro
+  /// data. Written by the main thread while no restart is pending, read by the render thread, which
+  /// sets them back to the options in use when it cannot apply them.
+  spectroOptions options;
+
+  /// Set by restart_dispatch_stream until the render thread has applied the restart; the blocks
+  /// queued before ring slot restartHead were captured before the request and are dropped.
+  _Atomic int restartPending;
+  size_t restartHead;
+
+  /// Set when the last restart was refused or could not be applied; the stream keeps analysing with
+  /// its previous options and its line of the statistics says so until a restart succeeds.
+  _Atomic int restartFailed;
+} dispatchStream;
+
+/**
+ * Render thread shared by one or more streams. Every refresh it analyses the blocks queued by
+ * each stream, in order, and draws the displayed one, at most renderFps times per second. Keys are
+ * read on this thread as well, since ncurses may only be used from one thread.
+ */
+typedef struct {
+
+  /// Streams analysed by the render thread; owned by the caller.
+  dispatchStream *streams[DISPATCH_MAX_STREAMS];
+  int numStreams;
+
+  /// Index of the stream shown in the volume, frequency and waterfall views. Written by the main
+  /// thread, read by the render thread.
+  _Atomic int displayedStream;
+
+  /// Thread running the analysis and drawing of the queued blocks.
+  pthread_t renderThread;
+
+  /// Maximum number of screen refreshes per second.
+  int renderFps;
+
+  /// Set when the screen was never initialized (a headless session): blocks are analysed and
+  /// exported, but nothing is drawn and no keys are read.
+  int headless;
+
+  /// Set to request the render thread to exit.
+  _Atomic int stop;
+
+  /// Protects the pending key below; never touched by the audio callback.
+  pthread_mutex_t keyLock;
+  pthread_cond_t keyReady;
+
+  /// Last key pressed by the user, or ERR if none is pending.
+  int pendingKey;
+} dispatchPipeline;
+
+/**
+ * Sets the maximum number of screen refreshes per second for pipelines started afterwards.
+ *
+ * @param fps Refresh rate limit; values below 1 are clamped to 1.
+ */
+void set_render_fps(int fps);
+
+/**
+ * Sets the number of threads analysing each block for streams initialized afterwards. The spectro
+ * data of the streams should be split into analysis_shards(numThreads) shards.
+ *
+ * @param numThreads Number of threads including the render thread; values below 1 select one per core.
+ */
+void set_dispatch_threads(int numThreads);
+
+/**
+ * Sets the server that the first stream of pipelines started afterwards publishes every analysed
+ * block to.
+ *
+ * @param server Running server, or NULL to stop publishing.
+ */
+void set_dispatch_server(streamServer *server);
+
+/**
+ * Sets the recorder that the first stream of pipelines started afterwards queues every captured
+ * block to.
+ *
+ * @param recorder Running recorder, or NULL to stop recording.
+ */
+void set_dispatch_recorder(audioRecorder *recorder);
+
+/**
+ * Sets whether streams initialized afterwards collect the statistics of their analysed blocks for
+ * the metrics exporter (see metrics.h).
+ *
+ * @param enabled Non-zero to collect them.
+ */
+void set_dispatch_metrics(int enabled);
+
+/**
+ * Sets the attack, release and peak-hold times of the bars of streams initialized afterwards.
+ *
+ * @param options Ballistics options; they must outlive the streams. NULL selects the defaults.
+ */
+void set_dispatch_ballistics(const ballisticsOptions *options);
+
+/**
+ * Allocates the ring, the analyser, the waterfall history and, if set_dispatch_metrics is enabled,
+ * the metrics of a stream of captured blocks.
+ *
+ * @param stream Stream to initialize.
+ * @param numChannels Number of interleaved channels in each captured block.
+ * @param spectroData Spectro data used for FFT computations.
+ * @param label Name of the stream in the statistics view; truncated to DISPATCH_LABEL_SIZE - 1 characters.
+ */
+void init_dispatch_stream(dispatchStream *stream, int numChannels, void *spectroData, const char *label);
+
+/**
+ * Allocates the ring and the waterfall history of a stream of levels and spectra analysed elsewhere
+ * (see dispatch_analysis) instead of samples.
+ *
+ * @param stream Stream to initialize.
+ * @param numChannels Number of channels whose levels are queued.
+ * @param spectroData Spectro data whose numSpectra rows of column amplitudes are queued.
+ * @param label Name of the stream in the statistics view.
+ */
+void init_analysis_stream(dispatchStream *stream, int numChannels, void *spectroData, const char *label);
+
+/**
+ * Stops the analysis pool of a stream and frees its ring, ballistics, waterfall history and metrics. Neither its
+ * callback nor a render thread may be using it anymore.
+ *
+ * @param stream Stream to free.
+ */
+void free_dispatch_stream(dispatchStream *stream);
+
+/**
+ * Starts the render thread of the given streams, the first of which is displayed.
+ *
+ * @param pipeline Pipeline to start.
+ * @param streams Initialized streams; they must outlive the pipeline.
+ * @param numStreams Number of streams, at most DISPATCH_MAX_STREAMS.
+ */
+void start_dispatch(dispatchPipeline *pipeline, dispatchStream *const *streams, int numStreams);
+
+/**
+ * Stops the render thread. The streams stay allocated until free_dispatch_stream.
+ *
+ * @param pipeline Pipeline to stop.
+ */
+void stop_dispatch(dispatchPipeline *pipeline);
+
+/**
+ * Returns the stream shown in the volume, frequency and waterfall views.
+ *
+ * @param pipeline Running pipeline.
+ * @return Displayed stream.
+ */
+dispatchStream *displayed_stream(dispatchPipeline *pipeline);
+
+/**
+ * Shows the next stream of the pipeline, wrapping around after the last one.
+ *
+ * @param pipeline Running pipeline.
+ */
+void show_next_stream(dispatchPipeline *pipeline);
+
+/**
+ * Waits for a pending restart of the stream to be applied, at most one render period, and copies
+ * the spectro options the stream is analysed with.
+ *
+ * @param stream Stream of a running pipeline.
+ * @param options Set to the options of the stream.
+ */
+void dispatch_stream_options(dispatchStream *stream, spectroOptions *options);
+
+/**
+ * Restarts the analysis of a running stream without stopping its audio stream or freeing its FFT
+ * plans and buffers. Before analysing the first block captured after the call, the render thread
+ * drops the blocks queued before it, applies the options with reconfigure_spectro_data and clears
+ * the meters, pitch, loudness, ballistics and waterfall history. Waits for a previous restart of
+ * the stream to be applied, at most one render period, but not for this one.
+ *
+ * @param stream Stream of a running pipeline.
+ * @param options New spectro options, or NULL to keep stream->options; pre-analysed streams only
+ *        accept NULL.
+ * @return 0 if the restart was queued, -1 if the options need new spectro data (see
+ *         spectro_options_compatible); the stream's restartFailed is set then.
+ */
+int restart_dispatch_stream(dispatchStream *stream, const spectroOptions *options);
+
+/**
+ * Queues a captured block for analysis, and for recording if a recorder is set. Lock-free; safe
+ * to call from the audio callback.
+ *
+ * @param stream Stream to queue the block into.
+ * @param in Interleaved input samples.
+ * @param framesPerBuffer Number of frames in the block.
+ */
+void dispatch_block(dispatchStream *stream, const float *in, unsigned long framesPerBuffer);
+
+/**
+ * Queues levels and column amplitudes analysed elsewhere for drawing. Not safe to call from the
+ * audio callback or from several threads.
+ *
+ * @param stream Stream initialized with init_analysis_stream.
+ * @param levels numChannels levels.
+ * @param columns numSpectra * WIN_WIDTH column amplitudes on the frequency view's 0..1 scale.
+ * @param frames Frames of audio the analysis covers, as recorded by the waterfall view.
+ */
+void dispatch_analysis(dispatchStream *stream, const channelLevels *levels, const double *columns,
+                       unsigned long frames);
+
+/**
+ * Returns the number of captured blocks dropped because the render thread fell behind.
+ *
+ * @param stream Stream to query; may already be freed.
+ * @return Number of dropped blocks.
+ */
+unsigned long dispatch_dropped_blocks(dispatchStream *stream);
+
+/**
+ * Prints the callback statistics and the analysis load of a stream, e.g. after the screen has been closed.
+ *
+ * @param stream Stream to print.
+ * @param file File to print to.
+ */
+void print_stream_stats(dispatchStream *stream, FILE *file);
+
+/**
+ * Blocks until the user presses a key. Keys are read on the render thread since
+ * ncurses may only be used from one thread.
+ *
+ * @param pipeline Pipeline whose render thread reads the keyboard.
+ * @return Key pressed by the user.
+ */
+int wait_for_key(dispatchPipeline *pipeline);
+
+/**
+ * Hands a key to wait_for_key as if the user had pressed it, e.g. to end the session when a
+ * remote stream closes.
+ *
+ * @param pipeline Pipeline whose wait_for_key receives the key.
+ * @param key Key to deliver.
+ */
+void post_key(dispatchPipeline *pipeline, int key);
 
 #endif //DISPATCH_H
@@ -1,28 +1,8 @@
 #include "volume.h"
 #include "frequencies.h"
 #include "display.h"
-
-/**
- * Fills the current local-max map with 0s (initial state).
- */
-void init_current_max() {
-  for (int freq = 0; freq < WIN_WIDTH; freq++) {
-    current_max[freq] = 0.0f;
-  }
-}
-
-/**
- * Decrements each value in the current local-max map by 0.03%.
- * Called every time streamCallBack is returned.
- */
-void decrement_current_max() {
-  float decrement = 0.0003f * (float) FREQ_WIN_HEIGHT;
-  for (int freq = 0; freq < WIN_WIDTH; freq++) {
-    if (current_max[freq] * (float) FREQ_WIN_HEIGHT > decrement) {
-      current_max[freq] -= decrement;
-    }
-  }
-}
+#include "callback_stats.h"
+#include "waterfall.h"
 
 /**
  * Initializes the ncurses screen with windows for each section of the view.
@@ -31,47 +11,58 @@ void decrement_current_max() {
  * of all windows on the screen.
  */
 void init_screen(int num_chan) {
-  init_current_max();
   initscr();
+  cbreak();
+  noecho();
   init_vol_win(num_chan);
   init_freq_win(num_chan);
+  init_stats_win(num_chan);
+  init_waterfall_win(num_chan);
 }
 
 /**
- * Refreshes all ncurses windows on the screen.
+ * Sends the changed cells of the volume and frequency views to ncurses and updates the
+ * terminal once for all windows, the waterfall view included if it is enabled.
  */
 void refresh_screen() {
-  wrefresh(VOL_WIN);
-  wrefresh(FREQ_WIN);
+  cell_grid_flush(&VOL_GRID);
+  cell_grid_flush(&FREQ_GRID);
+  wnoutrefresh(VOL_WIN);
+  wnoutrefresh(FREQ_WIN);
+  wnoutrefresh(STATS_WIN);
+  if (WATERFALL_WIN != NULL) {
+    wnoutrefresh(WATERFALL_WIN);
+  }
+  doupdate();
 }
 
 /**
  * Deletes all ncurses windows on the screen.
  */
 void del_screen() {
+  cell_grid_free(&VOL_GRID);
+  cell_grid_free(&FREQ_GRID);
   delwin(VOL_WIN);
   delwin(FREQ_WIN);
+  delwin(STATS_WIN);
+  del_waterfall_win();
 }
 
 /**
- * Display the current local maxima on the frequency view window.
+ * Display the given local maxima on the frequency view window.
  * The local maxima are rendered as '_' characters above each x-coordinate
  * on the frequency graph.
+ *
+ * @param current_max Held peak of each of the WIN_WIDTH columns (see ballistics.h).
  */
-void display_current_max() {
-  int initial_x;
-  int initial_y;
-  getyx(FREQ_WIN, initial_y, initial_x);
-
+void display_current_max(const float *current_max) {
   for (int width_index = 0; width_index < WIN_WIDTH; width_index++) {
     int y_pos = 1 +
               FREQ_WIN_HEIGHT -
               (int) ((float) FREQ_WIN_HEIGHT *
               current_max[width_index]);
 
-    wmove(FREQ_WIN, y_pos, width_index);
-    waddch(FREQ_WIN, '_');
+    // Maxima below the bottom row fall outside the grid and are not drawn.
+    cell_grid_put(&FREQ_GRID, y_pos, width_index, '_');
   }
-
-  wmove(FREQ_WIN, initial_y, initial_x);
 }
\ No newline at end of file
@@ -1,3 +1,6 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
 #include "utils.h"
 
 /**
@@ -6,24 +9,6 @@ of the terminal. Increasing y moves the cursor down; increasing x moves
 the cursor to the right.
  */
 
-/**
- * Map representing the recent maximum measurement of the amplitude
- * at each frequency. Each value in the map will be decremented over
- * time until new max is set.
- */
-float current_max[WIN_WIDTH];
-
-/**
- * Fills the current local-max map with 0s (initial state).
- */
-void init_current_max();
-
-/**
- * Decrements each value in the current local-max map by 0.03%.
- * Called every time streamCallBack is returned.
- */
-void decrement_current_max();
-
 /**
  * Initializes the ncurses screen with windows for each section of the view.
  *
@@ -33,7 +18,8 @@ void decrement_current_max();
 void init_screen(int num_chan);
 
 /**
- * Refreshes all ncurses windows on the screen.
+ * Sends the changed cells of the volume and frequency views to ncurses and updates the
+ * terminal once for all windows, the waterfall view included if it is enabled.
  */
 void refresh_screen();
 
@@ -43,8 +29,12 @@ void refresh_screen();
 void del_screen();
 
 /**
- * Display the current local maxima on the frequency view window.
+ * Display the given local maxima on the frequency view window.
  * The local maxima are rendered as '_' characters above each x-coordinate
  * on the frequency graph.
+ *
+ * @param current_max Held peak of each of the WIN_WIDTH columns (see ballistics.h).
  */
-void display_current_max();
\ No newline at end of file
+void display_current_max(const float *current_max);
+
+#endif //DISPLAY_H
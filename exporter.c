@@ -0,0 +1,654 @@
+//
+// Headless export of the analysis and callback statistics as Prometheus text and JSON lines.
+//
+
+#include "exporter.h"
+#include "server.h"
+#include "frequencies.h"
+#include "arena.h"
+
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+/// Callback load quantiles exported for every stream
+static const double LOAD_QUANTILES[] = {0.5, 0.99, 0.999};
+#define NUM_LOAD_QUANTILES ((int) (sizeof(LOAD_QUANTILES) / sizeof(LOAD_QUANTILES[0])))
+
+/**
+ * Sets the default exporter options: no endpoint, no JSON lines, EXPORTER_DEFAULT_RATE exports per
+ * second, with the terminal views.
+ *
+ * @param options Options to initialize.
+ */
+void default_exporter_options(exporterOptions *options) {
+  options->httpPort = NULL;
+  options->jsonPath = NULL;
+  options->rate = EXPORTER_DEFAULT_RATE;
+  options->headless = 0;
+}
+
+/**
+ * Tells whether the options export anything.
+ *
+ * @param options Options to check.
+ * @return Non-zero if an HTTP port or a JSON file is set.
+ */
+int exporter_enabled(const exporterOptions *options) {
+  return options->httpPort != NULL || options->jsonPath != NULL;
+}
+
+/**
+ * Appends formatted text to a buffer of the given size, truncating it if it is full.
+ */
+static void append(char *buffer, size_t size, size_t *length, const char *format, ...) {
+  if (*length + 1 >= size) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(buffer + *length, size - *length, format, args);
+  va_end(args);
+  if (written > 0) {
+    *length += (size_t) written < size - *length ? (size_t) written : size - *length - 1;
+  }
+}
+
+/**
+ * Appends a value in Prometheus notation: NaN, +Inf and -Inf are spelled out.
+ */
+static void append_prometheus_value(char *buffer, size_t size, size_t *length, double value) {
+  if (isnan(value)) {
+    append(buffer, size, length, "NaN\n");
+  } else if (isinf(value)) {
+    append(buffer, size, length, value > 0.0 ? "+Inf\n" : "-Inf\n");
+  } else {
+    append(buffer, size, length, "%.6g\n", value);
+  }
+}
+
+/**
+ * Appends a JSON value; values that are not finite (no audio in the interval, silence in dB) are null.
+ */
+static void append_json_value(char *buffer, size_t size, size_t *length, double value) {
+  if (isfinite(value)) {
+    append(buffer, size, length, "%.6g", value);
+  } else {
+    append(buffer, size, length, "null");
+  }
+}
+
+/**
+ * Copies a stream label escaping backslashes, quotes and newlines, which both Prometheus labels and
+ * JSON strings need; other control characters become spaces.
+ */
+static void escape_label(const char *label, char *escaped, size_t size) {
+  size_t length = 0;
+  for (; *label != '\0' && length + 3 < size; label++) {
+    unsigned char c = (unsigned char) *label;
+    if (c == '\\' || c == '"') {
+      escaped[length++] = '\\';
+      escaped[length++] = (char) c;
+    } else if (c == '\n') {
+      escaped[length++] = '\\';
+      escaped[length++] = 'n';
+    } else {
+      escaped[length++] = c < 0x20 ? ' ' : (char) c;
+    }
+  }
+  escaped[length] = '\0';
+}
+
+/**
+ * Converts a linear level to dBFS; NaN if the interval holds no audio.
+ */
+static double level_db(double level, unsigned long frames) {
+  return frames == 0 ? NAN : 20.0 * log10(level);
+}
+
+/**
+ * Converts a frame-weighted power sum to a mean in dBFS; NaN if the interval holds no audio.
+ */
+static double power_db(double power, unsigned long frames) {
+  return frames == 0 ? NAN : 10.0 * log10(power / (double) frames);
+}
+
+/**
+ * Sample rate of a stream, in Hz.
+ */
+static double stream_rate(const dispatchStream *stream) {
+  return ((const streamCallbackData *) stream->spectroData)->options.sampleRate;
+}
+
+/**
+ * Share of real time the analysis of the interval took; NaN if the interval holds no audio.
+ */
+static double interval_load(const metricsInterval *interval, double sampleRate) {
+  double audioNs = (double) interval->frames * 1e9 / sampleRate;
+  return audioNs > 0.0 ? (double) interval->analysisNs / audioNs : NAN;
+}
+
+/**
+ * Mean capture-to-output latency reported for a stream, in seconds; NaN before the first report.
+ */
+static double mean_latency(const callbackStats *stats) {
+  uint64_t samples = atomic_load_explicit(&stats->latencySamples, memory_order_relaxed);
+  return samples > 0 ? (double) atomic_load_explicit(&stats->sumLatencyUs, memory_order_relaxed) /
+                       (double) samples / 1e6
+                     : NAN;
+}
+
+/**
+ * Appends the HELP and TYPE lines of a Prometheus metric.
+ */
+static void metric_header(metricsExporter *exporter, const char *name, const char *type, const char *help) {
+  append(exporter->page, exporter->bufferSize, &exporter->pageLength, "# HELP audio_analyzer_%s %s\n", name, help);
+  append(exporter->page, exporter->bufferSize, &exporter->pageLength, "# TYPE audio_analyzer_%s %s\n", name, type);
+}
+
+/**
+ * Appends one sample of a Prometheus metric labelled with the stream and, if extra is not NULL,
+ * further labels, e.g. channel="1".
+ */
+static void metric_sample(metricsExporter *exporter, const char *name, int stream, const char *extra, double value) {
+  append(exporter->page, exporter->bufferSize, &exporter->pageLength, "audio_analyzer_%s{device=\"%s\"%s%s} ", name,
+         exporter->labels[stream], extra != NULL ? "," : "", extra != NULL ? extra : "");
+  append_prometheus_value(exporter->page, exporter->bufferSize, &exporter->pageLength, value);
+}
+
+/**
+ * Appends the per-channel level metrics of every stream.
+ */
+static void page_levels(metricsExporter *exporter) {
+  static const char *const names[] = {"peak_dbfs", "true_peak_dbfs", "rms_dbfs", "dc_offset"};
+  static const char *const helps[] = {
+      "Largest sample of the channel during the last export interval, in dBFS.",
+      "Largest 4x-oversampled sample of the channel during the last export interval, in dBFS.",
+      "RMS level of the channel over the last export interval, in dBFS.",
+      "Mean of the samples of the channel over the last export interval, relative to full scale."
+  };
+
+  char extra[32];
+  for (int metric = 0; metric < 4; metric++) {
+    metric_header(exporter, names[metric], "gauge", helps[metric]);
+    for (int s = 0; s < exporter->numStreams; s++) {
+      const metricsInterval *interval = &exporter->intervals[s];
+      unsigned long frames = interval->frames;
+      for (int c = 0; c < exporter->streams[s]->numChannels; c++) {
+        double value;
+        if (metric == 0) {
+          value = level_db(interval->peak[c], frames);
+        } else if (metric == 1) {
+          value = level_db(interval->truePeak[c], frames);
+        } else if (metric == 2) {
+          value = power_db(interval->energy[c], frames);
+        } else {
+          value = frames == 0 ? NAN : interval->dc[c] / (double) frames;
+        }
+        snprintf(extra, sizeof(extra), "channel=\"%d\"", c + 1);
+        metric_sample(exporter, names[metric], s, extra, value);
+      }
+    }
+  }
+}
+
+/**
+ * Appends the octave band power of every spectrum of every stream.
+ */
+static void page_bands(metricsExporter *exporter) {
+  metric_header(exporter, "band_power_dbfs", "gauge",
+                "Mean power of the octave band centred on band_hz over the last export interval, in dBFS.");
+  char label[32];
+  char extra[96];
+  for (int s = 0; s < exporter->numStreams; s++) {
+    const streamCallbackData *spectroData = (const streamCallbackData *) exporter->streams[s]->spectroData;
+    const metricsInterval *interval = &exporter->intervals[s];
+    for (int spectrum = 0; spectrum < spectroData->numSpectra; spectrum++) {
+      spectrum_label(spectroData, spectrum, label, sizeof(label));
+      for (int band = 0; band < METRICS_BANDS; band++) {
+        snprintf(extra, sizeof(extra), "spectrum=\"%s\",band_hz=\"%g\"", label,
+                 METRICS_LOWEST_BAND * (double) (1 << band));
+        metric_sample(exporter, "band_power_dbfs", s, extra,
+                      power_db(interval->bandPower[(size_t) spectrum * METRICS_BANDS + band], interval->frames));
+      }
+    }
+  }
+}
+
+/**
+ * Appends the loudness, callback, xrun and load metrics of every stream.
+ */
+static void page_streams(metricsExporter *exporter) {
+  static const char *const windows[] = {"momentary", "short_term", "integrated", "max_momentary"};
+  static const char *const xruns[] = {"input_overflow", "input_underflow", "output_underflow", "output_overflow"};
+  char extra[64];
+
+  metric_header(exporter, "loudness_lufs", "gauge", "EBU R128 loudness of the stream, in LUFS.");
+  for (int s = 0; s < exporter->numStreams; s++) {
+    const loudnessLevels *loudness = &exporter->intervals[s].loudness;
+    double values[] = {loudness->momentary, loudness->shortTerm, loudness->integrated, loudness->maxMomentary};
+    for (int w = 0; w < 4; w++) {
+      snprintf(extra, sizeof(extra), "window=\"%s\"", windows[w]);
+      metric_sample(exporter, "loudness_lufs", s, extra, values[w]);
+    }
+  }
+  metric_header(exporter, "loudness_range_lu", "gauge", "EBU Tech 3342 loudness range of the stream, in LU.");
+  for (int s = 0; s < exporter->numStreams; s++) {
+    metric_sample(exporter, "loudness_range_lu", s, NULL, exporter->intervals[s].loudness.range);
+  }
+
+  metric_header(exporter, "callbacks_total", "counter", "Audio callbacks run since the stream started.");
+  for (int s = 0; s < exporter->numStreams; s++) {
+    metric_sample(exporter, "callbacks_total", s, NULL,
+                  (double) atomic_load_explicit(&exporter->streams[s]->stats.callbacks, memory_order_relaxed));
+  }
+  metric_header(exporter, "xruns_total", "counter", "Callbacks flagged with an overflow or underflow by PortAudio.");
+  for (int s = 0; s < exporter->numStreams; s++) {
+    const callbackStats *stats = &exporter->streams[s]->stats;
+    uint64_t counts[] = {
+        atomic_load_explicit(&stats->inputOverflows, memory_order_relaxed),
+        atomic_load_explicit(&stats->inputUnderflows, memory_order_relaxed),
+        atomic_load_explicit(&stats->outputUnderflows, memory_order_relaxed),
+        atomic_load_explicit(&stats->outputOverflows, memory_order_relaxed)
+    };
+    for (int x = 0; x < 4; x++) {
+      snprintf(extra, sizeof(extra), "kind=\"%s\"", xruns[x]);
+      metric_sample(exporter, "xruns_total", s, extra, (double) counts[x]);
+    }
+  }
+  metric_header(exporter, "dropped_blocks_total", "counter",
+                "Captured blocks dropped because the analysis fell behind.");
+  for (int s = 0; s < exporter->numStreams; s++) {
+    metric_sample(exporter, "dropped_blocks_total", s, NULL, (double) dispatch_dropped_blocks(exporter->streams[s]));
+  }
+
+  metric_header(exporter, "callback_load", "gauge",
+                "Callback wall time at the quantile as a share of the buffer period, since the stream started.");
+  for (int s = 0; s < exporter->numStreams; s++) {
+    for (int q = 0; q < NUM_LOAD_QUANTILES; q++) {
+      snprintf(extra, sizeof(extra), "quantile=\"%g\"", LOAD_QUANTILES[q]);
+      metric_sample(exporter, "callback_load", s, extra,
+                    callback_load_percentile(&exporter->streams[s]->stats, LOAD_QUANTILES[q]));
+    }
+  }
+  metric_header(exporter, "callback_max_seconds", "gauge", "Longest audio callback since the stream started.");
+  for (int s = 0; s < exporter->numStreams; s++) {
+    metric_sample(exporter, "callback_max_seconds", s, NULL,
+                  (double) atomic_load_explicit(&exporter->streams[s]->stats.maxCallbackNs, memory_order_relaxed) /
+                  1e9);
+  }
+  metric_header(exporter, "latency_seconds", "gauge", "Mean capture-to-output latency reported by PortAudio.");
+  for (int s = 0; s < exporter->numStreams; s++) {
+    metric_sample(exporter, "latency_seconds", s, NULL, mean_latency(&exporter->streams[s]->stats));
+  }
+  metric_header(exporter, "analysis_load", "gauge",
+                "Share of real time the analysis of the stream took during the last export interval.");
+  for (int s = 0; s < exporter->numStreams; s++) {
+    metric_sample(exporter, "analysis_load", s, NULL,
+                  interval_load(&exporter->intervals[s], stream_rate(exporter->streams[s])));
+  }
+}
+
+/**
+ * Writes the JSON line of an export covering the given number of seconds.
+ */
+static void write_json_line(metricsExporter *exporter, double seconds) {
+  char *line = exporter->line;
+  size_t size = exporter->bufferSize;
+  size_t length = 0;
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  append(line, size, &length, "{\"time\":%.3f,\"interval\":%.3f,\"bandsHz\":[",
+         (double) now.tv_sec + (double) now.tv_nsec / 1e9, seconds);
+  for (int band = 0; band < METRICS_BANDS; band++) {
+    append(line, size, &length, band > 0 ? ",%g" : "%g", METRICS_LOWEST_BAND * (double) (1 << band));
+  }
+  append(line, size, &length, "],\"devices\":[");
+
+  char label[32];
+  for (int s = 0; s < exporter->numStreams; s++) {
+    const dispatchStream *stream = exporter->streams[s];
+    const streamCallbackData *spectroData = (const streamCallbackData *) stream->spectroData;
+    const metricsInterval *interval = &exporter->intervals[s];
+    const callbackStats *stats = &stream->stats;
+    unsigned long frames = interval->frames;
+
+    append(line, size, &length, "%s{\"device\":\"%s\",\"frames\":%lu,\"channels\":[", s > 0 ? "," : "",
+           exporter->labels[s], frames);
+    for (int c = 0; c < stream->numChannels; c++) {
+      append(line, size, &length, "%s{\"peak\":", c > 0 ? "," : "");
+      append_json_value(line, size, &length, level_db(interval->peak[c], frames));
+      append(line, size, &length, ",\"truePeak\":");
+      append_json_value(line, size, &length, level_db(interval->truePeak[c], frames));
+      append(line, size, &length, ",\"rms\":");
+      append_json_value(line, size, &length, power_db(interval->energy[c], frames));
+      append(line, size, &length, ",\"dc\":");
+      append_json_value(line, size, &length, frames == 0 ? NAN : interval->dc[c] / (double) frames);
+      append(line, size, &length, "}");
+    }
+
+    append(line, size, &length, "],\"spectra\":[");
+    for (int spectrum = 0; spectrum < spectroData->numSpectra; spectrum++) {
+      spectrum_label(spectroData, spectrum, label, sizeof(label));
+      append(line, size, &length, "%s{\"name\":\"%s\",\"bands\":[", spectrum > 0 ? "," : "", label);
+      for (int band = 0; band < METRICS_BANDS; band++) {
+        append(line, size, &length, band > 0 ? "," : "");
+        append_json_value(line, size, &length,
+                          power_db(interval->bandPower[(size_t) spectrum * METRICS_BANDS + band], frames));
+      }
+      append(line, size, &length, "]}");
+    }
+
+    const loudnessLevels *loudness = &interval->loudness;
+    append(line, size, &length, "],\"loudness\":{\"momentary\":");
+    append_json_value(line, size, &length, loudness->momentary);
+    append(line, size, &length, ",\"shortTerm\":");
+    append_json_value(line, size, &length, loudness->shortTerm);
+    append(line, size, &length, ",\"integrated\":");
+    append_json_value(line, size, &length, loudness->integrated);
+    append(line, size, &length, ",\"range\":");
+    append_json_value(line, size, &length, loudness->range);
+    append(line, size, &length, ",\"maxMomentary\":");
+    append_json_value(line, size, &length, loudness->maxMomentary);
+
+    append(line, size, &length,
+           "},\"callbacks\":%llu,\"xruns\":{\"inputOverflow\":%llu,\"inputUnderflow\":%llu,"
+           "\"outputUnderflow\":%llu,\"outputOverflow\":%llu},\"droppedBlocks\":%lu,\"callbackLoad\":{",
+           (unsigned long long) atomic_load_explicit(&stats->callbacks, memory_order_relaxed),
+           (unsigned long long) atomic_load_explicit(&stats->inputOverflows, memory_order_relaxed),
+           (unsigned long long) atomic_load_explicit(&stats->inputUnderflows, memory_order_relaxed),
+           (unsigned long long) atomic_load_explicit(&stats->outputUnderflows, memory_order_relaxed),
+           (unsigned long long) atomic_load_explicit(&stats->outputOverflows, memory_order_relaxed),
+           dispatch_dropped_blocks((dispatchStream *) stream));
+    for (int q = 0; q < NUM_LOAD_QUANTILES; q++) {
+      append(line, size, &length, "%s\"%g\":", q > 0 ? "," : "", LOAD_QUANTILES[q]);
+      append_json_value(line, size, &length, callback_load_percentile(stats, LOAD_QUANTILES[q]));
+    }
+    append(line, size, &length, "},\"callbackMaxSeconds\":");
+    append_json_value(line, size, &length,
+                      (double) atomic_load_explicit(&stats->maxCallbackNs, memory_order_relaxed) / 1e9);
+    append(line, size, &length, ",\"latencySeconds\":");
+    append_json_value(line, size, &length, mean_latency(stats));
+    append(line, size, &length, ",\"analysisLoad\":");
+    append_json_value(line, size, &length, interval_load(interval, stream_rate(stream)));
+    append(line, size, &length, "}");
+  }
+  append(line, size, &length, "]}\n");
+
+  fputs(line, exporter->json);
+  fflush(exporter->json);
+}
+
+/**
+ * Takes the interval of every stream and exports it: writes the JSON line and rebuilds the page
+ * served to scrapers.
+ */
+static void export_metrics(metricsExporter *exporter) {
+  uint64_t nowNs = callback_clock_ns();
+  double seconds = (double) (nowNs - exporter->lastExportNs) / 1e9;
+  exporter->lastExportNs = nowNs;
+  for (int s = 0; s < exporter->numStreams; s++) {
+    metrics_take(&exporter->streams[s]->metrics, &exporter->intervals[s]);
+  }
+
+  if (exporter->listenFd >= 0) {
+    exporter->pageLength = 0;
+    page_levels(exporter);
+    page_bands(exporter);
+    page_streams(exporter);
+  }
+  if (exporter->json != NULL) {
+    write_json_line(exporter, seconds);
+  }
+  exporter->exports++;
+}
+
+/**
+ * Sends the whole buffer, waiting at most EXPORTER_IO_TIMEOUT_MS each time the socket is full.
+ *
+ * @return 0 on success, -1 if the scraper went away or stalled.
+ */
+static int send_all(int fd, const char *data, size_t length) {
+  while (length > 0) {
+    ssize_t sent = send(fd, data, length, SEND_FLAGS);
+    if (sent < 0 && errno == EINTR) {
+      continue;
+    }
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      struct pollfd writable = {fd, POLLOUT, 0};
+      if (poll(&writable, 1, EXPORTER_IO_TIMEOUT_MS) <= 0) {
+        return -1;
+      }
+      continue;
+    }
+    if (sent <= 0) {
+      return -1;
+    }
+    data += sent;
+    length -= (size_t) sent;
+  }
+  return 0;
+}
+
+/**
+ * Accepts a scraper and answers its request with the page of the last export (GET /metrics or
+ * GET /) or a 404, then closes the connection.
+ */
+static void serve_scrape(metricsExporter *exporter) {
+  int fd = accept(exporter->listenFd, NULL, NULL);
+  if (fd < 0) {
+    return;
+  }
+#ifdef SO_NOSIGPIPE
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+  // Read up to the end of the headers, so that closing the socket does not reset the connection.
+  char request[EXPORTER_REQUEST_SIZE];
+  size_t length = 0;
+  struct pollfd readable = {fd, POLLIN, 0};
+  request[0] = '\0';
+  while (length + 1 < sizeof(request) && strstr(request, "\r\n\r\n") == NULL &&
+         poll(&readable, 1, EXPORTER_IO_TIMEOUT_MS) > 0) {
+    ssize_t received = recv(fd, request + length, sizeof(request) - 1 - length, 0);
+    if (received <= 0) {
+      break;
+    }
+    length += (size_t) received;
+    request[length] = '\0';
+  }
+
+  int found = strncmp(request, "GET /metrics ", strlen("GET /metrics ")) == 0 ||
+              strncmp(request, "GET / ", strlen("GET / ")) == 0;
+  const char *body = found ? exporter->page : "Not found\n";
+  size_t bodyLength = found ? exporter->pageLength : strlen(body);
+  char header[192];
+  int headerLength = snprintf(header, sizeof(header),
+                              "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                              "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                              found ? "200 OK" : "404 Not Found", bodyLength);
+  if (send_all(fd, header, (size_t) headerLength) == 0) {
+    send_all(fd, body, bodyLength);
+  }
+  close(fd);
+  exporter->scrapes++;
+}
+
+/**
+ * Exporter thread: exports rate times per second and serves the scrapes in between.
+ */
+static void *exporter_loop(void *arg) {
+  metricsExporter *exporter = (metricsExporter *) arg;
+  uint64_t periodNs = (uint64_t) (1e9 / exporter->options.rate);
+  uint64_t nextNs = exporter->lastExportNs + periodNs;
+
+  while (!atomic_load(&exporter->stop)) {
+    uint64_t nowNs = callback_clock_ns();
+    if (nowNs >= nextNs) {
+      export_metrics(exporter);
+      // Skip the exports missed while the thread was held up rather than catching up on them.
+      nextNs = nextNs + periodNs > nowNs ? nextNs + periodNs : nowNs + periodNs;
+      continue;
+    }
+
+    uint64_t waitMs = (nextNs - nowNs) / 1000000 + 1;
+    int timeout = waitMs < EXPORTER_POLL_MS ? (int) waitMs : EXPORTER_POLL_MS;
+    if (exporter->listenFd >= 0) {
+      struct pollfd listening = {exporter->listenFd, POLLIN, 0};
+      if (poll(&listening, 1, timeout) > 0) {
+        serve_scrape(exporter);
+      }
+    } else {
+      struct timespec wait = {0, (long) timeout * 1000000L};
+      nanosleep(&wait, NULL);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Binds the HTTP endpoint and opens the JSON file, so that bad options fail before the session
+ * starts. Nothing is exported until start_exporter.
+ *
+ * @param exporter Exporter to open.
+ * @param options Where and how often to export; see exporter_enabled.
+ * @return 0 on success, -1 if the port could not be bound, the file could not be opened or the
+ *         options are invalid.
+ */
+int open_exporter(metricsExporter *exporter, const exporterOptions *options) {
+  memset(exporter, 0, sizeof(*exporter));
+  exporter->options = *options;
+  exporter->listenFd = -1;
+  if (!(options->rate > 0.0)) {
+    printf("The export rate must be positive.\n");
+    return -1;
+  }
+  if (options->jsonPath != NULL && strcmp(options->jsonPath, "-") == 0 && !options->headless) {
+    printf("JSON lines can only be written to stdout with --headless.\n");
+    return -1;
+  }
+
+  if (options->httpPort != NULL) {
+    exporter->listenFd = open_listen_socket(options->httpPort);
+    if (exporter->listenFd < 0) {
+      perror("Could not listen for metrics scrapers");
+      return -1;
+    }
+    struct sockaddr_in address;
+    socklen_t addressLength = sizeof(address);
+    getsockname(exporter->listenFd, (struct sockaddr *) &address, &addressLength);
+    exporter->port = ntohs(address.sin_port);
+  }
+
+  if (options->jsonPath != NULL) {
+    exporter->json = strcmp(options->jsonPath, "-") == 0 ? stdout : fopen(options->jsonPath, "a");
+    if (exporter->json == NULL) {
+      perror(options->jsonPath);
+      stop_exporter(exporter);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Allocates the export buffers and starts the exporter thread. The streams must have been
+ * initialized with their metrics enabled (see set_dispatch_metrics).
+ *
+ * @param exporter Open exporter.
+ * @param streams Streams to export; they must outlive the exporter thread.
+ * @param numStreams Number of streams, at most DISPATCH_MAX_STREAMS.
+ * @return 0 on success, -1 if memory could not be allocated or the thread could not be started.
+ */
+int start_exporter(metricsExporter *exporter, dispatchStream *const *streams, int numStreams) {
+  size_t bufferSize = 0;
+  for (int s = 0; s < numStreams; s++) {
+    const dispatchStream *stream = streams[s];
+    int numSpectra = ((const streamCallbackData *) stream->spectroData)->numSpectra;
+    exporter->streams[s] = streams[s];
+    escape_label(stream->label, exporter->labels[s], sizeof(exporter->labels[s]));
+    if (metrics_interval_init(&exporter->intervals[s], stream->numChannels, numSpectra) != 0) {
+      return -1;
+    }
+    exporter->numStreams = s + 1;
+    bufferSize += EXPORTER_STREAM_BYTES + (size_t) stream->numChannels * EXPORTER_CHANNEL_BYTES +
+                  (size_t) numSpectra * METRICS_BANDS * EXPORTER_BAND_BYTES;
+  }
+
+  exporter->bufferSize = bufferSize;
+  exporter->page = (char *) session_calloc(bufferSize, 1);
+  exporter->line = (char *) session_calloc(bufferSize, 1);
+  if (exporter->page == NULL || exporter->line == NULL) {
+    return -1;
+  }
+
+  exporter->lastExportNs = callback_clock_ns();
+  atomic_init(&exporter->stop, 0);
+  if (pthread_create(&exporter->thread, NULL, exporter_loop, exporter) != 0) {
+    return -1;
+  }
+  exporter->running = 1;
+  return 0;
+}
+
+/**
+ * Stops the exporter thread, exports the last interval and closes the endpoint and the file.
+ * Nothing happens if the exporter was never opened.
+ *
+ * @param exporter Exporter to stop.
+ */
+void stop_exporter(metricsExporter *exporter) {
+  if (exporter->running) {
+    atomic_store(&exporter->stop, 1);
+    pthread_join(exporter->thread, NULL);
+    exporter->running = 0;
+    export_metrics(exporter);
+  }
+
+  if (exporter->listenFd >= 0) {
+    close(exporter->listenFd);
+    exporter->listenFd = -1;
+  }
+  if (exporter->json != NULL && exporter->json != stdout) {
+    fclose(exporter->json);
+  }
+  exporter->json = NULL;
+
+  for (int s = 0; s < exporter->numStreams; s++) {
+    metrics_interval_free(&exporter->intervals[s]);
+  }
+  exporter->numStreams = 0;
+  session_free(exporter->page);
+  session_free(exporter->line);
+  exporter->page = NULL;
+  exporter->line = NULL;
+}
+
+/**
+ * Prints the number of exports and scrapes, e.g. after the session has ended.
+ *
+ * @param exporter Stopped exporter.
+ * @param file File to print to.
+ */
+void print_exporter_stats(const metricsExporter *exporter, FILE *file) {
+  fprintf(file, "Metrics: %lu exports", exporter->exports);
+  if (exporter->options.httpPort != NULL) {
+    fprintf(file, ", %lu scrapes on port %d", exporter->scrapes, exporter->port);
+  }
+  fprintf(file, "\n");
+}
@@ -0,0 +1,147 @@
+//
+// Headless export of the analysis and callback statistics as Prometheus text and JSON lines.
+//
+
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "dispatch.h"
+#include "metrics.h"
+
+/// Default number of exports per second
+#define EXPORTER_DEFAULT_RATE 1.0
+
+/// Milliseconds the exporter thread waits at most before checking for a stop request
+#define EXPORTER_POLL_MS 100
+
+/// Largest HTTP request read from a scraper; only its request line is looked at
+#define EXPORTER_REQUEST_SIZE 2048
+
+/// Milliseconds a scraper may take to send its request or receive the page before it is closed
+#define EXPORTER_IO_TIMEOUT_MS 500
+
+/// Bytes of exported text reserved per stream, per channel and per octave band of a spectrum
+#define EXPORTER_STREAM_BYTES 8192
+#define EXPORTER_CHANNEL_BYTES 1024
+#define EXPORTER_BAND_BYTES 256
+
+/**
+ * Where and how often the statistics are exported.
+ */
+typedef struct {
+
+  /// Port serving the latest export as Prometheus text on GET /metrics, or NULL for none.
+  const char *httpPort;
+
+  /// File every export is appended to as one JSON line, "-" for stdout, or NULL for none.
+  const char *jsonPath;
+
+  /// Exports per second.
+  double rate;
+
+  /// Non-zero to run the session without ncurses: no views, no keys, and the session ends on
+  /// SIGINT or SIGTERM.
+  int headless;
+} exporterOptions;
+
+/**
+ * Exporter of the statistics of every stream of a session. At every interval its thread takes the
+ * interval accumulated by each stream (see metrics.h) and reads the callback statistics, formats
+ * them once into preallocated buffers, appends the JSON line and keeps the Prometheus page for the
+ * scrapes of the next interval. Neither the audio callback nor the render thread waits for it.
+ */
+typedef struct {
+  exporterOptions options;
+
+  /// Listening socket of the HTTP endpoint and the port it is bound to, or -1 without one.
+  int listenFd;
+  int port;
+
+  /// File the JSON lines are written to, or NULL.
+  FILE *json;
+
+  /// Exported streams and the last interval taken from each.
+  dispatchStream *streams[DISPATCH_MAX_STREAMS];
+  metricsInterval intervals[DISPATCH_MAX_STREAMS];
+  int numStreams;
+
+  /// Label of every stream escaped for Prometheus labels and JSON strings.
+  char labels[DISPATCH_MAX_STREAMS][2 * DISPATCH_LABEL_SIZE];
+
+  /// Prometheus page of the last export and the buffer of the JSON line, both bufferSize bytes.
+  char *page;
+  size_t pageLength;
+  char *line;
+  size_t bufferSize;
+
+  /// CLOCK_MONOTONIC time of the last export, in nanoseconds.
+  uint64_t lastExportNs;
+
+  /// Number of exports and of scrapes served.
+  unsigned long exports;
+  unsigned long scrapes;
+
+  pthread_t thread;
+  _Atomic int stop;
+  int running;
+} metricsExporter;
+
+/**
+ * Sets the default exporter options: no endpoint, no JSON lines, EXPORTER_DEFAULT_RATE exports per
+ * second, with the terminal views.
+ *
+ * @param options Options to initialize.
+ */
+void default_exporter_options(exporterOptions *options);
+
+/**
+ * Tells whether the options export anything.
+ *
+ * @param options Options to check.
+ * @return Non-zero if an HTTP port or a JSON file is set.
+ */
+int exporter_enabled(const exporterOptions *options);
+
+/**
+ * Binds the HTTP endpoint and opens the JSON file, so that bad options fail before the session
+ * starts. Nothing is exported until start_exporter.
+ *
+ * @param exporter Exporter to open.
+ * @param options Where and how often to export; see exporter_enabled.
+ * @return 0 on success, -1 if the port could not be bound, the file could not be opened or the
+ *         options are invalid.
+ */
+int open_exporter(metricsExporter *exporter, const exporterOptions *options);
+
+/**
+ * Allocates the export buffers and starts the exporter thread. The streams must have been
+ * initialized with their metrics enabled (see set_dispatch_metrics).
+ *
+ * @param exporter Open exporter.
+ * @param streams Streams to export; they must outlive the exporter thread.
+ * @param numStreams Number of streams, at most DISPATCH_MAX_STREAMS.
+ * @return 0 on success, -1 if memory could not be allocated or the thread could not be started.
+ */
+int start_exporter(metricsExporter *exporter, dispatchStream *const *streams, int numStreams);
+
+/**
+ * Stops the exporter thread, exports the last interval and closes the endpoint and the file.
+ * Nothing happens if the exporter was never opened.
+ *
+ * @param exporter Exporter to stop.
+ */
+void stop_exporter(metricsExporter *exporter);
+
+/**
+ * Prints the number of exports and scrapes, e.g. after the session has ended.
+ *
+ * @param exporter Stopped exporter.
+ * @param file File to print to.
+ */
+void print_exporter_stats(const metricsExporter *exporter, FILE *file);
+
+#endif //EXPORTER_H
@@ -2,7 +2,12 @@
 #include <math.h>
 #include "display.h"
 #include <stdlib.h>
+#include <string.h>
 #include "frequencies.h"
+#include "arena.h"
+
+WINDOW *FREQ_WIN;
+cellGrid FREQ_GRID;
 
 /**
  * Initializes the frequency display window using ncurses, given the number
@@ -13,106 +18,479 @@
  */
 void init_freq_win(int num_chan) {
   FREQ_WIN = newwin(FREQ_WIN_HEIGHT, WIN_WIDTH, num_chan + 1 + MARGIN, 0);
-  waddstr(FREQ_WIN, "Frequencies:\n");
+  if (cell_grid_init(&FREQ_GRID, FREQ_WIN) != 0) {
+    endwin();
+    printf("Could not allocate the frequency view.\n");
+    exit(EXIT_FAILURE);
+  }
+  cell_grid_print_line(&FREQ_GRID, 0, 0, "Frequencies:");
 }
 
 /**
- * Renders the volume representation of the given input buffer.
- * The volume is rendered as a line of '=' characters of length
- * between 0 and WIN_WIDTH.
- *
- * @param inputBuffer Input buffer to compute and render the frequencies for.
- * @param framesPerBuffer Number of frames in the buffer.
- * @param userData Callback data used for FFT computations.
+ * De-interleaves the given rows of the input into one contiguous row of rowStride samples per spectrum:
+ * a channel, or one of the mixed-down views computed from all channels. Only the first
+ * frames samples of each row are written. Always inlined, so that the kernels below compile it
+ * with a constant frame count.
  */
-void streamCallBackFrequencies(
-    const void *inputBuffer, void *outputBuffer, unsigned long framesPerBuffer,
-    void *userData
+static inline __attribute__((always_inline)) void deinterleave_rows(
+    const float *in, unsigned long frames, int numChannels, double *rows, unsigned long rowStride,
+    int firstRow, int endRow
 ) {
-  float *in = (float *) inputBuffer;
-  float *out = (float *) outputBuffer;
+  for (int row = firstRow; row < endRow && row < numChannels; row++) {
+    double *out = rows + (size_t) row * rowStride;
+    for (unsigned long i = 0; i < frames; i++) {
+      out[i] = in[i * numChannels + row];
+    }
+  }
 
-  const int NUM_OUTPUT_CHANNELS = num_output_channels;
+  for (int row = firstRow > numChannels ? firstRow : numChannels; row < endRow; row++) {
+    double *mix = rows + (size_t) row * rowStride;
+    if (numChannels == 2) {
+      // Mid, then side.
+      double sign = row == numChannels ? 1.0 : -1.0;
+      for (unsigned long i = 0; i < frames; i++) {
+        mix[i] = 0.5 * ((double) in[2 * i] + sign * (double) in[2 * i + 1]);
+      }
+      continue;
+    }
 
-  streamCallbackData *callbackData = (streamCallbackData *) userData;
+    double scale = 1.0 / numChannels;
+    for (unsigned long i = 0; i < frames; i++) {
+      const float *frame = in + i * numChannels;
+      double sum = frame[0];
+      for (int channelNum = 1; channelNum < numChannels; channelNum++) {
+        sum += frame[channelNum];
+      }
+      mix[i] = sum * scale;
+    }
+  }
+}
 
-  for (unsigned long i = 0; i < framesPerBuffer; i++) {
-    callbackData->in[i] = in[i * 2];
+/**
+ * De-interleaves a buffer of any size.
+ */
+static void deinterleave_generic(const float *in, unsigned long frames, int numChannels, double *rows,
+                                 unsigned long rowStride, int firstRow, int endRow) {
+  deinterleave_rows(in, frames, numChannels, rows, rowStride, firstRow, endRow);
+}
+
+/// Defines deinterleave_<frames>, which only takes full buffers of rows of exactly that many frames,
+/// so the compiler can unroll and vectorize the loops without remainder handling
+#define DEINTERLEAVE_KERNEL(size)                                                                     \
+  static void deinterleave_##size(const float *in, unsigned long frames, int numChannels, double *rows, \
+                                  unsigned long rowStride, int firstRow, int endRow) {                \
+    (void) frames;                                                                                    \
+    (void) rowStride;                                                                                 \
+    deinterleave_rows(in, size, numChannels, rows, size, firstRow, endRow);                           \
   }
 
-  int initial_x;
-  int initial_y;
-  getyx(FREQ_WIN, initial_y, initial_x);
+DEINTERLEAVE_KERNEL(64)
+DEINTERLEAVE_KERNEL(128)
+DEINTERLEAVE_KERNEL(256)
+DEINTERLEAVE_KERNEL(512)
+DEINTERLEAVE_KERNEL(1024)
+DEINTERLEAVE_KERNEL(2048)
+DEINTERLEAVE_KERNEL(4096)
 
-  fftw_execute(callbackData->p);
+/**
+ * Chooses the de-interleaving kernel of full buffers of the given size.
+ *
+ * @return The kernel specialized for the size, or the generic one if there is none.
+ */
+static deinterleaveKernel select_deinterleave_kernel(int framesPerBuffer) {
+  static const deinterleaveKernel kernels[] = {
+      deinterleave_64, deinterleave_128, deinterleave_256, deinterleave_512,
+      deinterleave_1024, deinterleave_2048, deinterleave_4096
+  };
 
-  for (int i = 0; i < WIN_WIDTH; i++) {
-    float freq = powf((float)i / ((float) WIN_WIDTH), 2);
-    double proportion = callbackData->out[
-      (int)((float)callbackData->startIndex +
-        freq * (float)callbackData->spectroSize)
-      ] / 5;
-
-    if (fabs(proportion) > current_max[i]) {
-      current_max[i] = (float)fmin(fabs(proportion), 1.0);
+  int index = 0;
+  for (int size = SPECTRO_KERNEL_MIN_FRAMES; size <= SPECTRO_KERNEL_MAX_FRAMES; size *= 2, index++) {
+    if (size == framesPerBuffer) {
+      return kernels[index];
     }
+  }
+  return deinterleave_generic;
+}
 
-    for (unsigned long i = 0;
-      i < framesPerBuffer * NUM_OUTPUT_CHANNELS;
-      i += NUM_OUTPUT_CHANNELS) {
-      for (unsigned long channelNum = 0;
-        channelNum < NUM_OUTPUT_CHANNELS;
-        channelNum++) {
-        *out++ = in[i];
-        *out++ = in[i];
-      }
+/**
+ * Computes the columns of the rows of one shard, as compute_frequencies does for all of them.
+ * Shards only read the input and write their own rows, so different shards of the same buffer
+ * can be computed on different threads.
+ *
+ * @param in Interleaved input samples.
+ * @param framesPerBuffer Number of frames in the buffer; at most options.framesPerBuffer.
+ * @param callbackData Spectro data used for FFT computations.
+ * @param shard Index of the shard.
+ * @param proportions Output array of numSpectra * WIN_WIDTH column amplitudes; only the rows of
+ *        the shard are written.
+ */
+void compute_frequency_shard(
+    const float *in, unsigned long framesPerBuffer, streamCallbackData *callbackData, int shard, double *proportions
+) {
+  int firstRow = callbackData->shardRows[shard];
+  int endRow = callbackData->shardRows[shard + 1];
+  unsigned long rowStride = (unsigned long) callbackData->options.framesPerBuffer;
+
+  // Short buffers (the end of a file, a host handing over fewer frames) take the generic loop.
+  deinterleaveKernel deinterleave = framesPerBuffer == rowStride ? callbackData->deinterleave : deinterleave_generic;
+  deinterleave(in, framesPerBuffer, callbackData->numChannels, callbackData->in, rowStride, firstRow, endRow);
+
+  stftEngine *stft = &callbackData->shards[shard];
+  stft_push(stft, callbackData->in + (size_t) firstRow * rowStride, (int) rowStride, (int) framesPerBuffer);
+
+  for (int spectrum = firstRow; spectrum < endRow; spectrum++) {
+    double *row = proportions + (size_t) spectrum * WIN_WIDTH;
+    band_map_apply(&callbackData->bands, stft->power + (size_t) (spectrum - firstRow) * stft->numBins, row);
+
+    for (int i = 0; i < WIN_WIDTH; i++) {
+      double level = row[i] > 0.0 ? 10.0 * log10(row[i]) : SPECTRO_DB_FLOOR;
+      row[i] = fmax(0.0, fmin(1.0, 1.0 - level / SPECTRO_DB_FLOOR));
     }
+  }
+}
+
+/**
+ * Computes the amplitude shown in each of the WIN_WIDTH columns of the frequency view
+ * for every spectrum (each channel, then the mixed-down views) of the given buffer.
+ * The buffer is appended to the STFT history; the columns show the bins of the latest
+ * STFT frame reduced through the band map, on a dB scale from SPECTRO_DB_FLOOR (0) to 0 dBFS (1).
+ * Shared by the live display and the offline analysis so both produce identical spectra.
+ *
+ * @param in Interleaved input samples.
+ * @param framesPerBuffer Number of frames in the buffer; at most options.framesPerBuffer.
+ * @param num_input_channels Number of interleaved channels in the buffer; must match the spectro data.
+ * @param callbackData Spectro data used for FFT computations.
+ * @param proportions Output array of numSpectra * WIN_WIDTH column amplitudes, one row per spectrum.
+ */
+void compute_frequencies(
+    const float *in, unsigned long framesPerBuffer, int num_input_channels,
+    streamCallbackData *callbackData, double *proportions
+) {
+  (void) num_input_channels;
+  if (framesPerBuffer > (unsigned long) callbackData->options.framesPerBuffer) {
+    framesPerBuffer = (unsigned long) callbackData->options.framesPerBuffer;
+  }
+
+  band_map_resize(&callbackData->bands, WIN_WIDTH, callbackData->shards[0].fftSize);
+
+  for (int shard = 0; shard < callbackData->numShards; shard++) {
+    compute_frequency_shard(in, framesPerBuffer, callbackData, shard, proportions);
+  }
+}
+
+/**
+ * Renders the displayed spectrum into FREQ_GRID as columns of 'o' characters under the '_' of its
+ * held peaks, below a title with the FFT size; changed cells reach the window when the screen is refreshed.
+ *
+ * @param callbackData Spectro data whose displayed spectrum is drawn.
+ * @param columns Shown amplitude of numSpectra * WIN_WIDTH columns, one row per spectrum (see ballistics.h).
+ * @param peaks Held peak of each of those columns.
+ * @param status Short status shown after the title, e.g. that a restart failed, or NULL.
+ */
+void draw_frequencies(const streamCallbackData *callbackData, const float *columns, const float *peaks,
+                      const char *status) {
+  int displayed = atomic_load_explicit(&callbackData->displayedSpectrum, memory_order_relaxed);
+  const float *row = columns + (size_t) displayed * WIN_WIDTH;
+
+  char label[32];
+  char title[WIN_WIDTH + 1];
+  spectrum_label(callbackData, displayed, label, sizeof(label));
+  snprintf(title, sizeof(title), "Frequencies (%s, FFT %d, 'c' to switch):%s%s", label,
+           callbackData->options.fftSize, status != NULL ? "  " : "", status != NULL ? status : "");
+  cell_grid_print_line(&FREQ_GRID, 0, 0, title);
+
+  for (int i = 0; i < WIN_WIDTH; i++) {
+    float proportion = row[i];
 
     for (int j = 1; j < FREQ_WIN_HEIGHT; j++) {
       float desired_level = (float) ((FREQ_WIN_HEIGHT) - j) /
         (float) FREQ_WIN_HEIGHT;
-      wmove(FREQ_WIN, j, i + 1);
-
-      if (proportion >= desired_level) {
-        waddch(FREQ_WIN, 'o');
-      } else {
-        waddch(FREQ_WIN, ' ');
-      }
+      cell_grid_put(&FREQ_GRID, j, i + 1, proportion >= desired_level ? 'o' : ' ');
     }
   }
 
-  display_current_max();
-  decrement_current_max();
+  display_current_max(peaks + (size_t) displayed * WIN_WIDTH);
+}
+
+/**
+ * Writes a short label of the given spectrum, e.g. "channel 2", "sum", "mid" or "side".
+ *
+ * @param spectroData Spectro data the spectrum belongs to.
+ * @param spectrum Index of the spectrum.
+ * @param label Output buffer.
+ * @param size Size of the output buffer.
+ */
+void spectrum_label(const streamCallbackData *spectroData, int spectrum, char *label, size_t size) {
+  if (spectrum < spectroData->numChannels) {
+    snprintf(label, size, "channel %d/%d", spectrum + 1, spectroData->numChannels);
+  } else if (spectroData->numChannels == 2) {
+    snprintf(label, size, "%s", spectrum == spectroData->numChannels ? "mid" : "side");
+  } else {
+    snprintf(label, size, "sum");
+  }
+}
+
+/**
+ * Number of spectra analysed for the given channel count: one per channel, plus the sum
+ * (or mid and side for stereo input) when mixed-down views are enabled.
+ */
+static int spectro_rows(int numChannels, int mixViews) {
+  if (!mixViews) {
+    return numChannels;
+  }
+  return numChannels + (numChannels == 2 ? 2 : 1);
+}
+
+/**
+ * Fills the given spectro options with the defaults: no mixed-down views and a
+ * STFT_DEFAULT_SIZE Hann window advanced by STFT_DEFAULT_HOP samples, shown as the peak
+ * bin of quadratically spaced columns, all computed as one shard, without pitch detection, for
+ * DEFAULT_FRAMES_PER_BUFFER-frame buffers at DEFAULT_SAMPLE_RATE.
+ *
+ * @param options Options to fill.
+ */
+void default_spectro_options(spectroOptions *options) {
+  options->mixViews = 0;
+  options->fftSize = STFT_DEFAULT_SIZE;
+  options->hopSize = STFT_DEFAULT_HOP;
+  options->window = WindowHann;
+  options->scale = BandScaleQuadratic;
+  options->reduce = BandPeak;
+  options->numShards = 1;
+  options->pitch = 0;
+  options->sampleRate = DEFAULT_SAMPLE_RATE;
+  options->framesPerBuffer = DEFAULT_FRAMES_PER_BUFFER;
+}
 
-  wmove(FREQ_WIN, initial_y, initial_x);
+/**
+ * Number of shards the given number of rows is split into: the requested count, at most one per row.
+ */
+static int spectro_shards(int numSpectra, int numShards) {
+  if (numShards < 1) {
+    return 1;
+  }
+  return numShards > numSpectra ? numSpectra : numShards;
+}
+
+/**
+ * First row of the given shard; shards differ in size by at most one row.
+ */
+static int shard_first_row(int numSpectra, int numShards, int shard) {
+  return (int) ((long) shard * numSpectra / numShards);
 }
 
 /**
  * Initializes the spectro data used for FFT computations during callbacks.
+ * The STFTs of the channels (and of the mixed-down views) of each shard are planned as one batch.
  *
+ * @param numChannels Number of interleaved channels in the input.
+ * @param options Sample rate, buffer size, FFT size, hop, window, views and shards to analyse.
  * @return Spectro data (see streamCallbackData struct definition above)
  */
-streamCallbackData *init_spectro_data() {
+streamCallbackData *init_spectro_data(int numChannels, const spectroOptions *options) {
   streamCallbackData *spectroData;
 
+  if (numChannels < 1 || numChannels > MAX_INPUT_CHANNELS) {
+    printf("Unsupported number of channels: %d (1 to %d).\n", numChannels, MAX_INPUT_CHANNELS);
+    exit(EXIT_FAILURE);
+  }
+
+  if (options->sampleRate < MIN_SAMPLE_RATE || options->sampleRate > MAX_SAMPLE_RATE) {
+    printf("Unsupported sample rate: %.0f Hz (%d to %d).\n", options->sampleRate, MIN_SAMPLE_RATE, MAX_SAMPLE_RATE);
+    exit(EXIT_FAILURE);
+  }
+  if (options->framesPerBuffer < MIN_FRAMES_PER_BUFFER || options->framesPerBuffer > MAX_FRAMES_PER_BUFFER) {
+    printf("Unsupported buffer size: %d frames (%d to %d).\n", options->framesPerBuffer, MIN_FRAMES_PER_BUFFER,
+           MAX_FRAMES_PER_BUFFER);
+    exit(EXIT_FAILURE);
+  }
+
+  int numSpectra = spectro_rows(numChannels, options->mixViews);
+
   spectroData = (streamCallbackData *)
-  malloc(sizeof(streamCallbackData));
+  session_alloc(sizeof(streamCallbackData));
+  if (spectroData == NULL) {
+    printf("Could not allocate spectro data.\n");
+    exit(EXIT_FAILURE);
+  }
   spectroData->in = (double *)
-  fftw_malloc(sizeof(double) * FRAMES_PER_BUFFER);
-  spectroData->out = (double *) (double *)
-  fftw_malloc(sizeof(double) * FRAMES_PER_BUFFER);
-  if (spectroData->in == NULL || spectroData->out == NULL) {
+  session_alloc(sizeof(double) * options->framesPerBuffer * numSpectra);
+  spectroData->proportions = (double *)
+  session_calloc((size_t) numSpectra * WIN_WIDTH, sizeof(double));
+  if (spectroData->in == NULL || spectroData->proportions == NULL) {
+    printf("Could not allocate spectro data.\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(spectroData->in, 0, sizeof(double) * options->framesPerBuffer * numSpectra);
+  spectroData->deinterleave = select_deinterleave_kernel(options->framesPerBuffer);
+
+  int numShards = spectro_shards(numSpectra, options->numShards);
+  spectroData->numShards = numShards;
+  spectroData->shards = (stftEngine *) session_calloc((size_t) numShards, sizeof(stftEngine));
+  spectroData->shardRows = (int *) session_alloc(sizeof(int) * (numShards + 1));
+  if (spectroData->shards == NULL || spectroData->shardRows == NULL) {
     printf("Could not allocate spectro data.\n");
     exit(EXIT_FAILURE);
   }
-  spectroData->p = fftw_plan_r2r_1d(FRAMES_PER_BUFFER, spectroData->in,
-    spectroData->out, FFTW_R2HC, FFTW_ESTIMATE);
+  for (int shard = 0; shard <= numShards; shard++) {
+    spectroData->shardRows[shard] = shard_first_row(numSpectra, numShards, shard);
+  }
+  for (int shard = 0; shard < numShards; shard++) {
+    int numRows = spectroData->shardRows[shard + 1] - spectroData->shardRows[shard];
+    if (stft_init(&spectroData->shards[shard], numRows, options->fftSize, options->hopSize, options->window) != 0) {
+      printf("Invalid FFT size %d or hop %d: both must be powers of two, with %d <= size <= %d and hop <= size.\n",
+             options->fftSize, options->hopSize, STFT_MIN_SIZE, STFT_MAX_SIZE);
+      exit(EXIT_FAILURE);
+    }
+  }
 
-  float sampleRatio = FRAMES_PER_BUFFER / SAMPLE_RATE;
-  spectroData->startIndex = (int)ceilf(sampleRatio * SPECTRO_FREQ_START);
-  spectroData->spectroSize = (int)fmin(ceilf(sampleRatio * SPECTRO_FREQ_END),
-                                       FRAMES_PER_BUFFER / 2.0)
-                             - spectroData->startIndex;
+  spectroData->options = *options;
+  spectroData->numChannels = numChannels;
+  spectroData->numSpectra = numSpectra;
+  atomic_init(&spectroData->displayedSpectrum, 0);
+
+  // Below 40 kHz the top of the display range lies beyond the Nyquist frequency.
+  double highFrequency = fmin(SPECTRO_FREQ_END, options->sampleRate / 2.0);
+  if (band_map_init(&spectroData->bands, WIN_WIDTH, options->fftSize, options->sampleRate, SPECTRO_FREQ_START,
+                    highFrequency, options->scale, options->reduce) != 0) {
+    printf("Could not allocate spectro data.\n");
+    exit(EXIT_FAILURE);
+  }
 
   return spectroData;
-}
\ No newline at end of file
+}
+
+/**
+ * Clears the STFT history and the columns of the spectro data, as if no buffer
+ * had been analysed yet. The plans and buffers are kept.
+ *
+ * @param spectroData Spectro data to reset.
+ */
+void reset_spectro_data(streamCallbackData *spectroData) {
+  for (int shard = 0; shard < spectroData->numShards; shard++) {
+    stft_reset(&spectroData->shards[shard]);
+  }
+  memset(spectroData->proportions, 0, sizeof(double) * spectroData->numSpectra * WIN_WIDTH);
+}
+
+/**
+ * Tells whether spectro data created with the given options can be reconfigured to the other ones
+ * (see reconfigure_spectro_data): the sample rate, buffer size, views, shards and pitch detection
+ * size the buffers of the stream and its analyser, so they must match.
+ *
+ * @param current Options the spectro data was created with.
+ * @param options New options.
+ * @return Non-zero if the options are compatible.
+ */
+int spectro_options_compatible(const spectroOptions *current, const spectroOptions *options) {
+  return options->sampleRate == current->sampleRate && options->framesPerBuffer == current->framesPerBuffer &&
+         options->mixViews == current->mixViews && options->numShards == current->numShards &&
+         options->pitch == current->pitch;
+}
+
+/**
+ * Applies new options to existing spectro data and resets it (see reset_spectro_data), rebuilding
+ * only what the changed options need: the STFTs of the shards (planned from the wisdom cache when
+ * possible) for a new FFT size, hop or window, and the band map for a new FFT size, scale or
+ * reduction. The data is left unchanged on failure.
+ *
+ * @param spectroData Spectro data to reconfigure; not in use by any other thread.
+ * @param options New options, compatible with the current ones (see spectro_options_compatible).
+ * @return 0 on success, -1 if the options are not compatible or the STFTs could not be planned.
+ */
+int reconfigure_spectro_data(streamCallbackData *spectroData, const spectroOptions *options) {
+  const spectroOptions *current = &spectroData->options;
+  if (!spectro_options_compatible(current, options)) {
+    return -1;
+  }
+
+  int newStft = options->fftSize != current->fftSize || options->hopSize != current->hopSize ||
+                options->window != current->window;
+  int newBands = options->fftSize != current->fftSize || options->scale != current->scale ||
+                 options->reduce != current->reduce;
+
+  stftEngine *shards = NULL;
+  if (newStft) {
+    shards = (stftEngine *) session_calloc((size_t) spectroData->numShards, sizeof(stftEngine));
+    if (shards == NULL) {
+      return -1;
+    }
+    for (int shard = 0; shard < spectroData->numShards; shard++) {
+      int numRows = spectroData->shardRows[shard + 1] - spectroData->shardRows[shard];
+      if (stft_init(&shards[shard], numRows, options->fftSize, options->hopSize, options->window) != 0) {
+        for (int planned = 0; planned < shard; planned++) {
+          stft_free(&shards[planned]);
+        }
+        session_free(shards);
+        return -1;
+      }
+    }
+  }
+
+  bandMap bands;
+  if (newBands && band_map_init(&bands, WIN_WIDTH, options->fftSize, spectroData->bands.sampleRate,
+                                spectroData->bands.lowFrequency, spectroData->bands.highFrequency,
+                                options->scale, options->reduce) != 0) {
+    for (int shard = 0; newStft && shard < spectroData->numShards; shard++) {
+      stft_free(&shards[shard]);
+    }
+    session_free(shards);
+    return -1;
+  }
+
+  if (newStft) {
+    for (int shard = 0; shard < spectroData->numShards; shard++) {
+      stft_free(&spectroData->shards[shard]);
+    }
+    session_free(spectroData->shards);
+    spectroData->shards = shards;
+  }
+  if (newBands) {
+    band_map_free(&spectroData->bands);
+    spectroData->bands = bands;
+  }
+  spectroData->options = *options;
+  reset_spectro_data(spectroData);
+  return 0;
+}
+
+/**
+ * Plans the STFT of the configured size for every channel count in WISDOM_WARM_CHANNELS, so
+ * the plans land in the wisdom cache before they are needed.
+ *
+ * @param options FFT size, hop, window, views and shards to plan for.
+ */
+void warm_spectro_wisdom(const spectroOptions *options) {
+  static const int warmChannels[] = WISDOM_WARM_CHANNELS;
+
+  for (size_t i = 0; i < sizeof(warmChannels) / sizeof(warmChannels[0]); i++) {
+    int numSpectra = spectro_rows(warmChannels[i], options->mixViews);
+    int numShards = spectro_shards(numSpectra, options->numShards);
+    for (int shard = 0; shard < numShards; shard++) {
+      int numRows = shard_first_row(numSpectra, numShards, shard + 1) - shard_first_row(numSpectra, numShards, shard);
+      stftEngine stft;
+      if (stft_init(&stft, numRows, options->fftSize, options->hopSize, options->window) != 0) {
+        printf("Could not plan a %d-point FFT for %d spectra.\n", options->fftSize, numRows);
+        exit(EXIT_FAILURE);
+      }
+      stft_free(&stft);
+    }
+  }
+}
+
+/**
+ * Frees the spectro data and the FFT plans of its shards.
+ *
+ * @param spectroData Spectro data to free.
+ */
+void free_spectro_data(streamCallbackData *spectroData) {
+  for (int shard = 0; shard < spectroData->numShards; shard++) {
+    stft_free(&spectroData->shards[shard]);
+  }
+  session_free(spectroData->shards);
+  session_free(spectroData->shardRows);
+  band_map_free(&spectroData->bands);
+  session_free(spectroData->in);
+  session_free(spectroData->proportions);
+  session_free(spectroData);
+}
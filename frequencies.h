@@ -1,27 +1,115 @@
+#ifndef FREQUENCIES_H
+#define FREQUENCIES_H
+
 #include <fftw3.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include "utils.h"
+#include "stft.h"
+#include "bands.h"
+#include "cellgrid.h"
 
 /// Data structure representing the frequency view window
-WINDOW *FREQ_WIN;
+extern WINDOW *FREQ_WIN;
+
+/// Cells of the frequency view window
+extern cellGrid FREQ_GRID;
+
+/// Maximum number of mixed-down views (sum, or mid and side for stereo) added after the channel spectra
+#define MAX_MIX_SPECTRA 2
+
+/// Input channel counts whose plans are pre-computed by --warm-wisdom
+#define WISDOM_WARM_CHANNELS {1, 2, 4, 6, 8, 16, 32, 64}
+
+/// Level, in dBFS, shown at the bottom of the frequency view; a full-scale sine reaches the top
+#define SPECTRO_DB_FLOOR (-80.0)
+
+/// Smallest and largest buffer size with a de-interleaving kernel specialized for it; every power
+/// of two in between has one, other sizes take the generic loop
+#define SPECTRO_KERNEL_MIN_FRAMES 64
+#define SPECTRO_KERNEL_MAX_FRAMES 4096
+
+/**
+ * Options of the spectrum analysis.
+ */
+typedef struct {
+
+  /// Non-zero to add a summed view (mid and side views for stereo input).
+  int mixViews;
+
+  /// Number of samples in each STFT frame; a power of two.
+  int fftSize;
+
+  /// Number of samples between consecutive STFT frames; a power of two no larger than fftSize.
+  int hopSize;
+
+  /// Window applied to every frame.
+  enum WindowType window;
+
+  /// Frequency scale of the columns of the frequency view.
+  enum BandScale scale;
+
+  /// Reduction of the bins falling into each column.
+  enum BandReduce reduce;
+
+  /// Number of shards the spectra are split into: contiguous ranges of rows with their own STFT,
+  /// so that a worker pool can compute them in parallel. 1 computes all rows with one batched FFT.
+  int numShards;
+
+  /// Non-zero to detect the pitch of every channel along with its levels (see pitch.h).
+  int pitch;
+
+  /// Sample rate of the input, in Hz.
+  double sampleRate;
+
+  /// Largest number of frames in a buffer, from MIN_FRAMES_PER_BUFFER to MAX_FRAMES_PER_BUFFER.
+  int framesPerBuffer;
+} spectroOptions;
+
+/**
+ * De-interleaves the rows firstRow to endRow - 1 of a buffer of frames frames into rows of
+ * rowStride samples (see compute_frequency_shard).
+ */
+typedef void (*deinterleaveKernel)(const float *in, unsigned long frames, int numChannels, double *rows,
+                                   unsigned long rowStride, int firstRow, int endRow);
 
 /**
  * Contains the data used for a singular stream call back.
  */
 typedef struct {
 
-  /// Array of size FRAMES_PER_BUFFER * num_channels, containing amplitudes of the input wave in the current buffer.
+  /// Array of size options.framesPerBuffer * numSpectra, containing the de-interleaved input of every
+  /// spectrum in the current buffer; spectrum k starts at in[k * options.framesPerBuffer].
   double *in;
 
-  /// Array of size FRAMES_PER_BUFFER * num_channels, containing amplitudes of the output wave in the current buffer.
-  double *out;
+  /// De-interleaving kernel of full buffers, specialized for options.framesPerBuffer when it is a
+  /// power of two from SPECTRO_KERNEL_MIN_FRAMES to SPECTRO_KERNEL_MAX_FRAMES.
+  deinterleaveKernel deinterleave;
+
+  /// Array of numSpectra * WIN_WIDTH column amplitudes of the last analysed buffer, one row per spectrum.
+  double *proportions;
+
+  /// STFT of the rows of each shard, computed with one batched FFT per hop.
+  stftEngine *shards;
 
-  /// Contains information required to compute an FFT of the buffered waveform.
-  fftw_plan p;
+  /// numShards + 1 row boundaries; shard s covers rows shardRows[s] to shardRows[s + 1] - 1.
+  int *shardRows;
+  int numShards;
 
-  /// Starting x-coordinate of the computed FFT graph.
-  int startIndex;
+  /// Options the spectro data was created with.
+  spectroOptions options;
 
-  /// Size of the delta between each consecutive x-coordinate on the FFT graph.
-  int spectroSize;
+  /// Number of interleaved channels in the input.
+  int numChannels;
+
+  /// Number of spectra computed per buffer: one per channel, followed by the mixed-down views if enabled.
+  int numSpectra;
+
+  /// Index of the spectrum shown in the frequency view. Written by the main thread, read by the render thread.
+  _Atomic int displayedSpectrum;
+
+  /// Bins of the STFT reduced into each column of the frequency view.
+  bandMap bands;
 } streamCallbackData;
 
 /**
@@ -32,21 +120,125 @@ typedef struct {
 void init_freq_win(int num_chan);
 
 /**
- * Renders the volume representation of the given input buffer.
- * The volume is rendered as a line of '=' characters of length between 0 and WIN_WIDTH.
+ * Computes the amplitude shown in each of the WIN_WIDTH columns of the frequency view
+ * for every spectrum (each channel, then the mixed-down views) of the given buffer.
+ * The buffer is appended to the STFT history; the columns show the bins of the latest
+ * STFT frame reduced through the band map, on a dB scale from SPECTRO_DB_FLOOR (0) to 0 dBFS (1).
+ * Shared by the live display and the offline analysis so both produce identical spectra.
+ *
+ * @param in Interleaved input samples.
+ * @param framesPerBuffer Number of frames in the buffer; at most options.framesPerBuffer.
+ * @param num_input_channels Number of interleaved channels in the buffer; must match the spectro data.
+ * @param callbackData Spectro data used for FFT computations.
+ * @param proportions Output array of numSpectra * WIN_WIDTH column amplitudes, one row per spectrum.
+ */
+void compute_frequencies(
+    const float *in, unsigned long framesPerBuffer, int num_input_channels,
+    streamCallbackData *callbackData, double *proportions
+);
+
+/**
+ * Computes the columns of the rows of one shard, as compute_frequencies does for all of them.
+ * Shards only read the input and write their own rows, so different shards of the same buffer
+ * can be computed on different threads.
  *
- * @param inputBuffer Input buffer to compute and render the frequencies for.
- * @param framesPerBuffer Number of frames in the buffer.
- * @param userData Callback data used for FFT computations.
+ * @param in Interleaved input samples.
+ * @param framesPerBuffer Number of frames in the buffer; at most options.framesPerBuffer.
+ * @param callbackData Spectro data used for FFT computations.
+ * @param shard Index of the shard.
+ * @param proportions Output array of numSpectra * WIN_WIDTH column amplitudes; only the rows of
+ *        the shard are written.
  */
-void streamCallBackFrequencies(
-    const void *inputBuffer, void *outputBuffer, unsigned long framesPerBuffer,
-    void *userData
+void compute_frequency_shard(
+    const float *in, unsigned long framesPerBuffer, streamCallbackData *callbackData, int shard, double *proportions
 );
 
+/**
+ * Renders the displayed spectrum into FREQ_GRID as columns of 'o' characters under the '_' of its
+ * held peaks, below a title with the FFT size; changed cells reach the window when the screen is refreshed.
+ *
+ * @param callbackData Spectro data whose displayed spectrum is drawn.
+ * @param columns Shown amplitude of numSpectra * WIN_WIDTH columns, one row per spectrum (see ballistics.h).
+ * @param peaks Held peak of each of those columns.
+ * @param status Short status shown after the title, e.g. that a restart failed, or NULL.
+ */
+void draw_frequencies(const streamCallbackData *callbackData, const float *columns, const float *peaks,
+                      const char *status);
+
+/**
+ * Writes a short label of the given spectrum, e.g. "channel 2", "sum", "mid" or "side".
+ *
+ * @param spectroData Spectro data the spectrum belongs to.
+ * @param spectrum Index of the spectrum.
+ * @param label Output buffer.
+ * @param size Size of the output buffer.
+ */
+void spectrum_label(const streamCallbackData *spectroData, int spectrum, char *label, size_t size);
+
+/**
+ * Fills the given spectro options with the defaults: no mixed-down views and a
+ * STFT_DEFAULT_SIZE Hann window advanced by STFT_DEFAULT_HOP samples, shown as the peak
+ * bin of quadratically spaced columns, all computed as one shard, without pitch detection, for
+ * DEFAULT_FRAMES_PER_BUFFER-frame buffers at DEFAULT_SAMPLE_RATE.
+ *
+ * @param options Options to fill.
+ */
+void default_spectro_options(spectroOptions *options);
+
 /**
  * Initializes the spectro data used for FFT computations during callbacks.
+ * The STFTs of the channels (and of the mixed-down views) of each shard are planned as one batch.
  *
+ * @param numChannels Number of interleaved channels in the input.
+ * @param options Sample rate, buffer size, FFT size, hop, window, views and shards to analyse.
  * @return Spectro data (see streamCallbackData struct definition above)
  */
-streamCallbackData *init_spectro_data();
\ No newline at end of file
+streamCallbackData *init_spectro_data(int numChannels, const spectroOptions *options);
+
+/**
+ * Clears the STFT history and the columns of the spectro data, as if no buffer
+ * had been analysed yet. The plans and buffers are kept.
+ *
+ * @param spectroData Spectro data to reset.
+ */
+void reset_spectro_data(streamCallbackData *spectroData);
+
+/**
+ * Tells whether spectro data created with the given options can be reconfigured to the other ones
+ * (see reconfigure_spectro_data): the sample rate, buffer size, views, shards and pitch detection
+ * size the buffers of the stream and its analyser, so they must match.
+ *
+ * @param current Options the spectro data was created with.
+ * @param options New options.
+ * @return Non-zero if the options are compatible.
+ */
+int spectro_options_compatible(const spectroOptions *current, const spectroOptions *options);
+
+/**
+ * Applies new options to existing spectro data and resets it (see reset_spectro_data), rebuilding
+ * only what the changed options need: the STFTs of the shards (planned from the wisdom cache when
+ * possible) for a new FFT size, hop or window, and the band map for a new FFT size, scale or
+ * reduction. The data is left unchanged on failure.
+ *
+ * @param spectroData Spectro data to reconfigure; not in use by any other thread.
+ * @param options New options, compatible with the current ones (see spectro_options_compatible).
+ * @return 0 on success, -1 if the options are not compatible or the STFTs could not be planned.
+ */
+int reconfigure_spectro_data(streamCallbackData *spectroData, const spectroOptions *options);
+
+/**
+ * Plans the STFT of the configured size for every channel count in WISDOM_WARM_CHANNELS, so
+ * the plans land in the wisdom cache before they are needed.
+ *
+ * @param options FFT size, hop, window, views and shards to plan for.
+ */
+void warm_spectro_wisdom(const spectroOptions *options);
+
+/**
+ * Frees the spectro data and the FFT plans of its shards.
+ *
+ * @param spectroData Spectro data to free.
+ */
+void free_spectro_data(streamCallbackData *spectroData);
+
+#endif //FREQUENCIES_H
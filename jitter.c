@@ -0,0 +1,208 @@
+//
+// Adaptive jitter buffer reordering and concealing audio blocks received over UDP.
+//
+
+#include "jitter.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Allocates a jitter buffer.
+ *
+ * @param buffer Buffer to initialize.
+ * @param numChannels Number of interleaved channels of the blocks.
+ * @param framesPerBlock Largest number of frames in a block.
+ * @param sampleRate Sample rate of the stream.
+ * @param targetDelayMs Playout delay to aim for, in milliseconds.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int jitter_init(jitterBuffer *buffer, int numChannels, unsigned long framesPerBlock, int sampleRate,
+                int targetDelayMs) {
+  memset(buffer, 0, sizeof(*buffer));
+  buffer->numChannels = numChannels;
+  buffer->framesPerBlock = framesPerBlock;
+  buffer->sampleRate = sampleRate;
+  buffer->blockNs = (uint64_t) framesPerBlock * 1000000000ULL / (uint64_t) sampleRate;
+  buffer->targetDelayNs = (uint64_t) (targetDelayMs < 0 ? 0 : targetDelayMs) * 1000000ULL;
+
+  size_t blockSamples = framesPerBlock * (size_t) numChannels;
+  buffer->samples = (float *) malloc(sizeof(float) * blockSamples * JITTER_SLOTS);
+  buffer->output = (float *) calloc(blockSamples, sizeof(float));
+  if (buffer->samples == NULL || buffer->output == NULL) {
+    jitter_free(buffer);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Frees the memory of a jitter buffer.
+ *
+ * @param buffer Buffer to free.
+ */
+void jitter_free(jitterBuffer *buffer) {
+  free(buffer->samples);
+  free(buffer->output);
+  buffer->samples = NULL;
+  buffer->output = NULL;
+}
+
+/**
+ * Empties the buffer and anchors playout to a block arriving now.
+ */
+static void jitter_restart(jitterBuffer *buffer, uint32_t sequence, uint64_t nowNs) {
+  memset(buffer->present, 0, sizeof(buffer->present));
+  buffer->started = 1;
+  buffer->anchorNs = nowNs;
+  buffer->anchorSequence = sequence;
+  buffer->nextSequence = sequence;
+  buffer->highestSequence = sequence;
+  buffer->consecutiveLosses = 0;
+}
+
+/**
+ * Current playout delay: the target, or the jitter-based delay if larger.
+ *
+ * @param buffer Buffer to query.
+ * @return Delay in nanoseconds.
+ */
+uint64_t jitter_delay(const jitterBuffer *buffer) {
+  double adaptive = JITTER_SAFETY * buffer->jitterNs;
+  // Never wait for more blocks than the buffer can hold.
+  double limit = (double) buffer->blockNs * (JITTER_SLOTS / 2);
+  adaptive = adaptive < limit ? adaptive : limit;
+  return adaptive > (double) buffer->targetDelayNs ? (uint64_t) adaptive : buffer->targetDelayNs;
+}
+
+/**
+ * Stores a received audio block until its playout time.
+ *
+ * @param buffer Buffer to store into.
+ * @param header Header of the frame; its channel count must match the buffer's.
+ * @param payload Little-endian float32 samples of the frame.
+ * @param nowNs Arrival time on a monotonic clock.
+ * @return 1 if the block was stored, 0 if it was late, duplicated or malformed.
+ */
+int jitter_push(jitterBuffer *buffer, const streamHeader *header, const unsigned char *payload, uint64_t nowNs) {
+  unsigned long frames = header->payloadLength / (sizeof(float) * (size_t) buffer->numChannels);
+  if (header->type != StreamAudio || header->numChannels != buffer->numChannels ||
+      frames > buffer->framesPerBlock || frames * sizeof(float) * buffer->numChannels != header->payloadLength) {
+    return 0;
+  }
+
+  uint32_t sequence = header->sequence;
+  if (!buffer->started) {
+    jitter_restart(buffer, sequence, nowNs);
+  }
+
+  int32_t ahead = (int32_t) (sequence - buffer->nextSequence);
+  if (ahead < 0) {
+    buffer->stats.late++;
+    return 0;
+  }
+  if (ahead >= JITTER_SLOTS) {
+    // The sender restarted or we were away for long; start over rather than conceal the gap.
+    buffer->stats.resyncs++;
+    jitter_restart(buffer, sequence, nowNs);
+  }
+
+  size_t slot = sequence % JITTER_SLOTS;
+  if (buffer->present[slot] && buffer->sequences[slot] == sequence) {
+    buffer->stats.duplicates++;
+    return 0;
+  }
+  if ((int32_t) (sequence - buffer->highestSequence) < 0) {
+    buffer->stats.reordered++;
+  } else {
+    buffer->highestSequence = sequence;
+  }
+
+  size_t blockSamples = buffer->framesPerBlock * (size_t) buffer->numChannels;
+  decode_stream_samples(payload, frames * (size_t) buffer->numChannels, buffer->samples + slot * blockSamples);
+  buffer->frames[slot] = frames;
+  buffer->arrivals[slot] = nowNs;
+  buffer->sequences[slot] = sequence;
+  buffer->present[slot] = 1;
+  buffer->stats.received++;
+
+  // RFC 3550 interarrival jitter, with the sender clock given by the stream timestamp.
+  int64_t transitNs = (int64_t) nowNs -
+                      (int64_t) (header->timestamp * 1000000000ULL / (uint64_t) buffer->sampleRate);
+  if (buffer->stats.received > 1) {
+    double difference = fabs((double) (transitNs - buffer->lastTransitNs));
+    buffer->jitterNs += (difference - buffer->jitterNs) / 16.0;
+  }
+  buffer->lastTransitNs = transitNs;
+  return 1;
+}
+
+/**
+ * Time at which the next block becomes due.
+ *
+ * @param buffer Buffer to query.
+ * @return Time on the clock passed to jitter_push, or 0 if no block has been received yet.
+ */
+uint64_t jitter_next_due(const jitterBuffer *buffer) {
+  if (!buffer->started) {
+    return 0;
+  }
+  return buffer->anchorNs + (uint64_t) (uint32_t) (buffer->nextSequence - buffer->anchorSequence) * buffer->blockNs +
+         jitter_delay(buffer);
+}
+
+/**
+ * Returns the next block if its playout time has come. A block that has not been received is
+ * concealed once a later one has arrived; until then playout waits for it. If it then arrives
+ * after its playout time, playout is anchored to its arrival and it is held for the delay.
+ *
+ * @param buffer Buffer to play from.
+ * @param nowNs Current time on the clock passed to jitter_push.
+ * @param sequence Set to the sequence number of the block.
+ * @param frames Set to the number of frames in the block.
+ * @param concealed Set to 1 if the block was not received and was concealed, 0 otherwise.
+ * @return Interleaved samples valid until the next call, or NULL if no block is due.
+ */
+const float *jitter_pop(jitterBuffer *buffer, uint64_t nowNs, uint32_t *sequence, unsigned long *frames,
+                        int *concealed) {
+  if (!buffer->started || nowNs < jitter_next_due(buffer)) {
+    return NULL;
+  }
+
+  size_t blockSamples = buffer->framesPerBlock * (size_t) buffer->numChannels;
+  size_t slot = buffer->nextSequence % JITTER_SLOTS;
+  int received = buffer->present[slot] && buffer->sequences[slot] == buffer->nextSequence;
+  if (!received && (int32_t) (buffer->nextSequence - buffer->highestSequence) > 0) {
+    // Nothing after this block has arrived either: the stream stalled rather than lost a block.
+    return NULL;
+  }
+  if (received && buffer->arrivals[slot] > jitter_next_due(buffer)) {
+    // Playout had to wait for this block, so it and every later one would play the moment they arrive.
+    buffer->stats.reanchors++;
+    buffer->anchorNs = buffer->arrivals[slot];
+    buffer->anchorSequence = buffer->nextSequence;
+    if (nowNs < jitter_next_due(buffer)) {
+      return NULL;
+    }
+  }
+  *sequence = buffer->nextSequence++;
+
+  if (received) {
+    buffer->present[slot] = 0;
+    buffer->consecutiveLosses = 0;
+    *frames = buffer->frames[slot];
+    *concealed = 0;
+    memcpy(buffer->output, buffer->samples + slot * blockSamples, sizeof(float) * *frames * buffer->numChannels);
+    return buffer->output;
+  }
+
+  buffer->stats.lost++;
+  buffer->consecutiveLosses++;
+  *frames = buffer->framesPerBlock;
+  *concealed = 1;
+  float gain = buffer->consecutiveLosses > JITTER_MAX_CONCEAL ? 0.0f : 0.5f;
+  for (size_t i = 0; i < blockSamples; i++) {
+    buffer->output[i] *= gain;
+  }
+  return buffer->output;
+}
@@ -0,0 +1,159 @@
+//
+// Adaptive jitter buffer reordering and concealing audio blocks received over UDP.
+//
+
+#ifndef JITTER_H
+#define JITTER_H
+
+#include <stdint.h>
+#include "protocol.h"
+
+/// Number of blocks the jitter buffer can hold; sequence numbers further ahead resynchronize it
+#define JITTER_SLOTS 256
+
+/// Default playout delay in milliseconds
+#define JITTER_DEFAULT_DELAY_MS 40
+
+/// The playout delay grows to this many times the measured interarrival jitter when that is larger than the target
+#define JITTER_SAFETY 4.0
+
+/// Consecutive lost blocks concealed by fading out the last received block; later ones are silent
+#define JITTER_MAX_CONCEAL 4
+
+/**
+ * Reception statistics of a jitter buffer.
+ */
+typedef struct {
+
+  /// Blocks stored for playout.
+  unsigned long received;
+
+  /// Blocks that were never received by their playout time and were concealed.
+  unsigned long lost;
+
+  /// Blocks received after a block with a higher sequence number, but in time.
+  unsigned long reordered;
+
+  /// Blocks received after their playout time, discarded.
+  unsigned long late;
+
+  /// Blocks received twice, discarded.
+  unsigned long duplicates;
+
+  /// Times the sequence jumped beyond the buffer and playout restarted.
+  unsigned long resyncs;
+
+  /// Times playout waited for a block past its playout time (the sender paused or its clock drifted)
+  /// and was anchored to that block's arrival to restore the delay.
+  unsigned long reanchors;
+} jitterStats;
+
+/**
+ * Buffer holding received blocks until their playout time. Blocks are due at a fixed delay after
+ * the arrival of the first one, plus their distance in sequence numbers times the block duration,
+ * so network jitter below the delay does not reach the analysis. The delay is the configured
+ * target, or JITTER_SAFETY times the RFC 3550 interarrival jitter estimate when that is larger.
+ * A block missing at its playout time while later ones have arrived is concealed with a faded copy
+ * of the last one. A block that arrives after its playout time, while playout waited for it, moves
+ * the anchor to its arrival, so a sender pause or clock drift does not use up the delay for good.
+ */
+typedef struct {
+  int numChannels;
+  unsigned long framesPerBlock;
+  int sampleRate;
+
+  /// JITTER_SLOTS blocks of framesPerBlock * numChannels samples, indexed by sequence number.
+  float *samples;
+  unsigned long frames[JITTER_SLOTS];
+  uint64_t arrivals[JITTER_SLOTS];
+  uint32_t sequences[JITTER_SLOTS];
+  unsigned char present[JITTER_SLOTS];
+
+  /// Block returned by jitter_pop: the last received block, faded while concealing losses.
+  float *output;
+  int consecutiveLosses;
+
+  /// Set once the first block has been received.
+  int started;
+
+  /// Arrival time and sequence number of the block playout is anchored to.
+  uint64_t anchorNs;
+  uint32_t anchorSequence;
+
+  /// Sequence number of the next block to play and the highest one received.
+  uint32_t nextSequence;
+  uint32_t highestSequence;
+
+  uint64_t blockNs;
+  uint64_t targetDelayNs;
+
+  /// Interarrival jitter estimate and the transit time of the last block, in ns.
+  double jitterNs;
+  int64_t lastTransitNs;
+
+  jitterStats stats;
+} jitterBuffer;
+
+/**
+ * Allocates a jitter buffer.
+ *
+ * @param buffer Buffer to initialize.
+ * @param numChannels Number of interleaved channels of the blocks.
+ * @param framesPerBlock Largest number of frames in a block.
+ * @param sampleRate Sample rate of the stream.
+ * @param targetDelayMs Playout delay to aim for, in milliseconds.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int jitter_init(jitterBuffer *buffer, int numChannels, unsigned long framesPerBlock, int sampleRate,
+                int targetDelayMs);
+
+/**
+ * Frees the memory of a jitter buffer.
+ *
+ * @param buffer Buffer to free.
+ */
+void jitter_free(jitterBuffer *buffer);
+
+/**
+ * Stores a received audio block until its playout time.
+ *
+ * @param buffer Buffer to store into.
+ * @param header Header of the frame; its channel count must match the buffer's.
+ * @param payload Little-endian float32 samples of the frame.
+ * @param nowNs Arrival time on a monotonic clock.
+ * @return 1 if the block was stored, 0 if it was late, duplicated or malformed.
+ */
+int jitter_push(jitterBuffer *buffer, const streamHeader *header, const unsigned char *payload, uint64_t nowNs);
+
+/**
+ * Returns the next block if its playout time has come. A block that has not been received is
+ * concealed once a later one has arrived; until then playout waits for it. If it then arrives
+ * after its playout time, playout is anchored to its arrival and it is held for the delay.
+ *
+ * @param buffer Buffer to play from.
+ * @param nowNs Current time on the clock passed to jitter_push.
+ * @param sequence Set to the sequence number of the block.
+ * @param frames Set to the number of frames in the block.
+ * @param concealed Set to 1 if the block was not received and was concealed, 0 otherwise.
+ * @return Interleaved samples valid until the next call, or NULL if no block is due.
+ */
+const float *jitter_pop(jitterBuffer *buffer, uint64_t nowNs, uint32_t *sequence, unsigned long *frames,
+                        int *concealed);
+
+/**
+ * Time at which the next block becomes due.
+ *
+ * @param buffer Buffer to query.
+ * @return Time on the clock passed to jitter_push, or 0 if no block has been received yet.
+ */
+uint64_t jitter_next_due(const jitterBuffer *buffer);
+
+/**
+ * Current playout delay: the target, or the jitter-based delay if larger.
+ *
+ * @param buffer Buffer to query.
+ * @return Delay in nanoseconds.
+ */
+uint64_t jitter_delay(const jitterBuffer *buffer);
+
+#endif //JITTER_H
@@ -0,0 +1,323 @@
+//
+// EBU R128 / ITU-R BS.1770 loudness: momentary, short-term and integrated loudness and loudness range.
+//
+
+#include "loudness.h"
+#include "arena.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/// Filter states smaller than this are flushed to zero after every buffer, so silence never
+/// leaves the filters computing with denormals
+#define LOUDNESS_DENORMAL 1e-30
+
+/**
+ * Loudness in LUFS of a sum of weighted mean squares (BS.1770 equation 2).
+ */
+static double power_to_lufs(double power) {
+  return power > 0.0 ? -0.691 + 10.0 * log10(power) : -INFINITY;
+}
+
+/**
+ * Computes the K-weighting filter for the sample rate: the BS.1770 high shelf modelling the head
+ * followed by the RLB high-pass, derived from their analog prototypes so that any rate matches the
+ * published 48 kHz coefficients.
+ */
+static void k_weighting(loudnessMeter *meter) {
+  double K = tan(M_PI * 1681.974450955533 / meter->sampleRate);
+  double Q = 0.7071752369554196;
+  double Vh = pow(10.0, 3.999843853973347 / 20.0);
+  double Vb = pow(Vh, 0.4996667741545416);
+  double a0 = 1.0 + K / Q + K * K;
+  meter->shelf[0] = (Vh + Vb * K / Q + K * K) / a0;
+  meter->shelf[1] = 2.0 * (K * K - Vh) / a0;
+  meter->shelf[2] = (Vh - Vb * K / Q + K * K) / a0;
+  meter->shelf[3] = 2.0 * (K * K - 1.0) / a0;
+  meter->shelf[4] = (1.0 - K / Q + K * K) / a0;
+
+  K = tan(M_PI * 38.13547087602444 / meter->sampleRate);
+  Q = 0.5003270373238773;
+  a0 = 1.0 + K / Q + K * K;
+  meter->highPass[0] = 1.0;
+  meter->highPass[1] = -2.0;
+  meter->highPass[2] = 1.0;
+  meter->highPass[3] = 2.0 * (K * K - 1.0) / a0;
+  meter->highPass[4] = (1.0 - K / Q + K * K) / a0;
+}
+
+/**
+ * Allocates the filter state and computes the K-weighting coefficients for the sample rate.
+ *
+ * @param meter Meter to initialize.
+ * @param numChannels Number of interleaved channels; 5 is taken as L, R, C, Ls, Rs and 6 as
+ *        L, R, C, LFE, Ls, Rs.
+ * @param sampleRate Sample rate of the input, in Hz.
+ * @param maxFrames Largest buffer loudness_process is called with.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int loudness_init(loudnessMeter *meter, int numChannels, double sampleRate, unsigned long maxFrames) {
+  memset(meter, 0, sizeof(*meter));
+  meter->numChannels = numChannels;
+  meter->sampleRate = sampleRate;
+  meter->capacity = maxFrames;
+  meter->blockFrames = (unsigned long) lround(sampleRate * LOUDNESS_BLOCK_MS / 1000.0);
+  meter->state = (double *) session_calloc((size_t) numChannels * 4, sizeof(double));
+  meter->weights = (double *) session_alloc(sizeof(double) * numChannels);
+  meter->squares = (double *) session_alloc(sizeof(double) * maxFrames);
+  if (meter->state == NULL || meter->weights == NULL || meter->squares == NULL) {
+    loudness_free(meter);
+    return -1;
+  }
+
+  for (int c = 0; c < numChannels; c++) {
+    meter->weights[c] = 1.0;
+  }
+  if (numChannels == 5 || numChannels == 6) {
+    meter->weights[numChannels - 2] = LOUDNESS_SURROUND_WEIGHT;
+    meter->weights[numChannels - 1] = LOUDNESS_SURROUND_WEIGHT;
+  }
+  if (numChannels == 6) {
+    meter->weights[3] = 0.0;
+  }
+
+  k_weighting(meter);
+  loudness_reset(meter);
+  return 0;
+}
+
+/**
+ * Frees the filter state of the meter.
+ *
+ * @param meter Meter to free.
+ */
+void loudness_free(loudnessMeter *meter) {
+  session_free(meter->state);
+  session_free(meter->weights);
+  session_free(meter->squares);
+  meter->state = NULL;
+  meter->weights = NULL;
+  meter->squares = NULL;
+}
+
+/**
+ * Clears the filters, windows and histograms as if the stream had just started.
+ *
+ * @param meter Meter to reset.
+ */
+void loudness_reset(loudnessMeter *meter) {
+  memset(meter->state, 0, sizeof(double) * meter->numChannels * 4);
+  memset(meter->blockPowers, 0, sizeof(meter->blockPowers));
+  memset(&meter->momentaryHistogram, 0, sizeof(meter->momentaryHistogram));
+  memset(&meter->shortTermHistogram, 0, sizeof(meter->shortTermHistogram));
+  meter->blockFill = 0;
+  meter->blockEnergy = 0.0;
+  meter->blocksCompleted = 0;
+  meter->levels = (loudnessLevels) {-INFINITY, -INFINITY, -INFINITY, 0.0, -INFINITY};
+}
+
+/**
+ * K-weights a contiguous range of the channels of an interleaved buffer and adds the weighted
+ * square of each frame to squares. Ranges of different channels can be filtered on different threads.
+ *
+ * @param meter Meter of the whole stream.
+ * @param in First sample of the range in the first frame.
+ * @param stride Number of samples between consecutive frames of the buffer.
+ * @param firstChannel Index of the first channel of the range.
+ * @param numChannels Number of channels in the range.
+ * @param frames Number of frames in the buffer.
+ * @param squares Array of frames sums the weighted squares are added to.
+ */
+void loudness_filter(loudnessMeter *meter, const float *in, int stride, int firstChannel, int numChannels,
+                     unsigned long frames, double *squares) {
+  const double *shelf = meter->shelf;
+  const double *highPass = meter->highPass;
+
+  for (int c = 0; c < numChannels; c++) {
+    double weight = meter->weights[firstChannel + c];
+    if (weight == 0.0) {
+      continue;
+    }
+    double *state = meter->state + (size_t) (firstChannel + c) * 4;
+    double s0 = state[0], s1 = state[1], s2 = state[2], s3 = state[3];
+
+    const float *sample = in + c;
+    for (unsigned long i = 0; i < frames; i++, sample += stride) {
+      double x = *sample;
+      double y = shelf[0] * x + s0;
+      s0 = shelf[1] * x - shelf[3] * y + s1;
+      s1 = shelf[2] * x - shelf[4] * y;
+
+      double z = y + s2;
+      s2 = -2.0 * y - highPass[3] * z + s3;
+      s3 = y - highPass[4] * z;
+      squares[i] += weight * z * z;
+    }
+
+    state[0] = fabs(s0) < LOUDNESS_DENORMAL ? 0.0 : s0;
+    state[1] = fabs(s1) < LOUDNESS_DENORMAL ? 0.0 : s1;
+    state[2] = fabs(s2) < LOUDNESS_DENORMAL ? 0.0 : s2;
+    state[3] = fabs(s3) < LOUDNESS_DENORMAL ? 0.0 : s3;
+  }
+}
+
+/**
+ * Adds a gating block of the given mean square to the histogram if it passes the absolute gate.
+ */
+static void histogram_add(loudnessHistogram *histogram, double power) {
+  double lufs = power_to_lufs(power);
+  if (!(lufs > LOUDNESS_ABSOLUTE_GATE)) {
+    return;
+  }
+  int bin = (int) ((lufs - LOUDNESS_ABSOLUTE_GATE) / LOUDNESS_HISTOGRAM_STEP);
+  bin = bin < LOUDNESS_HISTOGRAM_BINS ? bin : LOUDNESS_HISTOGRAM_BINS - 1;
+  histogram->counts[bin]++;
+  histogram->powers[bin] += power;
+  histogram->count++;
+  histogram->power += power;
+}
+
+/**
+ * First bin of the histogram above the relative gate: the loudness of the mean of all its blocks
+ * plus the given gate. A bin is above the gate if its centre is.
+ *
+ * @return Index of the bin, or LOUDNESS_HISTOGRAM_BINS if the histogram is empty.
+ */
+static int gated_bin(const loudnessHistogram *histogram, double relativeGate) {
+  if (histogram->count == 0) {
+    return LOUDNESS_HISTOGRAM_BINS;
+  }
+  double threshold = power_to_lufs(histogram->power / histogram->count) + relativeGate;
+  double bin = ceil((threshold - LOUDNESS_ABSOLUTE_GATE) / LOUDNESS_HISTOGRAM_STEP - 0.5);
+  return bin < 0.0 ? 0 : bin < LOUDNESS_HISTOGRAM_BINS ? (int) bin : LOUDNESS_HISTOGRAM_BINS - 1;
+}
+
+/**
+ * Loudness at the centre of the given bin of a histogram.
+ */
+static double bin_lufs(int bin) {
+  return LOUDNESS_ABSOLUTE_GATE + (bin + 0.5) * LOUDNESS_HISTOGRAM_STEP;
+}
+
+/**
+ * Integrated loudness: the loudness of the mean of the momentary blocks above both gates.
+ */
+static double integrated_loudness(const loudnessHistogram *histogram) {
+  unsigned long count = 0;
+  double power = 0.0;
+  for (int bin = gated_bin(histogram, LOUDNESS_RELATIVE_GATE); bin < LOUDNESS_HISTOGRAM_BINS; bin++) {
+    count += histogram->counts[bin];
+    power += histogram->powers[bin];
+  }
+  return count > 0 ? power_to_lufs(power / count) : -INFINITY;
+}
+
+/**
+ * Loudness range (EBU Tech 3342): the spread between the LOUDNESS_RANGE_LOW and
+ * LOUDNESS_RANGE_HIGH percentiles of the short-term loudness above both gates.
+ */
+static double loudness_range(const loudnessHistogram *histogram) {
+  int first = gated_bin(histogram, LOUDNESS_RANGE_GATE);
+  unsigned long count = 0;
+  for (int bin = first; bin < LOUDNESS_HISTOGRAM_BINS; bin++) {
+    count += histogram->counts[bin];
+  }
+  if (count == 0) {
+    return 0.0;
+  }
+
+  unsigned long lowRank = (unsigned long) lround(LOUDNESS_RANGE_LOW * (count - 1));
+  unsigned long highRank = (unsigned long) lround(LOUDNESS_RANGE_HIGH * (count - 1));
+  double low = 0.0;
+  double high = 0.0;
+  unsigned long seen = 0;
+  for (int bin = first; bin < LOUDNESS_HISTOGRAM_BINS; bin++) {
+    if (histogram->counts[bin] == 0) {
+      continue;
+    }
+    if (seen <= lowRank && lowRank < seen + histogram->counts[bin]) {
+      low = bin_lufs(bin);
+    }
+    if (seen <= highRank && highRank < seen + histogram->counts[bin]) {
+      high = bin_lufs(bin);
+      break;
+    }
+    seen += histogram->counts[bin];
+  }
+  return high - low;
+}
+
+/**
+ * Mean of the last count block powers.
+ */
+static double window_power(const loudnessMeter *meter, int count) {
+  double sum = 0.0;
+  for (int i = 1; i <= count; i++) {
+    sum += meter->blockPowers[(meter->blocksCompleted - i) % LOUDNESS_SHORT_TERM_BLOCKS];
+  }
+  return sum / count;
+}
+
+/**
+ * Completes the current block: updates the momentary and short-term loudness, adds them to the
+ * gating histograms and recomputes the integrated loudness and range from the histograms.
+ */
+static void complete_block(loudnessMeter *meter) {
+  meter->blockPowers[meter->blocksCompleted % LOUDNESS_SHORT_TERM_BLOCKS] = meter->blockEnergy / meter->blockFrames;
+  meter->blocksCompleted++;
+  meter->blockEnergy = 0.0;
+  meter->blockFill = 0;
+
+  if (meter->blocksCompleted >= LOUDNESS_MOMENTARY_BLOCKS) {
+    double power = window_power(meter, LOUDNESS_MOMENTARY_BLOCKS);
+    meter->levels.momentary = power_to_lufs(power);
+    meter->levels.maxMomentary = fmax(meter->levels.maxMomentary, meter->levels.momentary);
+    histogram_add(&meter->momentaryHistogram, power);
+    meter->levels.integrated = integrated_loudness(&meter->momentaryHistogram);
+  }
+  if (meter->blocksCompleted >= LOUDNESS_SHORT_TERM_BLOCKS) {
+    double power = window_power(meter, LOUDNESS_SHORT_TERM_BLOCKS);
+    meter->levels.shortTerm = power_to_lufs(power);
+    histogram_add(&meter->shortTermHistogram, power);
+    meter->levels.range = loudness_range(&meter->shortTermHistogram);
+  }
+}
+
+/**
+ * Adds the summed weighted squares of consecutive frames, completing a block every
+ * LOUDNESS_BLOCK_MS and updating meter->levels with it.
+ *
+ * @param meter Meter of the stream.
+ * @param squares Weighted squares of all channels of each frame, see loudness_filter.
+ * @param frames Number of frames.
+ * @return Number of blocks completed.
+ */
+int loudness_accumulate(loudnessMeter *meter, const double *squares, unsigned long frames) {
+  int completed = 0;
+  for (unsigned long i = 0; i < frames; i++) {
+    meter->blockEnergy += squares[i];
+    if (++meter->blockFill == meter->blockFrames) {
+      complete_block(meter);
+      completed++;
+    }
+  }
+  return completed;
+}
+
+/**
+ * Measures a whole interleaved buffer: loudness_filter over every channel followed by loudness_accumulate.
+ *
+ * @param meter Meter of the stream.
+ * @param in Interleaved input samples.
+ * @param frames Number of frames; at most the maxFrames the meter was created with.
+ * @return Number of blocks completed.
+ */
+int loudness_process(loudnessMeter *meter, const float *in, unsigned long frames) {
+  memset(meter->squares, 0, sizeof(double) * frames);
+  loudness_filter(meter, in, meter->numChannels, 0, meter->numChannels, frames, meter->squares);
+  return loudness_accumulate(meter, meter->squares, frames);
+}
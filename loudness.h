@@ -0,0 +1,179 @@
+//
+// EBU R128 / ITU-R BS.1770 loudness: momentary, short-term and integrated loudness and loudness range.
+//
+
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <stddef.h>
+
+/// Length of the blocks the loudness is measured in, in milliseconds; gating blocks and short-term
+/// windows advance by one block
+#define LOUDNESS_BLOCK_MS 100
+
+/// Blocks covered by the momentary (400 ms) and short-term (3 s) loudness
+#define LOUDNESS_MOMENTARY_BLOCKS 4
+#define LOUDNESS_SHORT_TERM_BLOCKS 30
+
+/// Absolute gate of the integrated loudness and the loudness range, in LUFS
+#define LOUDNESS_ABSOLUTE_GATE (-70.0)
+
+/// Relative gates below the mean of the blocks above the absolute gate, in LU: BS.1770 for the
+/// integrated loudness, EBU Tech 3342 for the loudness range
+#define LOUDNESS_RELATIVE_GATE (-10.0)
+#define LOUDNESS_RANGE_GATE (-20.0)
+
+/// Percentiles of the short-term loudness distribution whose difference is the loudness range
+#define LOUDNESS_RANGE_LOW 0.10
+#define LOUDNESS_RANGE_HIGH 0.95
+
+/// Range and resolution of the gating histograms, in LUFS, and their number of bins,
+/// (LOUDNESS_HISTOGRAM_MAX - LOUDNESS_ABSOLUTE_GATE) / LOUDNESS_HISTOGRAM_STEP; louder blocks (only
+/// possible with many channels near full scale) are counted in the top bin
+#define LOUDNESS_HISTOGRAM_MAX 30.0
+#define LOUDNESS_HISTOGRAM_STEP 0.1
+#define LOUDNESS_HISTOGRAM_BINS 1000
+
+/// Weight of the surround channels of a 5.0 or 5.1 input
+#define LOUDNESS_SURROUND_WEIGHT 1.41
+
+/**
+ * Loudness of a stream so far, in LUFS (LU for the range). Values are -INFINITY until enough
+ * audio above the gates has been measured.
+ */
+typedef struct {
+
+  /// Loudness of the last 400 ms.
+  double momentary;
+
+  /// Loudness of the last 3 s.
+  double shortTerm;
+
+  /// Gated loudness of the whole stream.
+  double integrated;
+
+  /// Loudness range of the whole stream; 0 until short-term loudness is available.
+  double range;
+
+  /// Loudest momentary loudness so far.
+  double maxMomentary;
+} loudnessLevels;
+
+/**
+ * Histogram of the loudness of gating blocks: the number of blocks and the sum of their mean
+ * squares in each LOUDNESS_HISTOGRAM_STEP bin above the absolute gate, plus the totals. Adding a
+ * block is O(1); the gated means only walk the fixed number of bins.
+ */
+typedef struct {
+  unsigned long counts[LOUDNESS_HISTOGRAM_BINS];
+  double powers[LOUDNESS_HISTOGRAM_BINS];
+  unsigned long count;
+  double power;
+} loudnessHistogram;
+
+/**
+ * Loudness meter of an interleaved stream. Every channel runs through the two K-weighting biquads;
+ * the weighted squares of all channels are summed per frame and collected into LOUDNESS_BLOCK_MS
+ * blocks. Each completed block updates the momentary and short-term windows and adds the
+ * 400 ms and 3 s loudness to the gating histograms, so the integrated loudness and range of an
+ * arbitrarily long stream never reprocess its history.
+ */
+typedef struct {
+  int numChannels;
+  double sampleRate;
+
+  /// Coefficients b0, b1, b2, a1, a2 of the high-shelf and high-pass stages.
+  double shelf[5];
+  double highPass[5];
+
+  /// Transposed direct form II state of both stages of every channel, 4 values per channel.
+  double *state;
+
+  /// Weight of every channel: 1, 0 for the LFE channel of a 5.1 input and LOUDNESS_SURROUND_WEIGHT
+  /// for its surround channels.
+  double *weights;
+
+  /// Weighted squares of every frame of the buffer being processed, for loudness_process.
+  double *squares;
+  unsigned long capacity;
+
+  /// Frames per block, frames of the current block so far and the sum of their weighted squares.
+  unsigned long blockFrames;
+  unsigned long blockFill;
+  double blockEnergy;
+
+  /// Mean weighted square of the last LOUDNESS_SHORT_TERM_BLOCKS blocks, oldest overwritten first.
+  double blockPowers[LOUDNESS_SHORT_TERM_BLOCKS];
+  unsigned long blocksCompleted;
+
+  /// Gating histograms of the momentary (integrated loudness) and short-term (range) loudness.
+  loudnessHistogram momentaryHistogram;
+  loudnessHistogram shortTermHistogram;
+
+  /// Loudness as of the last completed block.
+  loudnessLevels levels;
+} loudnessMeter;
+
+/**
+ * Allocates the filter state and computes the K-weighting coefficients for the sample rate.
+ *
+ * @param meter Meter to initialize.
+ * @param numChannels Number of interleaved channels; 5 is taken as L, R, C, Ls, Rs and 6 as
+ *        L, R, C, LFE, Ls, Rs.
+ * @param sampleRate Sample rate of the input, in Hz.
+ * @param maxFrames Largest buffer loudness_process is called with.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int loudness_init(loudnessMeter *meter, int numChannels, double sampleRate, unsigned long maxFrames);
+
+/**
+ * Frees the filter state of the meter.
+ *
+ * @param meter Meter to free.
+ */
+void loudness_free(loudnessMeter *meter);
+
+/**
+ * Clears the filters, windows and histograms as if the stream had just started.
+ *
+ * @param meter Meter to reset.
+ */
+void loudness_reset(loudnessMeter *meter);
+
+/**
+ * K-weights a contiguous range of the channels of an interleaved buffer and adds the weighted
+ * square of each frame to squares. Ranges of different channels can be filtered on different threads.
+ *
+ * @param meter Meter of the whole stream.
+ * @param in First sample of the range in the first frame.
+ * @param stride Number of samples between consecutive frames of the buffer.
+ * @param firstChannel Index of the first channel of the range.
+ * @param numChannels Number of channels in the range.
+ * @param frames Number of frames in the buffer.
+ * @param squares Array of frames sums the weighted squares are added to.
+ */
+void loudness_filter(loudnessMeter *meter, const float *in, int stride, int firstChannel, int numChannels,
+                     unsigned long frames, double *squares);
+
+/**
+ * Adds the summed weighted squares of consecutive frames, completing a block every
+ * LOUDNESS_BLOCK_MS and updating meter->levels with it.
+ *
+ * @param meter Meter of the stream.
+ * @param squares Weighted squares of all channels of each frame, see loudness_filter.
+ * @param frames Number of frames.
+ * @return Number of blocks completed.
+ */
+int loudness_accumulate(loudnessMeter *meter, const double *squares, unsigned long frames);
+
+/**
+ * Measures a whole interleaved buffer: loudness_filter over every channel followed by loudness_accumulate.
+ *
+ * @param meter Meter of the stream.
+ * @param in Interleaved input samples.
+ * @param frames Number of frames; at most the maxFrames the meter was created with.
+ * @return Number of blocks completed.
+ */
+int loudness_process(loudnessMeter *meter, const float *in, unsigned long frames);
+
+#endif //LOUDNESS_H
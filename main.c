@@ -1,18 +1,647 @@
 #include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
 
 #include "volume.h"
 #include "display.h"
 #include "frequencies.h"
 #include "user_prompts.h"
 #include "stream.h"
+#include "offline.h"
+#include "wisdom.h"
+#include "server.h"
+#include "client.h"
+#include "jitter.h"
+#include "viewer.h"
+#include "analysis.h"
+#include "waterfall.h"
+#include "recorder.h"
+#include "arena.h"
+#include "exporter.h"
+#include "ballistics.h"
+
+/// Longest line of a --config file, including the newline
+#define CONFIG_LINE_SIZE 512
+
+/**
+ * Prints the command line usage of the program.
+ *
+ * @param program Name the program was invoked with.
+ */
+static void print_usage(const char *program) {
+  printf("Usage: %s [options]\n", program);
+  printf("  -f, --fps N              Maximum number of screen refreshes per second (default %d)\n", DEFAULT_RENDER_FPS);
+  printf("  -i, --offline FILE       Analyse a WAV (PCM16/PCM24/float32) or raw float32 file without a sound card\n");
+  printf("  -o, --output FILE        Offline output file (default stdout)\n");
+  printf("      --format bin|csv     Offline output format (default bin)\n");
+  printf("      --raw-channels N     Channel count of a raw float32 input file\n");
+  printf("      --raw-rate HZ        Sample rate of a raw float32 input file (default %d)\n",
+         (int) DEFAULT_SAMPLE_RATE);
+  printf("  -j, --threads N          Analysis threads, live or offline (default: all cores)\n");
+  printf("  -m, --mix-views          Also analyse the summed signal (mid and side for stereo input)\n");
+  printf("      --waterfall SECONDS  Show a scrolling spectrogram covering SECONDS below the statistics\n");
+  printf("      --pitch              Show the pitch of every channel next to its volume bar (needs %d columns)\n",
+         WIN_WIDTH + PITCH_READOUT_WIDTH);
+  printf("      --sample-rate HZ     Capture rate, checked against the devices (default: the input device's rate)\n");
+  printf("      --buffer-size N      Frames per buffer, %d to %d; powers of two %d-%d are fastest (default %d)\n",
+         MIN_FRAMES_PER_BUFFER, MAX_FRAMES_PER_BUFFER, SPECTRO_KERNEL_MIN_FRAMES, SPECTRO_KERNEL_MAX_FRAMES,
+         DEFAULT_FRAMES_PER_BUFFER);
+  printf("      --fft-size N         STFT frame size, a power of two from %d to %d (default %d)\n",
+         STFT_MIN_SIZE, STFT_MAX_SIZE, STFT_DEFAULT_SIZE);
+  printf("      --hop N              Samples between STFT frames, a power of two (default %d)\n", STFT_DEFAULT_HOP);
+  printf("      --window NAME        hann, blackman-harris or flat-top (default hann)\n");
+  printf("      --scale NAME         Column frequency scale: quadratic, log or mel (default quadratic)\n");
+  printf("      --bands MODE         Reduction of the bins of a column: peak or rms (default peak)\n");
+  printf("      --planner EFFORT     FFTW planning effort: estimate, measure or patient (default measure)\n");
+  printf("      --wisdom FILE        FFTW wisdom cache (default $XDG_CACHE_HOME/%s; empty to disable)\n",
+         WISDOM_FILE_NAME);
+  printf("      --warm-wisdom        Plan the configured FFT size for common channel counts, save the wisdom and exit\n");
+  printf("      --serve PORT         Stream the captured audio to every client connecting to PORT\n");
+  printf("      --stream KIND        What --serve sends: audio or spectrum (quantized levels and spectra)\n");
+  printf("      --stream-rate N      Spectral frames per second (default %d)\n", SPECTRAL_DEFAULT_RATE);
+  printf("      --stream-bits N      Spectral quantization: 8 (0.5 dB steps, default) or 16 bits\n");
+  printf("      --udp HOST:PORT      Stream as UDP datagrams to a unicast or multicast address instead of --serve\n");
+  printf("      --induce-loss PCT    Deliberately drop this percentage of UDP datagrams, for testing\n");
+  printf("      --record FILE        Record the captured audio to FILE on a background thread\n");
+  printf("      --record-format KIND wav (32-bit float, default) or raw interleaved float32\n");
+  printf("      --record-direct      Bypass the page cache (O_DIRECT) while recording\n");
+  printf("      --record-rotate-mb N Start a new numbered file every N MB of samples\n");
+  printf("      --record-rotate-s N  Start a new numbered file every N seconds\n");
+  printf("      --record-buffer-ms MS Audio queued while the disk is busy (default %d)\n", RECORDER_DEFAULT_BUFFER_MS);
+  printf("      --connect HOST:PORT  View the stream of another instance; audio streams are analysed locally\n");
+  printf("      --listen-udp PORT    View a UDP stream, played out through a jitter buffer\n");
+  printf("      --multicast-group IP Multicast group to join with --listen-udp\n");
+  printf("      --playout-ms MS      Target playout delay of the jitter buffer (default %d)\n",
+         JITTER_DEFAULT_DELAY_MS);
+  printf("      --stats              With --connect or --listen-udp, print reception statistics instead\n");
+  printf("      --input-devices LIST Capture several comma-separated input devices instead of prompting for one\n");
+  printf("      --lock-memory        Lock the session's buffers into RAM (mlock) so they are never paged out\n");
+  printf("      --metrics-port PORT  Serve the levels, bands, loudness and callback statistics as Prometheus text\n");
+  printf("      --metrics-json FILE  Append them to FILE as one JSON object per line (- for stdout with --headless)\n");
+  printf("      --metrics-rate N     Exports per second (default %g)\n", EXPORTER_DEFAULT_RATE);
+  printf("      --headless           Run without the terminal views, exporting until SIGINT or SIGTERM\n");
+  printf("      --ballistics MODE    Bar and peak-mark movement: peak, vu or ppm (default peak)\n");
+  printf("      --attack-ms MS       Time constant of rising bars, overriding the mode (0 = instant)\n");
+  printf("      --release-ms MS      Time constant of falling bars, overriding the mode (0 = instant)\n");
+  printf("      --hold-ms MS         Time peak marks stay before falling, overriding the mode\n");
+  printf("      --fall-ms MS         Time a released peak mark takes to fall the full view, overriding the mode\n");
+  printf("      --config FILE        Read options from FILE, one \"name value\" per line; the command line wins\n");
+  printf("  -h, --help               Show this message\n");
+}
+
+/**
+ * Parses a comma-separated list of input devices and checks that every device exists, has input
+ * channels and appears only once. PortAudio must be initialized.
+ *
+ * @param list Device indices, e.g. "0,3".
+ * @param devices Output array of at most MAX_INPUT_DEVICES device indices.
+ * @return Number of devices, or -1 if the list is invalid.
+ */
+static int parse_input_devices(char *list, int *devices) {
+  int count = 0;
+  for (char *token = strtok(list, ","); token != NULL; token = strtok(NULL, ",")) {
+    char *end;
+    long device = strtol(token, &end, 10);
+    if (end == token || *end != '\0' || device < 0 || device >= Pa_GetDeviceCount() ||
+        Pa_GetDeviceInfo((int) device)->maxInputChannels == 0) {
+      printf("Not an input device: %s\n", token);
+      return -1;
+    }
+    for (int i = 0; i < count; i++) {
+      if (devices[i] == device) {
+        printf("Input device %ld is listed twice.\n", device);
+        return -1;
+      }
+    }
+    if (count == MAX_INPUT_DEVICES) {
+      printf("At most %d input devices can be captured at once.\n", MAX_INPUT_DEVICES);
+      return -1;
+    }
+    devices[count++] = (int) device;
+  }
+  if (count == 0) {
+    printf("No input devices given.\n");
+    return -1;
+  }
+  return count;
+}
+
+/**
+ * Builds the arguments to parse: the options of the --config file, if one is given, followed by the
+ * command line, so that the command line overrides the file. Every line of the file holds a long
+ * option without its dashes and, for options that take one, its value after a space or '=', e.g.
+ * "sample-rate 48000"; empty lines and lines starting with '#' are skipped.
+ *
+ * @param argc Number of command line arguments.
+ * @param argv Command line arguments.
+ * @param mergedArgc Output number of arguments to parse.
+ * @return Arguments to parse (argv itself without --config), or NULL if the file could not be read.
+ */
+static char **read_config(int argc, char **argv, int *mergedArgc) {
+  const char *path = NULL;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+      path = argv[i + 1];
+    } else if (strncmp(argv[i], "--config=", strlen("--config=")) == 0) {
+      path = argv[i] + strlen("--config=");
+    }
+  }
+  *mergedArgc = argc;
+  if (path == NULL) {
+    return argv;
+  }
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror(path);
+    return NULL;
+  }
+
+  // The merged arguments live until the program exits, as getopt_long hands out pointers into them.
+  int capacity = argc + 16;
+  char **merged = (char **) malloc(sizeof(char *) * (capacity + 1));
+  int count = 0;
+  if (merged == NULL) {
+    printf("Could not allocate the options of %s.\n", path);
+    exit(EXIT_FAILURE);
+  }
+  merged[count++] = argv[0];
+
+  char line[CONFIG_LINE_SIZE];
+  while (fgets(line, sizeof(line), file) != NULL) {
+    char *name = line + strspn(line, " \t");
+    size_t length = strcspn(name, "\r\n");
+    while (length > 0 && (name[length - 1] == ' ' || name[length - 1] == '\t')) {
+      length--;
+    }
+    name[length] = '\0';
+    if (*name == '\0' || *name == '#') {
+      continue;
+    }
+
+    char *value = name + strcspn(name, " \t=");
+    if (*value != '\0') {
+      *value++ = '\0';
+      value += strspn(value, " \t=");
+    }
+
+    if (count + 2 + argc > capacity) {
+      capacity *= 2;
+      merged = (char **) realloc(merged, sizeof(char *) * (capacity + 1));
+    }
+    char *option = (char *) malloc(strlen(name) + 3);
+    if (merged == NULL || option == NULL || (*value != '\0' && (value = strdup(value)) == NULL)) {
+      printf("Could not allocate the options of %s.\n", path);
+      exit(EXIT_FAILURE);
+    }
+    sprintf(option, "--%s", name);
+    merged[count++] = option;
+    if (*value != '\0') {
+      merged[count++] = value;
+    }
+  }
+  fclose(file);
+
+  for (int i = 1; i < argc; i++) {
+    merged[count++] = argv[i];
+  }
+  merged[count] = NULL;
+  *mergedArgc = count;
+  return merged;
+}
+
+int main(int argc, char **argv) {
+  static const struct option longOptions[] = {
+      {"fps", required_argument, NULL, 'f'},
+      {"offline", required_argument, NULL, 'i'},
+      {"output", required_argument, NULL, 'o'},
+      {"format", required_argument, NULL, 'F'},
+      {"raw-channels", required_argument, NULL, 'C'},
+      {"raw-rate", required_argument, NULL, 'R'},
+      {"threads", required_argument, NULL, 'j'},
+      {"mix-views", no_argument, NULL, 'm'},
+      {"waterfall", required_argument, NULL, 'Y'},
+      {"pitch", no_argument, NULL, 'p'},
+      {"sample-rate", required_argument, NULL, 'z'},
+      {"buffer-size", required_argument, NULL, 'n'},
+      {"fft-size", required_argument, NULL, 'N'},
+      {"hop", required_argument, NULL, 'H'},
+      {"window", required_argument, NULL, 'W'},
+      {"scale", required_argument, NULL, 'S'},
+      {"bands", required_argument, NULL, 'B'},
+      {"planner", required_argument, NULL, 'P'},
+      {"wisdom", required_argument, NULL, 'w'},
+      {"warm-wisdom", no_argument, NULL, 'A'},
+      {"serve", required_argument, NULL, 's'},
+      {"stream", required_argument, NULL, 'T'},
+      {"stream-rate", required_argument, NULL, 'r'},
+      {"stream-bits", required_argument, NULL, 'b'},
+      {"udp", required_argument, NULL, 'U'},
+      {"induce-loss", required_argument, NULL, 'L'},
+      {"record", required_argument, NULL, 'a'},
+      {"record-format", required_argument, NULL, 'K'},
+      {"record-direct", no_argument, NULL, 'D'},
+      {"record-rotate-mb", required_argument, NULL, 'M'},
+      {"record-rotate-s", required_argument, NULL, 'E'},
+      {"record-buffer-ms", required_argument, NULL, 'Q'},
+      {"connect", required_argument, NULL, 'c'},
+      {"listen-udp", required_argument, NULL, 'u'},
+      {"multicast-group", required_argument, NULL, 'g'},
+      {"playout-ms", required_argument, NULL, 'd'},
+      {"stats", no_argument, NULL, 'x'},
+      {"input-devices", required_argument, NULL, 'I'},
+      {"lock-memory", no_argument, NULL, 'k'},
+      {"metrics-port", required_argument, NULL, 'O'},
+      {"metrics-json", required_argument, NULL, 'J'},
+      {"metrics-rate", required_argument, NULL, 'V'},
+      {"headless", no_argument, NULL, 'e'},
+      {"ballistics", required_argument, NULL, 'Z'},
+      {"attack-ms", required_argument, NULL, 't'},
+      {"release-ms", required_argument, NULL, 'l'},
+      {"hold-ms", required_argument, NULL, 'y'},
+      {"fall-ms", required_argument, NULL, 'q'},
+      {"config", required_argument, NULL, 'G'},
+      {"help", no_argument, NULL, 'h'},
+      {NULL, 0, NULL, 0}
+  };
+
+  offlineOptions offline;
+  memset(&offline, 0, sizeof(offline));
+  offline.format = OfflineBinary;
+  offline.rawSampleRate = (int) DEFAULT_SAMPLE_RATE;
+
+  spectroOptions spectro;
+  default_spectro_options(&spectro);
+  int warmWisdom = 0;
+  const char *servePort = NULL;
+  serverOptions serve;
+  default_server_options(&serve);
+  char *connectAddress = NULL;
+  const char *listenPort = NULL;
+  const char *multicastGroup = NULL;
+  int playoutMs = JITTER_DEFAULT_DELAY_MS;
+  int printStats = 0;
+  char *inputDeviceList = NULL;
+  double sampleRate = 0.0;
+  int lockMemory = 0;
+  exporterOptions metrics;
+  default_exporter_options(&metrics);
+  recorderOptions record;
+  default_recorder_options(&record);
+  ballisticsOptions ballistics;
+  default_ballistics_options(&ballistics);
+  // Times given on their own override whichever mode is selected, in any order; negative when not given.
+  double attackMs = -1.0;
+  double releaseMs = -1.0;
+  double holdMs = -1.0;
+  double fallMs = -1.0;
+
+  argv = read_config(argc, argv, &argc);
+  if (argv == NULL) {
+    return EXIT_FAILURE;
+  }
+
+  int option;
+  while ((option = getopt_long(argc, argv, "f:i:o:j:mh", longOptions, NULL)) != -1) {
+    switch (option) {
+      case 'f':
+        set_render_fps(atoi(optarg));
+        break;
+      case 'i':
+        offline.inputPath = optarg;
+        break;
+      case 'o':
+        offline.outputPath = optarg;
+        break;
+      case 'F':
+        if (parse_offline_format(optarg, &offline.format) != 0) {
+          printf("Unknown offline format: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'C':
+        offline.rawChannels = atoi(optarg);
+        break;
+      case 'R':
+        offline.rawSampleRate = atoi(optarg);
+        break;
+      case 'j':
+        offline.numThreads = atoi(optarg);
+        break;
+      case 'm':
+        spectro.mixViews = 1;
+        break;
+      case 'p':
+        spectro.pitch = 1;
+        set_pitch_readout(1);
+        break;
+      case 'Y':
+        set_waterfall_seconds(atof(optarg));
+        break;
+      case 'z':
+        sampleRate = atof(optarg);
+        break;
+      case 'n':
+        spectro.framesPerBuffer = atoi(optarg);
+        break;
+      case 'N':
+        spectro.fftSize = atoi(optarg);
+        break;
+      case 'H':
+        spectro.hopSize = atoi(optarg);
+        break;
+      case 'W':
+        if (parse_window_type(optarg, &spectro.window) != 0) {
+          printf("Unknown window: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'S':
+        if (parse_band_scale(optarg, &spectro.scale) != 0) {
+          printf("Unknown scale: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'B':
+        if (parse_band_reduce(optarg, &spectro.reduce) != 0) {
+          printf("Unknown band reduction: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'P':
+        if (set_planner_effort(optarg) != 0) {
+          printf("Unknown planner effort: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'w':
+        set_wisdom_path(optarg);
+        break;
+      case 'A':
+        warmWisdom = 1;
+        break;
+      case 's':
+        servePort = optarg;
+        break;
+      case 'T':
+        if (strcmp(optarg, "audio") == 0) {
+          serve.type = StreamAudio;
+        } else if (strcmp(optarg, "spectrum") == 0) {
+          serve.type = StreamSpectrum;
+        } else {
+          printf("Unknown stream kind: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'r':
+        serve.spectralRate = atoi(optarg);
+        break;
+      case 'b':
+        serve.spectralBits = atoi(optarg);
+        break;
+      case 'U': {
+        char *separator = strrchr(optarg, ':');
+        if (separator == NULL) {
+          printf("Expected HOST:PORT, got %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        *separator = '\0';
+        serve.udpHost = optarg;
+        servePort = separator + 1;
+        break;
+      }
+      case 'L':
+        serve.inducedLoss = atof(optarg);
+        break;
+      case 'a':
+        record.path = optarg;
+        break;
+      case 'K':
+        if (parse_record_format(optarg, &record.format) != 0) {
+          printf("Unknown recording format: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'D':
+        record.direct = 1;
+        break;
+      case 'M':
+        record.rotateBytes = (unsigned long long) (atof(optarg) * 1e6);
+        break;
+      case 'E':
+        record.rotateSeconds = atof(optarg);
+        break;
+      case 'Q':
+        record.bufferMs = atoi(optarg);
+        break;
+      case 'c':
+        connectAddress = optarg;
+        break;
+      case 'u':
+        listenPort = optarg;
+        break;
+      case 'g':
+        multicastGroup = optarg;
+        break;
+      case 'd':
+        playoutMs = atoi(optarg);
+        break;
+      case 'x':
+        printStats = 1;
+        break;
+      case 'I':
+        inputDeviceList = optarg;
+        break;
+      case 'k':
+        lockMemory = 1;
+        break;
+      case 'O':
+        metrics.httpPort = optarg;
+        break;
+      case 'J':
+        metrics.jsonPath = optarg;
+        break;
+      case 'V':
+        metrics.rate = atof(optarg);
+        break;
+      case 'e':
+        metrics.headless = 1;
+        break;
+      case 'Z':
+        if (parse_ballistics_mode(optarg, &ballistics) != 0) {
+          printf("Unknown ballistics: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 't':
+        attackMs = atof(optarg);
+        break;
+      case 'l':
+        releaseMs = atof(optarg);
+        break;
+      case 'y':
+        holdMs = atof(optarg);
+        break;
+      case 'q':
+        fallMs = atof(optarg);
+        break;
+      case 'G':
+        // Already merged into the arguments by read_config.
+        break;
+      case 'h':
+        print_usage(argv[0]);
+        return EXIT_SUCCESS;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (attackMs >= 0.0 || releaseMs >= 0.0 || holdMs >= 0.0 || fallMs >= 0.0) {
+    ballistics.mode = BallisticsCustom;
+    ballistics.attackMs = attackMs >= 0.0 ? attackMs : ballistics.attackMs;
+    ballistics.releaseMs = releaseMs >= 0.0 ? releaseMs : ballistics.releaseMs;
+    ballistics.holdMs = holdMs >= 0.0 ? holdMs : ballistics.holdMs;
+    ballistics.fallMs = fallMs >= 0.0 ? fallMs : ballistics.fallMs;
+  }
+  set_dispatch_ballistics(&ballistics);
+
+  viewerSource source = {NULL, listenPort, multicastGroup, playoutMs};
+  if (connectAddress != NULL) {
+    char *separator = strrchr(connectAddress, ':');
+    if (separator == NULL) {
+      printf("Expected HOST:PORT, got %s\n", connectAddress);
+      return EXIT_FAILURE;
+    }
+    *separator = '\0';
+    source.host = connectAddress;
+    source.port = separator + 1;
+  }
+  if (printStats && source.host != NULL) {
+    return start_client(source.host, source.port) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+  if (printStats && source.port != NULL) {
+    return start_udp_client(source.port, multicastGroup, playoutMs) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  load_wisdom();
+  // Offline threads split the file between them, so each analyses all spectra as one shard.
+  offline.spectro = spectro;
+  int analysisThreads = offline.numThreads > 0 ? offline.numThreads : pool_default_threads();
+  spectro.numShards = analysis_shards(analysisThreads);
+  set_dispatch_threads(analysisThreads);
+
+  if (warmWisdom) {
+    warm_spectro_wisdom(&offline.spectro);
+    warm_spectro_wisdom(&spectro);
+    save_wisdom();
+    return EXIT_SUCCESS;
+  }
+
+  if (offline.inputPath != NULL) {
+    int status = run_offline(&offline);
+    save_wisdom();
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (source.port != NULL) {
+    int status = start_viewer(&source, &spectro);
+    save_wisdom();
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (metrics.headless && !exporter_enabled(&metrics)) {
+    printf("--headless needs --metrics-port or --metrics-json.\n");
+    return EXIT_FAILURE;
+  }
+  metricsExporter exporter;
+  if (exporter_enabled(&metrics) && open_exporter(&exporter, &metrics) != 0) {
+    return EXIT_FAILURE;
+  }
 
-int main() {
   init_stream();
-  streamCallbackData *currentSpectroData = init_spectro_data();
-  int inputDeviceSelection = prompt_device(Input);
-  int outputDeviceSelection = prompt_device(Output);
-  process_stream(inputDeviceSelection, outputDeviceSelection, currentSpectroData);
+  int inputDeviceSelections[MAX_INPUT_DEVICES];
+  int numInputs = 1;
+  if (inputDeviceList != NULL) {
+    numInputs = parse_input_devices(inputDeviceList, inputDeviceSelections);
+    if (numInputs < 0) {
+      return EXIT_FAILURE;
+    }
+  } else if (metrics.headless) {
+    // Nobody is there to answer the prompts.
+    inputDeviceSelections[0] = Pa_GetDefaultInputDevice();
+    if (inputDeviceSelections[0] == paNoDevice) {
+      printf("No default input device; pick one with --input-devices.\n");
+      return EXIT_FAILURE;
+    }
+  } else {
+    inputDeviceSelections[0] = prompt_device(Input);
+  }
+  int outputDeviceSelection = metrics.headless ? -1 : prompt_device(Output);
+
+  // Every buffer of the session, the server's and the recorder's included, is carved out of one
+  // arena, which process_stream seals once the streams are set up.
+  sessionArena arena;
+  if (arena_open(&arena, lockMemory) != 0) {
+    printf("Could not reserve the session memory.\n");
+    return EXIT_FAILURE;
+  }
+  streamCallbackData *spectroData[MAX_INPUT_DEVICES];
+  for (int i = 0; i < numInputs; i++) {
+    spectroOptions deviceOptions = spectro;
+    deviceOptions.sampleRate = stream_sample_rate(inputDeviceSelections[i], i == 0 ? outputDeviceSelection : -1,
+                                                  sampleRate);
+    if (deviceOptions.sampleRate < 0.0) {
+      return EXIT_FAILURE;
+    }
+    spectroData[i] = init_spectro_data(stream_input_channels(inputDeviceSelections[i]), &deviceOptions);
+  }
+  save_wisdom();
+
+  // The server and the recorder take the first input device.
+  int inputDeviceSelection = inputDeviceSelections[0];
+  streamServer server;
+  if (servePort != NULL) {
+    serve.numSpectra = spectroData[0]->numSpectra;
+    serve.framesPerBuffer = spectroData[0]->options.framesPerBuffer;
+    if (start_server(&server, servePort, stream_input_channels(inputDeviceSelection),
+                     (int) spectroData[0]->options.sampleRate, &serve) != 0) {
+      return EXIT_FAILURE;
+    }
+    set_dispatch_server(&server);
+  }
+
+  audioRecorder recorder;
+  if (record.path != NULL) {
+    if (start_recorder(&recorder, &record, stream_input_channels(inputDeviceSelection),
+                       (int) spectroData[0]->options.sampleRate,
+                       (unsigned long) spectroData[0]->options.framesPerBuffer) != 0) {
+      return EXIT_FAILURE;
+    }
+    set_dispatch_recorder(&recorder);
+  }
+
+  process_stream(inputDeviceSelections, numInputs, outputDeviceSelection, spectroData, &arena,
+                 exporter_enabled(&metrics) ? &exporter : NULL);
   endwin();
 
+  FILE *summary = metrics.headless ? stderr : stdout;
+  int recorded = 0;
+  if (servePort != NULL) {
+    stop_server(&server);
+  }
+  if (record.path != NULL) {
+    recorded = stop_recorder(&recorder);
+    print_recorder_stats(&recorder, summary);
+  }
+  if (exporter_enabled(&metrics)) {
+    print_exporter_stats(&exporter, summary);
+  }
+  print_arena_stats(&arena, summary);
+  arena_close(&arena);
+  if (recorded != 0) {
+    return EXIT_FAILURE;
+  }
+
   return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
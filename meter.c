@@ -0,0 +1,327 @@
+//
+// Per-channel level metering (peak, RMS, DC offset and true-peak) with SIMD kernels.
+//
+
+#include "meter.h"
+#include "arena.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define METER_X86 1
+#include <immintrin.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/**
+ * Returns the name of the given kernel ("scalar", "sse2" or "avx2").
+ *
+ * @param kernel Kernel to name.
+ * @return Name of the kernel.
+ */
+const char *meter_kernel_name(enum MeterKernel kernel) {
+  static const char *NAMES[NUM_METER_KERNELS] = {"scalar", "sse2", "avx2"};
+  return NAMES[kernel];
+}
+
+/**
+ * Checks whether the given kernel can run on this CPU.
+ *
+ * @param kernel Kernel to check.
+ * @return Non-zero if the kernel is supported.
+ */
+int meter_kernel_supported(enum MeterKernel kernel) {
+  switch (kernel) {
+    case MeterScalar:
+      return 1;
+#ifdef METER_X86
+    case MeterSse2:
+      return __builtin_cpu_supports("sse2");
+    case MeterAvx2:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return 0;
+  }
+}
+
+/**
+ * Fills the Blackman-windowed sinc interpolator of every phase. Phase p estimates the signal
+ * p / METER_OVERSAMPLING samples after frame t - METER_TAPS / 2 from frames t - METER_TAPS + 1 .. t.
+ */
+static void build_coefficients(meterState *meter) {
+  const double halfWidth = METER_TAPS / 2;
+
+  for (int phase = 0; phase < METER_OVERSAMPLING; phase++) {
+    double sum = 0.0;
+    double taps[METER_TAPS];
+    for (int k = 0; k < METER_TAPS; k++) {
+      double x = k - halfWidth + (double) phase / METER_OVERSAMPLING;
+      double sinc = x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+      double window = 0.42 + 0.5 * cos(M_PI * x / halfWidth) + 0.08 * cos(2.0 * M_PI * x / halfWidth);
+      taps[k] = sinc * window;
+      sum += taps[k];
+    }
+    for (int k = 0; k < METER_TAPS; k++) {
+      meter->coefficients[phase][k] = (float) (taps[k] / sum);
+    }
+  }
+}
+
+/**
+ * Scalar kernel for channels [first, last). It is also the reference the SIMD kernels are checked
+ * against, so every accumulation runs in the same order as in the vector lanes.
+ */
+static void meter_channels_scalar(meterState *meter, unsigned long frames, int first, int last) {
+  const int numChannels = meter->numChannels;
+  const float *work = meter->work;
+
+  for (int channelNum = first; channelNum < last; channelNum++) {
+    float peak = 0.0f;
+    float sum = 0.0f;
+    float sumSquares = 0.0f;
+    float truePeak = 0.0f;
+
+    for (unsigned long i = METER_HISTORY; i < METER_HISTORY + frames; i++) {
+      float sample = work[i * numChannels + channelNum];
+      peak = fmaxf(peak, fabsf(sample));
+      sum += sample;
+      sumSquares += sample * sample;
+
+      for (int phase = 1; phase < METER_OVERSAMPLING; phase++) {
+        const float *coefficients = meter->coefficients[phase];
+        float value = 0.0f;
+        for (int k = 0; k < METER_TAPS; k++) {
+          value += coefficients[k] * work[(i - k) * numChannels + channelNum];
+        }
+        truePeak = fmaxf(truePeak, fabsf(value));
+      }
+    }
+
+    meter->peak[channelNum] = peak;
+    meter->sum[channelNum] = sum;
+    meter->sumSquares[channelNum] = sumSquares;
+    meter->truePeak[channelNum] = truePeak;
+  }
+}
+
+#ifdef METER_X86
+/**
+ * SSE2 kernel: four channels per vector, one frame at a time.
+ *
+ * @return First channel left for a narrower kernel.
+ */
+__attribute__((target("sse2")))
+static int meter_channels_sse2(meterState *meter, unsigned long frames, int first) {
+  const int numChannels = meter->numChannels;
+  const float *work = meter->work;
+  const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+  int channelNum = first;
+
+  for (; channelNum + 4 <= numChannels; channelNum += 4) {
+    __m128 peak = _mm_setzero_ps();
+    __m128 sum = _mm_setzero_ps();
+    __m128 sumSquares = _mm_setzero_ps();
+    __m128 truePeak = _mm_setzero_ps();
+
+    for (unsigned long i = METER_HISTORY; i < METER_HISTORY + frames; i++) {
+      __m128 sample = _mm_loadu_ps(work + i * numChannels + channelNum);
+      peak = _mm_max_ps(peak, _mm_and_ps(sample, absMask));
+      sum = _mm_add_ps(sum, sample);
+      sumSquares = _mm_add_ps(sumSquares, _mm_mul_ps(sample, sample));
+
+      for (int phase = 1; phase < METER_OVERSAMPLING; phase++) {
+        const float *coefficients = meter->coefficients[phase];
+        __m128 value = _mm_setzero_ps();
+        for (int k = 0; k < METER_TAPS; k++) {
+          __m128 tap = _mm_loadu_ps(work + (i - k) * numChannels + channelNum);
+          value = _mm_add_ps(value, _mm_mul_ps(_mm_set1_ps(coefficients[k]), tap));
+        }
+        truePeak = _mm_max_ps(truePeak, _mm_and_ps(value, absMask));
+      }
+    }
+
+    _mm_storeu_ps(meter->peak + channelNum, peak);
+    _mm_storeu_ps(meter->sum + channelNum, sum);
+    _mm_storeu_ps(meter->sumSquares + channelNum, sumSquares);
+    _mm_storeu_ps(meter->truePeak + channelNum, truePeak);
+  }
+
+  return channelNum;
+}
+
+/**
+ * AVX2 kernel: eight channels per vector, one frame at a time.
+ *
+ * @return First channel left for a narrower kernel.
+ */
+__attribute__((target("avx2")))
+static int meter_channels_avx2(meterState *meter, unsigned long frames, int first) {
+  const int numChannels = meter->numChannels;
+  const float *work = meter->work;
+  const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+  int channelNum = first;
+
+  for (; channelNum + 8 <= numChannels; channelNum += 8) {
+    __m256 peak = _mm256_setzero_ps();
+    __m256 sum = _mm256_setzero_ps();
+    __m256 sumSquares = _mm256_setzero_ps();
+    __m256 truePeak = _mm256_setzero_ps();
+
+    for (unsigned long i = METER_HISTORY; i < METER_HISTORY + frames; i++) {
+      __m256 sample = _mm256_loadu_ps(work + i * numChannels + channelNum);
+      peak = _mm256_max_ps(peak, _mm256_and_ps(sample, absMask));
+      sum = _mm256_add_ps(sum, sample);
+      sumSquares = _mm256_add_ps(sumSquares, _mm256_mul_ps(sample, sample));
+
+      for (int phase = 1; phase < METER_OVERSAMPLING; phase++) {
+        const float *coefficients = meter->coefficients[phase];
+        __m256 value = _mm256_setzero_ps();
+        for (int k = 0; k < METER_TAPS; k++) {
+          __m256 tap = _mm256_loadu_ps(work + (i - k) * numChannels + channelNum);
+          value = _mm256_add_ps(value, _mm256_mul_ps(_mm256_set1_ps(coefficients[k]), tap));
+        }
+        truePeak = _mm256_max_ps(truePeak, _mm256_and_ps(value, absMask));
+      }
+    }
+
+    _mm256_storeu_ps(meter->peak + channelNum, peak);
+    _mm256_storeu_ps(meter->sum + channelNum, sum);
+    _mm256_storeu_ps(meter->sumSquares + channelNum, sumSquares);
+    _mm256_storeu_ps(meter->truePeak + channelNum, truePeak);
+  }
+
+  return channelNum;
+}
+#endif
+
+/**
+ * Initializes the metering state for the given number of channels, selecting the fastest kernel
+ * the CPU supports.
+ *
+ * @param meter State to initialize.
+ * @param numChannels Number of interleaved channels.
+ * @param maxFrames Largest buffer expected; larger buffers grow the state.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int meter_init(meterState *meter, int numChannels, unsigned long maxFrames) {
+  memset(meter, 0, sizeof(*meter));
+  meter->numChannels = numChannels;
+  meter->capacity = maxFrames;
+  meter->work = (float *) session_alloc(sizeof(float) * (METER_HISTORY + maxFrames) * numChannels);
+  meter->peak = (float *) session_alloc(sizeof(float) * 4 * numChannels);
+  if (meter->work == NULL || meter->peak == NULL) {
+    meter_free(meter);
+    return -1;
+  }
+  meter->sum = meter->peak + numChannels;
+  meter->sumSquares = meter->sum + numChannels;
+  meter->truePeak = meter->sumSquares + numChannels;
+
+  meter->kernel = MeterScalar;
+  for (int kernel = MeterScalar; kernel < NUM_METER_KERNELS; kernel++) {
+    if (meter_kernel_supported((enum MeterKernel) kernel)) {
+      meter->kernel = (enum MeterKernel) kernel;
+    }
+  }
+
+  build_coefficients(meter);
+  meter_reset(meter);
+  return 0;
+}
+
+/**
+ * Frees the metering state.
+ *
+ * @param meter State to free.
+ */
+void meter_free(meterState *meter) {
+  session_free(meter->work);
+  session_free(meter->peak);
+  meter->work = NULL;
+  meter->peak = NULL;
+}
+
+/**
+ * Clears the history as if the stream had been silent.
+ *
+ * @param meter State to reset.
+ */
+void meter_reset(meterState *meter) {
+  memset(meter->work, 0, sizeof(float) * METER_HISTORY * meter->numChannels);
+}
+
+/**
+ * Measures the levels of every channel of the given buffer in one pass.
+ *
+ * @param meter Metering state of the stream.
+ * @param in Interleaved input samples.
+ * @param framesPerBuffer Number of frames in the buffer.
+ * @param levels Output array of numChannels levels.
+ * @return 0 on success, -1 if the state could not grow to the buffer size.
+ */
+int meter_process(meterState *meter, const float *in, unsigned long framesPerBuffer, channelLevels *levels) {
+  return meter_process_strided(meter, in, meter->numChannels, framesPerBuffer, levels);
+}
+
+/**
+ * Measures the levels of a contiguous range of the channels of a wider interleaved buffer, so that
+ * several meters can share one buffer and run on different threads.
+ *
+ * @param meter Metering state of the channel range; its numChannels is the width of the range.
+ * @param in First sample of the range in the first frame.
+ * @param stride Number of samples between consecutive frames of the buffer; at least numChannels.
+ * @param framesPerBuffer Number of frames in the buffer.
+ * @param levels Output array of numChannels levels.
+ * @return 0 on success, -1 if the state could not grow to the buffer size.
+ */
+int meter_process_strided(meterState *meter, const float *in, int stride, unsigned long framesPerBuffer,
+                          channelLevels *levels) {
+  const int numChannels = meter->numChannels;
+
+  if (framesPerBuffer > meter->capacity) {
+    float *work = (float *) session_alloc(sizeof(float) * (METER_HISTORY + framesPerBuffer) * numChannels);
+    if (work == NULL) {
+      return -1;
+    }
+    memcpy(work, meter->work, sizeof(float) * METER_HISTORY * numChannels);
+    session_free(meter->work);
+    meter->work = work;
+    meter->capacity = framesPerBuffer;
+  }
+  if (stride == numChannels) {
+    memcpy(meter->work + METER_HISTORY * numChannels, in, sizeof(float) * framesPerBuffer * numChannels);
+  } else {
+    for (unsigned long i = 0; i < framesPerBuffer; i++) {
+      memcpy(meter->work + (METER_HISTORY + i) * numChannels, in + i * stride, sizeof(float) * numChannels);
+    }
+  }
+
+  int channelNum = 0;
+#ifdef METER_X86
+  if (meter->kernel == MeterAvx2) {
+    channelNum = meter_channels_avx2(meter, framesPerBuffer, channelNum);
+  }
+  if (meter->kernel >= MeterSse2) {
+    channelNum = meter_channels_sse2(meter, framesPerBuffer, channelNum);
+  }
+#endif
+  meter_channels_scalar(meter, framesPerBuffer, channelNum, numChannels);
+
+  float scale = framesPerBuffer > 0 ? 1.0f / (float) framesPerBuffer : 0.0f;
+  for (int c = 0; c < numChannels; c++) {
+    levels[c].peak = meter->peak[c];
+    levels[c].rms = sqrtf(meter->sumSquares[c] * scale);
+    levels[c].dc = meter->sum[c] * scale;
+    levels[c].truePeak = fmaxf(meter->peak[c], meter->truePeak[c]);
+  }
+
+  // Keep the last METER_HISTORY frames as the history of the next buffer.
+  memmove(meter->work, meter->work + framesPerBuffer * numChannels,
+          sizeof(float) * METER_HISTORY * numChannels);
+  return 0;
+}
@@ -0,0 +1,137 @@
+//
+// Per-channel level metering (peak, RMS, DC offset and true-peak) with SIMD kernels.
+//
+
+#ifndef METER_H
+#define METER_H
+
+#include <stddef.h>
+
+/// Oversampling factor of the true-peak estimate
+#define METER_OVERSAMPLING 4
+
+/// Taps per phase of the true-peak interpolation filter
+#define METER_TAPS 12
+
+/// Frames kept from the previous buffer so the interpolation filter runs across buffer boundaries
+#define METER_HISTORY (METER_TAPS - 1)
+
+/**
+ * Implementation of the metering kernel.
+ */
+enum MeterKernel {
+  MeterScalar,
+  MeterSse2,
+  MeterAvx2,
+  NUM_METER_KERNELS
+};
+
+/**
+ * Levels of one channel over one buffer, relative to full scale.
+ */
+typedef struct {
+
+  /// Largest absolute sample.
+  float peak;
+
+  /// Root mean square of the samples.
+  float rms;
+
+  /// Mean of the samples.
+  float dc;
+
+  /// Largest absolute value of the signal oversampled METER_OVERSAMPLING times; at least peak.
+  float truePeak;
+} channelLevels;
+
+/**
+ * Metering state of one interleaved stream. The samples of each buffer are appended after the last
+ * METER_HISTORY frames of the previous one, so the true-peak filter sees a continuous signal.
+ */
+typedef struct {
+  int numChannels;
+  enum MeterKernel kernel;
+
+  /// Interleaved frames: METER_HISTORY frames of history followed by the current buffer.
+  float *work;
+
+  /// Number of buffer frames work has room for after the history.
+  unsigned long capacity;
+
+  /// Interpolation filter of each oversampled phase; phase 0 is the input sample itself.
+  float coefficients[METER_OVERSAMPLING][METER_TAPS];
+
+  /// Per-channel accumulators of the current buffer.
+  float *peak;
+  float *sum;
+  float *sumSquares;
+  float *truePeak;
+} meterState;
+
+/**
+ * Returns the name of the given kernel ("scalar", "sse2" or "avx2").
+ *
+ * @param kernel Kernel to name.
+ * @return Name of the kernel.
+ */
+const char *meter_kernel_name(enum MeterKernel kernel);
+
+/**
+ * Checks whether the given kernel can run on this CPU.
+ *
+ * @param kernel Kernel to check.
+ * @return Non-zero if the kernel is supported.
+ */
+int meter_kernel_supported(enum MeterKernel kernel);
+
+/**
+ * Initializes the metering state for the given number of channels, selecting the fastest kernel
+ * the CPU supports.
+ *
+ * @param meter State to initialize.
+ * @param numChannels Number of interleaved channels.
+ * @param maxFrames Largest buffer expected; larger buffers grow the state.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int meter_init(meterState *meter, int numChannels, unsigned long maxFrames);
+
+/**
+ * Frees the metering state.
+ *
+ * @param meter State to free.
+ */
+void meter_free(meterState *meter);
+
+/**
+ * Clears the history as if the stream had been silent.
+ *
+ * @param meter State to reset.
+ */
+void meter_reset(meterState *meter);
+
+/**
+ * Measures the levels of every channel of the given buffer in one pass.
+ *
+ * @param meter Metering state of the stream.
+ * @param in Interleaved input samples.
+ * @param framesPerBuffer Number of frames in the buffer.
+ * @param levels Output array of numChannels levels.
+ * @return 0 on success, -1 if the state could not grow to the buffer size.
+ */
+int meter_process(meterState *meter, const float *in, unsigned long framesPerBuffer, channelLevels *levels);
+
+/**
+ * Measures the levels of a contiguous range of the channels of a wider interleaved buffer, so that
+ * several meters can share one buffer and run on different threads.
+ *
+ * @param meter Metering state of the channel range; its numChannels is the width of the range.
+ * @param in First sample of the range in the first frame.
+ * @param stride Number of samples between consecutive frames of the buffer; at least numChannels.
+ * @param framesPerBuffer Number of frames in the buffer.
+ * @param levels Output array of numChannels levels.
+ * @return 0 on success, -1 if the state could not grow to the buffer size.
+ */
+int meter_process_strided(meterState *meter, const float *in, int stride, unsigned long framesPerBuffer,
+                          channelLevels *levels);
+
+#endif //METER_H
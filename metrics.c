@@ -0,0 +1,214 @@
+//
+// Interval statistics of the analysed blocks of a stream, collected for the metrics exporter.
+//
+
+#include "metrics.h"
+#include "arena.h"
+#include <math.h>
+#include <string.h>
+
+/**
+ * Allocates the sums of an interval.
+ *
+ * @param interval Interval to initialize.
+ * @param numChannels Number of channels of the stream.
+ * @param numSpectra Number of spectra of the stream.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int metrics_interval_init(metricsInterval *interval, int numChannels, int numSpectra) {
+  memset(interval, 0, sizeof(*interval));
+  interval->peak = (float *) session_calloc((size_t) numChannels, sizeof(float));
+  interval->truePeak = (float *) session_calloc((size_t) numChannels, sizeof(float));
+  interval->energy = (double *) session_calloc((size_t) numChannels, sizeof(double));
+  interval->dc = (double *) session_calloc((size_t) numChannels, sizeof(double));
+  interval->bandPower = (double *) session_calloc((size_t) numSpectra * METRICS_BANDS, sizeof(double));
+  if (interval->peak == NULL || interval->truePeak == NULL || interval->energy == NULL || interval->dc == NULL ||
+      interval->bandPower == NULL) {
+    metrics_interval_free(interval);
+    return -1;
+  }
+  interval->loudness.momentary = -INFINITY;
+  interval->loudness.shortTerm = -INFINITY;
+  interval->loudness.integrated = -INFINITY;
+  interval->loudness.maxMomentary = -INFINITY;
+  return 0;
+}
+
+/**
+ * Frees the sums of an interval.
+ *
+ * @param interval Interval to free.
+ */
+void metrics_interval_free(metricsInterval *interval) {
+  session_free(interval->peak);
+  session_free(interval->truePeak);
+  session_free(interval->energy);
+  session_free(interval->dc);
+  session_free(interval->bandPower);
+  memset(interval, 0, sizeof(*interval));
+}
+
+/**
+ * Zeroes the sums of an interval of the given size, keeping its buffers.
+ */
+static void clear_interval(metricsInterval *interval, int numChannels, int numSpectra) {
+  interval->blocks = 0;
+  interval->frames = 0;
+  interval->analysisNs = 0;
+  memset(interval->peak, 0, sizeof(float) * (size_t) numChannels);
+  memset(interval->truePeak, 0, sizeof(float) * (size_t) numChannels);
+  memset(interval->energy, 0, sizeof(double) * (size_t) numChannels);
+  memset(interval->dc, 0, sizeof(double) * (size_t) numChannels);
+  memset(interval->bandPower, 0, sizeof(double) * (size_t) numSpectra * METRICS_BANDS);
+}
+
+/**
+ * Allocates an empty accumulator.
+ *
+ * @param metrics Accumulator to initialize.
+ * @param numChannels Number of channels of the stream.
+ * @param numSpectra Number of spectra of the stream.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int metrics_init(metricsAccumulator *metrics, int numChannels, int numSpectra) {
+  memset(metrics, 0, sizeof(*metrics));
+  if (metrics_interval_init(&metrics->current, numChannels, numSpectra) != 0) {
+    return -1;
+  }
+  metrics->numChannels = numChannels;
+  metrics->numSpectra = numSpectra;
+  pthread_mutex_init(&metrics->lock, NULL);
+  return 0;
+}
+
+/**
+ * Frees an accumulator; nothing happens if it was zeroed instead of initialized.
+ *
+ * @param metrics Accumulator to free.
+ */
+void metrics_free(metricsAccumulator *metrics) {
+  if (metrics->numChannels == 0) {
+    return;
+  }
+  metrics_interval_free(&metrics->current);
+  pthread_mutex_destroy(&metrics->lock);
+  metrics->numChannels = 0;
+}
+
+/**
+ * Returns the lower and upper edge of an octave band.
+ *
+ * @param band Index of the band, below METRICS_BANDS.
+ * @param low Set to the lower edge, in Hz.
+ * @param high Set to the upper edge, in Hz.
+ */
+void metrics_band_edges(int band, double *low, double *high) {
+  double centre = METRICS_LOWEST_BAND * (double) (1 << band);
+  *low = centre / M_SQRT2;
+  *high = centre * M_SQRT2;
+}
+
+/**
+ * Maps the octave bands onto the bins of the given STFT, if its size or window changed since the
+ * last block (e.g. after a restart with another FFT size).
+ */
+static void update_band_bins(metricsAccumulator *metrics, const stftEngine *stft, double sampleRate) {
+  if (metrics->bandFftSize == stft->fftSize && metrics->bandWindow == stft->window) {
+    return;
+  }
+
+  double binWidth = sampleRate / (double) stft->fftSize;
+  for (int band = 0; band <= METRICS_BANDS; band++) {
+    double low;
+    double high;
+    metrics_band_edges(band < METRICS_BANDS ? band : METRICS_BANDS - 1, &low, &high);
+    int bin = (int) ceil((band < METRICS_BANDS ? low : high) / binWidth);
+    metrics->bandBins[band] = bin < stft->numBins ? bin : stft->numBins;
+  }
+
+  // A sine spreads its peak power over the main lobe: sum(w^2) * N / sum(w)^2 bins of it.
+  double sum = 0.0;
+  double sumSquares = 0.0;
+  for (int i = 0; i < stft->fftSize; i++) {
+    sum += stft->window[i];
+    sumSquares += stft->window[i] * stft->window[i];
+  }
+  metrics->bandScale = sumSquares > 0.0 ? sum * sum / (sumSquares * (double) stft->fftSize) : 0.0;
+  metrics->bandFftSize = stft->fftSize;
+  metrics->bandWindow = stft->window;
+}
+
+/**
+ * Adds the last block analysed by an analyser to the interval in progress.
+ *
+ * @param metrics Accumulator of the analyser's stream.
+ * @param analyser Analyser that has just analysed the block; its spectro data must have the
+ *        accumulator's channels and spectra.
+ * @param frames Number of frames in the block.
+ * @param analysisNs Wall time the analysis of the block took.
+ */
+void metrics_add_block(metricsAccumulator *metrics, const blockAnalyser *analyser, unsigned long frames,
+                       uint64_t analysisNs) {
+  const streamCallbackData *spectroData = analyser->spectroData;
+  update_band_bins(metrics, &spectroData->shards[0], spectroData->options.sampleRate);
+
+  pthread_mutex_lock(&metrics->lock);
+  metricsInterval *interval = &metrics->current;
+  double weight = (double) frames;
+  interval->blocks++;
+  interval->frames += frames;
+  interval->analysisNs += analysisNs;
+
+  for (int c = 0; c < metrics->numChannels; c++) {
+    const channelLevels *levels = &analyser->levels[c];
+    interval->peak[c] = fmaxf(interval->peak[c], levels->peak);
+    interval->truePeak[c] = fmaxf(interval->truePeak[c], levels->truePeak);
+    interval->energy[c] += (double) levels->rms * (double) levels->rms * weight;
+    interval->dc[c] += (double) levels->dc * weight;
+  }
+
+  // Every shard holds the latest STFT frame of its rows; blocks shorter than a hop add it again.
+  for (int shard = 0; shard < spectroData->numShards; shard++) {
+    const stftEngine *stft = &spectroData->shards[shard];
+    int firstRow = spectroData->shardRows[shard];
+    for (int row = 0; row < stft->numRows; row++) {
+      const double *power = stft->power + (size_t) row * stft->numBins;
+      double *bands = interval->bandPower + (size_t) (firstRow + row) * METRICS_BANDS;
+      for (int band = 0; band < METRICS_BANDS; band++) {
+        double sum = 0.0;
+        for (int bin = metrics->bandBins[band]; bin < metrics->bandBins[band + 1]; bin++) {
+          sum += power[bin];
+        }
+        bands[band] += sum * metrics->bandScale * weight;
+      }
+    }
+  }
+
+  interval->loudness = analyser->loudness.levels;
+  pthread_mutex_unlock(&metrics->lock);
+}
+
+/**
+ * Ends the interval in progress: copies it into the given interval and starts an empty one.
+ *
+ * @param metrics Accumulator to take the interval from.
+ * @param interval Interval initialized with the accumulator's channels and spectra.
+ */
+void metrics_take(metricsAccumulator *metrics, metricsInterval *interval) {
+  int numChannels = metrics->numChannels;
+  int numSpectra = metrics->numSpectra;
+
+  pthread_mutex_lock(&metrics->lock);
+  const metricsInterval *current = &metrics->current;
+  interval->blocks = current->blocks;
+  interval->frames = current->frames;
+  interval->analysisNs = current->analysisNs;
+  memcpy(interval->peak, current->peak, sizeof(float) * (size_t) numChannels);
+  memcpy(interval->truePeak, current->truePeak, sizeof(float) * (size_t) numChannels);
+  memcpy(interval->energy, current->energy, sizeof(double) * (size_t) numChannels);
+  memcpy(interval->dc, current->dc, sizeof(double) * (size_t) numChannels);
+  memcpy(interval->bandPower, current->bandPower, sizeof(double) * (size_t) numSpectra * METRICS_BANDS);
+  interval->loudness = current->loudness;
+  clear_interval(&metrics->current, numChannels, numSpectra);
+  pthread_mutex_unlock(&metrics->lock);
+}
@@ -0,0 +1,136 @@
+//
+// Interval statistics of the analysed blocks of a stream, collected for the metrics exporter.
+//
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include "analysis.h"
+
+/// Number of octave bands whose power is collected for every spectrum
+#define METRICS_BANDS 10
+
+/// Centre of the lowest octave band, in Hz; band b is centred on METRICS_LOWEST_BAND * 2^b, up to 16 kHz
+#define METRICS_LOWEST_BAND 31.25
+
+/**
+ * Levels, band power and analysis cost of the blocks analysed during one export interval. Sums
+ * are weighted by the frames of each block, so intervals of blocks of any size average alike.
+ */
+typedef struct {
+
+  /// Blocks and frames analysed during the interval.
+  unsigned long blocks;
+  unsigned long frames;
+
+  /// Wall time the render thread spent analysing them.
+  uint64_t analysisNs;
+
+  /// Largest peak and true-peak level of every channel.
+  float *peak;
+  float *truePeak;
+
+  /// Sum of the squared RMS level and of the DC offset of every channel, times the frames of each block.
+  double *energy;
+  double *dc;
+
+  /// Sum of the power of every octave band of every spectrum, METRICS_BANDS per spectrum, times the
+  /// frames of each block; a full-scale sine in a band adds a power of 1 per frame.
+  double *bandPower;
+
+  /// Loudness of the stream as of the last block.
+  loudnessLevels loudness;
+} metricsInterval;
+
+/**
+ * Statistics of a stream accumulated by the render thread after every analysed block and taken
+ * by the exporter once per interval. Both only hold the lock to add or copy a fixed number of
+ * values; nothing is allocated after metrics_init, and the audio callback never touches it.
+ */
+typedef struct {
+  int numChannels;
+  int numSpectra;
+
+  /// Protects current.
+  pthread_mutex_t lock;
+
+  /// Statistics of the interval in progress.
+  metricsInterval current;
+
+  /// First bin of every octave band and one past the last bin of the last one, for the FFT size and
+  /// window the bins were computed for; bands narrower than one bin are empty.
+  int bandBins[METRICS_BANDS + 1];
+  int bandFftSize;
+  const double *bandWindow;
+
+  /// Inverse of the equivalent noise bandwidth of that window, in bins, so that the summed bins
+  /// of a sine add up to its peak power.
+  double bandScale;
+} metricsAccumulator;
+
+/**
+ * Allocates the sums of an interval.
+ *
+ * @param interval Interval to initialize.
+ * @param numChannels Number of channels of the stream.
+ * @param numSpectra Number of spectra of the stream.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int metrics_interval_init(metricsInterval *interval, int numChannels, int numSpectra);
+
+/**
+ * Frees the sums of an interval.
+ *
+ * @param interval Interval to free.
+ */
+void metrics_interval_free(metricsInterval *interval);
+
+/**
+ * Allocates an empty accumulator.
+ *
+ * @param metrics Accumulator to initialize.
+ * @param numChannels Number of channels of the stream.
+ * @param numSpectra Number of spectra of the stream.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int metrics_init(metricsAccumulator *metrics, int numChannels, int numSpectra);
+
+/**
+ * Frees an accumulator; nothing happens if it was zeroed instead of initialized.
+ *
+ * @param metrics Accumulator to free.
+ */
+void metrics_free(metricsAccumulator *metrics);
+
+/**
+ * Adds the last block analysed by an analyser to the interval in progress.
+ *
+ * @param metrics Accumulator of the analyser's stream.
+ * @param analyser Analyser that has just analysed the block; its spectro data must have the
+ *        accumulator's channels and spectra.
+ * @param frames Number of frames in the block.
+ * @param analysisNs Wall time the analysis of the block took.
+ */
+void metrics_add_block(metricsAccumulator *metrics, const blockAnalyser *analyser, unsigned long frames,
+                       uint64_t analysisNs);
+
+/**
+ * Ends the interval in progress: copies it into the given interval and starts an empty one.
+ *
+ * @param metrics Accumulator to take the interval from.
+ * @param interval Interval initialized with the accumulator's channels and spectra.
+ */
+void metrics_take(metricsAccumulator *metrics, metricsInterval *interval);
+
+/**
+ * Returns the lower and upper edge of an octave band.
+ *
+ * @param band Index of the band, below METRICS_BANDS.
+ * @param low Set to the lower edge, in Hz.
+ * @param high Set to the upper edge, in Hz.
+ */
+void metrics_band_edges(int band, double *low, double *high);
+
+#endif //METRICS_H
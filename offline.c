@@ -0,0 +1,519 @@
+//
+// Headless analysis of recorded audio files.
+//
+
+#include "offline.h"
+#include "utils.h"
+#include "meter.h"
+#include "frequencies.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Encoding of the samples in the mapped input file.
+ */
+enum SampleEncoding {
+  EncodingPcm16,
+  EncodingPcm24,
+  EncodingFloat32
+};
+
+/**
+ * Memory-mapped input file and the layout of its sample data.
+ */
+typedef struct {
+  void *map;
+  size_t mapSize;
+  const unsigned char *samples;
+  size_t numFrames;
+  size_t frameBytes;
+  int numChannels;
+  int sampleRate;
+  enum SampleEncoding encoding;
+} offlineSource;
+
+/**
+ * State shared by the worker threads of a single run.
+ */
+typedef struct {
+  const offlineSource *source;
+  enum OfflineFormat format;
+  FILE *output;
+  const spectroOptions *spectro;
+  int numSpectra;
+  size_t numBlocks;
+  size_t numChunks;
+
+  /// Next chunk to be claimed by a worker.
+  _Atomic size_t nextChunk;
+
+  /// Next chunk to be written; chunks are written in order so the output is deterministic.
+  size_t nextWrite;
+  pthread_mutex_t writeLock;
+  pthread_cond_t writeTurn;
+  int failed;
+} offlineRun;
+
+/**
+ * Per-thread scratch memory, FFT plan and level meter.
+ */
+typedef struct {
+  offlineRun *run;
+  pthread_t thread;
+  streamCallbackData *spectroData;
+  meterState meter;
+  float *block;
+  channelLevels *levels;
+  char *output;
+  size_t outputCapacity;
+} offlineWorker;
+
+static uint16_t read_le16(const unsigned char *p) {
+  return (uint16_t) (p[0] | (p[1] << 8));
+}
+
+static uint32_t read_le32(const unsigned char *p) {
+  return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/**
+ * Locates the fmt and data chunks of a RIFF/WAVE file.
+ *
+ * @return 0 on success, -1 if the file is not a supported WAV file.
+ */
+static int parse_wav(offlineSource *source, const unsigned char *file, size_t size) {
+  const unsigned char *fmt = NULL;
+  size_t pos = 12;
+
+  while (pos + 8 <= size) {
+    const unsigned char *chunk = file + pos;
+    size_t chunkSize = read_le32(chunk + 4);
+
+    if (memcmp(chunk, "fmt ", 4) == 0 && chunkSize >= 16) {
+      fmt = chunk + 8;
+    } else if (memcmp(chunk, "data", 4) == 0 && fmt != NULL) {
+      uint16_t format = read_le16(fmt);
+      uint16_t bits = read_le16(fmt + 14);
+      if (format == 0xFFFE && read_le32(fmt - 4) >= 26) {
+        // WAVE_FORMAT_EXTENSIBLE: the real format is the first field of the sub-format GUID.
+        format = read_le16(fmt + 24);
+      }
+
+      if (format == 1 && bits == 16) {
+        source->encoding = EncodingPcm16;
+      } else if (format == 1 && bits == 24) {
+        source->encoding = EncodingPcm24;
+      } else if (format == 3 && bits == 32) {
+        source->encoding = EncodingFloat32;
+      } else {
+        fprintf(stderr, "Unsupported WAV encoding (format %u, %u bits).\n", format, bits);
+        return -1;
+      }
+
+      source->numChannels = read_le16(fmt + 2);
+      source->sampleRate = (int) read_le32(fmt + 4);
+      source->frameBytes = (size_t) source->numChannels * (bits / 8);
+      source->samples = chunk + 8;
+      if (chunkSize > size - pos - 8) {
+        chunkSize = size - pos - 8;
+      }
+      source->numFrames = source->frameBytes == 0 ? 0 : chunkSize / source->frameBytes;
+      return source->numChannels > 0 ? 0 : -1;
+    }
+
+    pos += 8 + chunkSize + (chunkSize & 1);
+  }
+
+  fprintf(stderr, "WAV file has no fmt/data chunk.\n");
+  return -1;
+}
+
+/**
+ * Maps the input file and determines its sample layout.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int open_source(offlineSource *source, const offlineOptions *options) {
+  int fd = open(options->inputPath, O_RDONLY);
+  if (fd < 0) {
+    perror(options->inputPath);
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size == 0) {
+    fprintf(stderr, "Cannot read %s.\n", options->inputPath);
+    close(fd);
+    return -1;
+  }
+
+  source->mapSize = (size_t) st.st_size;
+  source->map = mmap(NULL, source->mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (source->map == MAP_FAILED) {
+    perror("mmap");
+    return -1;
+  }
+  posix_madvise(source->map, source->mapSize, POSIX_MADV_SEQUENTIAL);
+
+  const unsigned char *file = (const unsigned char *) source->map;
+  if (source->mapSize >= 12 && memcmp(file, "RIFF", 4) == 0 && memcmp(file + 8, "WAVE", 4) == 0) {
+    if (parse_wav(source, file, source->mapSize) == 0) {
+      return 0;
+    }
+  } else if (options->rawChannels > 0) {
+    source->encoding = EncodingFloat32;
+    source->numChannels = options->rawChannels;
+    source->sampleRate = options->rawSampleRate;
+    source->frameBytes = sizeof(float) * (size_t) options->rawChannels;
+    source->samples = file;
+    source->numFrames = source->mapSize / source->frameBytes;
+    return 0;
+  } else {
+    fprintf(stderr, "%s is not a WAV file; pass --raw-channels to read raw float32 samples.\n", options->inputPath);
+  }
+
+  munmap(source->map, source->mapSize);
+  return -1;
+}
+
+/**
+ * Decodes one block of framesPerBuffer frames of the input into interleaved floats, zero-padding
+ * past the end of the file.
+ */
+static void decode_block(const offlineSource *source, size_t blockIndex, size_t framesPerBuffer, float *block) {
+  size_t firstFrame = blockIndex * framesPerBuffer;
+  size_t frames = source->numFrames - firstFrame;
+  if (frames > framesPerBuffer) {
+    frames = framesPerBuffer;
+  }
+
+  size_t count = frames * source->numChannels;
+  const unsigned char *p = source->samples + firstFrame * source->frameBytes;
+
+  switch (source->encoding) {
+    case EncodingPcm16:
+      for (size_t i = 0; i < count; i++, p += 2) {
+        block[i] = (float) (int16_t) read_le16(p) / 32768.0f;
+      }
+      break;
+    case EncodingPcm24:
+      for (size_t i = 0; i < count; i++, p += 3) {
+        int32_t sample = (int32_t) ((uint32_t) p[0] << 8 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 24) >> 8;
+        block[i] = (float) sample / 8388608.0f;
+      }
+      break;
+    case EncodingFloat32:
+      memcpy(block, p, count * sizeof(float));
+      break;
+  }
+
+  memset(block + count, 0, (framesPerBuffer * (size_t) source->numChannels - count) * sizeof(float));
+}
+
+/**
+ * Analyses one block and appends its record to the worker's output buffer.
+ *
+ * @return Number of bytes appended.
+ */
+static size_t analyse_block(offlineWorker *worker, size_t blockIndex, char *dest) {
+  const offlineSource *source = worker->run->source;
+  int numChannels = source->numChannels;
+  int numColumns = worker->run->numSpectra * WIN_WIDTH;
+  const double *proportions = worker->spectroData->proportions;
+  size_t framesPerBuffer = (size_t) worker->run->spectro->framesPerBuffer;
+
+  decode_block(source, blockIndex, framesPerBuffer, worker->block);
+  meter_process(&worker->meter, worker->block, framesPerBuffer, worker->levels);
+  compute_frequencies(worker->block, framesPerBuffer, numChannels, worker->spectroData,
+                      worker->spectroData->proportions);
+
+  if (worker->run->format == OfflineBinary) {
+    float *record = (float *) dest;
+    int numLevels = numChannels * OFFLINE_LEVELS;
+    for (int channelNum = 0; channelNum < numChannels; channelNum++) {
+      const channelLevels *levels = &worker->levels[channelNum];
+      float *channelRecord = record + channelNum * OFFLINE_LEVELS;
+      channelRecord[0] = levels->peak;
+      channelRecord[1] = levels->rms;
+      channelRecord[2] = levels->dc;
+      channelRecord[3] = levels->truePeak;
+    }
+    for (int i = 0; i < numColumns; i++) {
+      record[numLevels + i] = (float) proportions[i];
+    }
+    return sizeof(float) * (numLevels + numColumns);
+  }
+
+  char *p = dest;
+  double seconds = source->sampleRate > 0
+                   ? (double) blockIndex * framesPerBuffer / source->sampleRate
+                   : 0.0;
+  p += sprintf(p, "%zu,%.6f", blockIndex, seconds);
+  for (int channelNum = 0; channelNum < numChannels; channelNum++) {
+    const channelLevels *levels = &worker->levels[channelNum];
+    p += sprintf(p, ",%.9g,%.9g,%.9g,%.9g", levels->peak, levels->rms, levels->dc, levels->truePeak);
+  }
+  for (int i = 0; i < numColumns; i++) {
+    p += sprintf(p, ",%.9g", (float) proportions[i]);
+  }
+  *p++ = '\n';
+  return (size_t) (p - dest);
+}
+
+/**
+ * Brings the worker's STFT and level meter to the state the live view would have at the start of the given block.
+ * A reset STFT computes its frames every hopSize samples from the first sample it is given, so the history is
+ * refilled from a multiple of hopSize, as in an uninterrupted run, that lies fftSize samples before the last
+ * frame completed ahead of the block. Every frame the chunk shows is then computed from the same samples at the
+ * same offsets as in an uninterrupted run, whatever the ratio of the block size to the hop.
+ */
+static void warm_up(offlineWorker *worker, size_t firstBlock) {
+  const stftEngine *stft = &worker->spectroData->shards[0];
+  const offlineSource *source = worker->run->source;
+  size_t framesPerBuffer = (size_t) worker->run->spectro->framesPerBuffer;
+  size_t hopSize = (size_t) stft->hopSize;
+  size_t fftSize = (size_t) stft->fftSize;
+
+  for (int shard = 0; shard < worker->spectroData->numShards; shard++) {
+    stft_reset(&worker->spectroData->shards[shard]);
+  }
+  meter_reset(&worker->meter);
+  if (firstBlock == 0) {
+    return;
+  }
+
+  // fftSize is a multiple of hopSize, so the start stays on the frame grid of an uninterrupted run.
+  size_t lastFrameEnd = firstBlock * framesPerBuffer / hopSize * hopSize;
+  size_t firstFrame = lastFrameEnd > fftSize ? lastFrameEnd - fftSize : 0;
+
+  for (size_t blockIndex = firstFrame / framesPerBuffer; blockIndex < firstBlock; blockIndex++) {
+    decode_block(source, blockIndex, framesPerBuffer, worker->block);
+    size_t skip = blockIndex * framesPerBuffer < firstFrame ? firstFrame - blockIndex * framesPerBuffer : 0;
+    compute_frequencies(worker->block + skip * source->numChannels, framesPerBuffer - skip, source->numChannels,
+                        worker->spectroData, worker->spectroData->proportions);
+  }
+  // The true-peak filter only looks back METER_HISTORY frames, well within the last block.
+  meter_process(&worker->meter, worker->block, framesPerBuffer, worker->levels);
+}
+
+/**
+ * Worker thread: claims chunks of blocks, analyses them and writes them out in chunk order.
+ */
+static void *offline_worker(void *arg) {
+  offlineWorker *worker = (offlineWorker *) arg;
+  offlineRun *run = worker->run;
+
+  for (;;) {
+    size_t chunk = atomic_fetch_add(&run->nextChunk, 1);
+    if (chunk >= run->numChunks) {
+      break;
+    }
+
+    size_t first = chunk * OFFLINE_CHUNK_BLOCKS;
+    size_t last = first + OFFLINE_CHUNK_BLOCKS;
+    if (last > run->numBlocks) {
+      last = run->numBlocks;
+    }
+
+    warm_up(worker, first);
+
+    size_t length = 0;
+    for (size_t blockIndex = first; blockIndex < last; blockIndex++) {
+      length += analyse_block(worker, blockIndex, worker->output + length);
+    }
+
+    pthread_mutex_lock(&run->writeLock);
+    while (run->nextWrite != chunk) {
+      pthread_cond_wait(&run->writeTurn, &run->writeLock);
+    }
+    if (fwrite(worker->output, 1, length, run->output) != length) {
+      run->failed = 1;
+    }
+    run->nextWrite++;
+    pthread_cond_broadcast(&run->writeTurn);
+    pthread_mutex_unlock(&run->writeLock);
+  }
+
+  return NULL;
+}
+
+/**
+ * Writes the binary header or the CSV column names.
+ */
+static void write_preamble(const offlineRun *run) {
+  const offlineSource *source = run->source;
+
+  if (run->format == OfflineBinary) {
+    offlineHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, OFFLINE_MAGIC, 4);
+    header.version = OFFLINE_VERSION;
+    header.numChannels = (uint16_t) source->numChannels;
+    header.numColumns = WIN_WIDTH;
+    header.numSpectra = (uint16_t) run->numSpectra;
+    header.framesPerBuffer = (uint32_t) run->spectro->framesPerBuffer;
+    header.sampleRate = (uint32_t) source->sampleRate;
+    header.fftSize = (uint32_t) run->spectro->fftSize;
+    header.hopSize = (uint32_t) run->spectro->hopSize;
+    header.blockCount = run->numBlocks;
+    fwrite(&header, sizeof(header), 1, run->output);
+    return;
+  }
+
+  fprintf(run->output, "block,time_s");
+  for (int channelNum = 0; channelNum < source->numChannels; channelNum++) {
+    fprintf(run->output, ",peak_%d,rms_%d,dc_%d,true_peak_%d", channelNum, channelNum, channelNum, channelNum);
+  }
+  for (int spectrum = 0; spectrum < run->numSpectra; spectrum++) {
+    for (int i = 0; i < WIN_WIDTH; i++) {
+      fprintf(run->output, ",s%d_col_%d", spectrum, i);
+    }
+  }
+  fprintf(run->output, "\n");
+}
+
+/**
+ * Parses an offline output format name ("bin" or "csv").
+ *
+ * @param name Name to parse.
+ * @param format Set to the parsed format.
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int parse_offline_format(const char *name, enum OfflineFormat *format) {
+  if (strcmp(name, "bin") == 0) {
+    *format = OfflineBinary;
+  } else if (strcmp(name, "csv") == 0) {
+    *format = OfflineCsv;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Memory-maps the input file, analyses it block by block on every core and writes the
+ * per-block peak levels and spectra to the output.
+ *
+ * @param options Options of the run.
+ * @return 0 on success, -1 if the input could not be read or the output could not be written.
+ */
+int run_offline(const offlineOptions *options) {
+  offlineSource source;
+  memset(&source, 0, sizeof(source));
+  if (open_source(&source, options) != 0) {
+    return -1;
+  }
+
+  // The file is analysed at its own rate, so the frequency columns match a live capture at that rate.
+  spectroOptions spectro = options->spectro;
+  spectro.sampleRate = source.sampleRate;
+  size_t framesPerBuffer = (size_t) spectro.framesPerBuffer;
+
+  offlineRun run;
+  memset(&run, 0, sizeof(run));
+  run.source = &source;
+  run.format = options->format;
+  run.spectro = &spectro;
+  run.numBlocks = (source.numFrames + framesPerBuffer - 1) / framesPerBuffer;
+  run.numChunks = (run.numBlocks + OFFLINE_CHUNK_BLOCKS - 1) / OFFLINE_CHUNK_BLOCKS;
+  atomic_init(&run.nextChunk, 0);
+  pthread_mutex_init(&run.writeLock, NULL);
+  pthread_cond_init(&run.writeTurn, NULL);
+
+  int useStdout = options->outputPath == NULL || strcmp(options->outputPath, "-") == 0;
+  run.output = useStdout ? stdout : fopen(options->outputPath, "wb");
+  if (run.output == NULL) {
+    perror(options->outputPath);
+    munmap(source.map, source.mapSize);
+    return -1;
+  }
+  setvbuf(run.output, NULL, _IOFBF, 1 << 20);
+
+  int numThreads = options->numThreads;
+  if (numThreads <= 0) {
+    numThreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (numThreads < 1) {
+    numThreads = 1;
+  }
+  if ((size_t) numThreads > run.numChunks && run.numChunks > 0) {
+    numThreads = (int) run.numChunks;
+  }
+
+  offlineWorker *workers = (offlineWorker *) calloc(numThreads, sizeof(offlineWorker));
+  for (int t = 0; t < numThreads; t++) {
+    // FFTW planning is not thread-safe, so every worker's plan is created here.
+    workers[t].spectroData = init_spectro_data(source.numChannels, &spectro);
+  }
+  run.numSpectra = workers[0].spectroData->numSpectra;
+  write_preamble(&run);
+
+  // Upper bound of one CSV record: two leading fields plus one value per peak/column.
+  size_t recordValues = (size_t) source.numChannels * OFFLINE_LEVELS + (size_t) run.numSpectra * WIN_WIDTH;
+  size_t recordCapacity = run.format == OfflineBinary
+                          ? sizeof(float) * recordValues
+                          : 48 + 24 * recordValues;
+
+  for (int t = 0; t < numThreads; t++) {
+    workers[t].run = &run;
+    workers[t].block = (float *) malloc(sizeof(float) * framesPerBuffer * source.numChannels);
+    workers[t].levels = (channelLevels *) malloc(sizeof(channelLevels) * source.numChannels);
+    workers[t].outputCapacity = recordCapacity * OFFLINE_CHUNK_BLOCKS;
+    workers[t].output = (char *) malloc(workers[t].outputCapacity);
+    if (workers[t].block == NULL || workers[t].levels == NULL || workers[t].output == NULL ||
+        meter_init(&workers[t].meter, source.numChannels, framesPerBuffer) != 0) {
+      printf("Could not allocate offline worker buffers.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  int started = 0;
+  int startFailed = 0;
+  for (; started < numThreads; started++) {
+    if (pthread_create(&workers[started].thread, NULL, offline_worker, &workers[started]) != 0) {
+      fprintf(stderr, "Could not start offline worker thread %d of %d.\n", started + 1, numThreads);
+      // Chunks are claimed in order, so the workers that did start finish the ones they hold and stop.
+      atomic_store(&run.nextChunk, run.numChunks);
+      startFailed = 1;
+      break;
+    }
+  }
+  for (int t = 0; t < started; t++) {
+    pthread_join(workers[t].thread, NULL);
+  }
+  run.failed |= startFailed;
+
+  for (int t = 0; t < numThreads; t++) {
+    free_spectro_data(workers[t].spectroData);
+    free(workers[t].block);
+    free(workers[t].levels);
+    meter_free(&workers[t].meter);
+    free(workers[t].output);
+  }
+  free(workers);
+
+  if (fflush(run.output) != 0) {
+    run.failed = 1;
+  }
+  if (!useStdout && fclose(run.output) != 0) {
+    run.failed = 1;
+  }
+  pthread_mutex_destroy(&run.writeLock);
+  pthread_cond_destroy(&run.writeTurn);
+  munmap(source.map, source.mapSize);
+
+  if (!startFailed) {
+    fprintf(stderr, "Analysed %zu blocks (%zu frames, %d channels) on %d threads.\n",
+            run.numBlocks, source.numFrames, source.numChannels, numThreads);
+  }
+  return run.failed ? -1 : 0;
+}
@@ -0,0 +1,100 @@
+//
+// Headless analysis of recorded audio files.
+//
+
+#ifndef OFFLINE_H
+#define OFFLINE_H
+
+#include <stdint.h>
+
+#include "frequencies.h"
+
+/// Magic number at the start of the binary offline output ("AAOF")
+#define OFFLINE_MAGIC "AAOF"
+
+/// Version of the binary offline output layout
+#define OFFLINE_VERSION 4
+
+/// Number of float32 levels recorded per channel: peak, RMS, DC offset and true-peak
+#define OFFLINE_LEVELS 4
+
+/// Number of blocks each worker claims at a time
+#define OFFLINE_CHUNK_BLOCKS 512
+
+/**
+ * Format of the offline analysis output.
+ */
+enum OfflineFormat {
+  OfflineBinary,
+  OfflineCsv
+};
+
+/**
+ * Options of a single offline analysis run.
+ */
+typedef struct {
+
+  /// Path of the WAV or raw interleaved float32 file to analyse.
+  const char *inputPath;
+
+  /// Path of the output file, or NULL/"-" for stdout.
+  const char *outputPath;
+
+  /// Format of the output file.
+  enum OfflineFormat format;
+
+  /// Number of channels of a raw input file; ignored for WAV files.
+  int rawChannels;
+
+  /// Sample rate of a raw input file; ignored for WAV files.
+  int rawSampleRate;
+
+  /// Number of worker threads, or 0 to use every online core.
+  int numThreads;
+
+  /// Block size, FFT size, hop, window and views of the spectrum analysis; the sample rate is the file's.
+  spectroOptions spectro;
+} offlineOptions;
+
+/**
+ * Header at the start of the binary output. It is followed by blockCount records, each
+ * made of OFFLINE_LEVELS float32 levels per channel (peak, RMS, DC offset and true-peak)
+ * followed by numSpectra rows of numColumns float32 column amplitudes (the values
+ * meter_process and compute_frequencies produce for the live view). Each block's spectra
+ * are those of the latest STFT frame of fftSize samples completed by the end of the block,
+ * so consecutive records repeat until the next hop. Spectra are ordered by channel,
+ * followed by the mixed-down views.
+ * All fields are written in host byte order.
+ */
+typedef struct {
+  char magic[4];
+  uint16_t version;
+  uint16_t numChannels;
+  uint16_t numColumns;
+  uint16_t numSpectra;
+  uint32_t framesPerBuffer;
+  uint32_t sampleRate;
+  uint32_t fftSize;
+  uint32_t hopSize;
+  uint64_t blockCount;
+} offlineHeader;
+
+/**
+ * Parses an offline output format name ("bin" or "csv").
+ *
+ * @param name Name to parse.
+ * @param format Set to the parsed format.
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int parse_offline_format(const char *name, enum OfflineFormat *format);
+
+/**
+ * Memory-maps the input file, analyses it block by block on every core and writes the
+ * per-block peak levels and spectra to the output.
+ *
+ * @param options Options of the run.
+ * @return 0 on success, -1 if the input could not be read or the output could not be written.
+ */
+int run_offline(const offlineOptions *options);
+
+#endif //OFFLINE_H
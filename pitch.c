@@ -0,0 +1,269 @@
+//
+// Fundamental-frequency detection from the FFT autocorrelation of every channel.
+//
+
+#include "pitch.h"
+#include "arena.h"
+#include "wisdom.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Allocates the buffers and plans the batched transform (from the wisdom cache when possible,
+ * see plan_r2hc_batch).
+ *
+ * @param detector Detector to initialize.
+ * @param numRows Number of channels analysed together.
+ * @param sampleRate Sample rate of the input, in Hz.
+ * @return 0 on success, -1 if memory could not be allocated or the transform could not be planned.
+ */
+int pitch_init(pitchDetector *detector, int numRows, double sampleRate) {
+  memset(detector, 0, sizeof(*detector));
+  if (numRows < 1) {
+    return -1;
+  }
+
+  const int n = 2 * PITCH_FRAME_SIZE;
+  detector->numRows = numRows;
+  detector->sampleRate = sampleRate;
+  detector->history = (double *) session_alloc(sizeof(double) * numRows * PITCH_FRAME_SIZE);
+  detector->in = (double *) session_alloc(sizeof(double) * numRows * n);
+  detector->out = (double *) session_alloc(sizeof(double) * numRows * n);
+  detector->estimates = (pitchEstimate *) session_calloc((size_t) numRows, sizeof(pitchEstimate));
+  if (detector->history == NULL || detector->in == NULL || detector->out == NULL || detector->estimates == NULL) {
+    pitch_free(detector);
+    return -1;
+  }
+
+  detector->plan = plan_r2hc_batch(n, numRows, detector->in, detector->out);
+  if (detector->plan == NULL) {
+    pitch_free(detector);
+    return -1;
+  }
+
+  // The interpolation around a peak reads one lag on either side of it.
+  detector->minLag = (int) floor(sampleRate / PITCH_MAX_FREQ);
+  detector->maxLag = (int) ceil(sampleRate / PITCH_MIN_FREQ);
+  detector->minLag = detector->minLag < 2 ? 2 : detector->minLag;
+  detector->maxLag = detector->maxLag > PITCH_FRAME_SIZE - 2 ? PITCH_FRAME_SIZE - 2 : detector->maxLag;
+
+  pitch_reset(detector);
+  return 0;
+}
+
+/**
+ * Frees the buffers and the plan of the detector.
+ *
+ * @param detector Detector to free.
+ */
+void pitch_free(pitchDetector *detector) {
+  if (detector->plan != NULL) {
+    fftw_destroy_plan(detector->plan);
+  }
+  session_free(detector->history);
+  session_free(detector->in);
+  session_free(detector->out);
+  session_free(detector->estimates);
+  memset(detector, 0, sizeof(*detector));
+}
+
+/**
+ * Clears the sample history and the estimates as if the detector had just been created.
+ *
+ * @param detector Detector to reset.
+ */
+void pitch_reset(pitchDetector *detector) {
+  memset(detector->history, 0, sizeof(double) * detector->numRows * PITCH_FRAME_SIZE);
+  for (int row = 0; row < detector->numRows; row++) {
+    detector->estimates[row] = (pitchEstimate) {0.0f, 0.0f, 0.0f, -1};
+  }
+  detector->fill = PITCH_FRAME_SIZE - PITCH_HOP_SIZE;
+  detector->framesComputed = 0;
+}
+
+/**
+ * Position of the first key maximum of the normalized autocorrelation after the given lag: the
+ * highest point of a positive lobe that starts after a negative one. Lobes still rising at maxLag
+ * are ignored, as their peak lies beyond the searched range.
+ *
+ * @return Lag of the key maximum, or -1 if there is none up to maxLag.
+ */
+static int next_key_maximum(const double *nsdf, int lag, int maxLag) {
+  while (lag <= maxLag && nsdf[lag] > 0.0) {
+    lag++;
+  }
+  while (lag <= maxLag && nsdf[lag] <= 0.0) {
+    lag++;
+  }
+
+  int best = -1;
+  for (; lag <= maxLag && nsdf[lag] > 0.0; lag++) {
+    if (best < 0 || nsdf[lag] > nsdf[best]) {
+      best = lag;
+    }
+  }
+  return best >= 0 && best < maxLag ? best : -1;
+}
+
+/**
+ * Picks the pitch of one row from its normalized autocorrelation (McLeod's normalized square
+ * difference function): the first key maximum within PITCH_PEAK_THRESHOLD of the highest one,
+ * refined by a parabola through its neighbours.
+ */
+static pitchEstimate pick_pitch(const pitchDetector *detector, const double *nsdf) {
+  pitchEstimate estimate = {0.0f, 0.0f, 0.0f, -1};
+
+  double highest = 0.0;
+  for (int lag = next_key_maximum(nsdf, 1, detector->maxLag); lag > 0;
+       lag = next_key_maximum(nsdf, lag, detector->maxLag)) {
+    highest = lag >= detector->minLag && nsdf[lag] > highest ? nsdf[lag] : highest;
+  }
+  if (highest <= 0.0) {
+    return estimate;
+  }
+
+  // The highest key maximum itself passes, so the search always ends on a lag within range.
+  int lag = next_key_maximum(nsdf, 1, detector->maxLag);
+  while (lag < detector->minLag || nsdf[lag] < PITCH_PEAK_THRESHOLD * highest) {
+    lag = next_key_maximum(nsdf, lag, detector->maxLag);
+  }
+
+  double before = nsdf[lag - 1];
+  double peak = nsdf[lag];
+  double after = nsdf[lag + 1];
+  double curvature = before - 2.0 * peak + after;
+  double shift = curvature < 0.0 ? 0.5 * (before - after) / curvature : 0.0;
+  double value = peak - 0.25 * (before - after) * shift;
+
+  double frequency = detector->sampleRate / (lag + shift);
+  double semitones = 12.0 * log2(frequency / PITCH_REFERENCE_A4) + 69.0;
+  estimate.frequency = (float) frequency;
+  estimate.confidence = (float) fmin(1.0, value);
+  estimate.note = (int) lround(semitones);
+  estimate.cents = (float) (100.0 * (semitones - estimate.note));
+  return estimate;
+}
+
+/**
+ * Computes the autocorrelation of the full history of every row through its power spectrum,
+ * normalizes it and picks the pitch of each row.
+ */
+static void compute_frame(pitchDetector *detector) {
+  const int n = 2 * PITCH_FRAME_SIZE;
+
+  for (int row = 0; row < detector->numRows; row++) {
+    double *in = detector->in + (size_t) row * n;
+    memcpy(in, detector->history + (size_t) row * PITCH_FRAME_SIZE, sizeof(double) * PITCH_FRAME_SIZE);
+    memset(in + PITCH_FRAME_SIZE, 0, sizeof(double) * PITCH_FRAME_SIZE);
+  }
+
+  fftw_execute(detector->plan);
+
+  // The power spectrum is written out as a full even sequence, whose real-to-half-complex
+  // transform is n times its inverse transform: the autocorrelation lands in the real half of out.
+  for (int row = 0; row < detector->numRows; row++) {
+    const double *restrict re = detector->out + (size_t) row * n;
+    const double *restrict imReversed = re + n;
+    double *restrict power = detector->in + (size_t) row * n;
+
+    power[0] = re[0] * re[0];
+    for (int k = 1; k < n / 2; k++) {
+      power[k] = re[k] * re[k] + imReversed[-k] * imReversed[-k];
+      power[n - k] = power[k];
+    }
+    power[n / 2] = re[n / 2] * re[n / 2];
+  }
+
+  fftw_execute(detector->plan);
+
+  for (int row = 0; row < detector->numRows; row++) {
+    const double *history = detector->history + (size_t) row * PITCH_FRAME_SIZE;
+    double *correlation = detector->out + (size_t) row * n;
+
+    // m(lag) is the energy of the two overlapping parts, updated as the overlap shrinks.
+    double energy = 0.0;
+    for (int i = 0; i < PITCH_FRAME_SIZE; i++) {
+      energy += history[i] * history[i];
+    }
+    if (energy < PITCH_SILENCE_POWER * PITCH_FRAME_SIZE) {
+      detector->estimates[row] = (pitchEstimate) {0.0f, 0.0f, 0.0f, -1};
+      continue;
+    }
+
+    double overlapEnergy = 2.0 * energy;
+    for (int lag = 0; lag <= detector->maxLag + 1; lag++) {
+      if (lag > 0) {
+        overlapEnergy -= history[lag - 1] * history[lag - 1] +
+                         history[PITCH_FRAME_SIZE - lag] * history[PITCH_FRAME_SIZE - lag];
+      }
+      correlation[lag] = overlapEnergy > 0.0 ? 2.0 * correlation[lag] / n / overlapEnergy : 0.0;
+    }
+    detector->estimates[row] = pick_pitch(detector, correlation);
+  }
+
+  detector->framesComputed++;
+}
+
+/**
+ * Appends the samples of a contiguous range of the channels of an interleaved buffer and updates
+ * the estimates every PITCH_HOP_SIZE samples.
+ *
+ * @param detector Detector of the channel range; its numRows is the width of the range.
+ * @param in First sample of the range in the first frame.
+ * @param stride Number of samples between consecutive frames of the buffer; at least numRows.
+ * @param frames Number of frames in the buffer.
+ * @return Number of frames analysed; estimates holds the latest one.
+ */
+int pitch_push(pitchDetector *detector, const float *in, int stride, unsigned long frames) {
+  int computed = 0;
+  unsigned long consumed = 0;
+
+  while (consumed < frames) {
+    unsigned long count = PITCH_FRAME_SIZE - detector->fill;
+    if (count > frames - consumed) {
+      count = frames - consumed;
+    }
+
+    for (int row = 0; row < detector->numRows; row++) {
+      double *history = detector->history + (size_t) row * PITCH_FRAME_SIZE + detector->fill;
+      const float *sample = in + consumed * stride + row;
+      for (unsigned long i = 0; i < count; i++, sample += stride) {
+        history[i] = *sample;
+      }
+    }
+    detector->fill += (int) count;
+    consumed += count;
+
+    if (detector->fill == PITCH_FRAME_SIZE) {
+      compute_frame(detector);
+      computed++;
+
+      // Keep the newest PITCH_FRAME_SIZE - PITCH_HOP_SIZE samples as the start of the next frame.
+      for (int row = 0; row < detector->numRows; row++) {
+        double *history = detector->history + (size_t) row * PITCH_FRAME_SIZE;
+        memmove(history, history + PITCH_HOP_SIZE, sizeof(double) * (PITCH_FRAME_SIZE - PITCH_HOP_SIZE));
+      }
+      detector->fill = PITCH_FRAME_SIZE - PITCH_HOP_SIZE;
+    }
+  }
+
+  return computed;
+}
+
+/**
+ * Writes the name of a MIDI note, e.g. "A4" or "C#3".
+ *
+ * @param note MIDI note number.
+ * @param name Output buffer.
+ * @param size Size of the output buffer.
+ */
+void pitch_note_name(int note, char *name, size_t size) {
+  static const char *const NAMES[] = {"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B"};
+  if (note < 0) {
+    snprintf(name, size, "--");
+    return;
+  }
+  snprintf(name, size, "%s%d", NAMES[note % 12], note / 12 - 1);
+}
@@ -0,0 +1,141 @@
+//
+// Fundamental-frequency detection from the FFT autocorrelation of every channel.
+//
+
+#ifndef PITCH_H
+#define PITCH_H
+
+#include <stddef.h>
+#include <fftw3.h>
+
+/// Samples analysed per estimate; the lowest detectable pitch needs about two periods of it
+#define PITCH_FRAME_SIZE 2048
+
+/// Samples between consecutive estimates
+#define PITCH_HOP_SIZE 1024
+
+/// Range of detectable fundamentals, in Hz; 40 Hz leaves room below 50 Hz mains hum
+#define PITCH_MIN_FREQ 40.0
+#define PITCH_MAX_FREQ 4000.0
+
+/// Fraction of the highest normalized autocorrelation peak the first accepted peak must reach,
+/// so that the fundamental wins over peaks at its multiples
+#define PITCH_PEAK_THRESHOLD 0.9
+
+/// Confidence below which an estimate is shown as unpitched
+#define PITCH_MIN_CONFIDENCE 0.6
+
+/// Mean square below which a frame is treated as silence (about -80 dBFS RMS)
+#define PITCH_SILENCE_POWER 1e-8
+
+/// Reference of the note names and cents offsets, in Hz
+#define PITCH_REFERENCE_A4 440.0
+
+/// Width of the pitch readout drawn next to the volume bars
+#define PITCH_READOUT_WIDTH 26
+
+/**
+ * Pitch of one channel over the latest analysed frame.
+ */
+typedef struct {
+
+  /// Fundamental frequency in Hz, or 0 if the frame is silent or has no periodic component.
+  float frequency;
+
+  /// Height of the chosen peak of the normalized autocorrelation, between 0 (noise) and 1 (periodic).
+  float confidence;
+
+  /// Offset from the nearest equal-tempered note, between -50 and 50 cents.
+  float cents;
+
+  /// Nearest note as a MIDI number (69 is A4), or -1 without a pitch.
+  int note;
+} pitchEstimate;
+
+/**
+ * Pitch detector of several channels analysed together. The autocorrelation of every channel is
+ * the inverse transform of its power spectrum: each frame is zero-padded to twice its length so
+ * the correlation does not wrap around, and since the power spectrum is real and even the same
+ * batched real-to-half-complex plan computes both transforms. Plans and buffers are allocated
+ * once; pushing samples never allocates.
+ */
+typedef struct {
+
+  /// Number of channels analysed together.
+  int numRows;
+
+  /// Per-row buffer of the last PITCH_FRAME_SIZE samples; row r starts at history[r * PITCH_FRAME_SIZE].
+  double *history;
+
+  /// Number of valid samples at the start of each history row.
+  int fill;
+
+  /// Zero-padded frames and their transforms, numRows * 2 * PITCH_FRAME_SIZE each. The power
+  /// spectra are written back into in, so the autocorrelations end up in out.
+  double *in;
+  double *out;
+
+  /// Batched plan transforming all rows of in into out.
+  fftw_plan plan;
+
+  /// Sample rate of the input, in Hz.
+  double sampleRate;
+
+  /// Shortest and longest lag searched, in samples.
+  int minLag;
+  int maxLag;
+
+  /// Estimates of the latest frame, numRows of them.
+  pitchEstimate *estimates;
+
+  /// Number of frames analysed since the detector was created or reset.
+  unsigned long framesComputed;
+} pitchDetector;
+
+/**
+ * Allocates the buffers and plans the batched transform (from the wisdom cache when possible,
+ * see plan_r2hc_batch).
+ *
+ * @param detector Detector to initialize.
+ * @param numRows Number of channels analysed together.
+ * @param sampleRate Sample rate of the input, in Hz.
+ * @return 0 on success, -1 if memory could not be allocated or the transform could not be planned.
+ */
+int pitch_init(pitchDetector *detector, int numRows, double sampleRate);
+
+/**
+ * Frees the buffers and the plan of the detector.
+ *
+ * @param detector Detector to free.
+ */
+void pitch_free(pitchDetector *detector);
+
+/**
+ * Clears the sample history and the estimates as if the detector had just been created.
+ *
+ * @param detector Detector to reset.
+ */
+void pitch_reset(pitchDetector *detector);
+
+/**
+ * Appends the samples of a contiguous range of the channels of an interleaved buffer and updates
+ * the estimates every PITCH_HOP_SIZE samples.
+ *
+ * @param detector Detector of the channel range; its numRows is the width of the range.
+ * @param in First sample of the range in the first frame.
+ * @param stride Number of samples between consecutive frames of the buffer; at least numRows.
+ * @param frames Number of frames in the buffer.
+ * @return Number of frames analysed; estimates holds the latest one.
+ */
+int pitch_push(pitchDetector *detector, const float *in, int stride, unsigned long frames);
+
+/**
+ * Writes the name of a MIDI note, e.g. "A4" or "C#3".
+ *
+ * @param note MIDI note number.
+ * @param name Output buffer.
+ * @param size Size of the output buffer.
+ */
+void pitch_note_name(int note, char *name, size_t size);
+
+#endif //PITCH_H
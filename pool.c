@@ -0,0 +1,223 @@
+//
+// Work-stealing thread pool running the independent jobs of one block in parallel.
+//
+
+#include "pool.h"
+#include <string.h>
+#include <unistd.h>
+
+static uint64_t pack_range(uint32_t lo, uint32_t hi) {
+  return (uint64_t) hi << 32 | lo;
+}
+
+/**
+ * Takes the first job of the thread's own queue.
+ *
+ * @return Index of the job, or -1 if the queue is empty.
+ */
+static int take_own(poolQueue *queue) {
+  uint64_t range = atomic_load_explicit(&queue->range, memory_order_relaxed);
+  for (;;) {
+    uint32_t lo = (uint32_t) range;
+    uint32_t hi = (uint32_t) (range >> 32);
+    if (lo >= hi) {
+      return -1;
+    }
+    if (atomic_compare_exchange_weak(&queue->range, &range, pack_range(lo + 1, hi))) {
+      return (int) lo;
+    }
+  }
+}
+
+/**
+ * Takes the last job of another thread's queue.
+ *
+ * @return Index of the job, or -1 if the queue is empty.
+ */
+static int steal(poolQueue *queue) {
+  uint64_t range = atomic_load_explicit(&queue->range, memory_order_relaxed);
+  for (;;) {
+    uint32_t lo = (uint32_t) range;
+    uint32_t hi = (uint32_t) (range >> 32);
+    if (lo >= hi) {
+      return -1;
+    }
+    if (atomic_compare_exchange_weak(&queue->range, &range, pack_range(lo, hi - 1))) {
+      return (int) hi - 1;
+    }
+  }
+}
+
+/**
+ * Runs jobs from the thread's own queue, then from the others', until none is left.
+ */
+static void run_jobs(workPool *pool, int self, poolJobFn job, void *context) {
+  for (;;) {
+    int index = take_own(&pool->queues[self]);
+    for (int i = 1; index < 0 && i < pool->participants; i++) {
+      index = steal(&pool->queues[(self + i) % pool->participants]);
+      if (index >= 0) {
+        atomic_fetch_add_explicit(&pool->steals, 1, memory_order_relaxed);
+      }
+    }
+    if (index < 0) {
+      return;
+    }
+    job(context, index);
+  }
+}
+
+/**
+ * Worker thread: sleeps until a batch it takes part in starts, runs jobs until none is left and
+ * reports back to pool_run.
+ */
+static void *pool_worker(void *arg) {
+  poolWorker *worker = (poolWorker *) arg;
+  workPool *pool = worker->pool;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->stop && pool->generation == seen) {
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if (pool->stop) {
+      break;
+    }
+    seen = pool->generation;
+    if (worker->index >= pool->participants) {
+      continue;
+    }
+
+    poolJobFn job = pool->job;
+    void *context = pool->context;
+    pthread_mutex_unlock(&pool->lock);
+    run_jobs(pool, worker->index, job, context);
+    pthread_mutex_lock(&pool->lock);
+
+    if (--pool->busyWorkers == 0) {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+/**
+ * Number of threads a pool uses by default: one per online core, at most POOL_MAX_THREADS.
+ *
+ * @return Number of threads.
+ */
+int pool_default_threads() {
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores < 1) {
+    return 1;
+  }
+  return cores > POOL_MAX_THREADS ? POOL_MAX_THREADS : (int) cores;
+}
+
+/**
+ * Starts the worker threads of a pool.
+ *
+ * @param pool Pool to start.
+ * @param numThreads Number of threads including the caller of pool_run; values below 1 select
+ *        pool_default_threads.
+ * @return 0 on success, -1 if the threads could not be started.
+ */
+int pool_init(workPool *pool, int numThreads) {
+  memset(pool, 0, sizeof(*pool));
+  if (numThreads < 1) {
+    numThreads = pool_default_threads();
+  }
+  if (numThreads > POOL_MAX_THREADS) {
+    numThreads = POOL_MAX_THREADS;
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  for (int t = 0; t < POOL_MAX_THREADS; t++) {
+    atomic_init(&pool->queues[t].range, 0);
+  }
+  atomic_init(&pool->steals, 0);
+
+  pool->numThreads = 1;
+  for (int t = 1; t < numThreads; t++) {
+    pool->workers[t].pool = pool;
+    pool->workers[t].index = t;
+    if (pthread_create(&pool->threads[t], NULL, pool_worker, &pool->workers[t]) != 0) {
+      pool_free(pool);
+      return -1;
+    }
+    pool->numThreads++;
+  }
+  return 0;
+}
+
+/**
+ * Stops and joins the worker threads of a pool.
+ *
+ * @param pool Pool to stop; no batch may be running.
+ */
+void pool_free(workPool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int t = 1; t < pool->numThreads; t++) {
+    pthread_join(pool->threads[t], NULL);
+  }
+  pool->numThreads = 1;
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start);
+  pthread_cond_destroy(&pool->done);
+}
+
+/**
+ * Runs job(context, i) for every i from 0 to numJobs - 1 on the threads of the pool, the calling
+ * thread included, and returns when all of them have finished. Must not be called from several
+ * threads at once.
+ *
+ * @param pool Pool to run the jobs on.
+ * @param job Function to run.
+ * @param context Context passed to every call.
+ * @param numJobs Number of jobs.
+ */
+void pool_run(workPool *pool, poolJobFn job, void *context, int numJobs) {
+  if (pool->numThreads == 1 || numJobs <= 1) {
+    for (int i = 0; i < numJobs; i++) {
+      job(context, i);
+    }
+    return;
+  }
+
+  int participants = numJobs < pool->numThreads ? numJobs : pool->numThreads;
+  for (int p = 0; p < participants; p++) {
+    uint32_t lo = (uint32_t) ((long) p * numJobs / participants);
+    uint32_t hi = (uint32_t) ((long) (p + 1) * numJobs / participants);
+    atomic_store_explicit(&pool->queues[p].range, pack_range(lo, hi), memory_order_relaxed);
+  }
+
+  // Every worker that took part in the previous batch has reported back, so none of them can
+  // still be reading the queues or the batch below.
+  pthread_mutex_lock(&pool->lock);
+  pool->job = job;
+  pool->context = context;
+  pool->participants = participants;
+  pool->busyWorkers = participants - 1;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  run_jobs(pool, 0, job, context);
+
+  // A worker only reports back once every queue is empty and its own last job has finished.
+  pthread_mutex_lock(&pool->lock);
+  while (pool->busyWorkers > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,116 @@
+//
+// Work-stealing thread pool running the independent jobs of one block in parallel.
+//
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+/// Largest number of threads in a pool, including the thread calling pool_run
+#define POOL_MAX_THREADS 64
+
+/// Size of a cache line; every job queue gets its own so that stealing does not slow down the owner
+#define POOL_CACHE_LINE 64
+
+/**
+ * Job of a batch: called with the batch context and the index of the job.
+ */
+typedef void (*poolJobFn)(void *context, int job);
+
+/**
+ * Jobs of one thread: the indices from lo to hi - 1, packed into one word (lo in the low half)
+ * so that the owner taking from the front and thieves taking from the back never need a lock.
+ */
+typedef struct {
+  _Alignas(POOL_CACHE_LINE) _Atomic uint64_t range;
+} poolQueue;
+
+struct workPool;
+
+/**
+ * Thread of a pool and the index of its job queue.
+ */
+typedef struct {
+  struct workPool *pool;
+  int index;
+} poolWorker;
+
+/**
+ * Pool of threads that run batches of jobs. pool_run splits a batch into one contiguous range of
+ * job indices per thread, the calling thread included; a thread that runs out of jobs steals
+ * from the back of the others' ranges, so uneven jobs still keep every thread busy. pool_run
+ * returns once every job of the batch has finished, which joins the results of each block before
+ * the next one is analysed.
+ */
+typedef struct workPool {
+
+  /// Threads running jobs, including the one calling pool_run; entry 0 of threads and workers is unused.
+  int numThreads;
+  pthread_t threads[POOL_MAX_THREADS];
+  poolWorker workers[POOL_MAX_THREADS];
+
+  /// Job queue of each thread; queue 0 belongs to the thread calling pool_run.
+  poolQueue queues[POOL_MAX_THREADS];
+
+  /// Batch being run.
+  poolJobFn job;
+  void *context;
+
+  /// Threads taking part in the batch; the others keep sleeping.
+  int participants;
+
+  /// Workers of the batch still running jobs; pool_run returns when it drops to 0.
+  int busyWorkers;
+
+  /// Incremented for every batch; wakes the workers.
+  unsigned long generation;
+  int stop;
+
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t done;
+
+  /// Jobs run by a thread other than the one they were queued to.
+  _Atomic unsigned long steals;
+} workPool;
+
+/**
+ * Number of threads a pool uses by default: one per online core, at most POOL_MAX_THREADS.
+ *
+ * @return Number of threads.
+ */
+int pool_default_threads();
+
+/**
+ * Starts the worker threads of a pool.
+ *
+ * @param pool Pool to start.
+ * @param numThreads Number of threads including the caller of pool_run; values below 1 select
+ *        pool_default_threads.
+ * @return 0 on success, -1 if the threads could not be started.
+ */
+int pool_init(workPool *pool, int numThreads);
+
+/**
+ * Stops and joins the worker threads of a pool.
+ *
+ * @param pool Pool to stop; no batch may be running.
+ */
+void pool_free(workPool *pool);
+
+/**
+ * Runs job(context, i) for every i from 0 to numJobs - 1 on the threads of the pool, the calling
+ * thread included, and returns when all of them have finished. Must not be called from several
+ * threads at once.
+ *
+ * @param pool Pool to run the jobs on.
+ * @param job Function to run.
+ * @param context Context passed to every call.
+ * @param numJobs Number of jobs.
+ */
+void pool_run(workPool *pool, poolJobFn job, void *context, int numJobs);
+
+#endif //POOL_H
@@ -0,0 +1,140 @@
+//
+// Framed wire protocol used to stream captured audio to remote clients.
+//
+
+#include "protocol.h"
+#include <string.h>
+
+static void put_be16(unsigned char *p, uint16_t value) {
+  p[0] = (unsigned char) (value >> 8);
+  p[1] = (unsigned char) value;
+}
+
+static void put_be32(unsigned char *p, uint32_t value) {
+  put_be16(p, (uint16_t) (value >> 16));
+  put_be16(p + 2, (uint16_t) value);
+}
+
+static void put_be64(unsigned char *p, uint64_t value) {
+  put_be32(p, (uint32_t) (value >> 32));
+  put_be32(p + 4, (uint32_t) value);
+}
+
+static uint16_t get_be16(const unsigned char *p) {
+  return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static uint32_t get_be32(const unsigned char *p) {
+  return (uint32_t) get_be16(p) << 16 | get_be16(p + 2);
+}
+
+static uint64_t get_be64(const unsigned char *p) {
+  return (uint64_t) get_be32(p) << 32 | get_be32(p + 4);
+}
+
+/**
+ * Fills a header with the magic number, the version and the given fields.
+ *
+ * @param header Header to fill.
+ * @param type Kind of payload.
+ * @param sequence Number of the frame in its stream.
+ * @param numChannels Number of channels of the stream.
+ * @param sampleRate Sample rate of the stream.
+ * @param timestamp Position of the frame in the stream, in frames.
+ * @param payloadLength Number of payload bytes.
+ */
+void init_stream_header(streamHeader *header, enum StreamFrameType type, uint32_t sequence, int numChannels,
+                        int sampleRate, uint64_t timestamp, uint32_t payloadLength) {
+  header->magic = STREAM_MAGIC;
+  header->version = STREAM_VERSION;
+  header->type = (uint16_t) type;
+  header->sequence = sequence;
+  header->numChannels = (uint16_t) numChannels;
+  header->flags = 0;
+  header->sampleRate = (uint32_t) sampleRate;
+  header->timestamp = timestamp;
+  header->payloadLength = payloadLength;
+}
+
+/**
+ * Encodes a header into STREAM_HEADER_SIZE bytes.
+ *
+ * @param header Header to encode.
+ * @param out Output buffer of at least STREAM_HEADER_SIZE bytes.
+ */
+void encode_stream_header(const streamHeader *header, unsigned char *out) {
+  put_be32(out, header->magic);
+  put_be16(out + 4, header->version);
+  put_be16(out + 6, header->type);
+  put_be32(out + 8, header->sequence);
+  put_be16(out + 12, header->numChannels);
+  put_be16(out + 14, header->flags);
+  put_be32(out + 16, header->sampleRate);
+  put_be64(out + 20, header->timestamp);
+  put_be32(out + 28, header->payloadLength);
+}
+
+/**
+ * Decodes and validates a header.
+ *
+ * @param in STREAM_HEADER_SIZE encoded bytes.
+ * @param header Set to the decoded header.
+ * @return 0 on success, -1 if the magic number, version or payload length is invalid.
+ */
+int decode_stream_header(const unsigned char *in, streamHeader *header) {
+  header->magic = get_be32(in);
+  header->version = get_be16(in + 4);
+  header->type = get_be16(in + 6);
+  header->sequence = get_be32(in + 8);
+  header->numChannels = get_be16(in + 12);
+  header->flags = get_be16(in + 14);
+  header->sampleRate = get_be32(in + 16);
+  header->timestamp = get_be64(in + 20);
+  header->payloadLength = get_be32(in + 28);
+
+  if (header->magic != STREAM_MAGIC || header->version != STREAM_VERSION ||
+      header->payloadLength > STREAM_MAX_PAYLOAD) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Encodes interleaved samples as little-endian float32.
+ *
+ * @param samples Samples to encode.
+ * @param count Number of samples.
+ * @param out Output buffer of at least count * 4 bytes.
+ */
+void encode_stream_samples(const float *samples, size_t count, unsigned char *out) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(out, samples, count * sizeof(float));
+#else
+  for (size_t i = 0; i < count; i++, out += 4) {
+    uint32_t bits;
+    memcpy(&bits, &samples[i], sizeof(bits));
+    out[0] = (unsigned char) bits;
+    out[1] = (unsigned char) (bits >> 8);
+    out[2] = (unsigned char) (bits >> 16);
+    out[3] = (unsigned char) (bits >> 24);
+  }
+#endif
+}
+
+/**
+ * Decodes little-endian float32 samples.
+ *
+ * @param in Encoded samples.
+ * @param count Number of samples.
+ * @param samples Output array of count samples.
+ */
+void decode_stream_samples(const unsigned char *in, size_t count, float *samples) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(samples, in, count * sizeof(float));
+#else
+  for (size_t i = 0; i < count; i++, in += 4) {
+    uint32_t bits = (uint32_t) in[0] | (uint32_t) in[1] << 8 | (uint32_t) in[2] << 16 | (uint32_t) in[3] << 24;
+    memcpy(&samples[i], &bits, sizeof(bits));
+  }
+#endif
+}
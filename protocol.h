@@ -0,0 +1,113 @@
+//
+// Framed wire protocol used to stream captured audio to remote clients.
+//
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Magic number at the start of every frame ("AAST")
+#define STREAM_MAGIC 0x41415354u
+
+/// Version of the frame layout
+#define STREAM_VERSION 2
+
+/// Size of the encoded frame header in bytes
+#define STREAM_HEADER_SIZE 32
+
+/// Header flag of a spectral frame that does not depend on the frames before it
+#define STREAM_FLAG_KEYFRAME 0x0001
+
+/// Largest payload a receiver accepts; anything larger is treated as a corrupt stream
+#define STREAM_MAX_PAYLOAD (1u << 24)
+
+/**
+ * Kind of payload carried by a frame.
+ */
+enum StreamFrameType {
+
+  /// Interleaved float32 samples, little-endian.
+  StreamAudio = 1,
+
+  /// Quantized levels and frequency columns (see spectral.h); timestamp is the first frame they cover.
+  StreamSpectrum = 2
+};
+
+/**
+ * Header preceding every payload on the wire. Encoded as STREAM_HEADER_SIZE bytes in
+ * network byte order:
+ *
+ *   0 magic (4)   4 version (2)   6 type (2)   8 sequence (4)   12 numChannels (2)
+ *   14 flags (2)  16 sampleRate (4)   20 timestamp (8)   28 payloadLength (4)
+ */
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t type;
+
+  /// Number of the frame in its stream; consecutive frames differ by one, so gaps reveal losses.
+  uint32_t sequence;
+
+  uint16_t numChannels;
+  uint16_t flags;
+  uint32_t sampleRate;
+
+  /// Position of the first sample of the frame in the stream, in frames since the stream started.
+  uint64_t timestamp;
+
+  /// Number of payload bytes following the header.
+  uint32_t payloadLength;
+} streamHeader;
+
+/**
+ * Fills a header with the magic number, the version and the given fields.
+ *
+ * @param header Header to fill.
+ * @param type Kind of payload.
+ * @param sequence Number of the frame in its stream.
+ * @param numChannels Number of channels of the stream.
+ * @param sampleRate Sample rate of the stream.
+ * @param timestamp Position of the frame in the stream, in frames.
+ * @param payloadLength Number of payload bytes.
+ */
+void init_stream_header(streamHeader *header, enum StreamFrameType type, uint32_t sequence, int numChannels,
+                        int sampleRate, uint64_t timestamp, uint32_t payloadLength);
+
+/**
+ * Encodes a header into STREAM_HEADER_SIZE bytes.
+ *
+ * @param header Header to encode.
+ * @param out Output buffer of at least STREAM_HEADER_SIZE bytes.
+ */
+void encode_stream_header(const streamHeader *header, unsigned char *out);
+
+/**
+ * Decodes and validates a header.
+ *
+ * @param in STREAM_HEADER_SIZE encoded bytes.
+ * @param header Set to the decoded header.
+ * @return 0 on success, -1 if the magic number, version or payload length is invalid.
+ */
+int decode_stream_header(const unsigned char *in, streamHeader *header);
+
+/**
+ * Encodes interleaved samples as little-endian float32.
+ *
+ * @param samples Samples to encode.
+ * @param count Number of samples.
+ * @param out Output buffer of at least count * 4 bytes.
+ */
+void encode_stream_samples(const float *samples, size_t count, unsigned char *out);
+
+/**
+ * Decodes little-endian float32 samples.
+ *
+ * @param in Encoded samples.
+ * @param count Number of samples.
+ * @param samples Output array of count samples.
+ */
+void decode_stream_samples(const unsigned char *in, size_t count, float *samples);
+
+#endif //PROTOCOL_H
@@ -0,0 +1,473 @@
+//
+// Asynchronous capture-to-disk recorder fed from the audio callback.
+//
+
+// O_DIRECT is a GNU extension of fcntl.h.
+#ifdef __linux__
+#define _GNU_SOURCE
+#endif
+
+#include "recorder.h"
+#include "utils.h"
+#include "callback_stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t recorder_clock_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + (uint64_t) ts.tv_nsec;
+}
+
+static void write_le16(unsigned char *out, uint16_t value) {
+  out[0] = (unsigned char) value;
+  out[1] = (unsigned char) (value >> 8);
+}
+
+static void write_le32(unsigned char *out, uint32_t value) {
+  write_le16(out, (uint16_t) value);
+  write_le16(out + 2, (uint16_t) (value >> 16));
+}
+
+/**
+ * Fills the given recorder options with the defaults: a WAV file without rotation, written
+ * through the page cache, with RECORDER_DEFAULT_BUFFER_MS of queue.
+ *
+ * @param options Options to fill.
+ */
+void default_recorder_options(recorderOptions *options) {
+  memset(options, 0, sizeof(*options));
+  options->format = RecordWav;
+  options->bufferMs = RECORDER_DEFAULT_BUFFER_MS;
+}
+
+/**
+ * Parses a recording format name ("wav" or "raw").
+ *
+ * @param name Name to parse.
+ * @param format Set to the parsed format.
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int parse_record_format(const char *name, enum RecordFormat *format) {
+  if (strcmp(name, "wav") == 0) {
+    *format = RecordWav;
+  } else if (strcmp(name, "raw") == 0) {
+    *format = RecordRaw;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Fills the WAV header of the current file for the given size of its samples. The fmt chunk is
+ * followed by a JUNK chunk so that the samples start at RECORDER_WAV_HEADER_BYTES and every batch
+ * stays aligned.
+ */
+static void fill_wav_header(audioRecorder *recorder, unsigned long long dataBytes) {
+  unsigned char *header = recorder->header;
+  uint32_t frameBytes = (uint32_t) (sizeof(float) * recorder->numChannels);
+
+  memset(header, 0, RECORDER_WAV_HEADER_BYTES);
+  memcpy(header, "RIFF", 4);
+  write_le32(header + 4, (uint32_t) (RECORDER_WAV_HEADER_BYTES - 8 + dataBytes));
+  memcpy(header + 8, "WAVE", 4);
+
+  memcpy(header + 12, "fmt ", 4);
+  write_le32(header + 16, 16);
+  write_le16(header + 20, 3);
+  write_le16(header + 22, (uint16_t) recorder->numChannels);
+  write_le32(header + 24, (uint32_t) recorder->sampleRate);
+  write_le32(header + 28, (uint32_t) recorder->sampleRate * frameBytes);
+  write_le16(header + 32, (uint16_t) frameBytes);
+  write_le16(header + 34, 32);
+
+  memcpy(header + 36, "JUNK", 4);
+  write_le32(header + 40, RECORDER_WAV_HEADER_BYTES - 52);
+
+  memcpy(header + RECORDER_WAV_HEADER_BYTES - 8, "data", 4);
+  write_le32(header + RECORDER_WAV_HEADER_BYTES - 4, (uint32_t) dataBytes);
+}
+
+/**
+ * Writes the whole buffer at the given offset, retrying after interruptions and partial writes.
+ *
+ * @return 0 on success, -1 on error.
+ */
+static int write_fully(int fd, const unsigned char *data, size_t size, off_t offset) {
+  while (size > 0) {
+    ssize_t written = pwrite(fd, data, size, offset);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return -1;
+    }
+    data += written;
+    size -= (size_t) written;
+    offset += written;
+  }
+  return 0;
+}
+
+/**
+ * Path of the file with the given number: the path with "-NNNN" inserted before its extension, or
+ * the configured path itself for the first file when no rotation was requested (a WAV recording
+ * still moves on to numbered files when it reaches RECORDER_WAV_MAX_BYTES).
+ */
+static void file_path(const audioRecorder *recorder, int index, char *path, size_t size) {
+  const char *base = recorder->options.path;
+  if (index == 0 && recorder->options.rotateBytes == 0 && recorder->options.rotateSeconds <= 0.0) {
+    snprintf(path, size, "%s", base);
+    return;
+  }
+
+  const char *slash = strrchr(base, '/');
+  const char *dot = strrchr(base, '.');
+  if (dot == NULL || (slash != NULL && dot < slash)) {
+    dot = base + strlen(base);
+  }
+  snprintf(path, size, "%.*s-%04d%s", (int) (dot - base), base, index, dot);
+}
+
+/**
+ * Opens the next file of the recording, bypassing the page cache if requested and supported.
+ *
+ * @return 0 on success, -1 if the file could not be opened.
+ */
+static int open_file(audioRecorder *recorder) {
+  char path[4096];
+  file_path(recorder, recorder->fileIndex, path, sizeof(path));
+
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+  recorder->directIo = 0;
+  recorder->fd = -1;
+#ifdef O_DIRECT
+  if (recorder->options.direct) {
+    recorder->fd = open(path, flags | O_DIRECT, 0644);
+    recorder->directIo = recorder->fd >= 0;
+  }
+#endif
+  if (recorder->fd < 0) {
+    // Also taken when the file system does not support O_DIRECT (e.g. tmpfs).
+    recorder->fd = open(path, flags, 0644);
+  }
+  if (recorder->fd < 0) {
+    recorder->errorNumber = errno;
+    return -1;
+  }
+#if defined(__APPLE__) && defined(F_NOCACHE)
+  if (recorder->options.direct) {
+    fcntl(recorder->fd, F_NOCACHE, 1);
+  }
+#endif
+
+  recorder->fileBytes = 0;
+  recorder->fileFrames = 0;
+  if (recorder->options.format == RecordWav) {
+    fill_wav_header(recorder, 0);
+    if (write_fully(recorder->fd, recorder->header, RECORDER_WAV_HEADER_BYTES, 0) != 0) {
+      recorder->errorNumber = errno;
+      close(recorder->fd);
+      recorder->fd = -1;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Offset of the samples of the current file.
+ */
+static off_t data_offset(const audioRecorder *recorder) {
+  return recorder->options.format == RecordWav ? RECORDER_WAV_HEADER_BYTES : 0;
+}
+
+/**
+ * Writes the batch at the end of the current file. With O_DIRECT a partial batch is padded to
+ * RECORDER_ALIGN and the file truncated back afterwards.
+ *
+ * @return 0 on success, -1 if the write failed.
+ */
+static int flush_batch(audioRecorder *recorder) {
+  if (recorder->batchBytes == 0) {
+    return 0;
+  }
+
+  size_t size = recorder->batchBytes;
+  if (recorder->directIo && size % RECORDER_ALIGN != 0) {
+    size_t padded = (size + RECORDER_ALIGN - 1) / RECORDER_ALIGN * RECORDER_ALIGN;
+    memset(recorder->batch + size, 0, padded - size);
+    size = padded;
+  }
+
+  // Batches are written back to back, so the offset stays aligned until the last one of a file.
+  off_t offset = data_offset(recorder) + (off_t) (recorder->fileBytes - recorder->batchBytes);
+  uint64_t startNs = recorder_clock_ns();
+  int status = write_fully(recorder->fd, recorder->batch, size, offset);
+  uint64_t elapsed = recorder_clock_ns() - startNs;
+
+  if (elapsed > atomic_load_explicit(&recorder->maxWriteNs, memory_order_relaxed)) {
+    atomic_store_explicit(&recorder->maxWriteNs, elapsed, memory_order_relaxed);
+  }
+  if (status == 0) {
+    atomic_fetch_add_explicit(&recorder->bytesWritten, recorder->batchBytes, memory_order_relaxed);
+  }
+  recorder->batchBytes = 0;
+  return status;
+}
+
+/**
+ * Writes what is left of the batch, completes the WAV header and closes the current file.
+ *
+ * @return 0 on success, -1 if a write failed.
+ */
+static int close_file(audioRecorder *recorder) {
+  int status = flush_batch(recorder);
+  off_t end = data_offset(recorder) + (off_t) recorder->fileBytes;
+  if (recorder->directIo && ftruncate(recorder->fd, end) != 0) {
+    status = -1;
+  }
+  if (recorder->options.format == RecordWav) {
+    fill_wav_header(recorder, recorder->fileBytes);
+    if (write_fully(recorder->fd, recorder->header, RECORDER_WAV_HEADER_BYTES, 0) != 0) {
+      status = -1;
+    }
+  }
+  if (close(recorder->fd) != 0) {
+    status = -1;
+  }
+  recorder->fd = -1;
+  atomic_fetch_add_explicit(&recorder->filesWritten, 1, memory_order_relaxed);
+  return status;
+}
+
+/**
+ * Appends one block to the batch, writing the batch whenever it fills up and starting a new file
+ * when the current one reaches its size or length limit.
+ *
+ * @return 0 on success, -1 if a write failed.
+ */
+static int append_block(audioRecorder *recorder, const float *block, unsigned long frames) {
+  size_t blockBytes = frames * sizeof(float) * (size_t) recorder->numChannels;
+
+  if ((recorder->rotateBytes > 0 && recorder->fileBytes > 0 &&
+       recorder->fileBytes + blockBytes > recorder->rotateBytes) ||
+      (recorder->rotateFrames > 0 && recorder->fileFrames >= recorder->rotateFrames)) {
+    if (close_file(recorder) != 0) {
+      return -1;
+    }
+    recorder->fileIndex++;
+    if (open_file(recorder) != 0) {
+      return -1;
+    }
+  }
+
+  const unsigned char *bytes = (const unsigned char *) block;
+  size_t remaining = blockBytes;
+  while (remaining > 0) {
+    size_t space = RECORDER_BATCH_BYTES - recorder->batchBytes;
+    size_t count = remaining < space ? remaining : space;
+    memcpy(recorder->batch + recorder->batchBytes, bytes, count);
+    recorder->batchBytes += count;
+    recorder->fileBytes += count;
+    bytes += count;
+    remaining -= count;
+    if (recorder->batchBytes == RECORDER_BATCH_BYTES && flush_batch(recorder) != 0) {
+      return -1;
+    }
+  }
+  recorder->fileFrames += frames;
+  return 0;
+}
+
+/**
+ * Moves every queued block into the batch.
+ *
+ * @return Number of blocks taken from the queue.
+ */
+static int drain_queue(audioRecorder *recorder) {
+  int drained = 0;
+  unsigned long frames;
+  const float *block;
+
+  while ((block = ring_peek(&recorder->ring, &frames)) != NULL) {
+    if (atomic_load_explicit(&recorder->failed, memory_order_relaxed)) {
+      atomic_fetch_add_explicit(&recorder->lostBlocks, 1, memory_order_relaxed);
+    } else if (append_block(recorder, block, frames) != 0) {
+      if (recorder->errorNumber == 0) {
+        recorder->errorNumber = errno;
+      }
+      atomic_store(&recorder->failed, 1);
+      atomic_fetch_add_explicit(&recorder->lostBlocks, 1, memory_order_relaxed);
+    } else {
+      atomic_fetch_add_explicit(&recorder->blocksWritten, 1, memory_order_relaxed);
+    }
+    ring_release(&recorder->ring);
+    drained++;
+  }
+
+  return drained;
+}
+
+/**
+ * Writer thread: drains the queue into the batch until stopped, sleeping while it is empty.
+ */
+static void *writer_loop(void *arg) {
+  audioRecorder *recorder = (audioRecorder *) arg;
+  struct timespec idle = {0, RECORDER_POLL_MS * 1000000L};
+
+  while (!atomic_load(&recorder->stop)) {
+    if (drain_queue(recorder) == 0) {
+      nanosleep(&idle, NULL);
+    }
+  }
+  drain_queue(recorder);
+
+  if (recorder->fd >= 0 && close_file(recorder) != 0) {
+    recorder->errorNumber = errno;
+    atomic_store(&recorder->failed, 1);
+  }
+  return NULL;
+}
+
+/**
+ * Allocates the queue, opens the first file and starts the writer thread.
+ *
+ * @param recorder Recorder to start.
+ * @param options Path, format, rotation and queue length of the recording.
+ * @param numChannels Number of interleaved channels in each block.
+ * @param sampleRate Sample rate of the stream, in Hz.
+ * @param framesPerBuffer Largest number of frames in a block.
+ * @return 0 on success, -1 if the file could not be opened or memory could not be allocated.
+ */
+int start_recorder(audioRecorder *recorder, const recorderOptions *options, int numChannels, int sampleRate,
+                   unsigned long framesPerBuffer) {
+  memset(recorder, 0, sizeof(*recorder));
+  recorder->options = *options;
+  recorder->numChannels = numChannels;
+  recorder->sampleRate = sampleRate;
+  recorder->fd = -1;
+
+  unsigned long long limit = options->rotateBytes;
+  if (options->format == RecordWav && (limit == 0 || limit > RECORDER_WAV_MAX_BYTES)) {
+    limit = RECORDER_WAV_MAX_BYTES;
+  }
+  unsigned long long frameBytes = sizeof(float) * (unsigned long long) numChannels;
+  recorder->rotateBytes = limit / frameBytes * frameBytes;
+  recorder->rotateFrames = (unsigned long long) (options->rotateSeconds * sampleRate);
+
+  size_t blocks = (size_t) ((double) options->bufferMs / 1000.0 * sampleRate / framesPerBuffer) + 1;
+  if (ring_init(&recorder->ring, blocks, framesPerBuffer * numChannels) != 0 ||
+      posix_memalign((void **) &recorder->batch, RECORDER_ALIGN, RECORDER_BATCH_BYTES) != 0 ||
+      posix_memalign((void **) &recorder->header, RECORDER_ALIGN, RECORDER_WAV_HEADER_BYTES) != 0) {
+    printf("Could not allocate the recorder.\n");
+    return -1;
+  }
+  // Touches every page of the queue now, so the callback never takes a page fault on first use.
+  memset(recorder->ring.data, 0, sizeof(float) * recorder->ring.capacity * recorder->ring.slotSamples);
+
+  atomic_init(&recorder->highWater, 0);
+  atomic_init(&recorder->blocksWritten, 0);
+  atomic_init(&recorder->bytesWritten, 0);
+  atomic_init(&recorder->filesWritten, 0);
+  atomic_init(&recorder->maxWriteNs, 0);
+  atomic_init(&recorder->failed, 0);
+  atomic_init(&recorder->lostBlocks, 0);
+  atomic_init(&recorder->stop, 0);
+
+  if (open_file(recorder) != 0) {
+    perror(options->path);
+    return -1;
+  }
+  if (pthread_create(&recorder->writerThread, NULL, writer_loop, recorder) != 0) {
+    printf("Could not start the recorder thread.\n");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Queues a block for writing. Lock-free and allocation-free; safe to call from the audio callback.
+ *
+ * @param recorder Running recorder.
+ * @param in Interleaved input samples.
+ * @param framesPerBuffer Number of frames in the block; at most the framesPerBuffer the recorder was
+ *        started with.
+ */
+void recorder_push(audioRecorder *recorder, const float *in, unsigned long framesPerBuffer) {
+  ring_push(&recorder->ring, in, framesPerBuffer, recorder->numChannels);
+
+  size_t queued = atomic_load_explicit(&recorder->ring.head, memory_order_relaxed) -
+                  atomic_load_explicit(&recorder->ring.tail, memory_order_relaxed);
+  if (queued > atomic_load_explicit(&recorder->highWater, memory_order_relaxed)) {
+    atomic_store_explicit(&recorder->highWater, queued, memory_order_relaxed);
+  }
+}
+
+/**
+ * Writes every queued block, finishes the current file and stops the writer thread. The callback
+ * must no longer be calling recorder_push.
+ *
+ * @param recorder Recorder to stop.
+ * @return 0 if every block was written, -1 if a write failed.
+ */
+int stop_recorder(audioRecorder *recorder) {
+  atomic_store(&recorder->stop, 1);
+  pthread_join(recorder->writerThread, NULL);
+
+  ring_free(&recorder->ring);
+  free(recorder->batch);
+  free(recorder->header);
+  recorder->batch = NULL;
+  recorder->header = NULL;
+  return atomic_load(&recorder->failed) ? -1 : 0;
+}
+
+/**
+ * Draws the queue high-water mark, dropped blocks and bytes written into the statistics view window.
+ *
+ * @param recorder Running recorder.
+ */
+void display_recorder_stats(audioRecorder *recorder) {
+  if (STATS_WIN == NULL) {
+    return;
+  }
+
+  mvwprintw(STATS_WIN, RECORDER_STATS_ROW, 0,
+            "Recorder: %.1f MB in %d file(s)  queue high-water %zu/%zu  dropped %lu  lost %lu  slowest write %.1f ms%s",
+            (double) atomic_load_explicit(&recorder->bytesWritten, memory_order_relaxed) / 1e6,
+            atomic_load_explicit(&recorder->filesWritten, memory_order_relaxed) + 1,
+            atomic_load_explicit(&recorder->highWater, memory_order_relaxed), recorder->ring.capacity,
+            atomic_load_explicit(&recorder->ring.dropped, memory_order_relaxed),
+            atomic_load_explicit(&recorder->lostBlocks, memory_order_relaxed),
+            (double) atomic_load_explicit(&recorder->maxWriteNs, memory_order_relaxed) / 1e6,
+            atomic_load_explicit(&recorder->failed, memory_order_relaxed) ? "  FAILED" : "");
+  wclrtoeol(STATS_WIN);
+}
+
+/**
+ * Prints a summary of the recording, e.g. after the screen has been closed.
+ *
+ * @param recorder Stopped recorder.
+ * @param file File to print to.
+ */
+void print_recorder_stats(audioRecorder *recorder, FILE *file) {
+  fprintf(file, "Recorder statistics\n");
+  fprintf(file, "  blocks written:    %lu\n", atomic_load(&recorder->blocksWritten));
+  fprintf(file, "  bytes written:     %llu in %d file(s)\n", atomic_load(&recorder->bytesWritten),
+          atomic_load(&recorder->filesWritten));
+  fprintf(file, "  queue high-water:  %zu of %zu blocks\n", atomic_load(&recorder->highWater),
+          recorder->ring.capacity);
+  fprintf(file, "  dropped blocks:    %lu\n", atomic_load(&recorder->ring.dropped));
+  fprintf(file, "  lost blocks:       %lu\n", atomic_load(&recorder->lostBlocks));
+  fprintf(file, "  slowest write:     %.3f ms\n", (double) atomic_load(&recorder->maxWriteNs) / 1e6);
+  fprintf(file, "  page cache:        %s\n", recorder->directIo ? "bypassed (O_DIRECT)" : "used");
+  if (atomic_load(&recorder->failed)) {
+    fprintf(file, "  recording failed:  %s\n", strerror(recorder->errorNumber));
+  }
+}
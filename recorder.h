@@ -0,0 +1,189 @@
+//
+// Asynchronous capture-to-disk recorder fed from the audio callback.
+//
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "ring.h"
+
+/// Alignment of the batch buffer and of every write, as O_DIRECT requires
+#define RECORDER_ALIGN 4096
+
+/// Bytes collected before they are written to disk in one call; a multiple of RECORDER_ALIGN
+#define RECORDER_BATCH_BYTES (4 << 20)
+
+/// Bytes before the samples of a WAV recording: the header padded with a JUNK chunk to RECORDER_ALIGN
+#define RECORDER_WAV_HEADER_BYTES RECORDER_ALIGN
+
+/// Largest data chunk of a WAV recording; RIFF sizes are 32-bit, so longer recordings are rotated
+#define RECORDER_WAV_MAX_BYTES (0xFFFFFFFFUL - RECORDER_WAV_HEADER_BYTES)
+
+/// Default audio queued between the callback and the writer thread, in milliseconds
+#define RECORDER_DEFAULT_BUFFER_MS 2000
+
+/// Time the writer thread sleeps when the queue is empty, in milliseconds
+#define RECORDER_POLL_MS 10
+
+/// Row of the statistics view window the recorder statistics are drawn into
+#define RECORDER_STATS_ROW 5
+
+/**
+ * File format of a recording.
+ */
+enum RecordFormat {
+
+  /// 32-bit float WAV (WAVE_FORMAT_IEEE_FLOAT), readable by --offline.
+  RecordWav,
+
+  /// Headerless interleaved little-endian float32.
+  RecordRaw
+};
+
+/**
+ * Options of a recording.
+ */
+typedef struct {
+
+  /// Path of the recording. With rotation, files are numbered: take.wav becomes take-0000.wav, ...
+  const char *path;
+
+  enum RecordFormat format;
+
+  /// Non-zero to bypass the page cache (O_DIRECT, or F_NOCACHE on macOS) where the file system allows it.
+  int direct;
+
+  /// Size in bytes of the samples after which a new file is started; 0 to never rotate by size.
+  unsigned long long rotateBytes;
+
+  /// Length in seconds after which a new file is started; 0 to never rotate by time.
+  double rotateSeconds;
+
+  /// Audio the queue holds while the disk is busy, in milliseconds.
+  int bufferMs;
+} recorderOptions;
+
+/**
+ * Recorder of a stream. The audio callback copies every block into a preallocated lock-free ring
+ * (recorder_push); a writer thread moves the blocks into a large aligned batch and writes it to
+ * disk once it is full, so a slow disk only fills the ring and never delays the callback. Blocks
+ * arriving while the ring is full are dropped and counted.
+ */
+typedef struct {
+  recorderOptions options;
+  int numChannels;
+  int sampleRate;
+
+  /// Blocks queued by the callback and not yet copied into the batch.
+  blockRing ring;
+
+  /// Most blocks queued at once since the recording started. Written by the callback only.
+  _Atomic size_t highWater;
+
+  /// Samples waiting to be written, RECORDER_BATCH_BYTES aligned to RECORDER_ALIGN, and their size in bytes.
+  unsigned char *batch;
+  size_t batchBytes;
+
+  /// Header of the current WAV file, RECORDER_WAV_HEADER_BYTES aligned to RECORDER_ALIGN.
+  unsigned char *header;
+
+  /// Current file, its number and the bytes of samples and frames it holds so far.
+  int fd;
+  int fileIndex;
+  int directIo;
+  unsigned long long fileBytes;
+  unsigned long long fileFrames;
+
+  /// Size in bytes and length in frames after which the file is rotated; 0 for no limit.
+  unsigned long long rotateBytes;
+  unsigned long long rotateFrames;
+
+  /// Writer thread statistics: blocks and bytes written, files finished and the slowest write.
+  /// Read by the render thread for display.
+  _Atomic unsigned long blocksWritten;
+  _Atomic unsigned long long bytesWritten;
+  _Atomic int filesWritten;
+  _Atomic uint64_t maxWriteNs;
+
+  /// Set once a write failed; later blocks are discarded and counted as lost.
+  _Atomic int failed;
+  _Atomic unsigned long lostBlocks;
+
+  /// errno of the first failure, reported once the recorder has stopped.
+  int errorNumber;
+
+  pthread_t writerThread;
+
+  /// Set to make the writer thread write what is queued and exit.
+  _Atomic int stop;
+} audioRecorder;
+
+/**
+ * Fills the given recorder options with the defaults: a WAV file without rotation, written
+ * through the page cache, with RECORDER_DEFAULT_BUFFER_MS of queue.
+ *
+ * @param options Options to fill.
+ */
+void default_recorder_options(recorderOptions *options);
+
+/**
+ * Parses a recording format name ("wav" or "raw").
+ *
+ * @param name Name to parse.
+ * @param format Set to the parsed format.
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int parse_record_format(const char *name, enum RecordFormat *format);
+
+/**
+ * Allocates the queue, opens the first file and starts the writer thread.
+ *
+ * @param recorder Recorder to start.
+ * @param options Path, format, rotation and queue length of the recording.
+ * @param numChannels Number of interleaved channels in each block.
+ * @param sampleRate Sample rate of the stream, in Hz.
+ * @param framesPerBuffer Largest number of frames in a block.
+ * @return 0 on success, -1 if the file could not be opened or memory could not be allocated.
+ */
+int start_recorder(audioRecorder *recorder, const recorderOptions *options, int numChannels, int sampleRate,
+                   unsigned long framesPerBuffer);
+
+/**
+ * Queues a block for writing. Lock-free and allocation-free; safe to call from the audio callback.
+ *
+ * @param recorder Running recorder.
+ * @param in Interleaved input samples.
+ * @param framesPerBuffer Number of frames in the block; at most the framesPerBuffer the recorder was
+ *        started with.
+ */
+void recorder_push(audioRecorder *recorder, const float *in, unsigned long framesPerBuffer);
+
+/**
+ * Writes every queued block, finishes the current file and stops the writer thread. The callback
+ * must no longer be calling recorder_push.
+ *
+ * @param recorder Recorder to stop.
+ * @return 0 if every block was written, -1 if a write failed.
+ */
+int stop_recorder(audioRecorder *recorder);
+
+/**
+ * Draws the queue high-water mark, dropped blocks and bytes written into the statistics view window.
+ *
+ * @param recorder Running recorder.
+ */
+void display_recorder_stats(audioRecorder *recorder);
+
+/**
+ * Prints a summary of the recording, e.g. after the screen has been closed.
+ *
+ * @param recorder Stopped recorder.
+ * @param file File to print to.
+ */
+void print_recorder_stats(audioRecorder *recorder, FILE *file);
+
+#endif //RECORDER_H
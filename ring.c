@@ -0,0 +1,116 @@
+//
+// Lock-free single-producer/single-consumer ring of audio blocks.
+//
+
+#include "ring.h"
+#include "arena.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Allocates the storage of the ring.
+ *
+ * @param ring Ring to initialize.
+ * @param capacity Requested number of slots; rounded up to a power of two.
+ * @param slotSamples Number of interleaved samples each slot can hold.
+ * @return 0 on success, -1 if the storage could not be allocated.
+ */
+int ring_init(blockRing *ring, size_t capacity, size_t slotSamples) {
+  size_t slots = 1;
+  while (slots < capacity) {
+    slots <<= 1;
+  }
+
+  ring->data = (float *) session_calloc(slots * slotSamples, sizeof(float));
+  ring->frames = (unsigned long *) session_calloc(slots, sizeof(unsigned long));
+  if (ring->data == NULL || ring->frames == NULL) {
+    session_free(ring->data);
+    session_free(ring->frames);
+    return -1;
+  }
+
+  ring->slotSamples = slotSamples;
+  ring->capacity = slots;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->dropped, 0);
+  return 0;
+}
+
+/**
+ * Frees the storage of the ring. Neither side may be using it anymore.
+ *
+ * @param ring Ring to free.
+ */
+void ring_free(blockRing *ring) {
+  session_free(ring->data);
+  session_free(ring->frames);
+  ring->data = NULL;
+  ring->frames = NULL;
+}
+
+/**
+ * Copies a block into the ring. Safe to call from the audio callback.
+ *
+ * @param ring Ring to push into.
+ * @param samples Interleaved samples of the block.
+ * @param frames Number of frames in the block.
+ * @param channels Number of channels in the block.
+ * @return 1 if the block was queued, 0 if it was dropped.
+ */
+int ring_push(blockRing *ring, const float *samples, unsigned long frames, int channels) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+  if (head - tail >= ring->capacity) {
+    atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    return 0;
+  }
+
+  size_t slot = head & (ring->capacity - 1);
+  size_t count = frames * (size_t) channels;
+  if (count > ring->slotSamples) {
+    count = ring->slotSamples;
+    frames = ring->slotSamples / (size_t) channels;
+  }
+
+  if (samples != NULL) {
+    memcpy(ring->data + slot * ring->slotSamples, samples, count * sizeof(float));
+  } else {
+    memset(ring->data + slot * ring->slotSamples, 0, count * sizeof(float));
+  }
+  ring->frames[slot] = frames;
+
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return 1;
+}
+
+/**
+ * Returns the oldest queued block without removing it from the ring.
+ *
+ * @param ring Ring to read from.
+ * @param frames Set to the number of frames in the block.
+ * @return Interleaved samples of the block, or NULL if the ring is empty.
+ */
+const float *ring_peek(blockRing *ring, unsigned long *frames) {
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+  if (tail == head) {
+    return NULL;
+  }
+
+  size_t slot = tail & (ring->capacity - 1);
+  *frames = ring->frames[slot];
+  return ring->data + slot * ring->slotSamples;
+}
+
+/**
+ * Removes the block last returned by ring_peek, handing its slot back to the producer.
+ *
+ * @param ring Ring to release the block from.
+ */
+void ring_release(blockRing *ring) {
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
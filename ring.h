@@ -0,0 +1,84 @@
+//
+// Lock-free single-producer/single-consumer ring of audio blocks.
+//
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/**
+ * Fixed-capacity ring of interleaved float blocks. Exactly one thread may push
+ * (the PortAudio callback) and exactly one thread may pop. Pushing never blocks
+ * and never allocates; when the ring is full the block is dropped and counted.
+ */
+typedef struct {
+
+  /// Sample storage, capacity * slotSamples floats.
+  float *data;
+
+  /// Number of frames stored in each slot.
+  unsigned long *frames;
+
+  /// Maximum number of interleaved samples in a single slot.
+  size_t slotSamples;
+
+  /// Number of slots; always a power of two.
+  size_t capacity;
+
+  /// Index of the next slot to be written. Only advanced by the producer.
+  _Atomic size_t head;
+
+  /// Index of the next slot to be read. Only advanced by the consumer.
+  _Atomic size_t tail;
+
+  /// Number of blocks dropped because the ring was full.
+  _Atomic unsigned long dropped;
+} blockRing;
+
+/**
+ * Allocates the storage of the ring.
+ *
+ * @param ring Ring to initialize.
+ * @param capacity Requested number of slots; rounded up to a power of two.
+ * @param slotSamples Number of interleaved samples each slot can hold.
+ * @return 0 on success, -1 if the storage could not be allocated.
+ */
+int ring_init(blockRing *ring, size_t capacity, size_t slotSamples);
+
+/**
+ * Frees the storage of the ring. Neither side may be using it anymore.
+ *
+ * @param ring Ring to free.
+ */
+void ring_free(blockRing *ring);
+
+/**
+ * Copies a block into the ring. Safe to call from the audio callback.
+ *
+ * @param ring Ring to push into.
+ * @param samples Interleaved samples of the block.
+ * @param frames Number of frames in the block.
+ * @param channels Number of channels in the block.
+ * @return 1 if the block was queued, 0 if it was dropped.
+ */
+int ring_push(blockRing *ring, const float *samples, unsigned long frames, int channels);
+
+/**
+ * Returns the oldest queued block without removing it from the ring.
+ *
+ * @param ring Ring to read from.
+ * @param frames Set to the number of frames in the block.
+ * @return Interleaved samples of the block, or NULL if the ring is empty.
+ */
+const float *ring_peek(blockRing *ring, unsigned long *frames);
+
+/**
+ * Removes the block last returned by ring_peek, handing its slot back to the producer.
+ *
+ * @param ring Ring to release the block from.
+ */
+void ring_release(blockRing *ring);
+
+#endif //RING_H
@@ -4,7 +4,11 @@
 
 #include "server.h"
 #include "utils.h"
+#include "protocol.h"
 
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,54 +16,712 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
 
-#include "dispatch.h"
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
 
-int start_server(char *port)
-{
-  int sockfd, newsockfd, port_num, n;
-  struct sockaddr_in serv_addr, cli_addr;
-  socklen_t clilen;
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
 
-  sockfd = socket(AF_INET, SOCK_STREAM, 0);
-  if(sockfd < 0) {
-    error("Error opening the socket");
+/// Event-loop tokens of the listening socket and the wake-up pipe; client i uses FIRST_CLIENT_TOKEN + i
+#define LISTEN_TOKEN 0
+#define WAKE_TOKEN 1
+#define FIRST_CLIENT_TOKEN 2
+
+/// Milliseconds the event loop sleeps at most before checking for a stop request
+#define SERVER_POLL_MS 100
+
+static int set_nonblocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags < 0 ? -1 : fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * Starts watching a descriptor for input (and output if wantWrite is set). No-op with poll(),
+ * which rebuilds its descriptor set on every iteration.
+ */
+static void watch_fd(streamServer *server, int fd, uint32_t token, int wantWrite, int modify) {
+#ifdef __linux__
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | (wantWrite ? EPOLLOUT : 0);
+  event.data.u32 = token;
+  epoll_ctl(server->eventFd, modify ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &event);
+#else
+  (void) server;
+  (void) fd;
+  (void) token;
+  (void) wantWrite;
+  (void) modify;
+#endif
+}
+
+/**
+ * Disconnects a subscriber and frees its queue.
+ */
+static void close_client(streamServer *server, serverClient *client, int dropped) {
+#ifdef __linux__
+  epoll_ctl(server->eventFd, EPOLL_CTL_DEL, client->fd, NULL);
+#endif
+  close(client->fd);
+  free(client->queue);
+  memset(client, 0, sizeof(*client));
+  client->fd = -1;
+
+  atomic_fetch_sub(&server->clientsConnected, 1);
+  if (dropped) {
+    atomic_fetch_add(&server->clientsDropped, 1);
   }
-  bzero((char *) &serv_addr, sizeof(serv_addr));
+}
 
-  port_num = atoi(port);
+/**
+ * Accepts every pending connection.
+ */
+static void accept_clients(streamServer *server) {
+  for (;;) {
+    int fd = accept(server->listenFd, NULL, NULL);
+    if (fd < 0) {
+      return;
+    }
 
-  serv_addr.sin_family = AF_INET;
-  serv_addr.sin_addr.s_addr = INADDR_ANY;
-  serv_addr.sin_port = htons(port_num);
+    int slot = -1;
+    for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+      if (server->clients[i].fd < 0) {
+        slot = i;
+        break;
+      }
+    }
+    unsigned char *queue = slot >= 0 ? (unsigned char *) malloc(server->queueBytes) : NULL;
+    if (queue == NULL || set_nonblocking(fd) != 0) {
+      free(queue);
+      close(fd);
+      continue;
+    }
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+    serverClient *client = &server->clients[slot];
+    client->fd = fd;
+    client->queue = queue;
+    client->head = 0;
+    client->tail = 0;
+    client->wantWrite = 0;
+    client->needsKeyframe = server->options.type == StreamSpectrum;
+    watch_fd(server, fd, FIRST_CLIENT_TOKEN + slot, 0, 0);
 
-  if(bind(sockfd, (struct sockaddr *) &serv_addr, sizeof(serv_addr)) < 0) {
-    error("Binding failed");
+    atomic_fetch_add(&server->clientsAccepted, 1);
+    atomic_fetch_add(&server->clientsConnected, 1);
   }
+}
 
-  listen(sockfd, MAX_CONNECTIONS);
-  clilen = sizeof(cli_addr);
+/**
+ * Writes as much of the subscriber's queue as its socket accepts.
+ *
+ * @return 0 if the subscriber is still connected, -1 if it was disconnected.
+ */
+static int flush_client(streamServer *server, int index) {
+  serverClient *client = &server->clients[index];
 
-  newsockfd = accept(sockfd, (struct sockaddr *) &cli_addr, &clilen);
+  while (client->head < client->tail) {
+    ssize_t n = send(client->fd, client->queue + client->head, client->tail - client->head, SEND_FLAGS);
+    if (n > 0) {
+      client->head += (size_t) n;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else {
+      close_client(server, client, 0);
+      return -1;
+    }
+  }
 
-  if(newsockfd < 0) {
-    error("Error while accepting a connection");
+  if (client->head == client->tail) {
+    client->head = 0;
+    client->tail = 0;
   }
 
-  for(;;) {
-    n = write(newsockfd, global_input_buffer, FRAMES_PER_BUFFER);
-    if(n < 0) {
-      error("Error while writing to client");
+  int wantWrite = client->head < client->tail;
+  if (wantWrite != client->wantWrite) {
+    client->wantWrite = wantWrite;
+    watch_fd(server, client->fd, FIRST_CLIENT_TOKEN + index, wantWrite, 1);
+  }
+  return 0;
+}
+
+/**
+ * Appends an encoded frame to a subscriber's queue.
+ *
+ * @return 0 on success, -1 if the queue is full.
+ */
+static int enqueue_frame(streamServer *server, serverClient *client, const unsigned char *frame, size_t length) {
+  if (client->tail + length > server->queueBytes && client->head > 0) {
+    memmove(client->queue, client->queue + client->head, client->tail - client->head);
+    client->tail -= client->head;
+    client->head = 0;
+  }
+  if (client->tail + length > server->queueBytes) {
+    return -1;
+  }
+
+  memcpy(client->queue + client->tail, frame, length);
+  client->tail += length;
+  return 0;
+}
+
+/**
+ * Queues an encoded frame to every subscriber, or the keyframe to subscribers still waiting for one.
+ */
+static void fan_out(streamServer *server, size_t length, size_t keyframeLength) {
+  for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+    serverClient *client = &server->clients[i];
+    if (client->fd < 0) {
+      continue;
     }
 
-    int i = strncmp("Bye", global_input_buffer, 3);
-    if(i == 0) {
-      break;
+    int sendKeyframe = client->needsKeyframe && keyframeLength > 0;
+    if (!sendKeyframe && length == 0) {
+      continue;
+    }
+    if (enqueue_frame(server, client, sendKeyframe ? server->keyframe : server->frame,
+                      sendKeyframe ? keyframeLength : length) != 0) {
+      close_client(server, client, 1);
+    } else if (sendKeyframe) {
+      client->needsKeyframe = 0;
+    }
+  }
+  atomic_fetch_add(&server->framesSent, 1);
+}
+
+/**
+ * Sends an encoded frame as one datagram, unless the induced loss discards it.
+ */
+static void send_datagram(streamServer *server, const unsigned char *frame, size_t length) {
+  // xorshift32: cheap and reproducible from run to run.
+  server->lossState ^= server->lossState << 13;
+  server->lossState ^= server->lossState >> 17;
+  server->lossState ^= server->lossState << 5;
+  if ((server->lossState % 1000000u) < server->options.inducedLoss * 10000.0) {
+    atomic_fetch_add(&server->datagramsDiscarded, 1);
+  } else if (sendto(server->udpFd, frame, length, 0, (const struct sockaddr *) &server->udpDestination,
+                    server->udpDestinationLength) != (ssize_t) length) {
+    atomic_fetch_add(&server->datagramsFailed, 1);
+  }
+  atomic_fetch_add(&server->framesSent, 1);
+}
+
+/**
+ * Encodes a block of samples into server->frame.
+ *
+ * @return Size of the frame.
+ */
+static size_t encode_audio_frame(streamServer *server, const float *block, unsigned long frames) {
+  size_t samples = frames * (size_t) server->numChannels;
+  uint32_t payloadLength = (uint32_t) (samples * sizeof(float));
+  streamHeader header;
+  init_stream_header(&header, StreamAudio, server->sequence, server->numChannels, server->sampleRate,
+                     server->timestamp, payloadLength);
+  encode_stream_header(&header, server->frame);
+  encode_stream_samples(block, samples, server->frame + STREAM_HEADER_SIZE);
+
+  server->timestamp += frames;
+  return STREAM_HEADER_SIZE + payloadLength;
+}
+
+/**
+ * Encodes one entry of the analysis ring (see streamServer.pending) as a delta frame into
+ * server->frame and, when the codec has no reference yet or a subscriber waits for one, as a
+ * keyframe into server->keyframe. A missing delta frame has size 0; subscribers get the keyframe.
+ *
+ * @param keyframeLength Set to the size of the keyframe, or 0 if none was encoded.
+ * @return Size of the delta frame.
+ */
+static size_t encode_spectral_frame(streamServer *server, const float *entry, size_t *keyframeLength) {
+  spectralCodec *codec = &server->codec;
+  channelLevels levels[server->numChannels];
+  memcpy(levels, entry + 1, sizeof(levels));
+  spectral_quantize(codec, levels, entry + 1 + server->numChannels * SPECTRAL_LEVELS);
+
+  int udp = server->udpFd >= 0;
+  int keyframeWanted = !codec->havePrevious || udp;
+  for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+    keyframeWanted |= server->clients[i].fd >= 0 && server->clients[i].needsKeyframe;
+  }
+
+  streamHeader header;
+  size_t length = 0;
+  if (codec->havePrevious && !udp) {
+    size_t payloadLength = spectral_encode(codec, 0, server->frame + STREAM_HEADER_SIZE);
+    init_stream_header(&header, StreamSpectrum, server->sequence, server->numChannels, server->sampleRate,
+                       server->timestamp, (uint32_t) payloadLength);
+    encode_stream_header(&header, server->frame);
+    length = STREAM_HEADER_SIZE + payloadLength;
+  }
+
+  *keyframeLength = 0;
+  if (keyframeWanted) {
+    size_t payloadLength = spectral_encode(codec, 1, server->keyframe + STREAM_HEADER_SIZE);
+    init_stream_header(&header, StreamSpectrum, server->sequence, server->numChannels, server->sampleRate,
+                       server->timestamp, (uint32_t) payloadLength);
+    header.flags = STREAM_FLAG_KEYFRAME;
+    encode_stream_header(&header, server->keyframe);
+    *keyframeLength = STREAM_HEADER_SIZE + payloadLength;
+  }
+
+  spectral_commit(codec);
+  server->timestamp += (unsigned long) entry[0];
+  return length;
+}
+
+/**
+ * Encodes every published block once, queues it to all subscribers and starts writing.
+ */
+static void broadcast_blocks(streamServer *server) {
+  char drain[64];
+  while (read(server->wakeFds[0], drain, sizeof(drain)) > 0) {
+  }
+
+  const float *block;
+  unsigned long frames;
+  while ((block = ring_peek(&server->ring, &frames)) != NULL) {
+    // Blocks the ring dropped are accounted for before the next frame, so receivers see the gap.
+    server->sequence += (uint32_t) atomic_exchange(&server->droppedBlocks, 0);
+    server->timestamp += atomic_exchange(&server->droppedFrames, 0);
+
+    size_t length;
+    size_t keyframeLength = 0;
+    if (server->options.type == StreamSpectrum) {
+      length = encode_spectral_frame(server, block, &keyframeLength);
+    } else {
+      length = encode_audio_frame(server, block, frames);
+    }
+    ring_release(&server->ring);
+
+    server->sequence++;
+    if (server->udpFd >= 0) {
+      send_datagram(server, keyframeLength > 0 ? server->keyframe : server->frame,
+                    keyframeLength > 0 ? keyframeLength : length);
+    } else {
+      fan_out(server, length, keyframeLength);
+    }
+  }
+
+  for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+    if (server->clients[i].fd >= 0 && !server->clients[i].wantWrite) {
+      flush_client(server, i);
+    }
+  }
+}
+
+/**
+ * Handles input from a subscriber. Subscribers do not send anything yet, so input is discarded;
+ * end-of-file or an error disconnects the subscriber.
+ */
+static void read_client(streamServer *server, int index) {
+  serverClient *client = &server->clients[index];
+  char discard[256];
+
+  for (;;) {
+    ssize_t n = recv(client->fd, discard, sizeof(discard), 0);
+    if (n > 0) {
+      continue;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+      return;
+    }
+    close_client(server, client, 0);
+    return;
+  }
+}
+
+/**
+ * Dispatches one ready descriptor of the event loop.
+ */
+static void handle_event(streamServer *server, uint32_t token, int readable, int writable) {
+  if (token == LISTEN_TOKEN) {
+    accept_clients(server);
+    return;
+  }
+  if (token == WAKE_TOKEN) {
+    broadcast_blocks(server);
+    return;
+  }
+
+  int index = (int) token - FIRST_CLIENT_TOKEN;
+  if (server->clients[index].fd < 0) {
+    return;
+  }
+  if (writable && flush_client(server, index) != 0) {
+    return;
+  }
+  if (readable) {
+    read_client(server, index);
+  }
+}
+
+/**
+ * Waits for ready descriptors and handles them.
+ */
+static void wait_events(streamServer *server) {
+#ifdef __linux__
+  struct epoll_event events[SERVER_MAX_CLIENTS + FIRST_CLIENT_TOKEN];
+  int count = epoll_wait(server->eventFd, events, SERVER_MAX_CLIENTS + FIRST_CLIENT_TOKEN, SERVER_POLL_MS);
+  for (int i = 0; i < count; i++) {
+    handle_event(server, events[i].data.u32,
+                 (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) != 0,
+                 (events[i].events & EPOLLOUT) != 0);
+  }
+#else
+  struct pollfd fds[SERVER_MAX_CLIENTS + FIRST_CLIENT_TOKEN];
+  uint32_t tokens[SERVER_MAX_CLIENTS + FIRST_CLIENT_TOKEN];
+  int count = 0;
+
+  fds[count].fd = server->listenFd;
+  fds[count].events = POLLIN;
+  tokens[count++] = LISTEN_TOKEN;
+  fds[count].fd = server->wakeFds[0];
+  fds[count].events = POLLIN;
+  tokens[count++] = WAKE_TOKEN;
+  for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+    if (server->clients[i].fd >= 0) {
+      fds[count].fd = server->clients[i].fd;
+      fds[count].events = POLLIN | (server->clients[i].wantWrite ? POLLOUT : 0);
+      tokens[count++] = FIRST_CLIENT_TOKEN + i;
+    }
+  }
+
+  if (poll(fds, count, SERVER_POLL_MS) <= 0) {
+    return;
+  }
+  for (int i = 0; i < count; i++) {
+    if (fds[i].revents != 0) {
+      handle_event(server, tokens[i],
+                   (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) != 0,
+                   (fds[i].revents & POLLOUT) != 0);
     }
   }
+#endif
+}
 
-  close(newsockfd);
-  close(sockfd);
+static void *server_loop(void *arg) {
+  streamServer *server = (streamServer *) arg;
 
+  while (!atomic_load(&server->stop)) {
+    wait_events(server);
+  }
+  return NULL;
+}
+
+/**
+ * Creates a non-blocking TCP listening socket on the given port of every local address.
+ *
+ * @param port Port to listen on; "0" picks a free port.
+ * @return The socket, or -1 on failure.
+ */
+int open_listen_socket(const char *port) {
+  struct addrinfo hints;
+  struct addrinfo *addresses;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  if (getaddrinfo(NULL, port, &hints, &addresses) != 0) {
+    return -1;
+  }
+
+  int fd = socket(addresses->ai_family, addresses->ai_socktype, addresses->ai_protocol);
+  if (fd >= 0) {
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, addresses->ai_addr, addresses->ai_addrlen) != 0 ||
+        listen(fd, MAX_CONNECTIONS) != 0 || set_nonblocking(fd) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+
+  freeaddrinfo(addresses);
+  return fd;
+}
+
+/**
+ * Creates a non-blocking UDP socket sending to the given address, with multicast datagrams kept
+ * on the local network and looped back to local receivers.
+ *
+ * @return The socket, or -1 on failure.
+ */
+static int open_udp_socket(streamServer *server, const char *host, const char *port) {
+  struct addrinfo hints;
+  struct addrinfo *addresses;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  if (getaddrinfo(host, port, &hints, &addresses) != 0) {
+    return -1;
+  }
+
+  int fd = socket(addresses->ai_family, addresses->ai_socktype, addresses->ai_protocol);
+  if (fd >= 0 && set_nonblocking(fd) == 0) {
+    memcpy(&server->udpDestination, addresses->ai_addr, addresses->ai_addrlen);
+    server->udpDestinationLength = addresses->ai_addrlen;
+    server->port = ntohs(((struct sockaddr_in *) addresses->ai_addr)->sin_port);
+
+    if (IN_MULTICAST(ntohl(((struct sockaddr_in *) addresses->ai_addr)->sin_addr.s_addr))) {
+      unsigned char ttl = SERVER_MULTICAST_TTL;
+      unsigned char loop = 1;
+      setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+      setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop));
+    }
+  } else if (fd >= 0) {
+    close(fd);
+    fd = -1;
+  }
+
+  freeaddrinfo(addresses);
+  return fd;
+}
+
+/**
+ * Sets the default server options: raw audio in DEFAULT_FRAMES_PER_BUFFER-frame blocks, with spectral frames
+ * at SPECTRAL_DEFAULT_RATE and 8 bits.
+ *
+ * @param options Options to initialize.
+ */
+void default_server_options(serverOptions *options) {
+  options->type = StreamAudio;
+  options->spectralRate = SPECTRAL_DEFAULT_RATE;
+  options->spectralBits = 8;
+  options->numSpectra = 0;
+  options->framesPerBuffer = DEFAULT_FRAMES_PER_BUFFER;
+  options->udpHost = NULL;
+  options->inducedLoss = 0.0;
+}
+
+/**
+ * Binds the listening socket (or opens the UDP socket) and starts the server thread.
+ *
+ * @param server Server to start.
+ * @param port Port to listen on; "0" picks a free port (see server->port). With options->udpHost,
+ *        the port the datagrams are sent to.
+ * @param numChannels Number of interleaved channels of the published blocks.
+ * @param sampleRate Sample rate of the published blocks.
+ * @param options What to publish.
+ * @return 0 on success, -1 if the socket could not be set up or the options are invalid.
+ */
+int start_server(streamServer *server, const char *port, int numChannels, int sampleRate,
+                 const serverOptions *options) {
+  memset(server, 0, sizeof(*server));
+  for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+    server->clients[i].fd = -1;
+  }
+  server->numChannels = numChannels;
+  server->sampleRate = sampleRate;
+  server->options = *options;
+  server->eventFd = -1;
+  server->listenFd = -1;
+  server->udpFd = -1;
+  server->lossState = 0x9e3779b9u;
+  atomic_init(&server->stop, 0);
+
+  size_t slotSamples = (size_t) options->framesPerBuffer * numChannels;
+  size_t frameBytes = STREAM_HEADER_SIZE + slotSamples * sizeof(float);
+  if (options->type == StreamSpectrum) {
+    if (options->spectralRate < 1 ||
+        spectral_codec_init(&server->codec, numChannels, options->numSpectra, WIN_WIDTH, options->spectralBits) != 0) {
+      printf("Invalid spectral stream options (%d frames/s, %d bits).\n", options->spectralRate,
+             options->spectralBits);
+      return -1;
+    }
+    slotSamples = 1 + (size_t) server->codec.numValues;
+    frameBytes = STREAM_HEADER_SIZE + spectral_max_payload(&server->codec);
+    server->pending = (float *) calloc(slotSamples, sizeof(float));
+    server->keyframe = (unsigned char *) malloc(frameBytes);
+    if (server->pending == NULL || server->keyframe == NULL) {
+      printf("Could not allocate the server buffers.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (options->udpHost != NULL) {
+    if (frameBytes > SERVER_MAX_DATAGRAM) {
+      printf("Frames of %zu bytes do not fit in a UDP datagram.\n", frameBytes);
+      return -1;
+    }
+    server->udpFd = open_udp_socket(server, options->udpHost, port);
+    if (server->udpFd < 0) {
+      perror("Could not open the UDP stream socket");
+      return -1;
+    }
+  } else {
+    server->listenFd = open_listen_socket(port);
+    if (server->listenFd < 0) {
+      perror("Could not listen for stream subscribers");
+      return -1;
+    }
+
+    struct sockaddr_in address;
+    socklen_t addressLength = sizeof(address);
+    getsockname(server->listenFd, (struct sockaddr *) &address, &addressLength);
+    server->port = ntohs(address.sin_port);
+  }
+
+  if (pipe(server->wakeFds) != 0 || set_nonblocking(server->wakeFds[0]) != 0 ||
+      set_nonblocking(server->wakeFds[1]) != 0) {
+    perror("Could not create the server wake-up pipe");
+    close(server->listenFd >= 0 ? server->listenFd : server->udpFd);
+    return -1;
+  }
+
+#ifdef __linux__
+  server->eventFd = epoll_create1(0);
+  if (server->eventFd < 0) {
+    perror("epoll_create1");
+    close(server->listenFd >= 0 ? server->listenFd : server->udpFd);
+    close(server->wakeFds[0]);
+    close(server->wakeFds[1]);
+    return -1;
+  }
+#endif
+  if (server->listenFd >= 0) {
+    watch_fd(server, server->listenFd, LISTEN_TOKEN, 0, 0);
+  }
+  watch_fd(server, server->wakeFds[0], WAKE_TOKEN, 0, 0);
+
+  server->queueBytes = SERVER_CLIENT_QUEUE_FRAMES * frameBytes;
+  server->frame = (unsigned char *) malloc(frameBytes);
+  if (server->frame == NULL || ring_init(&server->ring, SERVER_RING_BLOCKS, slotSamples) != 0) {
+    printf("Could not allocate the server buffers.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (pthread_create(&server->thread, NULL, server_loop, server) != 0) {
+    printf("Could not start the server thread.\n");
+    exit(EXIT_FAILURE);
+  }
   return 0;
 }
+
+/**
+ * Queues a captured block for every subscriber. Never blocks; if the server thread falls behind,
+ * the block is dropped and the next frame's sequence number skips it.
+ *
+ * @param server Running server.
+ * @param block Interleaved samples of numChannels channels.
+ * @param frames Number of frames in the block; at most options->framesPerBuffer.
+ * @return 1 if the block was queued, 0 if it was dropped.
+ */
+int server_publish(streamServer *server, const float *block, unsigned long frames) {
+  if (!ring_push(&server->ring, block, frames, server->numChannels)) {
+    atomic_fetch_add(&server->droppedBlocks, 1);
+    atomic_fetch_add(&server->droppedFrames, frames);
+    return 0;
+  }
+
+  char wake = 1;
+  // A full pipe already holds a pending wake-up.
+  if (write(server->wakeFds[1], &wake, 1) < 0 && errno != EAGAIN) {
+    perror("Could not wake the server thread");
+  }
+  return 1;
+}
+
+/**
+ * Gathers the analysis of a block and, about spectralRate times per second of stream time, queues
+ * a spectral frame for every subscriber. Peak and true-peak levels are held over the frames a
+ * spectral frame covers; RMS, DC and the spectra are the latest. Never blocks; a frame the server
+ * thread cannot keep up with is dropped like a block.
+ *
+ * @param server Running server publishing StreamSpectrum frames. Only one thread may publish.
+ * @param levels numChannels levels of the block.
+ * @param columns numSpectra * WIN_WIDTH column amplitudes of the block.
+ * @param frames Number of frames in the block.
+ * @return 1 if a spectral frame was queued, 0 otherwise.
+ */
+int server_publish_analysis(streamServer *server, const channelLevels *levels, const double *columns,
+                            unsigned long frames) {
+  channelLevels *pendingLevels = (channelLevels *) (server->pending + 1);
+  for (int c = 0; c < server->numChannels; c++) {
+    channelLevels held = levels[c];
+    if (server->pendingFrames > 0) {
+      held.peak = fmaxf(held.peak, pendingLevels[c].peak);
+      held.truePeak = fmaxf(held.truePeak, pendingLevels[c].truePeak);
+    }
+    pendingLevels[c] = held;
+  }
+  server->pendingFrames += frames;
+
+  server->rateAccumulator += (unsigned long long) frames * server->options.spectralRate;
+  if (server->rateAccumulator < (unsigned long long) server->sampleRate) {
+    return 0;
+  }
+  server->rateAccumulator %= (unsigned long long) server->sampleRate;
+
+  float *pendingColumns = server->pending + 1 + server->numChannels * SPECTRAL_LEVELS;
+  int numColumnValues = server->options.numSpectra * WIN_WIDTH;
+  for (int i = 0; i < numColumnValues; i++) {
+    pendingColumns[i] = (float) columns[i];
+  }
+  server->pending[0] = (float) server->pendingFrames;
+
+  unsigned long covered = server->pendingFrames;
+  server->pendingFrames = 0;
+  if (!ring_push(&server->ring, server->pending, 1 + (unsigned long) server->codec.numValues, 1)) {
+    atomic_fetch_add(&server->droppedBlocks, 1);
+    atomic_fetch_add(&server->droppedFrames, covered);
+    return 0;
+  }
+
+  char wake = 1;
+  if (write(server->wakeFds[1], &wake, 1) < 0 && errno != EAGAIN) {
+    perror("Could not wake the server thread");
+  }
+  return 1;
+}
+
+/**
+ * Stops the server thread and disconnects every subscriber.
+ *
+ * @param server Server to stop.
+ */
+void stop_server(streamServer *server) {
+  atomic_store(&server->stop, 1);
+  char wake = 1;
+  if (write(server->wakeFds[1], &wake, 1) < 0) {
+    // The loop also wakes up every SERVER_POLL_MS.
+  }
+  pthread_join(server->thread, NULL);
+
+  for (int i = 0; i < SERVER_MAX_CLIENTS; i++) {
+    if (server->clients[i].fd >= 0) {
+      close_client(server, &server->clients[i], 0);
+    }
+  }
+  if (server->listenFd >= 0) {
+    close(server->listenFd);
+  }
+  if (server->udpFd >= 0) {
+    close(server->udpFd);
+  }
+  close(server->wakeFds[0]);
+  close(server->wakeFds[1]);
+#ifdef __linux__
+  close(server->eventFd);
+#endif
+  ring_free(&server->ring);
+  free(server->frame);
+  free(server->keyframe);
+  free(server->pending);
+  spectral_codec_free(&server->codec);
+}
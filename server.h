@@ -5,10 +5,218 @@
 #ifndef SERVER_H
 #define SERVER_H
 
-#define MAX_CONNECTIONS 2
+/// Number of pending connections the listening socket queues
+#define MAX_CONNECTIONS 16
 
+/// Maximum number of subscribers served at once
+#define SERVER_MAX_CLIENTS 64
+
+/// Frames queued per subscriber before it is considered too slow and dropped (about 1.4 s of audio)
+#define SERVER_CLIENT_QUEUE_FRAMES 256
+
+/// Number of captured blocks queued between the render thread and the server thread
+#define SERVER_RING_BLOCKS 64
+
+/// Largest frame sent over UDP: the largest IPv4 datagram payload
+#define SERVER_MAX_DATAGRAM 65507
+
+/// Hops a multicast datagram may take; 1 keeps the stream on the local network
+#define SERVER_MULTICAST_TTL 1
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <sys/socket.h>
+
+#include "ring.h"
+#include "meter.h"
+#include "protocol.h"
+#include "spectral.h"
+
+/**
+ * A connected subscriber and the encoded frames not yet written to its socket.
+ */
+typedef struct {
+  int fd;
+
+  /// Queued bytes are queue[head, tail).
+  unsigned char *queue;
+  size_t head;
+  size_t tail;
+
+  /// Set while the event loop waits for the socket to become writable.
+  int wantWrite;
+
+  /// Set until the subscriber has been sent a spectral keyframe.
+  int needsKeyframe;
+} serverClient;
+
+/**
+ * What a server publishes.
+ */
+typedef struct {
+
+  /// StreamAudio to send every captured block, StreamSpectrum to send the analysed levels and spectra.
+  enum StreamFrameType type;
+
+  /// Spectral frames per second.
+  int spectralRate;
+
+  /// Width of the spectral codes: 8 or 16 bits.
+  int spectralBits;
+
+  /// Number of spectra of the analysis (see init_spectro_data); StreamSpectrum only.
+  int numSpectra;
+
+  /// Largest number of frames in a published block.
+  int framesPerBuffer;
+
+  /// Unicast or multicast address to send every frame to as a UDP datagram instead of serving TCP
+  /// subscribers; NULL for TCP. Spectral frames over UDP are all keyframes, so losses do not spread.
+  const char *udpHost;
+
+  /// Percentage of UDP datagrams deliberately not sent, to test receivers against packet loss.
+  double inducedLoss;
+} serverOptions;
+
+/**
+ * Non-blocking server fanning every captured block, or spectral frames made of the analysed
+ * levels and spectra, out to all subscribers as framed messages (see protocol.h). Blocks are
+ * handed over by server_publish (server_publish_analysis) through a lock-free ring and a
+ * wake-up pipe; a dedicated thread runs the event loop (epoll on Linux, poll elsewhere),
+ * encodes each block once and queues it to every subscriber. A subscriber whose queue overflows
+ * is disconnected instead of stalling the others. Over UDP, every frame is instead sent as one
+ * datagram to a unicast or multicast address, so a lost frame never delays the next one.
+ */
+typedef struct {
+
+  /// TCP listening socket, or -1 when streaming over UDP.
+  int listenFd;
+  int port;
+
+  /// UDP socket and destination of the frames, when streaming over UDP.
+  int udpFd;
+  struct sockaddr_storage udpDestination;
+  socklen_t udpDestinationLength;
+
+  /// State of the generator deciding which datagrams are deliberately lost.
+  uint32_t lossState;
+
+  /// Written by server_publish to wake the event loop; read end first.
+  int wakeFds[2];
+
+  /// epoll instance (Linux only).
+  int eventFd;
+
+  serverClient clients[SERVER_MAX_CLIENTS];
+
+  /// Blocks published and not yet encoded.
+  blockRing ring;
+
+  int numChannels;
+  int sampleRate;
+  serverOptions options;
+
+  /// Sequence number and stream position of the next frame.
+  uint32_t sequence;
+  uint64_t timestamp;
+
+  /// Blocks and frames dropped by the ring since the event loop last accounted for them.
+  _Atomic unsigned long droppedBlocks;
+  _Atomic unsigned long droppedFrames;
+
+  /// Encoding buffer of one frame.
+  unsigned char *frame;
+
+  /// Capacity of each subscriber's queue: SERVER_CLIENT_QUEUE_FRAMES full frames.
+  size_t queueBytes;
+
+  /// Spectral quantization state of the server thread and the encoding buffer of a keyframe.
+  spectralCodec codec;
+  unsigned char *keyframe;
+
+  /// Analysis gathered by server_publish_analysis since the last spectral frame: frames covered
+  /// followed by the levels and column amplitudes, laid out as queued in the ring.
+  float *pending;
+  unsigned long pendingFrames;
+
+  /// frames * spectralRate accumulated since the last spectral frame.
+  unsigned long long rateAccumulator;
+
+  pthread_t thread;
+  _Atomic int stop;
+
+  /// Statistics, readable from any thread.
+  _Atomic unsigned long clientsAccepted;
+  _Atomic unsigned long clientsDropped;
+  _Atomic unsigned long framesSent;
+  _Atomic unsigned long datagramsDiscarded;
+  _Atomic unsigned long datagramsFailed;
+  _Atomic int clientsConnected;
+} streamServer;
+
+/**
+ * Sets the default server options: raw audio in DEFAULT_FRAMES_PER_BUFFER-frame blocks, with spectral frames
+ * at SPECTRAL_DEFAULT_RATE and 8 bits.
+ *
+ * @param options Options to initialize.
+ */
+void default_server_options(serverOptions *options);
+
+/**
+ * Creates a non-blocking TCP listening socket on the given port of every local address.
+ *
+ * @param port Port to listen on; "0" picks a free port.
+ * @return The socket, or -1 on failure.
+ */
+int open_listen_socket(const char *port);
+
+/**
+ * Binds the listening socket (or opens the UDP socket) and starts the server thread.
+ *
+ * @param server Server to start.
+ * @param port Port to listen on; "0" picks a free port (see server->port). With options->udpHost,
+ *        the port the datagrams are sent to.
+ * @param numChannels Number of interleaved channels of the published blocks.
+ * @param sampleRate Sample rate of the published blocks.
+ * @param options What to publish.
+ * @return 0 on success, -1 if the socket could not be set up or the options are invalid.
+ */
+int start_server(streamServer *server, const char *port, int numChannels, int sampleRate,
+                 const serverOptions *options);
+
+/**
+ * Queues a captured block for every subscriber. Never blocks; if the server thread falls behind,
+ * the block is dropped and the next frame's sequence number skips it.
+ *
+ * @param server Running server.
+ * @param block Interleaved samples of numChannels channels.
+ * @param frames Number of frames in the block; at most options->framesPerBuffer.
+ * @return 1 if the block was queued, 0 if it was dropped.
+ */
+int server_publish(streamServer *server, const float *block, unsigned long frames);
+
+/**
+ * Gathers the analysis of a block and, about spectralRate times per second of stream time, queues
+ * a spectral frame for every subscriber. Peak and true-peak levels are held over the frames a
+ * spectral frame covers; RMS, DC and the spectra are the latest. Never blocks; a frame the server
+ * thread cannot keep up with is dropped like a block.
+ *
+ * @param server Running server publishing StreamSpectrum frames. Only one thread may publish.
+ * @param levels numChannels levels of the block.
+ * @param columns numSpectra * WIN_WIDTH column amplitudes of the block.
+ * @param frames Number of frames in the block.
+ * @return 1 if a spectral frame was queued, 0 otherwise.
+ */
+int server_publish_analysis(streamServer *server, const channelLevels *levels, const double *columns,
+                            unsigned long frames);
 
-int start_server(char *port, char *callback_buffer, size_t buffer_size);
+/**
+ * Stops the server thread and disconnects every subscriber.
+ *
+ * @param server Server to stop.
+ */
+void stop_server(streamServer *server);
 
 #endif //SERVER_H
@@ -0,0 +1,113 @@
+//
+// Deterministic synthetic test signals.
+//
+
+#include "signals.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static const char *SIGNAL_NAMES[NUM_SIGNAL_KINDS] = {
+    "sine", "white", "pink", "silence", "square_clip"
+};
+
+/**
+ * Returns a short lowercase name of the signal kind, e.g. "pink".
+ *
+ * @param kind Kind of signal.
+ * @return Name of the signal kind.
+ */
+const char *signal_name(enum SignalKind kind) {
+  return kind < NUM_SIGNAL_KINDS ? SIGNAL_NAMES[kind] : "unknown";
+}
+
+/**
+ * xorshift32 step; returns a uniform float in [-1, 1).
+ */
+static float next_uniform(uint32_t *state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return (float) ((double) x / 2147483648.0 - 1.0);
+}
+
+/**
+ * Fills an interleaved buffer with a synthetic signal. The same arguments always produce
+ * the same samples, so results can be compared across runs and machines.
+ *
+ * Sines use a different frequency on each channel (440 Hz * (channel + 1)) at half scale,
+ * noise is uniform white noise or Kellet-filtered pink noise at roughly -10 dBFS, and the
+ * square wave is a 1 kHz square at 1.5x full scale hard-clipped to [-1, 1].
+ *
+ * @param kind Kind of signal.
+ * @param out Output buffer of frames * channels samples.
+ * @param frames Number of frames to generate.
+ * @param channels Number of interleaved channels.
+ * @param sampleRate Sample rate in Hz.
+ * @param seed Seed of the noise generator.
+ */
+void generate_signal(enum SignalKind kind, float *out, unsigned long frames, int channels,
+                     double sampleRate, uint32_t seed) {
+  uint32_t state = seed != 0 ? seed : 0x9E3779B9u;
+
+  switch (kind) {
+    case SignalSine:
+      for (unsigned long i = 0; i < frames; i++) {
+        for (int channelNum = 0; channelNum < channels; channelNum++) {
+          double freq = 440.0 * (channelNum + 1);
+          out[i * channels + channelNum] = (float) (0.5 * sin(2.0 * M_PI * freq * (double) i / sampleRate));
+        }
+      }
+      break;
+
+    case SignalWhiteNoise:
+      for (unsigned long i = 0; i < frames * channels; i++) {
+        out[i] = 0.3f * next_uniform(&state);
+      }
+      break;
+
+    case SignalPinkNoise: {
+      // Paul Kellet's refined pink noise filter, one filter state per channel.
+      float *b = (float *) calloc((size_t) channels * 7, sizeof(float));
+      for (unsigned long i = 0; i < frames; i++) {
+        for (int channelNum = 0; channelNum < channels; channelNum++) {
+          float *s = b + channelNum * 7;
+          float white = next_uniform(&state);
+          s[0] = 0.99886f * s[0] + white * 0.0555179f;
+          s[1] = 0.99332f * s[1] + white * 0.0750759f;
+          s[2] = 0.96900f * s[2] + white * 0.1538520f;
+          s[3] = 0.86650f * s[3] + white * 0.3104856f;
+          s[4] = 0.55000f * s[4] + white * 0.5329522f;
+          s[5] = -0.7616f * s[5] - white * 0.0168980f;
+          float pink = s[0] + s[1] + s[2] + s[3] + s[4] + s[5] + s[6] + white * 0.5362f;
+          s[6] = white * 0.115926f;
+          out[i * channels + channelNum] = 0.05f * pink;
+        }
+      }
+      free(b);
+      break;
+    }
+
+    case SignalSquareClip:
+      for (unsigned long i = 0; i < frames; i++) {
+        double phase = fmod(1000.0 * (double) i / sampleRate, 1.0);
+        float value = phase < 0.5 ? 1.5f : -1.5f;
+        value = fmaxf(-1.0f, fminf(1.0f, value));
+        for (int channelNum = 0; channelNum < channels; channelNum++) {
+          out[i * channels + channelNum] = value;
+        }
+      }
+      break;
+
+    case SignalSilence:
+    default:
+      memset(out, 0, sizeof(float) * frames * channels);
+      break;
+  }
+}
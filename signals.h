@@ -0,0 +1,48 @@
+//
+// Deterministic synthetic test signals.
+//
+
+#ifndef SIGNALS_H
+#define SIGNALS_H
+
+#include <stdint.h>
+
+/**
+ * Kinds of synthetic signal that can be generated.
+ */
+enum SignalKind {
+  SignalSine,
+  SignalWhiteNoise,
+  SignalPinkNoise,
+  SignalSilence,
+  SignalSquareClip,
+  NUM_SIGNAL_KINDS
+};
+
+/**
+ * Returns a short lowercase name of the signal kind, e.g. "pink".
+ *
+ * @param kind Kind of signal.
+ * @return Name of the signal kind.
+ */
+const char *signal_name(enum SignalKind kind);
+
+/**
+ * Fills an interleaved buffer with a synthetic signal. The same arguments always produce
+ * the same samples, so results can be compared across runs and machines.
+ *
+ * Sines use a different frequency on each channel (440 Hz * (channel + 1)) at half scale,
+ * noise is uniform white noise or Kellet-filtered pink noise at roughly -10 dBFS, and the
+ * square wave is a 1 kHz square at 1.5x full scale hard-clipped to [-1, 1].
+ *
+ * @param kind Kind of signal.
+ * @param out Output buffer of frames * channels samples.
+ * @param frames Number of frames to generate.
+ * @param channels Number of interleaved channels.
+ * @param sampleRate Sample rate in Hz.
+ * @param seed Seed of the noise generator.
+ */
+void generate_signal(enum SignalKind kind, float *out, unsigned long frames, int channels,
+                     double sampleRate, uint32_t seed);
+
+#endif //SIGNALS_H
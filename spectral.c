@@ -0,0 +1,335 @@
+//
+// Quantized, delta-encoded spectral frames streamed instead of raw samples.
+//
+
+#include "spectral.h"
+#include "frequencies.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// Longest varint accepted by the decoder
+#define SPECTRAL_MAX_VARINT 4
+
+/**
+ * Size of one quantization step in dB.
+ */
+static double step_db(int bits) {
+  return bits == 8 ? 0.5 : 1.0 / 256.0;
+}
+
+static uint16_t quantize_db(int bits, double db) {
+  double maxCode = bits == 8 ? 255.0 : 65535.0;
+  double code = floor((db - SPECTRAL_DB_MIN) / step_db(bits) + 0.5);
+  // Also maps NaN (e.g. the dB of silence computed as 0 * -inf) to 0.
+  if (!(code > 0.0)) {
+    return 0;
+  }
+  return (uint16_t) (code < maxCode ? code : maxCode);
+}
+
+static uint16_t quantize_amplitude(int bits, float amplitude) {
+  amplitude = fabsf(amplitude);
+  return amplitude > 0.0f ? quantize_db(bits, 20.0 * log10(amplitude)) : 0;
+}
+
+/**
+ * Code of a signed level such as the DC offset: its magnitude on the dB scale at twice the step, in
+ * the upper bits, and its sign in the lowest bit, so that deltas of a steady offset stay small.
+ */
+static uint16_t quantize_signed_amplitude(int bits, float amplitude) {
+  double maxMagnitude = bits == 8 ? 127.0 : 32767.0;
+  double magnitude = amplitude != 0.0f
+                     ? floor((20.0 * log10(fabsf(amplitude)) - SPECTRAL_DB_MIN) / (2.0 * step_db(bits)) + 0.5)
+                     : 0.0;
+  if (!(magnitude > 0.0)) {
+    return 0;
+  }
+  magnitude = magnitude < maxMagnitude ? magnitude : maxMagnitude;
+  return (uint16_t) ((unsigned) magnitude << 1 | (amplitude < 0.0f));
+}
+
+/**
+ * Level in dB that a code stands for.
+ *
+ * @param bits Width of the code: 8 or 16.
+ * @param code Code to convert.
+ * @return Level in dB.
+ */
+double spectral_code_db(int bits, uint16_t code) {
+  return SPECTRAL_DB_MIN + code * step_db(bits);
+}
+
+static float dequantize_amplitude(int bits, uint16_t code) {
+  return code == 0 ? 0.0f : (float) pow(10.0, spectral_code_db(bits, code) / 20.0);
+}
+
+static float dequantize_signed_amplitude(int bits, uint16_t code) {
+  float magnitude = dequantize_amplitude(bits, (uint16_t) (code & ~1u));
+  return (code & 1u) ? -magnitude : magnitude;
+}
+
+static unsigned char *put_varint(unsigned char *out, uint32_t value) {
+  while (value >= 0x80) {
+    *out++ = (unsigned char) (value | 0x80);
+    value >>= 7;
+  }
+  *out++ = (unsigned char) value;
+  return out;
+}
+
+/**
+ * Reads a varint, advancing *in.
+ *
+ * @return 0 on success, -1 if the varint is truncated or too long.
+ */
+static int get_varint(const unsigned char **in, const unsigned char *end, uint32_t *value) {
+  *value = 0;
+  for (int i = 0; i < SPECTRAL_MAX_VARINT && *in < end; i++) {
+    unsigned char byte = *(*in)++;
+    *value |= (uint32_t) (byte & 0x7f) << (7 * i);
+    if ((byte & 0x80) == 0) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Code each value is predicted from: the same value of the previous frame, or for keyframes the
+ * preceding value of the same frame (neighbouring columns are similar).
+ */
+static int reference_code(const spectralCodec *codec, int keyframe, int i) {
+  if (keyframe) {
+    return i > 0 ? codec->current[i - 1] : 0;
+  }
+  return codec->previous[i];
+}
+
+/**
+ * Allocates the code buffers of a codec.
+ *
+ * @param codec Codec to initialize.
+ * @param numChannels Number of channels whose levels are sent.
+ * @param numSpectra Number of spectra sent.
+ * @param numColumns Number of columns of each spectrum.
+ * @param bits Width of each code: 8 or 16.
+ * @return 0 on success, -1 if the width is unsupported or memory could not be allocated.
+ */
+int spectral_codec_init(spectralCodec *codec, int numChannels, int numSpectra, int numColumns, int bits) {
+  memset(codec, 0, sizeof(*codec));
+  if (bits != 8 && bits != 16) {
+    return -1;
+  }
+
+  codec->numChannels = numChannels;
+  codec->numSpectra = numSpectra;
+  codec->numColumns = numColumns;
+  codec->bits = bits;
+  codec->numValues = numChannels * SPECTRAL_LEVELS + numSpectra * numColumns;
+  codec->current = (uint16_t *) calloc((size_t) codec->numValues, sizeof(uint16_t));
+  codec->previous = (uint16_t *) calloc((size_t) codec->numValues, sizeof(uint16_t));
+  if (codec->current == NULL || codec->previous == NULL) {
+    spectral_codec_free(codec);
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Frees the code buffers of a codec.
+ *
+ * @param codec Codec to free.
+ */
+void spectral_codec_free(spectralCodec *codec) {
+  free(codec->current);
+  free(codec->previous);
+  memset(codec, 0, sizeof(*codec));
+}
+
+/**
+ * Largest payload spectral_encode can produce for the given codec.
+ *
+ * @param codec Initialized codec.
+ * @return Size in bytes.
+ */
+size_t spectral_max_payload(const spectralCodec *codec) {
+  // A changed value takes at most 3 varint bytes; a run of unchanged values never takes more.
+  return SPECTRAL_PREAMBLE_SIZE + 3 * (size_t) codec->numValues;
+}
+
+/**
+ * Quantizes the levels and column amplitudes of one frame into codec->current.
+ *
+ * @param codec Initialized codec.
+ * @param levels numChannels levels.
+ * @param columns numSpectra * numColumns column amplitudes on the frequency view's 0..1 scale
+ *        (SPECTRO_DB_FLOOR to 0 dBFS).
+ */
+void spectral_quantize(spectralCodec *codec, const channelLevels *levels, const float *columns) {
+  uint16_t *code = codec->current;
+
+  for (int c = 0; c < codec->numChannels; c++) {
+    *code++ = quantize_amplitude(codec->bits, levels[c].peak);
+    *code++ = quantize_amplitude(codec->bits, levels[c].rms);
+    *code++ = quantize_signed_amplitude(codec->bits, levels[c].dc);
+    *code++ = quantize_amplitude(codec->bits, levels[c].truePeak);
+  }
+
+  int numColumnValues = codec->numSpectra * codec->numColumns;
+  for (int i = 0; i < numColumnValues; i++) {
+    *code++ = quantize_db(codec->bits, (1.0 - columns[i]) * SPECTRO_DB_FLOOR);
+  }
+}
+
+/**
+ * Encodes codec->current as a keyframe or as a delta to codec->previous. Does not change the
+ * codec, so that both kinds can be encoded from the same frame before spectral_commit.
+ *
+ * @param codec Codec holding a quantized frame.
+ * @param keyframe Set to encode every code on its own; otherwise codec->havePrevious must be set.
+ * @param out Output buffer of at least spectral_max_payload bytes.
+ * @return Number of bytes written.
+ */
+size_t spectral_encode(const spectralCodec *codec, int keyframe, unsigned char *out) {
+  out[0] = (unsigned char) (codec->numSpectra >> 8);
+  out[1] = (unsigned char) codec->numSpectra;
+  out[2] = (unsigned char) (codec->numColumns >> 8);
+  out[3] = (unsigned char) codec->numColumns;
+  out[4] = (unsigned char) codec->bits;
+  out[5] = SPECTRAL_LEVELS;
+  out[6] = 0;
+  out[7] = 0;
+
+  unsigned char *p = out + SPECTRAL_PREAMBLE_SIZE;
+  int i = 0;
+  while (i < codec->numValues) {
+    int delta = codec->current[i] - reference_code(codec, keyframe, i);
+    if (delta != 0) {
+      p = put_varint(p, delta > 0 ? (uint32_t) delta << 1 : ((uint32_t) -delta << 1) - 1);
+      i++;
+      continue;
+    }
+
+    int run = 1;
+    while (i + run < codec->numValues &&
+           codec->current[i + run] == reference_code(codec, keyframe, i + run)) {
+      run++;
+    }
+    p = put_varint(p, 0);
+    p = put_varint(p, (uint32_t) run - 1);
+    i += run;
+  }
+
+  return (size_t) (p - out);
+}
+
+/**
+ * Makes codec->current the reference of the next delta.
+ *
+ * @param codec Codec holding an encoded or decoded frame.
+ */
+void spectral_commit(spectralCodec *codec) {
+  uint16_t *swap = codec->previous;
+  codec->previous = codec->current;
+  codec->current = swap;
+  codec->havePrevious = 1;
+}
+
+/**
+ * Decodes a spectral payload into codec->current and commits it. A keyframe whose shape differs
+ * from the codec's reinitializes the codec.
+ *
+ * @param codec Codec to decode with; may be zero-initialized before the first keyframe.
+ * @param numChannels Channel count from the frame header.
+ * @param keyframe Set if the frame header carries STREAM_FLAG_KEYFRAME.
+ * @param in Payload of the frame.
+ * @param length Number of payload bytes.
+ * @return 0 on success, -1 if the payload is malformed or a delta arrives without a reference.
+ */
+int spectral_decode(spectralCodec *codec, int numChannels, int keyframe, const unsigned char *in, size_t length) {
+  if (length < SPECTRAL_PREAMBLE_SIZE || in[5] != SPECTRAL_LEVELS) {
+    return -1;
+  }
+  int numSpectra = in[0] << 8 | in[1];
+  int numColumns = in[2] << 8 | in[3];
+  int bits = in[4];
+
+  int sameShape = codec->current != NULL && codec->numChannels == numChannels &&
+                  codec->numSpectra == numSpectra && codec->numColumns == numColumns && codec->bits == bits;
+  if (!sameShape) {
+    if (!keyframe) {
+      return -1;
+    }
+    spectral_codec_free(codec);
+    if (spectral_codec_init(codec, numChannels, numSpectra, numColumns, bits) != 0) {
+      return -1;
+    }
+  }
+  if (!keyframe && !codec->havePrevious) {
+    return -1;
+  }
+
+  const unsigned char *p = in + SPECTRAL_PREAMBLE_SIZE;
+  const unsigned char *end = in + length;
+  int maxCode = bits == 8 ? 255 : 65535;
+  int i = 0;
+  while (i < codec->numValues) {
+    uint32_t value;
+    if (get_varint(&p, end, &value) != 0) {
+      return -1;
+    }
+
+    if (value != 0) {
+      int delta = (value & 1) ? -(int) ((value + 1) >> 1) : (int) (value >> 1);
+      int code = reference_code(codec, keyframe, i) + delta;
+      if (code < 0 || code > maxCode) {
+        return -1;
+      }
+      codec->current[i++] = (uint16_t) code;
+      continue;
+    }
+
+    uint32_t run;
+    if (get_varint(&p, end, &run) != 0 || run >= (uint32_t) (codec->numValues - i)) {
+      return -1;
+    }
+    for (uint32_t r = 0; r <= run; r++, i++) {
+      codec->current[i] = (uint16_t) reference_code(codec, keyframe, i);
+    }
+  }
+  if (p != end) {
+    return -1;
+  }
+
+  spectral_commit(codec);
+  return 0;
+}
+
+/**
+ * Converts the codes of the last decoded frame back to levels and column amplitudes.
+ *
+ * @param codec Codec holding a decoded frame.
+ * @param levels Output array of numChannels levels; NULL to skip.
+ * @param columns Output array of numSpectra * numColumns amplitudes on the 0..1 scale; NULL to skip.
+ */
+void spectral_dequantize(const spectralCodec *codec, channelLevels *levels, double *columns) {
+  const uint16_t *code = codec->previous;
+
+  for (int c = 0; c < codec->numChannels; c++, code += SPECTRAL_LEVELS) {
+    if (levels != NULL) {
+      levels[c].peak = dequantize_amplitude(codec->bits, code[0]);
+      levels[c].rms = dequantize_amplitude(codec->bits, code[1]);
+      levels[c].dc = dequantize_signed_amplitude(codec->bits, code[2]);
+      levels[c].truePeak = dequantize_amplitude(codec->bits, code[3]);
+    }
+  }
+
+  if (columns != NULL) {
+    int numColumnValues = codec->numSpectra * codec->numColumns;
+    for (int i = 0; i < numColumnValues; i++) {
+      double level = spectral_code_db(codec->bits, code[i]);
+      columns[i] = fmax(0.0, fmin(1.0, 1.0 - level / SPECTRO_DB_FLOOR));
+    }
+  }
+}
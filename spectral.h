@@ -0,0 +1,139 @@
+//
+// Quantized, delta-encoded spectral frames streamed instead of raw samples.
+//
+
+#ifndef SPECTRAL_H
+#define SPECTRAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "meter.h"
+
+/// Default number of spectral frames per second
+#define SPECTRAL_DEFAULT_RATE 30
+
+/// Levels sent per channel (peak, RMS, signed DC offset and true-peak), in the order of offline records
+#define SPECTRAL_LEVELS 4
+
+/// Level in dB of quantization code 0; anything quieter, including silence, is sent as code 0
+#define SPECTRAL_DB_MIN (-120.0)
+
+/// Size in bytes of the shape description preceding the encoded values of a spectral payload
+#define SPECTRAL_PREAMBLE_SIZE 8
+
+/**
+ * Quantization state of a stream of spectral frames. Every value (the levels of each channel,
+ * then the columns of each spectrum) is sent as a code of `bits` bits on a dB scale starting at
+ * SPECTRAL_DB_MIN: 0.5 dB steps with 8 bits, 1/256 dB steps with 16 bits. The DC offset keeps its
+ * sign in the lowest bit of its code, so its magnitude has twice the step. Frames other than
+ * keyframes only carry the difference of each code to the previous frame, zigzag- and
+ * varint-encoded with runs of unchanged values collapsed, so a steady spectrum costs a few bytes.
+ *
+ * The encoder and the decoder each keep the codes of the last frame in `previous`.
+ */
+typedef struct {
+  int numChannels;
+  int numSpectra;
+  int numColumns;
+
+  /// Width of each code: 8 or 16.
+  int bits;
+
+  /// numChannels * SPECTRAL_LEVELS + numSpectra * numColumns.
+  int numValues;
+
+  /// Codes of the frame being encoded or decoded, and of the frame before it.
+  uint16_t *current;
+  uint16_t *previous;
+
+  /// Set once `previous` holds a frame, i.e. deltas can be encoded or applied.
+  int havePrevious;
+} spectralCodec;
+
+/**
+ * Allocates the code buffers of a codec.
+ *
+ * @param codec Codec to initialize.
+ * @param numChannels Number of channels whose levels are sent.
+ * @param numSpectra Number of spectra sent.
+ * @param numColumns Number of columns of each spectrum.
+ * @param bits Width of each code: 8 or 16.
+ * @return 0 on success, -1 if the width is unsupported or memory could not be allocated.
+ */
+int spectral_codec_init(spectralCodec *codec, int numChannels, int numSpectra, int numColumns, int bits);
+
+/**
+ * Frees the code buffers of a codec.
+ *
+ * @param codec Codec to free.
+ */
+void spectral_codec_free(spectralCodec *codec);
+
+/**
+ * Largest payload spectral_encode can produce for the given codec.
+ *
+ * @param codec Initialized codec.
+ * @return Size in bytes.
+ */
+size_t spectral_max_payload(const spectralCodec *codec);
+
+/**
+ * Quantizes the levels and column amplitudes of one frame into codec->current.
+ *
+ * @param codec Initialized codec.
+ * @param levels numChannels levels.
+ * @param columns numSpectra * numColumns column amplitudes on the frequency view's 0..1 scale
+ *        (SPECTRO_DB_FLOOR to 0 dBFS).
+ */
+void spectral_quantize(spectralCodec *codec, const channelLevels *levels, const float *columns);
+
+/**
+ * Encodes codec->current as a keyframe or as a delta to codec->previous. Does not change the
+ * codec, so that both kinds can be encoded from the same frame before spectral_commit.
+ *
+ * @param codec Codec holding a quantized frame.
+ * @param keyframe Set to encode every code on its own; otherwise codec->havePrevious must be set.
+ * @param out Output buffer of at least spectral_max_payload bytes.
+ * @return Number of bytes written.
+ */
+size_t spectral_encode(const spectralCodec *codec, int keyframe, unsigned char *out);
+
+/**
+ * Makes codec->current the reference of the next delta.
+ *
+ * @param codec Codec holding an encoded or decoded frame.
+ */
+void spectral_commit(spectralCodec *codec);
+
+/**
+ * Decodes a spectral payload into codec->current and commits it. A keyframe whose shape differs
+ * from the codec's reinitializes the codec.
+ *
+ * @param codec Codec to decode with; may be zero-initialized before the first keyframe.
+ * @param numChannels Channel count from the frame header.
+ * @param keyframe Set if the frame header carries STREAM_FLAG_KEYFRAME.
+ * @param in Payload of the frame.
+ * @param length Number of payload bytes.
+ * @return 0 on success, -1 if the payload is malformed or a delta arrives without a reference.
+ */
+int spectral_decode(spectralCodec *codec, int numChannels, int keyframe, const unsigned char *in, size_t length);
+
+/**
+ * Converts the codes of the last decoded frame back to levels and column amplitudes.
+ *
+ * @param codec Codec holding a decoded frame.
+ * @param levels Output array of numChannels levels; NULL to skip.
+ * @param columns Output array of numSpectra * numColumns amplitudes on the 0..1 scale; NULL to skip.
+ */
+void spectral_dequantize(const spectralCodec *codec, channelLevels *levels, double *columns);
+
+/**
+ * Level in dB that a code stands for.
+ *
+ * @param bits Width of the code: 8 or 16.
+ * @param code Code to convert.
+ * @return Level in dB.
+ */
+double spectral_code_db(int bits, uint16_t code);
+
+#endif //SPECTRAL_H
@@ -0,0 +1,218 @@
+//
+// Short-time Fourier transform with overlap and windowing.
+//
+
+#include "stft.h"
+#include "arena.h"
+#include "wisdom.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static int is_power_of_two(int value) {
+  return value > 0 && (value & (value - 1)) == 0;
+}
+
+/**
+ * Parses a window name ("hann", "blackman-harris" or "flat-top").
+ *
+ * @param name Name of the window.
+ * @param type Set to the parsed window type.
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int parse_window_type(const char *name, enum WindowType *type) {
+  if (strcmp(name, "hann") == 0) {
+    *type = WindowHann;
+  } else if (strcmp(name, "blackman-harris") == 0) {
+    *type = WindowBlackmanHarris;
+  } else if (strcmp(name, "flat-top") == 0) {
+    *type = WindowFlatTop;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Fills the periodic window of the given type and scales it by 2 / sum(window), so the
+ * power of a full-scale sine centred on a bin is 1.
+ */
+static void build_window(double *window, int size, enum WindowType windowType) {
+  // Cosine-sum coefficients a0 - a1 cos(x) + a2 cos(2x) - a3 cos(3x) + a4 cos(4x).
+  static const double COEFFICIENTS[][5] = {
+      {0.5, 0.5, 0.0, 0.0, 0.0},
+      {0.35875, 0.48829, 0.14128, 0.01168, 0.0},
+      {0.21557895, 0.41663158, 0.277263158, 0.083578947, 0.006947368},
+  };
+  const double *a = COEFFICIENTS[windowType];
+
+  double sum = 0.0;
+  for (int n = 0; n < size; n++) {
+    double x = 2.0 * M_PI * n / size;
+    window[n] = a[0] - a[1] * cos(x) + a[2] * cos(2 * x) - a[3] * cos(3 * x) + a[4] * cos(4 * x);
+    sum += window[n];
+  }
+
+  for (int n = 0; n < size; n++) {
+    window[n] *= 2.0 / sum;
+  }
+}
+
+/**
+ * Allocates the buffers, precomputes the window and plans the batched transform
+ * (from the wisdom cache when possible, see plan_r2hc_batch).
+ *
+ * @param stft Engine to initialize.
+ * @param numRows Number of rows (channels) analysed together.
+ * @param fftSize Frame size; must be a power of two between STFT_MIN_SIZE and STFT_MAX_SIZE.
+ * @param hopSize Hop between frames; must be a power of two no larger than fftSize.
+ * @param windowType Window applied to every frame.
+ * @return 0 on success, -1 if the sizes are invalid or memory could not be allocated.
+ */
+int stft_init(stftEngine *stft, int numRows, int fftSize, int hopSize, enum WindowType windowType) {
+  memset(stft, 0, sizeof(*stft));
+  if (!is_power_of_two(fftSize) || fftSize < STFT_MIN_SIZE || fftSize > STFT_MAX_SIZE ||
+      !is_power_of_two(hopSize) || hopSize > fftSize || numRows < 1) {
+    return -1;
+  }
+
+  size_t samples = (size_t) numRows * fftSize;
+  stft->fftSize = fftSize;
+  stft->hopSize = hopSize;
+  stft->numRows = numRows;
+  stft->numBins = fftSize / 2 + 1;
+  stft->window = (double *) session_alloc(sizeof(double) * fftSize);
+  stft->history = (double *) session_alloc(sizeof(double) * samples);
+  stft->in = (double *) session_alloc(sizeof(double) * samples);
+  stft->out = (double *) session_alloc(sizeof(double) * samples);
+  stft->power = (double *) session_alloc(sizeof(double) * numRows * stft->numBins);
+  if (stft->window == NULL || stft->history == NULL || stft->in == NULL ||
+      stft->out == NULL || stft->power == NULL) {
+    stft_free(stft);
+    return -1;
+  }
+
+  build_window(stft->window, fftSize, windowType);
+
+  stft->plan = plan_r2hc_batch(fftSize, numRows, stft->in, stft->out);
+  if (stft->plan == NULL) {
+    stft_free(stft);
+    return -1;
+  }
+
+  stft_reset(stft);
+  return 0;
+}
+
+/**
+ * Frees the buffers and the plan of the engine.
+ *
+ * @param stft Engine to free.
+ */
+void stft_free(stftEngine *stft) {
+  if (stft->plan != NULL) {
+    fftw_destroy_plan(stft->plan);
+  }
+  session_free(stft->window);
+  session_free(stft->history);
+  session_free(stft->in);
+  session_free(stft->out);
+  session_free(stft->power);
+  memset(stft, 0, sizeof(*stft));
+}
+
+/**
+ * Clears the sample history as if the engine had just been created.
+ * The history is primed with fftSize - hopSize zeros, so the first frame is computed after hopSize samples.
+ *
+ * @param stft Engine to reset.
+ */
+void stft_reset(stftEngine *stft) {
+  size_t samples = (size_t) stft->numRows * stft->fftSize;
+  memset(stft->history, 0, sizeof(double) * samples);
+  memset(stft->power, 0, sizeof(double) * stft->numRows * stft->numBins);
+  stft->fill = stft->fftSize - stft->hopSize;
+  stft->framesComputed = 0;
+}
+
+/**
+ * Windows the full history of every row, transforms it and converts it to power spectra.
+ */
+static void compute_frame(stftEngine *stft) {
+  const int n = stft->fftSize;
+  const double *window = stft->window;
+
+  for (int row = 0; row < stft->numRows; row++) {
+    const double *history = stft->history + (size_t) row * n;
+    double *in = stft->in + (size_t) row * n;
+    for (int i = 0; i < n; i++) {
+      in[i] = history[i] * window[i];
+    }
+  }
+
+  fftw_execute(stft->plan);
+
+  // Half-complex layout: r0, r1, ..., r(n/2), i(n/2 - 1), ..., i1. The imaginary parts run
+  // backwards, so they are read through a reversed pointer to keep the loop vectorizable.
+  for (int row = 0; row < stft->numRows; row++) {
+    const double *restrict re = stft->out + (size_t) row * n;
+    const double *restrict imReversed = re + n;
+    double *restrict power = stft->power + (size_t) row * stft->numBins;
+
+    power[0] = 0.25 * re[0] * re[0];
+    for (int k = 1; k < n / 2; k++) {
+      power[k] = re[k] * re[k] + imReversed[-k] * imReversed[-k];
+    }
+    power[n / 2] = 0.25 * re[n / 2] * re[n / 2];
+  }
+
+  stft->framesComputed++;
+}
+
+/**
+ * Appends samples to every row and computes a frame every hopSize samples.
+ *
+ * @param stft Engine to push into.
+ * @param rows Samples of every row; row r starts at rows[r * rowStride].
+ * @param rowStride Distance between the starts of consecutive rows.
+ * @param frames Number of samples to append to each row.
+ * @return Number of frames computed; power holds the latest one.
+ */
+int stft_push(stftEngine *stft, const double *rows, int rowStride, int frames) {
+  const int n = stft->fftSize;
+  int computed = 0;
+  int consumed = 0;
+
+  while (consumed < frames) {
+    int count = n - stft->fill;
+    if (count > frames - consumed) {
+      count = frames - consumed;
+    }
+
+    for (int row = 0; row < stft->numRows; row++) {
+      memcpy(stft->history + (size_t) row * n + stft->fill,
+             rows + (size_t) row * rowStride + consumed,
+             sizeof(double) * count);
+    }
+    stft->fill += count;
+    consumed += count;
+
+    if (stft->fill == n) {
+      compute_frame(stft);
+      computed++;
+
+      // Keep the newest fftSize - hopSize samples as the start of the next frame.
+      for (int row = 0; row < stft->numRows; row++) {
+        double *history = stft->history + (size_t) row * n;
+        memmove(history, history + stft->hopSize, sizeof(double) * (n - stft->hopSize));
+      }
+      stft->fill = n - stft->hopSize;
+    }
+  }
+
+  return computed;
+}
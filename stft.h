@@ -0,0 +1,118 @@
+//
+// Short-time Fourier transform with overlap and windowing.
+//
+
+#ifndef STFT_H
+#define STFT_H
+
+#include <fftw3.h>
+
+/// Smallest and largest supported FFT sizes (both powers of two)
+#define STFT_MIN_SIZE 64
+#define STFT_MAX_SIZE 65536
+
+/// Default FFT size and hop: ~10.8 Hz bins at 44.1 kHz with 75% overlap
+#define STFT_DEFAULT_SIZE 4096
+#define STFT_DEFAULT_HOP 1024
+
+/**
+ * Window applied to every frame before the transform.
+ */
+enum WindowType {
+  WindowHann,
+  WindowBlackmanHarris,
+  WindowFlatTop
+};
+
+/**
+ * Batched STFT over several rows (channels) that share the frame size, hop and window.
+ * Frames are assembled from consecutive pushes of any length, so the FFT size is independent
+ * of the audio buffer size; one batched FFT runs per hop.
+ */
+typedef struct {
+
+  /// Number of samples in each analysed frame; a power of two.
+  int fftSize;
+
+  /// Number of new samples between consecutive frames; a power of two no larger than fftSize.
+  int hopSize;
+
+  /// Number of rows analysed together.
+  int numRows;
+
+  /// Number of frequency bins per row (fftSize / 2 + 1).
+  int numBins;
+
+  /// Window of fftSize samples, pre-scaled so a full-scale sine peaks at a power of 1.
+  double *window;
+
+  /// Per-row buffer of the last fftSize samples; row r starts at history[r * fftSize].
+  double *history;
+
+  /// Number of valid samples at the start of each history row.
+  int fill;
+
+  /// Windowed frames and their half-complex transforms, numRows * fftSize each.
+  double *in;
+  double *out;
+
+  /// Batched plan transforming all rows of in into out.
+  fftw_plan plan;
+
+  /// Power spectra (squared magnitudes) of the latest frame, numRows * numBins; row r starts
+  /// at power[r * numBins].
+  double *power;
+
+  /// Number of frames computed since the engine was created or reset.
+  unsigned long framesComputed;
+} stftEngine;
+
+/**
+ * Parses a window name ("hann", "blackman-harris" or "flat-top").
+ *
+ * @param name Name of the window.
+ * @param type Set to the parsed window type.
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int parse_window_type(const char *name, enum WindowType *type);
+
+/**
+ * Allocates the buffers, precomputes the window and plans the batched transform
+ * (from the wisdom cache when possible, see plan_r2hc_batch).
+ *
+ * @param stft Engine to initialize.
+ * @param numRows Number of rows (channels) analysed together.
+ * @param fftSize Frame size; must be a power of two between STFT_MIN_SIZE and STFT_MAX_SIZE.
+ * @param hopSize Hop between frames; must be a power of two no larger than fftSize.
+ * @param windowType Window applied to every frame.
+ * @return 0 on success, -1 if the sizes are invalid or memory could not be allocated.
+ */
+int stft_init(stftEngine *stft, int numRows, int fftSize, int hopSize, enum WindowType windowType);
+
+/**
+ * Frees the buffers and the plan of the engine.
+ *
+ * @param stft Engine to free.
+ */
+void stft_free(stftEngine *stft);
+
+/**
+ * Clears the sample history as if the engine had just been created.
+ * The history is primed with fftSize - hopSize zeros, so the first frame is computed after hopSize samples.
+ *
+ * @param stft Engine to reset.
+ */
+void stft_reset(stftEngine *stft);
+
+/**
+ * Appends samples to every row and computes a frame every hopSize samples.
+ *
+ * @param stft Engine to push into.
+ * @param rows Samples of every row; row r starts at rows[r * rowStride].
+ * @param rowStride Distance between the starts of consecutive rows.
+ * @param frames Number of samples to append to each row.
+ * @return Number of frames computed; power holds the latest one.
+ */
+int stft_push(stftEngine *stft, const double *rows, int rowStride, int frames);
+
+#endif //STFT_H
@@ -4,42 +4,64 @@
 #include "frequencies.h"
 #include <fftw3.h>
 #include <ctype.h>
+#include <signal.h>
 #include <string.h>
 #include "dispatch.h"
+#include "stream.h"
 
 /**
- * Processes a single buffer and displays its visual representation on the screen.
+ * Queues a single buffer for analysis and passes the input through to the output.
+ * Runs on the real-time audio thread, so it must not draw, lock or allocate;
+ * analysis and drawing happen on the render thread (see dispatch.h).
  *
  * @param inputBuffer Input buffer in the current callback.
- * @param outputBuffer Output buffer in the current callback. (not used)
+ * @param outputBuffer Output buffer in the current callback; receives a copy of the input.
  * @param framesPerBuffer Number of frames in the buffer.
- * @param timeInfo Timestamps indicating capture and output times. (not used)
- * @param statusFlags Flags for input and output buffers. (not used)
- * @param userData Callback data used for FFT computations.
- * @return 0 if the data was successfully displayed.
+ * @param timeInfo Timestamps indicating capture and output times; used for latency statistics.
+ * @param statusFlags Flags for input and output buffers; overflows and underflows are counted.
+ * @param userData Session of the device the buffer was captured from.
+ * @return 0 to keep the stream running.
  */
 static int streamCallBack(
     const void *inputBuffer, void *outputBuffer, unsigned long framesPerBuffer,
     const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags,
     void *userData
 ) {
-  (void) timeInfo;
-  (void) statusFlags;
+  uint64_t startNs = callback_clock_ns();
+  audio_path_enter();
+  inputSession *session = (inputSession *) userData;
+  int numInputChannels = session->dispatch.numChannels;
 
-  float *in = (float *) inputBuffer;
+  const float *in = (const float *) inputBuffer;
   float *out = (float *) outputBuffer;
 
-  streamCallBackVolume(inputBuffer, outputBuffer, framesPerBuffer, num_input_channels, num_output_channels);
+  dispatch_block(&session->dispatch, in, framesPerBuffer);
 
-  streamCallBackFrequencies(inputBuffer, outputBuffer, framesPerBuffer, userData);
-
-  update_global_buffer(in, out);
+  if (out != NULL) {
+    for (unsigned long i = 0; i < framesPerBuffer; i++) {
+      for (int channelNum = 0; channelNum < session->numOutputChannels; channelNum++) {
+        *out++ = in == NULL ? 0.0f : in[i * numInputChannels + channelNum % numInputChannels];
+      }
+    }
+  }
 
-  refresh_screen();
+  record_callback(&session->dispatch.stats, startNs, timeInfo, statusFlags);
 
+  audio_path_leave();
   return 0;
 }
 
+/**
+ * Returns the number of channels captured from the given input device.
+ *
+ * @param inputDeviceSelection Index of the input device.
+ * @return Number of input channels, at most MAX_INPUT_CHANNELS.
+ */
+int stream_input_channels(int inputDeviceSelection) {
+  int channels = Pa_GetDeviceInfo(inputDeviceSelection)->maxInputChannels;
+  return channels > MAX_INPUT_CHANNELS ? MAX_INPUT_CHANNELS : channels;
+}
+
 /**
  * Initializes a PulseAudio stream.
  */
@@ -49,84 +71,231 @@ void init_stream() {
 }
 
 /**
- * Closes the stream and cleans up all the allocated memory used during the program runtime.
+ * Closes the streams of every session and cleans up all the allocated memory used during the program runtime.
  *
- * @param stream Stream to be closed.
- * @param currentSpectroData Spectro data used for FFT computations.
+ * @param sessions Sessions to be closed.
+ * @param numSessions Number of sessions.
+ * @param pipeline Dispatch pipeline fed by the sessions.
  */
-void close_stream(PaStream *stream, streamCallbackData *currentSpectroData) {
-  PaError err = Pa_CloseStream(stream);
-  checkErr(err);
+void close_stream(inputSession *sessions, int numSessions, dispatchPipeline *pipeline) {
+  for (int i = 0; i < numSessions; i++) {
+    PaError err = Pa_CloseStream(sessions[i].stream);
+    checkErr(err);
+  }
 
-  err = Pa_Terminate();
+  stop_dispatch(pipeline);
+
+  PaError err = Pa_Terminate();
   checkErr(err);
 
-  fftw_destroy_plan(currentSpectroData->p);
-  fftw_free(currentSpectroData->in);
-  fftw_free(currentSpectroData->out);
-  fftw_free(currentSpectroData);
+  for (int i = 0; i < numSessions; i++) {
+    free_dispatch_stream(&sessions[i].dispatch);
+    free_spectro_data(sessions[i].spectroData);
+  }
 
   del_screen();
 }
 
 /**
- * Runs the stream processing for the selected device from start to finish.
+ * Fills the parameters of a float32 stream of the given device: every input channel the analysis
+ * supports, or every output channel.
+ */
+static void device_parameters(PaStreamParameters *parameters, int device, enum SignalType type) {
+  const PaDeviceInfo *info = Pa_GetDeviceInfo(device);
+  memset(parameters, 0, sizeof(*parameters));
+  parameters->channelCount = type == Input ? stream_input_channels(device) : info->maxOutputChannels;
+  parameters->device = device;
+  parameters->hostApiSpecificStreamInfo = NULL;
+  parameters->sampleFormat = paFloat32;
+  parameters->suggestedLatency = info->defaultLowInputLatency;
+}
+
+/**
+ * Chooses the sample rate of an input device and checks that PortAudio can open the device at it,
+ * together with the output device the input is played through.
  *
- * @param deviceSelection User's device selection.
- * @param currentSpectroData Spectro data used for FFT processing.
- * @param err PulseAudio error code.
+ * @param inputDeviceSelection Index of the input device.
+ * @param outputDeviceSelection Index of the output device, or -1 for none.
+ * @param requestedRate Rate asked for on the command line, or 0 for the input device's default rate.
+ * @return Sample rate in Hz, or -1 if the devices cannot run at it.
  */
-void process_stream(int inputDeviceSelection, int outputDeviceSelection, streamCallbackData *currentSpectroData) {
+double stream_sample_rate(int inputDeviceSelection, int outputDeviceSelection, double requestedRate) {
+  const PaDeviceInfo *info = Pa_GetDeviceInfo(inputDeviceSelection);
+  double sampleRate = requestedRate > 0.0 ? requestedRate : info->defaultSampleRate;
 
   PaStreamParameters inputParameters;
   PaStreamParameters outputParameters;
+  device_parameters(&inputParameters, inputDeviceSelection, Input);
+  if (outputDeviceSelection >= 0) {
+    device_parameters(&outputParameters, outputDeviceSelection, Output);
+  }
+  PaError err = Pa_IsFormatSupported(&inputParameters, outputDeviceSelection >= 0 ? &outputParameters : NULL,
+                                     sampleRate);
+  if (err != paFormatIsSupported) {
+    printf("%s cannot capture at %.0f Hz (%s); its default rate is %.0f Hz.\n", info->name, sampleRate,
+           Pa_GetErrorText(err), info->defaultSampleRate);
+    return -1;
+  }
+  return sampleRate;
+}
 
-  memset(&inputParameters, 0, sizeof(inputParameters));
-  inputParameters.channelCount = Pa_GetDeviceInfo(inputDeviceSelection)->maxInputChannels;
-  inputParameters.device = inputDeviceSelection;
-  inputParameters.hostApiSpecificStreamInfo = NULL;
-  inputParameters.sampleFormat = paFloat32;
-  inputParameters.suggestedLatency = Pa_GetDeviceInfo(inputDeviceSelection)->defaultLowInputLatency;
+/**
+ * Opens the PortAudio stream of a session at the sample rate and buffer size of its spectro data,
+ * with the given output device if it is not negative.
+ */
+static void open_session(inputSession *session, int outputDeviceSelection) {
+  PaStreamParameters inputParameters;
+  PaStreamParameters outputParameters;
 
+  device_parameters(&inputParameters, session->device, Input);
+  session->numOutputChannels = 0;
   if (outputDeviceSelection >= 0) {
-    memset(&outputParameters, 0, sizeof(outputParameters));
-    outputParameters.channelCount = Pa_GetDeviceInfo(outputDeviceSelection)->maxOutputChannels;
-    outputParameters.device = outputDeviceSelection;
-    outputParameters.hostApiSpecificStreamInfo = NULL;
-    outputParameters.sampleFormat = paFloat32;
-    outputParameters.suggestedLatency = Pa_GetDeviceInfo(outputDeviceSelection)->defaultLowInputLatency;
-    num_output_channels = outputParameters.channelCount;
+    device_parameters(&outputParameters, outputDeviceSelection, Output);
+    session->numOutputChannels = outputParameters.channelCount;
   }
 
-  num_input_channels = inputParameters.channelCount;
-  init_screen(num_input_channels);
-
-  PaStream *stream;
   PaError err = Pa_OpenStream(
-      &stream,
+      &session->stream,
       &inputParameters,
       outputDeviceSelection >= 0 ? &outputParameters : NULL,
-      SAMPLE_RATE,
-      FRAMES_PER_BUFFER,
+      session->spectroData->options.sampleRate,
+      (unsigned long) session->spectroData->options.framesPerBuffer,
       paNoFlag,
       streamCallBack,
-      currentSpectroData
+      session
   );
   checkErr(err);
+}
 
-  err = Pa_StartStream(stream);
-  checkErr(err);
+/**
+ * Blocks SIGINT and SIGTERM in the calling thread and the threads it starts afterwards, so that
+ * wait_for_signal receives them instead of the process being killed.
+ */
+static void block_stop_signals(sigset_t *signals) {
+  sigemptyset(signals);
+  sigaddset(signals, SIGINT);
+  sigaddset(signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, signals, NULL);
+}
 
-  unsigned char input = '\0';
-  while (input != ' ' && input != 'r') {
-    input = tolower(getch());
+/**
+ * Waits for one of the signals blocked by block_stop_signals.
+ */
+static void wait_for_signal(const sigset_t *signals) {
+  int received;
+  while (sigwait(signals, &received) != 0) {
+  }
+}
+
+/**
+ * Runs the stream processing for the selected devices from start to finish. Every input device
+ * gets its own PortAudio stream, callback statistics and analysis; all of them are analysed on
+ * one render thread, which shows one device at a time ('d' switches) and a line of statistics
+ * per device. The output device, if any, plays the first input device through. 'r' restarts the
+ * analysis of every device and '+' and '-' change the FFT size of the displayed one, both without
+ * stopping the streams (see restart_dispatch_stream). A headless exporter replaces the screen and
+ * the keys: the session exports its statistics until SIGINT or SIGTERM.
+ *
+ * @param inputDeviceSelections User's input device selections.
+ * @param numInputs Number of input devices, at most MAX_INPUT_DEVICES.
+ * @param outputDeviceSelection User's output device selection, or -1 for none.
+ * @param spectroData Spectro data used for FFT processing of each input device.
+ * @param arena Open arena the session's buffers are carved from, sealed once the streams are set up; or NULL.
+ * @param exporter Open exporter of the statistics of every device, or NULL.
+ */
+void process_stream(const int *inputDeviceSelections, int numInputs, int outputDeviceSelection,
+                    streamCallbackData **spectroData, sessionArena *arena, metricsExporter *exporter) {
+  inputSession sessions[MAX_INPUT_DEVICES];
+  dispatchStream *streams[MAX_INPUT_DEVICES];
+
+  int maxChannels = 0;
+  for (int i = 0; i < numInputs; i++) {
+    int channels = stream_input_channels(inputDeviceSelections[i]);
+    maxChannels = channels > maxChannels ? channels : maxChannels;
+  }
+  int headless = exporter != NULL && exporter->options.headless;
+  sigset_t stopSignals;
+  if (headless) {
+    block_stop_signals(&stopSignals);
+  } else {
+    set_stats_extra_rows(numInputs > 1 ? numInputs + 1 : 0);
+    init_screen(maxChannels);
+  }
+  set_dispatch_metrics(exporter != NULL);
+
+  for (int i = 0; i < numInputs; i++) {
+    sessions[i].device = inputDeviceSelections[i];
+    sessions[i].spectroData = spectroData[i];
+    init_dispatch_stream(&sessions[i].dispatch, stream_input_channels(inputDeviceSelections[i]), spectroData[i],
+                         Pa_GetDeviceInfo(inputDeviceSelections[i])->name);
+  }
+
+  for (int i = 0; i < numInputs; i++) {
+    streams[i] = &sessions[i].dispatch;
+  }
+  if (arena != NULL) {
+    arena_seal(arena);
+  }
+  dispatchPipeline pipeline;
+  start_dispatch(&pipeline, streams, numInputs);
+  if (exporter != NULL && start_exporter(exporter, streams, numInputs) != 0) {
+    endwin();
+    printf("Could not start the metrics exporter.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (int i = 0; i < numInputs; i++) {
+    open_session(&sessions[i], i == 0 ? outputDeviceSelection : -1);
+  }
+  for (int i = 0; i < numInputs; i++) {
+    PaError err = Pa_StartStream(sessions[i].stream);
+    checkErr(err);
+  }
+
+  if (headless) {
+    wait_for_signal(&stopSignals);
+  }
+  unsigned char input = headless ? ' ' : '\0';
+  while (input != ' ') {
+    input = tolower(wait_for_key(&pipeline));
+    streamCallbackData *displayedData = (streamCallbackData *) displayed_stream(&pipeline)->spectroData;
+    if (input == 'c') {
+      int next = (atomic_load(&displayedData->displayedSpectrum) + 1) % displayedData->numSpectra;
+      atomic_store(&displayedData->displayedSpectrum, next);
+    }
+    if (input == 'd') {
+      show_next_stream(&pipeline);
+    }
+    if (input == '[' || input == ']') {
+      waterfall_scroll(&displayed_stream(&pipeline)->waterfall,
+                       input == '[' ? WATERFALL_SCROLL_ROWS : -WATERFALL_SCROLL_ROWS);
+    }
     if (input == 'r') {
-      close_stream(stream, currentSpectroData);
-      init_stream();
-      currentSpectroData = init_spectro_data();
-      return process_stream(inputDeviceSelection, outputDeviceSelection, currentSpectroData);
+      for (int i = 0; i < numInputs; i++) {
+        restart_dispatch_stream(&sessions[i].dispatch, NULL);
+      }
+    }
+    if (input == '+' || input == '-') {
+      dispatchStream *stream = displayed_stream(&pipeline);
+      spectroOptions options;
+      dispatch_stream_options(stream, &options);
+      int grow = input == '+';
+      if (grow ? options.fftSize < STFT_MAX_SIZE : options.fftSize > STFT_MIN_SIZE) {
+        // The hop scales along, so the frames keep overlapping by the same share.
+        options.fftSize = grow ? options.fftSize * 2 : options.fftSize / 2;
+        options.hopSize = grow ? options.hopSize * 2 : (options.hopSize > 1 ? options.hopSize / 2 : 1);
+        restart_dispatch_stream(stream, &options);
+      }
     }
   }
 
-  close_stream(stream, currentSpectroData);
-}
\ No newline at end of file
+  if (exporter != NULL) {
+    stop_exporter(exporter);
+  }
+  close_stream(sessions, numInputs, &pipeline);
+  endwin();
+  for (int i = 0; i < numInputs; i++) {
+    // Headless sessions may be writing JSON lines to stdout.
+    print_stream_stats(&sessions[i].dispatch, headless ? stderr : stdout);
+  }
+}
@@ -1,21 +1,55 @@
+#ifndef STREAM_H
+#define STREAM_H
+
 #include <portaudio.h>
+#include "frequencies.h"
+#include "dispatch.h"
+#include "arena.h"
+#include "exporter.h"
+
+/// Largest number of input devices captured at once
+#define MAX_INPUT_DEVICES DISPATCH_MAX_STREAMS
 
 /**
- * Processes a single buffer and displays its visual representation on the screen.
+ * State of one captured input device: its PortAudio stream and the dispatch stream its callback
+ * queues into. Every device has its own channel counts, statistics and analysis.
+ */
+typedef struct {
+
+  /// Index of the input device.
+  int device;
+
+  /// PortAudio stream capturing the device.
+  PaStream *stream;
+
+  /// Number of output channels the callback copies the input to; 0 without an output device.
+  int numOutputChannels;
+
+  /// Spectro data used for FFT computations of the device's blocks.
+  streamCallbackData *spectroData;
+
+  /// Ring, statistics and analysis of the device's blocks.
+  dispatchStream dispatch;
+} inputSession;
+
+/**
+ * Returns the number of channels captured from the given input device.
  *
- * @param inputBuffer Input buffer in the current callback.
- * @param outputBuffer Output buffer in the current callback. (not used)
- * @param framesPerBuffer Number of frames in the buffer.
- * @param timeInfo Timestamps indicating capture and output times. (not used)
- * @param statusFlags Flags for input and output buffers. (not used)
- * @param userData Callback data used for FFT computations.
- * @return 0 if the data was successfully displayed.
+ * @param inputDeviceSelection Index of the input device.
+ * @return Number of input channels, at most MAX_INPUT_CHANNELS.
  */
-static int streamCallBack(
-    const void *inputBuffer, void *outputBuffer, unsigned long framesPerBuffer,
-    const PaStreamCallbackTimeInfo *timeInfo, PaStreamCallbackFlags statusFlags,
-    void *userData
-);
+int stream_input_channels(int inputDeviceSelection);
+
+/**
+ * Chooses the sample rate of an input device and checks that PortAudio can open the device at it,
+ * together with the output device the input is played through.
+ *
+ * @param inputDeviceSelection Index of the input device.
+ * @param outputDeviceSelection Index of the output device, or -1 for none.
+ * @param requestedRate Rate asked for on the command line, or 0 for the input device's default rate.
+ * @return Sample rate in Hz, or -1 if the devices cannot run at it.
+ */
+double stream_sample_rate(int inputDeviceSelection, int outputDeviceSelection, double requestedRate);
 
 /**
  * Initializes a PulseAudio stream.
@@ -23,17 +57,31 @@ static int streamCallBack(
 void init_stream();
 
 /**
- * Closes the stream and cleans up all the allocated memory used during the program runtime.
+ * Closes the streams of every session and cleans up all the allocated memory used during the program runtime.
  *
- * @param stream Stream to be closed.
- * @param currentSpectroData Spectro data used for FFT computations.
+ * @param sessions Sessions to be closed.
+ * @param numSessions Number of sessions.
+ * @param pipeline Dispatch pipeline fed by the sessions.
  */
-void close_stream(PaStream *stream, streamCallbackData *currentSpectroData);
+void close_stream(inputSession *sessions, int numSessions, dispatchPipeline *pipeline);
 
 /**
- * Runs the stream processing for the selected device from start to finish.
+ * Runs the stream processing for the selected devices from start to finish. Every input device
+ * gets its own PortAudio stream, callback statistics and analysis; all of them are analysed on
+ * one render thread, which shows one device at a time ('d' switches) and a line of statistics
+ * per device. The output device, if any, plays the first input device through. 'r' restarts the
+ * analysis of every device and '+' and '-' change the FFT size of the displayed one, both without
+ * stopping the streams (see restart_dispatch_stream). A headless exporter replaces the screen and
+ * the keys: the session exports its statistics until SIGINT or SIGTERM.
  *
- * @param deviceSelection User's device selection.
- * @param currentSpectroData Spectro data used for FFT processing.
+ * @param inputDeviceSelections User's input device selections.
+ * @param numInputs Number of input devices, at most MAX_INPUT_DEVICES.
+ * @param outputDeviceSelection User's output device selection, or -1 for none.
+ * @param spectroData Spectro data used for FFT processing of each input device.
+ * @param arena Open arena the session's buffers are carved from, sealed once the streams are set up; or NULL.
+ * @param exporter Open exporter of the statistics of every device, or NULL.
  */
-void process_stream(int inputDeviceSelection, int outputDeviceSelection, streamCallbackData *currentSpectroData);
\ No newline at end of file
+void process_stream(const int *inputDeviceSelections, int numInputs, int outputDeviceSelection,
+                    streamCallbackData **spectroData, sessionArena *arena, metricsExporter *exporter);
+
+#endif //STREAM_H
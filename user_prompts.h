@@ -1,3 +1,8 @@
+#ifndef USER_PROMPTS_H
+#define USER_PROMPTS_H
+
+#include "utils.h"
+
 /**
  * Displays a list of all available CoreAudio(macOS) or ALSA (Linux) devices
  * and prompts the user to choose the one they wish to work with.
@@ -5,4 +10,6 @@
  * @param signalType Type of signal the user is working with. Either Input or Output.
  * @return Device number selected by the user. Value between 1 and number of devices available.
  */
-int prompt_device(enum SignalType signalType);
\ No newline at end of file
+int prompt_device(enum SignalType signalType);
+
+#endif //USER_PROMPTS_H
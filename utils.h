@@ -1,3 +1,6 @@
+#ifndef UTILS_H
+#define UTILS_H
+
 #include <curses.h>
 #include <fftw3.h>
 #include <portaudio.h>
@@ -5,16 +8,27 @@
 /// The height of the frequency view window in number of lines
 #define FREQ_WIN_HEIGHT 20
 
-/// Rate at which the audio is sampled, in Hz
-#define SAMPLE_RATE 44100.0
+/// Rate at which the audio is sampled unless --sample-rate or the device's default rate says otherwise, in Hz
+#define DEFAULT_SAMPLE_RATE 44100.0
+
+/// Range of sample rates the analysis accepts, in Hz
+#define MIN_SAMPLE_RATE 8000
+#define MAX_SAMPLE_RATE 384000
 
-/// Number of data points collected in a single buffer
-#define FRAMES_PER_BUFFER 256
+/// Number of frames collected in a single buffer unless --buffer-size says otherwise
+#define DEFAULT_FRAMES_PER_BUFFER 256
+
+/// Range of buffer sizes the analysis accepts, in frames
+#define MIN_FRAMES_PER_BUFFER 16
+#define MAX_FRAMES_PER_BUFFER 8192
 
 /// Frequency display range minimum and maximum (normal human hearing range here)
 #define SPECTRO_FREQ_START 20
 #define SPECTRO_FREQ_END 20000
 
+/// Maximum number of input channels the analysis supports
+#define MAX_INPUT_CHANNELS 64
+
 /// Width of the console display window in number of characters
 #define WIN_WIDTH 100
 
@@ -33,12 +47,6 @@ enum SignalType {
   Output
 };
 
-/// Number of input channels for the input source the program is working with.
-int num_input_channels;
-
-/// Number of output channels for the output source the program is working with.
-int num_output_channels;
-
 /**
  * Check and output errors in the portaudio stream.
  *
@@ -46,4 +54,6 @@ int num_output_channels;
  */
 void checkErr(PaError err);
 
-void error(const char *msg);
\ No newline at end of file
+void error(const char *msg);
+
+#endif //UTILS_H
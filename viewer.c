@@ -0,0 +1,384 @@
+//
+// Remote viewer drawing the full TUI from a network stream instead of a local device.
+//
+
+#include "viewer.h"
+#include "client.h"
+#include "display.h"
+#include "dispatch.h"
+#include "jitter.h"
+#include "spectral.h"
+#include "callback_stats.h"
+#include <ctype.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+/**
+ * Receive state of a remote viewer, shared between the receiver thread and the thread waiting
+ * for keys. Everything but `stop` is owned by the receiver thread once it runs.
+ */
+typedef struct {
+  const viewerSource *source;
+
+  /// TCP connection, or -1 as its fd when receiving UDP datagrams.
+  streamClient client;
+
+  /// UDP socket and the datagram being read, or -1 and NULL for TCP.
+  int udpFd;
+  unsigned char *datagram;
+
+  /// Jitter buffer of UDP audio; UDP spectral frames are all keyframes and drawn as they arrive.
+  jitterBuffer jitter;
+
+  /// Type and channel count of the stream, fixed by its first frame.
+  int type;
+  int numChannels;
+
+  /// Decoder of spectral frames and the levels and columns of the last one.
+  spectralCodec codec;
+  channelLevels *levels;
+  double *columns;
+
+  /// Sequence number of the last drawn spectral datagram; older ones are dropped.
+  uint32_t lastSequence;
+
+  /// Position in the stream of the last drawn spectral frame, in frames.
+  uint64_t lastTimestamp;
+
+  /// Samples of the last received TCP audio frame.
+  float *samples;
+
+  unsigned long framesReceived;
+  unsigned long malformed;
+
+  dispatchPipeline pipeline;
+  dispatchStream stream;
+  streamCallbackData *spectroData;
+
+  /// Set when the user closed the viewer.
+  _Atomic int stop;
+} remoteViewer;
+
+/**
+ * Queues the last decoded spectral frame for drawing; it covers the frames since the previous one.
+ */
+static void show_spectral(remoteViewer *viewer, uint64_t timestamp) {
+  unsigned long frames = viewer->framesReceived > 1 ? (unsigned long) (timestamp - viewer->lastTimestamp) : 0;
+  viewer->lastTimestamp = timestamp;
+  spectral_dequantize(&viewer->codec, viewer->levels, viewer->columns);
+  dispatch_analysis(&viewer->stream, viewer->levels, viewer->columns, frames);
+}
+
+/**
+ * Hands a received frame to the analysis: TCP audio straight to the pipeline, UDP audio to the
+ * jitter buffer and spectral frames, once decoded, to the drawing.
+ *
+ * @return 0 on success, -1 if the frame does not belong to the stream or is malformed.
+ */
+static int deliver_frame(remoteViewer *viewer, const streamHeader *header, const unsigned char *payload,
+                         uint64_t nowNs) {
+  if ((int) header->type != viewer->type || (int) header->numChannels != viewer->numChannels) {
+    return -1;
+  }
+
+  if (header->type == StreamSpectrum) {
+    if (viewer->udpFd >= 0 && viewer->framesReceived > 0 && (int32_t) (header->sequence - viewer->lastSequence) <= 0) {
+      return 0;
+    }
+    int keyframe = (header->flags & STREAM_FLAG_KEYFRAME) != 0;
+    if (spectral_decode(&viewer->codec, viewer->numChannels, keyframe, payload, header->payloadLength) != 0 ||
+        viewer->codec.numSpectra != viewer->spectroData->numSpectra || viewer->codec.numColumns != WIN_WIDTH) {
+      return -1;
+    }
+    viewer->lastSequence = header->sequence;
+    viewer->framesReceived++;
+    show_spectral(viewer, header->timestamp);
+    return 0;
+  }
+
+  if (viewer->udpFd >= 0) {
+    viewer->framesReceived++;
+    jitter_push(&viewer->jitter, header, payload, nowNs);
+    return 0;
+  }
+
+  size_t numSamples = header->payloadLength / sizeof(float);
+  unsigned long frames = numSamples / (size_t) viewer->numChannels;
+  if (frames > (unsigned long) viewer->spectroData->options.framesPerBuffer ||
+      frames * sizeof(float) * (size_t) viewer->numChannels != header->payloadLength) {
+    return -1;
+  }
+  decode_stream_samples(payload, numSamples, viewer->samples);
+  viewer->framesReceived++;
+  dispatch_block(&viewer->stream, viewer->samples, frames);
+  return 0;
+}
+
+/**
+ * Receiver thread of a TCP stream. Ends the viewer when the server closes the stream.
+ */
+static void *receive_tcp(void *arg) {
+  remoteViewer *viewer = (remoteViewer *) arg;
+  streamHeader header;
+  const unsigned char *payload;
+
+  while (stream_client_receive(&viewer->client, &header, &payload) == 0) {
+    if (deliver_frame(viewer, &header, payload, 0) != 0) {
+      // A lost delta cannot be recovered on this connection.
+      viewer->malformed++;
+      break;
+    }
+  }
+
+  if (!atomic_load(&viewer->stop)) {
+    post_key(&viewer->pipeline, ' ');
+  }
+  return NULL;
+}
+
+/**
+ * Receiver thread of a UDP stream: plays audio blocks out of the jitter buffer when they are due.
+ * Ends the viewer when no datagram arrives for UDP_CLIENT_TIMEOUT_MS.
+ */
+static void *receive_udp(void *arg) {
+  remoteViewer *viewer = (remoteViewer *) arg;
+  uint64_t lastArrival = callback_clock_ns();
+
+  while (!atomic_load(&viewer->stop)) {
+    uint64_t now = callback_clock_ns();
+    uint64_t due = jitter_next_due(&viewer->jitter);
+    int timeoutMs = due == 0 ? 100 : due <= now ? 0 : (int) ((due - now) / 1000000ULL) + 1;
+    struct pollfd pfd = {viewer->udpFd, POLLIN, 0};
+    poll(&pfd, 1, timeoutMs > 100 ? 100 : timeoutMs);
+
+    streamHeader header;
+    int status;
+    while ((status = udp_receiver_read(viewer->udpFd, viewer->datagram, &header)) != 0) {
+      lastArrival = callback_clock_ns();
+      if (status < 0 || deliver_frame(viewer, &header, viewer->datagram + STREAM_HEADER_SIZE, lastArrival) != 0) {
+        viewer->malformed++;
+      }
+    }
+
+    now = callback_clock_ns();
+    uint32_t sequence;
+    unsigned long frames;
+    int concealed;
+    const float *block;
+    while (viewer->jitter.samples != NULL &&
+           (block = jitter_pop(&viewer->jitter, now, &sequence, &frames, &concealed)) != NULL) {
+      dispatch_block(&viewer->stream, block, frames);
+    }
+    if (now - lastArrival > (uint64_t) UDP_CLIENT_TIMEOUT_MS * 1000000ULL) {
+      post_key(&viewer->pipeline, ' ');
+      break;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * Blocks until the first frame of the stream arrives.
+ *
+ * @return 0 on success, -1 if the stream ended first.
+ */
+static int receive_first_frame(remoteViewer *viewer, streamHeader *header, const unsigned char **payload) {
+  if (viewer->udpFd < 0) {
+    return stream_client_receive(&viewer->client, header, payload);
+  }
+
+  printf("Waiting for a stream on UDP port %s...\n", viewer->source->port);
+  for (;;) {
+    struct pollfd pfd = {viewer->udpFd, POLLIN, 0};
+    if (poll(&pfd, 1, -1) < 0) {
+      return -1;
+    }
+    if (udp_receiver_read(viewer->udpFd, viewer->datagram, header) == 1) {
+      *payload = viewer->datagram + STREAM_HEADER_SIZE;
+      return 0;
+    }
+  }
+}
+
+/**
+ * Opens the connection or socket of the viewer's source.
+ *
+ * @return 0 on success, -1 on failure.
+ */
+static int open_source(remoteViewer *viewer) {
+  viewer->client.fd = -1;
+  viewer->udpFd = -1;
+  if (viewer->source->host != NULL) {
+    return stream_client_connect(&viewer->client, viewer->source->host, viewer->source->port);
+  }
+
+  viewer->udpFd = udp_receiver_open(viewer->source->port, viewer->source->group);
+  viewer->datagram = (unsigned char *) malloc(UDP_RECEIVE_BUFFER);
+  if (viewer->udpFd < 0 || viewer->datagram == NULL) {
+    perror("Could not open the UDP stream socket");
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Closes the connection or socket and frees the receive state.
+ */
+static void close_viewer(remoteViewer *viewer) {
+  stream_client_close(&viewer->client);
+  if (viewer->udpFd >= 0) {
+    close(viewer->udpFd);
+  }
+  free(viewer->datagram);
+  jitter_free(&viewer->jitter);
+  spectral_codec_free(&viewer->codec);
+  free(viewer->levels);
+  free(viewer->columns);
+  free(viewer->samples);
+}
+
+/**
+ * Sets up the analysis or drawing of the stream described by its first frame.
+ *
+ * @return 0 on success, -1 if the stream cannot be shown.
+ */
+static int prepare_viewer(remoteViewer *viewer, const streamHeader *header, const unsigned char *payload,
+                          const spectroOptions *options) {
+  if (header->numChannels < 1 || header->numChannels > MAX_INPUT_CHANNELS) {
+    printf("Cannot show a stream of %u channels.\n", header->numChannels);
+    return -1;
+  }
+  if (header->sampleRate < MIN_SAMPLE_RATE || header->sampleRate > MAX_SAMPLE_RATE) {
+    printf("Cannot show a stream at %u Hz (%d to %d Hz).\n", header->sampleRate, MIN_SAMPLE_RATE, MAX_SAMPLE_RATE);
+    return -1;
+  }
+  viewer->type = header->type;
+  viewer->numChannels = header->numChannels;
+
+  spectroOptions viewOptions = *options;
+  viewOptions.sampleRate = header->sampleRate;
+  if (header->type == StreamAudio) {
+    // Blocks arrive as they were captured, so the first one sets the buffer size of the analysis.
+    viewOptions.framesPerBuffer = (int) (header->payloadLength / (sizeof(float) * (size_t) viewer->numChannels));
+    if (viewOptions.framesPerBuffer < MIN_FRAMES_PER_BUFFER || viewOptions.framesPerBuffer > MAX_FRAMES_PER_BUFFER) {
+      printf("Cannot show a stream of %d-frame blocks (%d to %d).\n", viewOptions.framesPerBuffer,
+             MIN_FRAMES_PER_BUFFER, MAX_FRAMES_PER_BUFFER);
+      return -1;
+    }
+  }
+  if (header->type == StreamSpectrum) {
+    if (spectral_decode(&viewer->codec, viewer->numChannels, (header->flags & STREAM_FLAG_KEYFRAME) != 0,
+                        payload, header->payloadLength) != 0 || viewer->codec.numColumns != WIN_WIDTH) {
+      printf("The stream does not start with a spectral keyframe of %d columns.\n", WIN_WIDTH);
+      return -1;
+    }
+    viewOptions.mixViews = viewer->codec.numSpectra > viewer->numChannels;
+  }
+
+  viewer->spectroData = init_spectro_data(viewer->numChannels, &viewOptions);
+  if (header->type == StreamSpectrum && viewer->spectroData->numSpectra != viewer->codec.numSpectra) {
+    printf("Cannot show %d spectra of %d channels.\n", viewer->codec.numSpectra, viewer->numChannels);
+    free_spectro_data(viewer->spectroData);
+    return -1;
+  }
+
+  viewer->levels = (channelLevels *) calloc((size_t) viewer->numChannels, sizeof(channelLevels));
+  viewer->columns = (double *) calloc((size_t) viewer->spectroData->numSpectra * WIN_WIDTH, sizeof(double));
+  viewer->samples = (float *) malloc(sizeof(float) * viewOptions.framesPerBuffer * (size_t) viewer->numChannels);
+  if (viewer->levels == NULL || viewer->columns == NULL || viewer->samples == NULL ||
+      (viewer->udpFd >= 0 && header->type == StreamAudio &&
+       jitter_init(&viewer->jitter, viewer->numChannels, viewOptions.framesPerBuffer, (int) header->sampleRate,
+                   viewer->source->playoutMs) != 0)) {
+    printf("Could not allocate the viewer.\n");
+    exit(EXIT_FAILURE);
+  }
+  return 0;
+}
+
+/**
+ * Receives a stream from another instance and draws it with the same volume and frequency views
+ * as a local device. Audio streams are analysed locally with the given spectro options; spectral
+ * streams were analysed once by the server and are only drawn, so the server's `--stream` setting
+ * decides whether the capture host or the viewers spend the CPU. Returns when the user presses
+ * space or the stream ends.
+ *
+ * @param source Server or UDP port to receive from.
+ * @param options Spectro options of the local analysis of audio streams; mixViews is taken from
+ *        spectral streams, the sample rate from the stream and the buffer size from its first block.
+ * @return 0 when the viewer was closed, -1 if the stream could not be received.
+ */
+int start_viewer(const viewerSource *source, const spectroOptions *options) {
+  remoteViewer viewer;
+  memset(&viewer, 0, sizeof(viewer));
+  viewer.source = source;
+  atomic_init(&viewer.stop, 0);
+
+  streamHeader header;
+  const unsigned char *payload;
+  if (open_source(&viewer) != 0 || receive_first_frame(&viewer, &header, &payload) != 0 ||
+      prepare_viewer(&viewer, &header, payload, options) != 0) {
+    close_viewer(&viewer);
+    return -1;
+  }
+
+  init_screen(viewer.numChannels);
+  dispatchStream *stream = &viewer.stream;
+  const char *label = source->host != NULL ? source->host : source->port;
+  if (viewer.type == StreamSpectrum) {
+    init_analysis_stream(stream, viewer.numChannels, viewer.spectroData, label);
+    start_dispatch(&viewer.pipeline, &stream, 1);
+    viewer.lastSequence = header.sequence;
+    viewer.framesReceived++;
+    show_spectral(&viewer, header.timestamp);
+  } else {
+    init_dispatch_stream(stream, viewer.numChannels, viewer.spectroData, label);
+    start_dispatch(&viewer.pipeline, &stream, 1);
+    deliver_frame(&viewer, &header, payload, callback_clock_ns());
+  }
+
+  pthread_t receiver;
+  if (pthread_create(&receiver, NULL, viewer.udpFd >= 0 ? receive_udp : receive_tcp, &viewer) != 0) {
+    endwin();
+    printf("Could not start the receiver thread.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  unsigned char input = '\0';
+  while (input != ' ') {
+    input = tolower(wait_for_key(&viewer.pipeline));
+    if (input == 'c') {
+      int next = (atomic_load(&viewer.spectroData->displayedSpectrum) + 1) % viewer.spectroData->numSpectra;
+      atomic_store(&viewer.spectroData->displayedSpectrum, next);
+    }
+    if (input == '[' || input == ']') {
+      waterfall_scroll(&viewer.stream.waterfall, input == '[' ? WATERFALL_SCROLL_ROWS : -WATERFALL_SCROLL_ROWS);
+    }
+    if (input == 'r') {
+      restart_dispatch_stream(stream, NULL);
+    }
+  }
+
+  atomic_store(&viewer.stop, 1);
+  if (viewer.client.fd >= 0) {
+    // Wakes the receiver thread blocked in recv.
+    shutdown(viewer.client.fd, SHUT_RDWR);
+  }
+  pthread_join(receiver, NULL);
+
+  stop_dispatch(&viewer.pipeline);
+  free_dispatch_stream(&viewer.stream);
+  free_spectro_data(viewer.spectroData);
+  del_screen();
+  endwin();
+
+  printf("Viewer closed: %lu frames received, %lu missing, %lu malformed, %lu blocks dropped\n",
+         viewer.framesReceived, viewer.udpFd >= 0 ? viewer.jitter.stats.lost : viewer.client.gaps,
+         viewer.malformed, dispatch_dropped_blocks(&viewer.stream));
+  close_viewer(&viewer);
+  return 0;
+}
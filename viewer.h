@@ -0,0 +1,42 @@
+//
+// Remote viewer drawing the full TUI from a network stream instead of a local device.
+//
+
+#ifndef VIEWER_H
+#define VIEWER_H
+
+#include "frequencies.h"
+
+/**
+ * Where a remote viewer receives its stream from.
+ */
+typedef struct {
+
+  /// Host of a TCP server to connect to, or NULL to listen for UDP datagrams.
+  const char *host;
+
+  /// Port of the TCP server, or the local UDP port.
+  const char *port;
+
+  /// Multicast group to join when listening for UDP datagrams, or NULL for unicast.
+  const char *group;
+
+  /// Target playout delay of the jitter buffer for UDP audio, in milliseconds.
+  int playoutMs;
+} viewerSource;
+
+/**
+ * Receives a stream from another instance and draws it with the same volume and frequency views
+ * as a local device. Audio streams are analysed locally with the given spectro options; spectral
+ * streams were analysed once by the server and are only drawn, so the server's `--stream` setting
+ * decides whether the capture host or the viewers spend the CPU. Returns when the user presses
+ * space or the stream ends.
+ *
+ * @param source Server or UDP port to receive from.
+ * @param options Spectro options of the local analysis of audio streams; mixViews is taken from
+ *        spectral streams, the sample rate from the stream and the buffer size from its first block.
+ * @return 0 when the viewer was closed, -1 if the stream could not be received.
+ */
+int start_viewer(const viewerSource *source, const spectroOptions *options);
+
+#endif //VIEWER_H
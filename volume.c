@@ -2,6 +2,22 @@
 #include "utils.h"
 #include <curses.h>
 #include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+WINDOW *VOL_WIN;
+cellGrid VOL_GRID;
+
+static int pitch_readout = 0;
+
+/**
+ * Widens the volume view of screens initialized afterwards by a pitch readout next to the bars.
+ *
+ * @param enabled Non-zero to show the readout.
+ */
+void set_pitch_readout(int enabled) {
+  pitch_readout = enabled;
+}
 
 /**
  * Initializes the volume display window using ncurses, given the number of channels in the input.
@@ -9,51 +25,100 @@
  * @param num_chan number of channels in the input; directly affects the height of the window.
  */
 void init_vol_win(int num_chan) {
-  VOL_WIN = newwin(num_chan + 1, WIN_WIDTH, 0, 0);
-  waddstr(VOL_WIN, "Volume:\n");
+  VOL_WIN = newwin(num_chan + 1, WIN_WIDTH + (pitch_readout ? PITCH_READOUT_WIDTH : 0), 0, 0);
+  if (VOL_WIN == NULL) {
+    endwin();
+    printf("The terminal is too narrow for the pitch readout.\n");
+    exit(EXIT_FAILURE);
+  }
+  if (cell_grid_init(&VOL_GRID, VOL_WIN) != 0) {
+    endwin();
+    printf("Could not allocate the volume view.\n");
+    exit(EXIT_FAILURE);
+  }
+  cell_grid_print_line(&VOL_GRID, 0, 0, "Volume:");
+  if (pitch_readout) {
+    cell_grid_print_line(&VOL_GRID, 0, WIN_WIDTH, " Pitch:");
+  }
 }
 
 /**
- * Renders the volume representation of the given input buffer.
- * The volume is rendered as a line of '=' characters of length between 0 and WIN_WIDTH.
+ * Renders the given levels into VOL_GRID; changed cells reach the window when the screen is refreshed.
+ * The volume is rendered as a line of '=' characters up to the RMS level, continued with '-'
+ * characters up to the peak level, with a '|' at the true-peak level (all between 0 and WIN_WIDTH).
  *
- * @param inputBuffer Input buffer to render the volume for.
- * @param framesPerBuffer Number of frames in the buffer.
+ * @param levels Levels of each channel, measured locally or received from a server.
+ * @param num_input_channels Number of channels.
  */
-void streamCallBackVolume(
-    const void *inputBuffer, void *outputBuffer, unsigned long framesPerBuffer, int num_input_channels, int num_output_channels
-) {
-  float *in = (float *) inputBuffer;
-  float *out = (float *) outputBuffer;
-
-  const int NUM_INPUT_CHANNELS = num_input_channels;
-  float channelVolumes[NUM_INPUT_CHANNELS];
+void draw_volume(const channelLevels *levels, int num_input_channels) {
+  for (int channelNum = 0; channelNum < num_input_channels; channelNum++) {
+    int row = VOL_INIT_Y + channelNum + 1;
+    int truePeakColumn = (int) (fminf(levels[channelNum].truePeak, 1.0f) * (WIN_WIDTH - 1));
+    for (int i = 0; i < WIN_WIDTH; i++) {
+      float barProportion = (float)i / ((float) WIN_WIDTH);
+      chtype cell = ' ';
+      if (i == truePeakColumn && levels[channelNum].truePeak > 0.0f) {
+        cell = '|';
+      } else if (barProportion <= levels[channelNum].rms) {
+        cell = '=';
+      } else if (barProportion <= levels[channelNum].peak) {
+        cell = '-';
+      }
+      cell_grid_put(&VOL_GRID, row, VOL_INIT_X + i, cell);
+    }
+  }
+}
 
-  for (unsigned long channelNum = 0; channelNum < NUM_INPUT_CHANNELS; channelNum++) {
-    channelVolumes[channelNum] = 0.0f;
+/**
+ * Renders the pitch of each channel next to its volume bar as the nearest note, the offset from
+ * it in cents, the frequency and the confidence; estimates below PITCH_MIN_CONFIDENCE are shown
+ * as unpitched. Does nothing unless the readout is enabled.
+ *
+ * @param pitches Latest pitch of each channel.
+ * @param num_input_channels Number of channels.
+ */
+void draw_pitch(const pitchEstimate *pitches, int num_input_channels) {
+  if (!pitch_readout) {
+    return;
   }
 
-  for (unsigned long i = 0; i < framesPerBuffer * NUM_INPUT_CHANNELS; i += NUM_INPUT_CHANNELS) {
-    for (unsigned long channelNum = 0; channelNum < NUM_INPUT_CHANNELS; channelNum++) {
-      channelVolumes[channelNum] = fmaxf(channelVolumes[channelNum], fabsf(in[i + channelNum]));
+  char note[8];
+  char text[64];
+  for (int channelNum = 0; channelNum < num_input_channels; channelNum++) {
+    const pitchEstimate *pitch = &pitches[channelNum];
+    if (pitch->note < 0 || pitch->confidence < PITCH_MIN_CONFIDENCE) {
+      snprintf(text, sizeof(text), " --");
+    } else {
+      pitch_note_name(pitch->note, note, sizeof(note));
+      snprintf(text, sizeof(text), " %-3s %+3.0fc %7.1f Hz %3.0f%%", note, pitch->cents, pitch->frequency,
+               100.0f * pitch->confidence);
     }
+    cell_grid_print_line(&VOL_GRID, VOL_INIT_Y + channelNum + 1, VOL_INIT_X + WIN_WIDTH, text);
   }
+}
 
-  int initial_x;
-  int initial_y;
-  getyx(VOL_WIN, initial_y, initial_x);
-
-  for (unsigned long channelNum = 0; channelNum < NUM_INPUT_CHANNELS; channelNum++) {
-    wmove(VOL_WIN, VOL_INIT_Y + channelNum + 1, VOL_INIT_X);
-    for (int i = 0; i < WIN_WIDTH; i++) {
-      float barProportion = (float)i / ((float) WIN_WIDTH);
-      if (barProportion <= channelVolumes[channelNum]) {
-        waddch(VOL_WIN, '=');
-      } else {
-        waddch(VOL_WIN, ' ');
-      }
-    }
+/**
+ * Renders the momentary, short-term and integrated loudness, the loudness range and the loudest
+ * momentary loudness so far into the title line of VOL_GRID.
+ *
+ * @param levels Loudness of the stream.
+ */
+void draw_loudness(const loudnessLevels *levels) {
+  char text[WIN_WIDTH + 1];
+  snprintf(text, sizeof(text), "Volume:   M %5.1f  S %5.1f  I %5.1f LUFS   LRA %4.1f LU   max M %5.1f LUFS",
+           levels->momentary, levels->shortTerm, levels->integrated, levels->range, levels->maxMomentary);
+  cell_grid_print_line(&VOL_GRID, 0, 0, text);
+  if (pitch_readout) {
+    cell_grid_print_line(&VOL_GRID, 0, WIN_WIDTH, " Pitch:");
   }
+}
 
-  wmove(VOL_WIN, initial_y, initial_x);
-}
\ No newline at end of file
+/**
+ * Blanks the bars and pitch readouts of every channel row of VOL_GRID, e.g. before a stream with
+ * fewer channels is shown.
+ */
+void clear_volume() {
+  for (int row = VOL_INIT_Y + 1; row < VOL_GRID.rows; row++) {
+    cell_grid_print_line(&VOL_GRID, row, 0, "");
+  }
+}
@@ -1,22 +1,64 @@
+#ifndef VOLUME_H
+#define VOLUME_H
+
 #include <curses.h>
+#include "meter.h"
+#include "pitch.h"
+#include "loudness.h"
+#include "cellgrid.h"
 
 /// Data structure representing the volume and frequency view windows
-WINDOW *VOL_WIN;
+extern WINDOW *VOL_WIN;
+
+/// Cells of the volume view window
+extern cellGrid VOL_GRID;
+
+/**
+ * Renders the given levels into VOL_GRID; changed cells reach the window when the screen is refreshed.
+ * The volume is rendered as a line of '=' characters up to the RMS level, continued with '-'
+ * characters up to the peak level, with a '|' at the true-peak level (all between 0 and WIN_WIDTH).
+ *
+ * @param levels Levels of each channel, measured locally or received from a server.
+ * @param num_input_channels Number of channels.
+ */
+void draw_volume(const channelLevels *levels, int num_input_channels);
+
+/**
+ * Widens the volume view of screens initialized afterwards by a pitch readout next to the bars.
+ *
+ * @param enabled Non-zero to show the readout.
+ */
+void set_pitch_readout(int enabled);
+
+/**
+ * Renders the pitch of each channel next to its volume bar as the nearest note, the offset from
+ * it in cents, the frequency and the confidence; estimates below PITCH_MIN_CONFIDENCE are shown
+ * as unpitched. Does nothing unless the readout is enabled.
+ *
+ * @param pitches Latest pitch of each channel.
+ * @param num_input_channels Number of channels.
+ */
+void draw_pitch(const pitchEstimate *pitches, int num_input_channels);
 
 /**
- * Renders the volume representation of the given input buffer.
- * The volume is rendered as a line of '=' characters of length between 0 and WIN_WIDTH.
+ * Renders the momentary, short-term and integrated loudness, the loudness range and the loudest
+ * momentary loudness so far into the title line of VOL_GRID.
  *
- * @param inputBuffer Input buffer to render the volume for.
- * @param framesPerBuffer Number of frames in the buffer.
+ * @param levels Loudness of the stream.
  */
-void streamCallBackVolume(
-    const void *inputBuffer, void *outputBuffer, unsigned long framesPerBuffer, int num_input_channels, int num_output_channels
-);
+void draw_loudness(const loudnessLevels *levels);
+
+/**
+ * Blanks the bars and pitch readouts of every channel row of VOL_GRID, e.g. before a stream with
+ * fewer channels is shown.
+ */
+void clear_volume();
 
 /**
  * Initializes the volume display window using ncurses, given the number of channels in the input.
  *
  * @param num_chan number of channels in the input; directly affects the height of the window.
  */
-void init_vol_win(int num_chan);
\ No newline at end of file
+void init_vol_win(int num_chan);
+
+#endif //VOLUME_H
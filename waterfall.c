@@ -0,0 +1,283 @@
+//
+// Scrolling spectrogram (waterfall) of the frequency view, backed by a bounded history ring.
+//
+
+#include "waterfall.h"
+#include "arena.h"
+#include "callback_stats.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+WINDOW *WATERFALL_WIN;
+
+static double waterfall_seconds = 0.0;
+
+/**
+ * Enables the waterfall view for screens initialized afterwards.
+ *
+ * @param seconds Time covered by the rows visible at once; 0 disables the view.
+ */
+void set_waterfall_seconds(double seconds) {
+  waterfall_seconds = seconds > 0.0 ? seconds : 0.0;
+}
+
+/**
+ * Number of frames of audio covered by each row of the waterfall, so that the visible rows cover
+ * the configured time.
+ *
+ * @param sampleRate Sample rate of the audio, in Hz.
+ * @param framesPerBuffer Number of frames in each analysed block.
+ * @return Frames per row, at least framesPerBuffer.
+ */
+unsigned long waterfall_frames_per_row(double sampleRate, unsigned long framesPerBuffer) {
+  double frames = waterfall_seconds * sampleRate / (WATERFALL_WIN_HEIGHT - 1);
+  return frames < framesPerBuffer ? framesPerBuffer : (unsigned long) lround(frames);
+}
+
+/**
+ * Creates the waterfall view window below the statistics window if the view is enabled.
+ *
+ * @param num_chan number of channels in the input; affects the initial y position of the window.
+ */
+void init_waterfall_win(int num_chan) {
+  WATERFALL_WIN = NULL;
+  if (waterfall_seconds <= 0.0) {
+    return;
+  }
+
+  int y = num_chan + 1 + MARGIN + FREQ_WIN_HEIGHT + MARGIN + stats_win_height();
+  int height = LINES - y < WATERFALL_WIN_HEIGHT ? LINES - y : WATERFALL_WIN_HEIGHT;
+  if (height < 2 || (WATERFALL_WIN = newwin(height, WIN_WIDTH, y, 0)) == NULL) {
+    endwin();
+    printf("The terminal is too small for the waterfall view.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // New rows enter at the top of the lines below the title and push the older ones down; with
+  // idlok ncurses may move them with the terminal's own scrolling instead of rewriting them.
+  wsetscrreg(WATERFALL_WIN, 1, height - 1);
+  scrollok(WATERFALL_WIN, TRUE);
+  idlok(WATERFALL_WIN, TRUE);
+
+  if (has_colors()) {
+    start_color();
+    init_pair(1, COLOR_BLUE, COLOR_BLACK);
+    init_pair(2, COLOR_CYAN, COLOR_BLACK);
+    init_pair(3, COLOR_YELLOW, COLOR_BLACK);
+    init_pair(4, COLOR_RED, COLOR_BLACK);
+  }
+}
+
+/**
+ * Deletes the waterfall view window, if any.
+ */
+void del_waterfall_win() {
+  if (WATERFALL_WIN != NULL) {
+    delwin(WATERFALL_WIN);
+    WATERFALL_WIN = NULL;
+  }
+}
+
+/**
+ * Allocates an empty history.
+ *
+ * @param history History to initialize.
+ * @param numSpectra Number of spectra recorded per block.
+ * @param framesPerRow Number of frames of audio covered by each row.
+ * @param sampleRate Sample rate of the audio, in Hz.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int waterfall_init(waterfallHistory *history, int numSpectra, unsigned long framesPerRow, double sampleRate) {
+  memset(history, 0, sizeof(*history));
+  history->numSpectra = numSpectra;
+  history->framesPerRow = framesPerRow < 1 ? 1 : framesPerRow;
+  history->sampleRate = sampleRate;
+  history->rows = (uint8_t *) session_calloc((size_t) numSpectra * WATERFALL_HISTORY_ROWS * WIN_WIDTH, 1);
+  history->pending = (uint8_t *) session_calloc((size_t) numSpectra * WIN_WIDTH, 1);
+  if (history->rows == NULL || history->pending == NULL) {
+    waterfall_free(history);
+    return -1;
+  }
+  atomic_init(&history->scrollRequest, 0);
+  history->shownSpectrum = -1;
+  history->shownTop = -1;
+  return 0;
+}
+
+/**
+ * Frees the rows of a history.
+ *
+ * @param history History to free.
+ */
+void waterfall_free(waterfallHistory *history) {
+  session_free(history->rows);
+  session_free(history->pending);
+  history->rows = NULL;
+  history->pending = NULL;
+}
+
+/**
+ * Empties the history without freeing it, as if it had just been created, and makes the next
+ * draw_waterfall redraw the whole window.
+ *
+ * @param history History to clear.
+ */
+void waterfall_reset(waterfallHistory *history) {
+  if (history->rows == NULL) {
+    return;
+  }
+  memset(history->rows, 0, (size_t) history->numSpectra * WATERFALL_HISTORY_ROWS * WIN_WIDTH);
+  memset(history->pending, 0, (size_t) history->numSpectra * WIN_WIDTH);
+  history->pendingFrames = 0;
+  history->written = 0;
+  history->seenWritten = 0;
+  history->scrollBack = 0;
+  atomic_store(&history->scrollRequest, 0);
+  history->shownSpectrum = -1;
+  history->shownTop = -1;
+}
+
+/**
+ * Folds the column amplitudes of one analysis into the pending row and completes the row once it
+ * covers framesPerRow frames.
+ *
+ * @param history History to record into.
+ * @param proportions numSpectra * WIN_WIDTH column amplitudes on the frequency view's 0..1 scale.
+ * @param frames Frames of audio the analysis covers: a block, or the time between two spectral frames.
+ * @return 1 if a row was completed, 0 otherwise.
+ */
+int waterfall_push(waterfallHistory *history, const double *proportions, unsigned long frames) {
+  if (history->rows == NULL) {
+    return 0;
+  }
+
+  size_t numColumns = (size_t) history->numSpectra * WIN_WIDTH;
+  for (size_t i = 0; i < numColumns; i++) {
+    double proportion = fmax(0.0, fmin(1.0, proportions[i]));
+    uint8_t level = (uint8_t) lrint(proportion * 255.0);
+    if (level > history->pending[i]) {
+      history->pending[i] = level;
+    }
+  }
+  history->pendingFrames += frames;
+  if (history->pendingFrames < history->framesPerRow) {
+    return 0;
+  }
+
+  size_t slot = history->written % WATERFALL_HISTORY_ROWS;
+  for (int spectrum = 0; spectrum < history->numSpectra; spectrum++) {
+    memcpy(history->rows + ((size_t) spectrum * WATERFALL_HISTORY_ROWS + slot) * WIN_WIDTH,
+           history->pending + (size_t) spectrum * WIN_WIDTH, WIN_WIDTH);
+  }
+  memset(history->pending, 0, numColumns);
+  history->pendingFrames = 0;
+  history->written++;
+  return 1;
+}
+
+/**
+ * Scrolls the view back in time (positive rows) or towards the newest row (negative rows).
+ *
+ * @param history History shown in the view.
+ * @param rows Number of rows to scroll by.
+ */
+void waterfall_scroll(waterfallHistory *history, int rows) {
+  atomic_fetch_add(&history->scrollRequest, rows);
+}
+
+/**
+ * Writes the given row of the history into a line of the window, or blanks the line if the row
+ * was never recorded or has been overwritten.
+ */
+static void draw_row(const waterfallHistory *history, int spectrum, int line, long row) {
+  static const char ramp[] = WATERFALL_RAMP;
+  const int rampLevels = (int) sizeof(ramp) - 1;
+  chtype cells[WIN_WIDTH];
+
+  long oldest = (long) history->written - WATERFALL_HISTORY_ROWS;
+  if (row < 0 || row < oldest || row >= (long) history->written) {
+    for (int i = 0; i < WIN_WIDTH; i++) {
+      cells[i] = ' ';
+    }
+  } else {
+    const uint8_t *levels = history->rows +
+                            ((size_t) spectrum * WATERFALL_HISTORY_ROWS + row % WATERFALL_HISTORY_ROWS) * WIN_WIDTH;
+    for (int i = 0; i < WIN_WIDTH; i++) {
+      int intensity = levels[i] * rampLevels / 256;
+      cells[i] = (chtype) (unsigned char) ramp[intensity];
+      if (intensity > 0 && has_colors()) {
+        cells[i] |= COLOR_PAIR(1 + (intensity - 1) * 4 / (rampLevels - 1));
+      }
+    }
+  }
+  mvwaddchnstr(WATERFALL_WIN, 1 + line, 0, cells, WIN_WIDTH);
+}
+
+/**
+ * Draws the rows completed since the last call into WATERFALL_WIN: the window is scrolled down by
+ * one line per new row and only the top line is written, so each row costs WIN_WIDTH cells however
+ * long the history is. Scrolling through the history moves the window the same way; only switching
+ * spectra or jumping further than the window height redraws every line.
+ *
+ * @param history History to draw.
+ * @param spectrum Index of the spectrum to show.
+ * @param label Label of the spectrum, see spectrum_label.
+ */
+void draw_waterfall(waterfallHistory *history, int spectrum, const char *label) {
+  if (WATERFALL_WIN == NULL || history->rows == NULL) {
+    return;
+  }
+  int height = getmaxy(WATERFALL_WIN) - 1;
+
+  // A view scrolled back stays on its rows while new ones arrive, until they are overwritten.
+  if (history->scrollBack > 0) {
+    history->scrollBack += (int) (history->written - history->seenWritten);
+  }
+  history->seenWritten = history->written;
+  history->scrollBack += atomic_exchange(&history->scrollRequest, 0);
+
+  long stored = history->written < WATERFALL_HISTORY_ROWS ? (long) history->written : WATERFALL_HISTORY_ROWS;
+  long maxScrollBack = stored > height ? stored - height : 0;
+  if (history->scrollBack > maxScrollBack) {
+    history->scrollBack = (int) maxScrollBack;
+  }
+  if (history->scrollBack < 0) {
+    history->scrollBack = 0;
+  }
+
+  long top = (long) history->written - 1 - history->scrollBack;
+  if (spectrum == history->shownSpectrum && top == history->shownTop) {
+    return;
+  }
+
+  double secondsPerRow = history->framesPerRow / history->sampleRate;
+  if (history->scrollBack > 0) {
+    mvwprintw(WATERFALL_WIN, 0, 0, "Waterfall (%s, %.2f s/row, %.1f s ago, ']' for newer):",
+              label, secondsPerRow, history->scrollBack * secondsPerRow);
+  } else {
+    mvwprintw(WATERFALL_WIN, 0, 0, "Waterfall (%s, %.2f s/row, '[' to scroll back):", label, secondsPerRow);
+  }
+  wclrtoeol(WATERFALL_WIN);
+
+  long moved = top - history->shownTop;
+  if (spectrum != history->shownSpectrum || history->shownTop < 0 || labs(moved) >= height) {
+    for (int line = 0; line < height; line++) {
+      draw_row(history, spectrum, line, top - line);
+    }
+  } else if (moved > 0) {
+    wscrl(WATERFALL_WIN, (int) -moved);
+    for (int line = 0; line < moved; line++) {
+      draw_row(history, spectrum, line, top - line);
+    }
+  } else {
+    wscrl(WATERFALL_WIN, (int) -moved);
+    for (int line = height + (int) moved; line < height; line++) {
+      draw_row(history, spectrum, line, top - line);
+    }
+  }
+
+  history->shownSpectrum = spectrum;
+  history->shownTop = top;
+}
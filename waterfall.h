@@ -0,0 +1,156 @@
+//
+// Scrolling spectrogram (waterfall) of the frequency view, backed by a bounded history ring.
+//
+
+#ifndef WATERFALL_H
+#define WATERFALL_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <curses.h>
+#include "utils.h"
+
+/// Height of the waterfall view window in number of lines, including its title
+#define WATERFALL_WIN_HEIGHT 16
+
+/// Rows of history kept per spectrum; the view can be scrolled back this far
+#define WATERFALL_HISTORY_ROWS 1024
+
+/// Rows the view moves by for every press of '[' or ']'
+#define WATERFALL_SCROLL_ROWS 8
+
+/// Characters of increasing intensity used to draw a column level
+#define WATERFALL_RAMP " .:-=+*#%@"
+
+/// Data structure representing the waterfall view window; NULL when the view is disabled
+extern WINDOW *WATERFALL_WIN;
+
+/**
+ * History of the column amplitudes of every spectrum, newest row last. Each row covers
+ * framesPerRow frames of audio and holds the loudest level of each column among the analyses
+ * folded into it, so a transient shorter than a row still shows; levels are stored as one byte per column (the frequency view's
+ * SPECTRO_DB_FLOOR..0 dBFS scale in 255 steps of about 0.3 dB). The ring never grows: a long
+ * session keeps the last WATERFALL_HISTORY_ROWS rows.
+ */
+typedef struct {
+  int numSpectra;
+
+  /// numSpectra * WATERFALL_HISTORY_ROWS * WIN_WIDTH levels; row r of spectrum s starts at
+  /// ((s * WATERFALL_HISTORY_ROWS) + r % WATERFALL_HISTORY_ROWS) * WIN_WIDTH.
+  uint8_t *rows;
+
+  /// numSpectra * WIN_WIDTH loudest levels of the row being accumulated.
+  uint8_t *pending;
+
+  /// Frames of audio covered by every row, and by the pending one so far.
+  unsigned long framesPerRow;
+  unsigned long pendingFrames;
+
+  /// Sample rate of the audio, in Hz, for the time shown in the title.
+  double sampleRate;
+
+  /// Number of rows completed since the history was created.
+  unsigned long written;
+
+  /// Rows the user asked to scroll back by (negative: towards the newest row) since the last
+  /// draw. Written by the main thread, consumed by the render thread.
+  _Atomic int scrollRequest;
+
+  /// Rows between the newest one and the top of the view. While it is positive the view stays on
+  /// the same rows as new ones arrive.
+  int scrollBack;
+
+  /// What the window shows: the spectrum and the row at its top (-1 forces a full redraw), and the
+  /// number of rows completed when it was last drawn.
+  int shownSpectrum;
+  long shownTop;
+  unsigned long seenWritten;
+} waterfallHistory;
+
+/**
+ * Enables the waterfall view for screens initialized afterwards.
+ *
+ * @param seconds Time covered by the rows visible at once; 0 disables the view.
+ */
+void set_waterfall_seconds(double seconds);
+
+/**
+ * Number of frames of audio covered by each row of the waterfall, so that the visible rows cover
+ * the configured time.
+ *
+ * @param sampleRate Sample rate of the audio, in Hz.
+ * @param framesPerBuffer Number of frames in each analysed block.
+ * @return Frames per row, at least framesPerBuffer.
+ */
+unsigned long waterfall_frames_per_row(double sampleRate, unsigned long framesPerBuffer);
+
+/**
+ * Creates the waterfall view window below the statistics window if the view is enabled.
+ *
+ * @param num_chan number of channels in the input; affects the initial y position of the window.
+ */
+void init_waterfall_win(int num_chan);
+
+/**
+ * Deletes the waterfall view window, if any.
+ */
+void del_waterfall_win();
+
+/**
+ * Allocates an empty history.
+ *
+ * @param history History to initialize.
+ * @param numSpectra Number of spectra recorded per block.
+ * @param framesPerRow Number of frames of audio covered by each row.
+ * @param sampleRate Sample rate of the audio, in Hz.
+ * @return 0 on success, -1 if memory could not be allocated.
+ */
+int waterfall_init(waterfallHistory *history, int numSpectra, unsigned long framesPerRow, double sampleRate);
+
+/**
+ * Frees the rows of a history.
+ *
+ * @param history History to free.
+ */
+void waterfall_free(waterfallHistory *history);
+
+/**
+ * Empties the history without freeing it, as if it had just been created, and makes the next
+ * draw_waterfall redraw the whole window.
+ *
+ * @param history History to clear.
+ */
+void waterfall_reset(waterfallHistory *history);
+
+/**
+ * Folds the column amplitudes of one analysis into the pending row and completes the row once it
+ * covers framesPerRow frames.
+ *
+ * @param history History to record into.
+ * @param proportions numSpectra * WIN_WIDTH column amplitudes on the frequency view's 0..1 scale.
+ * @param frames Frames of audio the analysis covers: a block, or the time between two spectral frames.
+ * @return 1 if a row was completed, 0 otherwise.
+ */
+int waterfall_push(waterfallHistory *history, const double *proportions, unsigned long frames);
+
+/**
+ * Scrolls the view back in time (positive rows) or towards the newest row (negative rows).
+ *
+ * @param history History shown in the view.
+ * @param rows Number of rows to scroll by.
+ */
+void waterfall_scroll(waterfallHistory *history, int rows);
+
+/**
+ * Draws the rows completed since the last call into WATERFALL_WIN: the window is scrolled down by
+ * one line per new row and only the top line is written, so each row costs WIN_WIDTH cells however
+ * long the history is. Scrolling through the history moves the window the same way; only switching
+ * spectra or jumping further than the window height redraws every line.
+ *
+ * @param history History to draw.
+ * @param spectrum Index of the spectrum to show.
+ * @param label Label of the spectrum, see spectrum_label.
+ */
+void draw_waterfall(waterfallHistory *history, int spectrum, const char *label);
+
+#endif //WATERFALL_H
@@ -0,0 +1,149 @@
+//
+// FFTW planner effort and the on-disk wisdom cache.
+//
+
+#include "wisdom.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static unsigned planner_flags = FFTW_MEASURE;
+static char wisdom_path[4096];
+static int wisdom_path_set = 0;
+static int wisdom_dirty = 0;
+
+/// Set on threads that must not measure plans, see set_planner_realtime
+static _Thread_local int planner_realtime = 0;
+
+/**
+ * Sets how hard FFTW searches for the fastest transform when no wisdom is cached.
+ *
+ * @param name "estimate", "measure" (default) or "patient".
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int set_planner_effort(const char *name) {
+  if (strcmp(name, "estimate") == 0) {
+    planner_flags = FFTW_ESTIMATE;
+  } else if (strcmp(name, "measure") == 0) {
+    planner_flags = FFTW_MEASURE;
+  } else if (strcmp(name, "patient") == 0) {
+    planner_flags = FFTW_PATIENT;
+  } else {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Makes the plans the calling thread creates from now on skip measuring while set: they are taken
+ * from the wisdom when available and estimated otherwise, so planning takes microseconds instead
+ * of up to seconds. Estimated plans are not saved to the wisdom cache.
+ *
+ * @param realtime Non-zero while the calling thread must not stall, e.g. the render thread
+ *        rebuilding the FFT of a running stream; 0 to plan with the configured effort again.
+ */
+void set_planner_realtime(int realtime) {
+  planner_realtime = realtime;
+}
+
+/**
+ * Overrides the path of the wisdom cache file.
+ *
+ * @param path Path of the cache file, or NULL/"" to disable the cache.
+ */
+void set_wisdom_path(const char *path) {
+  snprintf(wisdom_path, sizeof(wisdom_path), "%s", path == NULL ? "" : path);
+  wisdom_path_set = 1;
+}
+
+/**
+ * Resolves the default cache path, $XDG_CACHE_HOME or ~/.cache, creating the directory if needed.
+ */
+static void resolve_wisdom_path(void) {
+  if (wisdom_path_set) {
+    return;
+  }
+  wisdom_path_set = 1;
+
+  const char *cacheHome = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  char directory[sizeof(wisdom_path) - sizeof(WISDOM_FILE_NAME) - 1];
+
+  if (cacheHome != NULL && cacheHome[0] != '\0') {
+    snprintf(directory, sizeof(directory), "%s", cacheHome);
+  } else if (home != NULL && home[0] != '\0') {
+    snprintf(directory, sizeof(directory), "%s/.cache", home);
+  } else {
+    wisdom_path[0] = '\0';
+    return;
+  }
+
+  if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+    wisdom_path[0] = '\0';
+    return;
+  }
+  snprintf(wisdom_path, sizeof(wisdom_path), "%s/%s", directory, WISDOM_FILE_NAME);
+}
+
+/**
+ * Imports the wisdom cache file, if any. Plans found in it are created without measuring.
+ */
+void load_wisdom(void) {
+  resolve_wisdom_path();
+  if (wisdom_path[0] != '\0') {
+    // A missing or stale file simply leaves the wisdom empty.
+    fftw_import_wisdom_from_filename(wisdom_path);
+  }
+  wisdom_dirty = 0;
+}
+
+/**
+ * Writes the accumulated wisdom back to the cache file if any plan was measured since it was loaded.
+ * The file is replaced atomically, so concurrent instances never read a partial file.
+ */
+void save_wisdom(void) {
+  resolve_wisdom_path();
+  if (!wisdom_dirty || wisdom_path[0] == '\0') {
+    return;
+  }
+
+  char temporary[sizeof(wisdom_path) + 16];
+  snprintf(temporary, sizeof(temporary), "%s.tmp", wisdom_path);
+  if (!fftw_export_wisdom_to_filename(temporary) || rename(temporary, wisdom_path) != 0) {
+    fprintf(stderr, "Could not save FFTW wisdom to %s.\n", wisdom_path);
+    remove(temporary);
+    return;
+  }
+  wisdom_dirty = 0;
+}
+
+/**
+ * Plans numRows real-to-half-complex transforms of size points each, laid out contiguously in
+ * in and out. The plan is taken from the wisdom when available; otherwise it is measured with
+ * the configured effort (estimated on a realtime thread, see set_planner_realtime) and the
+ * wisdom is marked for saving if it was measured. The contents of in and out are
+ * overwritten unless the wisdom already holds the plan.
+ *
+ * @param size Transform size.
+ * @param numRows Number of transforms in the batch.
+ * @param in Input rows, numRows * size doubles.
+ * @param out Output rows, numRows * size doubles.
+ * @return The plan, or NULL if FFTW could not create it.
+ */
+fftw_plan plan_r2hc_batch(int size, int numRows, double *in, double *out) {
+  fftw_r2r_kind kind = FFTW_R2HC;
+  fftw_plan plan = NULL;
+
+  if (planner_flags != FFTW_ESTIMATE) {
+    plan = fftw_plan_many_r2r(1, &size, numRows, in, NULL, 1, size, out, NULL, 1, size,
+                              &kind, planner_flags | FFTW_WISDOM_ONLY);
+  }
+  if (plan == NULL) {
+    unsigned flags = planner_realtime ? FFTW_ESTIMATE : planner_flags;
+    plan = fftw_plan_many_r2r(1, &size, numRows, in, NULL, 1, size, out, NULL, 1, size, &kind, flags);
+    wisdom_dirty |= plan != NULL && flags != FFTW_ESTIMATE;
+  }
+  return plan;
+}
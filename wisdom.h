@@ -0,0 +1,64 @@
+//
+// FFTW planner effort and the on-disk wisdom cache.
+//
+
+#ifndef WISDOM_H
+#define WISDOM_H
+
+#include <fftw3.h>
+
+/// Name of the wisdom cache file inside the cache directory; double-precision (fftw_) plans only
+#define WISDOM_FILE_NAME "audio_analyzer-fftw3.wisdom"
+
+/**
+ * Sets how hard FFTW searches for the fastest transform when no wisdom is cached.
+ *
+ * @param name "estimate", "measure" (default) or "patient".
+ * @return 0 on success, -1 if the name is unknown.
+ */
+int set_planner_effort(const char *name);
+
+/**
+ * Makes the plans the calling thread creates from now on skip measuring while set: they are taken
+ * from the wisdom when available and estimated otherwise, so planning takes microseconds instead
+ * of up to seconds. Estimated plans are not saved to the wisdom cache.
+ *
+ * @param realtime Non-zero while the calling thread must not stall, e.g. the render thread
+ *        rebuilding the FFT of a running stream; 0 to plan with the configured effort again.
+ */
+void set_planner_realtime(int realtime);
+
+/**
+ * Overrides the path of the wisdom cache file.
+ *
+ * @param path Path of the cache file, or NULL/"" to disable the cache.
+ */
+void set_wisdom_path(const char *path);
+
+/**
+ * Imports the wisdom cache file, if any. Plans found in it are created without measuring.
+ */
+void load_wisdom(void);
+
+/**
+ * Writes the accumulated wisdom back to the cache file if any plan was measured since it was loaded.
+ * The file is replaced atomically, so concurrent instances never read a partial file.
+ */
+void save_wisdom(void);
+
+/**
+ * Plans numRows real-to-half-complex transforms of size points each, laid out contiguously in
+ * in and out. The plan is taken from the wisdom when available; otherwise it is measured with
+ * the configured effort (estimated on a realtime thread, see set_planner_realtime) and the
+ * wisdom is marked for saving if it was measured. The contents of in and out are
+ * overwritten unless the wisdom already holds the plan.
+ *
+ * @param size Transform size.
+ * @param numRows Number of transforms in the batch.
+ * @param in Input rows, numRows * size doubles.
+ * @param out Output rows, numRows * size doubles.
+ * @return The plan, or NULL if FFTW could not create it.
+ */
+fftw_plan plan_r2hc_batch(int size, int numRows, double *in, double *out);
+
+#endif //WISDOM_H